@@ -360,11 +360,11 @@ poppr <- function(dat, total = TRUE, sublist = "ALL", exclude = NULL, blacklist
     poplist <- if (is.null(pop(dat))) NULL else seppop(dat, drop = pdrop)
   }
 
-  # Creating the genotype matrix for vegan's diversity analysis.
-  pop.mat <- mlg.matrix(dat)
+  # Creating the sparse genotype table for the diversity analysis.
+  pop.mat <- mlg.sparse(dat)
   if (total == TRUE & !is.null(poplist) & length(poplist) > 1){
     poplist$Total <- dat
-    pop.mat       <- rbind(pop.mat, colSums(pop.mat))
+    pop.mat       <- mlg_add_total(pop.mat)
   }
   sublist <- names(poplist)
   Iout    <- NULL
@@ -373,8 +373,8 @@ poppr <- function(dat, total = TRUE, sublist = "ALL", exclude = NULL, blacklist
   # For presence/absences markers, a different algorithm is applied. 
   if (legend) poppr_message()
   
-  MLG.vec <- rowSums(ifelse(pop.mat > 0, 1, 0))
-  N.vec   <- rowSums(pop.mat)
+  MLG.vec <- stats::setNames(as.numeric(diff(pop.mat$p)), rownames(pop.mat))
+  N.vec   <- mlg_margin(pop.mat)
   datploid <- unique(ploidy(dat))
   Hexp_correction <- 1
   if (length(datploid) > 1 || any(datploid > 2)){
@@ -389,15 +389,13 @@ poppr <- function(dat, total = TRUE, sublist = "ALL", exclude = NULL, blacklist
   if (!is.null(poplist)){
     # rarefaction giving the standard errors. This will use the minimum pop size
     # above a user-defined threshold.
-    raremax <- ifelse(is.null(nrow(pop.mat)), sum(pop.mat), 
-                      ifelse(min(rowSums(pop.mat)) > minsamp, 
-                             min(rowSums(pop.mat)), minsamp))
+    raremax <- ifelse(min(N.vec) > minsamp, min(N.vec), minsamp)
 
     Hexp <- vapply(lapply(poplist, pegas::as.loci), FUN = get_hexp_from_loci, 
                    FUN.VALUE = numeric(1), ploidy = datploid, type = dat@type)
 
     Hexp   <- data.frame(Hexp = Hexp)
-    N.rare <- suppressWarnings(vegan::rarefy(pop.mat, raremax, se = TRUE))
+    N.rare <- suppressWarnings(rarefy_sparse(pop.mat, raremax))
     IaList <- lapply(sublist, function(x){
       namelist <- list(file = namelist$File, population = x)
       .ia(poplist[[x]], 
@@ -444,7 +442,7 @@ poppr <- function(dat, total = TRUE, sublist = "ALL", exclude = NULL, blacklist
   } else { 
     # rarefaction giving the standard errors. No population structure means that
     # the sample is equal to the number of individuals.
-    N.rare <- rarefy(pop.mat, sum(pop.mat), se = TRUE)
+    N.rare <- rarefy_sparse(pop.mat, sum(N.vec))
     Hexp   <- get_hexp_from_loci(pegas::as.loci(dat), 
                                  ploidy = datploid, type = dat@type)
     Hexp   <- data.frame(Hexp = Hexp)
@@ -569,6 +567,13 @@ poppr.all <- function(filelist, ...){
 #'   reshuffled data is returned. If \code{FALSE} (default), the index is 
 #'   returned with associated p-values in a 4 element numeric vector.
 #'   
+#' @param threads (for ia and resample.ia) the maximum number of parallel
+#'   threads to be used for the permutations when \code{sample > 0} or the
+#'   replicates of resample.ia. Defaults to 1 thread, in 
+#'   which the permutations will run serially. A value of 0 will attempt to use
+#'   as many threads as there are available cores/CPUs. The results do not 
+#'   depend on the number of threads.
+#'   
 #' @return 
 #'   \subsection{for \code{pair.ia}}{
 #'   A matrix with two columns and choose(nLoc(gid), 2) rows representing the
@@ -761,7 +766,8 @@ poppr.all <- function(filelist, ...){
 #' }
 #==============================================================================#
 ia <- function(gid, sample = 0, method = 1, quiet = FALSE, missing = "ignore", 
-               plot = TRUE, hist = TRUE, index = "rbarD", valuereturn = FALSE){
+               plot = TRUE, hist = TRUE, index = "rbarD", valuereturn = FALSE,
+               threads = 1L){
   namelist <- list(population = ifelse(nPop(gid) > 1 | is.null(gid@pop), 
                                        "Total", popNames(gid)),
                    File = as.character(match.call()[2])
@@ -808,7 +814,8 @@ ia <- function(gid, sample = 0, method = 1, quiet = FALSE, missing = "ignore",
     }
     progressr::with_progress({
       samp <- .sampling(
-        popx, sample, missing, quiet = quiet, type = type, method = method
+        popx, sample, missing, quiet = quiet, type = type, method = method,
+        threads = threads
       )
     })
     p.val    <- sum(IarD[1] <= c(samp$Ia, IarD[1]))/(sample + 1)
@@ -846,11 +853,9 @@ ia <- function(gid, sample = 0, method = 1, quiet = FALSE, missing = "ignore",
 #==============================================================================#
 pair.ia <- function(gid, sample = 0L, quiet = FALSE, plot = TRUE, low = "blue", 
                     high = "red", limits = NULL, index = "rbarD", method = 1L){
-  N       <- nInd(gid)
   numLoci <- nLoc(gid)
   lnames  <- locNames(gid)
-  np      <- choose(N, 2)
-  nploci  <- choose(numLoci, 2)
+  np      <- choose(nInd(gid), 2)
   shuffle <- sample > 0L
   # quiet   <- should_poppr_be_quiet(quiet)
   # QUIET   <- if (shuffle) TRUE else quiet
@@ -860,14 +865,15 @@ pair.ia <- function(gid, sample = 0L, quiet = FALSE, plot = TRUE, low = "blue",
     progressr::handlers("void")
   }
   progressr::with_progress({
-    p <- make_progress((1 + sample) * nploci, 50)
-  res <- pair_ia_internal(gid, N, numLoci, lnames, np, nploci, p, sample = 0)
+    p <- make_progress(1 + sample, 50)
+  res <- pair_ia_internal(gid, numLoci, lnames, np)
   if (shuffle) {
     # Initialize with 1 to account for the observed data.
     counts <- matrix(1L, nrow = nrow(res), ncol = ncol(res))
     for (i in seq_len(sample)) {
+      if (i %% p$step == 0) p$rog()
       tmp    <- shufflepop(gid, method = method)
-      tmpres <- pair_ia_internal(tmp, N, numLoci, lnames, np, nploci, p, i)
+      tmpres <- pair_ia_internal(tmp, numLoci, lnames, np)
       counts <- counts + as.integer(tmpres >= res)
     }
     p   <- counts/(sample + 1)
@@ -886,39 +892,46 @@ pair.ia <- function(gid, sample = 0L, quiet = FALSE, plot = TRUE, low = "blue",
 }
 
 
-pair_ia_internal <- function(gid, N, numLoci, lnames, np, nploci, p, sample = NULL) {
-  # Calculate pairwise distances for each locus. This will be a matrix of 
-  # np rows and numLoci columns.
-  if (gid@type == "codom") {
-    V <- pair_matrix(seploc(gid), numLoci, np)
-  } else { # P/A case
-    V <- apply(tab(gid), 2, function(x) as.vector(dist(x)))
-    # checking for missing data and imputing the comparison to zero.
-    if (any(is.na(V))) {
-      V[which(is.na(V))] <- 0
+pair_ia_internal <- function(gid, numLoci, lnames, np) {
+  # The sums of the pairwise distances at each locus (d) and the sums of the
+  # products of pairwise distances between each pair of loci (VV) are all that
+  # is needed to calculate I_A and \bar{r}_d for any pair of loci. These are
+  # calculated in C without creating the np x numLoci matrix of distances.
+  codom <- gid@type == "codom"
+  mat   <- tab(gid)
+  if (all(is.na(mat) | mat == round(mat))){
+    n.all <- if (codom) as.integer(gid@loc.n.all) else rep(1L, ncol(mat))
+    storage.mode(mat) <- "integer"
+    sums  <- .Call("pair_ia_sums", mat, n.all, as.integer(ploidy(gid)), codom, 
+                   1L, PACKAGE = "poppr")
+    d     <- sums[[1]]
+    VV    <- sums[[2]]
+  } else {
+    # Counts that are not integers (e.g. after missingno(x, "mean")) can not 
+    # be counted in C, so the pairwise distances for each locus are calculated
+    # as a matrix of np rows and numLoci columns.
+    if (codom) {
+      V <- pair_matrix(seploc(gid), numLoci, np)
+    } else { # P/A case
+      V <- apply(mat, 2, function(x) as.vector(dist(x)))
+      # checking for missing data and imputing the comparison to zero.
+      V[is.na(V)] <- 0
     }
+    d     <- colSums(V)
+    VV    <- crossprod(V)
   }
-  colnames(V) <- lnames
+  vard  <- (diag(VV) - (d^2)/np)/np
 
   # calculate I_A and \bar{r}_d for each combination of loci
-  loci_pairs  <- combn(lnames, 2)
-  ia_pairs    <- matrix(NA_real_, nrow = 2, ncol = nploci)
-  for (i in seq(nploci)) {
-    if ((nploci * sample + i) %% p$step == 0) p$rog() 
-    the_pair <- loci_pairs[, i, drop = TRUE]
-    newV <- V[, the_pair, drop = FALSE]
-    ia_pairs[, i] <- ia_from_d_and_D(
-      V = list(
-        d.vector  = colSums(newV), 
-        d2.vector = colSums(newV * newV), 
-        D.vector  = rowSums(newV)
-      ),
-      np = np
-    )
-  }
-  colnames(ia_pairs) <- apply(loci_pairs, 2, paste, collapse = ":")
-  rownames(ia_pairs) <- c("Ia", "rbarD")
-  ia_pairs           <- t(ia_pairs)
+  loci_pairs <- combn(numLoci, 2)
+  a          <- loci_pairs[1, ]
+  b          <- loci_pairs[2, ]
+  D2         <- diag(VV)[a] + diag(VV)[b] + 2*VV[cbind(a, b)]
+  varD       <- (D2 - ((d[a] + d[b])^2)/np)/np
+  sigVarj    <- vard[a] + vard[b]
+  ia_pairs   <- cbind(Ia    = (varD/sigVarj) - 1,
+                      rbarD = (varD - sigVarj)/(2 * sqrt(vard[a] * vard[b])))
+  rownames(ia_pairs) <- paste(lnames[a], lnames[b], sep = ":")
   ia_pairs
 }
 #==============================================================================#
@@ -46,8 +46,9 @@
 #' 
 #' This function simplifies the process necessary for performing AMOVA in R. It
 #' gives user the choice of utilizing either the \pkg{ade4} or the \pkg{pegas}
-#' implementation of AMOVA. See [ade4::amova()] (ade4) and [pegas::amova()]
-#' (pegas) for details on the specific implementation.
+#' implementation of AMOVA or the implementation in \pkg{poppr}. See
+#' [ade4::amova()] (ade4) and [pegas::amova()] (pegas) for details on the
+#' specific implementation.
 #' 
 #' @param x a [genind][genind-class], [genclone][genclone-class], [genlight][genlight-class], or [snpclone][snpclone-class] object
 #'
@@ -71,14 +72,17 @@
 #'
 #' @param dist an optional distance matrix calculated on your data. If this is
 #'   set to `NULL` (default), the raw pairwise distances will be calculated via
-#'   [dist()].
+#'   [dist()]. With `method = "poppr"`, this can also be a 
+#'   [dist_file][write_dist_file()] of all samples, which is read from disk.
 #'
 #' @param squared if a distance matrix is supplied, this indicates whether or
 #'   not it represents squared distances.
 #'
 #' @param correction a `character` defining the correction method for
 #'   non-euclidean distances. Options are [ade4::quasieuclid()] (Default),
-#'   [ade4::lingoes()], and [ade4::cailliez()]. See Details below.
+#'   [ade4::lingoes()], and [ade4::cailliez()]. See Details below. Distances
+#'   in a [dist_file][write_dist_file()] cannot be corrected; set this to
+#'   `"none"` to use them as they are.
 #'
 #' @param sep Deprecated. As of poppr version 2, this argument serves no
 #'   purpose.
@@ -92,7 +96,8 @@
 #'
 #' @param threads `integer` When using filtering or genlight objects, this 
 #'   parameter specifies the number of parallel processes passed to 
-#'   [mlg.filter()] and/or [bitwise.dist()]. 
+#'   [mlg.filter()] and/or [bitwise.dist()]. With `method = "poppr"`, this is
+#'   also the number of threads used for the permutations.
 #'
 #' @param missing specify method of correcting for missing data utilizing
 #'   options given in the function [missingno()]. Default is `"loci"`. This only
@@ -107,16 +112,19 @@
 #'   printed.
 #'
 #' @param method Which method for calculating AMOVA should be used? Choices
-#'   refer to package implementations: "ade4" (default) or "pegas". See details
-#'   for differences.
+#'   refer to package implementations: "ade4" (default), "pegas", or "poppr".
+#'   See details for differences.
 #'
-#' @param nperm the number of permutations passed to the pegas implementation of
-#'   amova.
+#' @param nperm the number of permutations passed to the pegas or poppr
+#'   implementations of amova.
 #'   
 #' @inheritParams mlg.filter
 #'   
 #' @return a list of class `amova` from the ade4 or pegas package. See 
-#'   [ade4::amova()] or [pegas::amova()] for details.
+#'   [ade4::amova()] or [pegas::amova()] for details. The poppr implementation
+#'   returns the same list as [pegas::amova()] with the additional element
+#'   `permutations`, a matrix of the permuted variance components for each
+#'   level when `nperm > 0`.
 #' 
 #' @details The poppr implementation of AMOVA is a very detailed wrapper for the
 #'   ade4 implementation. The output is an [ade4::amova()] class list that
@@ -180,7 +188,18 @@
 #'   implementation. If you want to perform permutation analyses on the pegas
 #'   implementation, you must set `within = FALSE`. In addition, while clone
 #'   correction is implemented for both methods, filtering is only implemented
-#'   for the ade4 version.}
+#'   for the ade4 version.
+#'   
+#'   The poppr version (`method = "poppr"`) calculates the same statistics as
+#'   the pegas version in C directly from the distance matrix. The permutation
+#'   tests follow the same scheme as pegas, but only the strata labels are
+#'   shuffled and the permutations can be run in parallel with the `threads`
+#'   argument. This makes it suitable for large data sets. The results can be
+#'   printed with the print method from \pkg{pegas}. For genlight and snpclone
+#'   objects without a supplied distance matrix, the squared euclidean
+#'   distances are calculated in a single pass and passed to the AMOVA
+#'   without taking the square root. These distances are not corrected for
+#'   non-euclidean properties.}
 #'   
 #'   \subsection{On Polyploids:}{ As of \pkg{poppr} version 2.7.0, this
 #'   function is able to calculate phi statistics for within-individual variance
@@ -265,10 +284,11 @@ poppr.amova <- function(x, hier = NULL, clonecorrect = FALSE, within = TRUE,
                         correction = "quasieuclid", sep = "_", filter = FALSE, 
                         threshold = 0, algorithm = "farthest_neighbor", 
                         threads = 1L, missing = "loci", cutoff = 0.05, 
-                        quiet = FALSE,  method = c("ade4", "pegas"), nperm = 0){
+                        quiet = FALSE,  method = c("ade4", "pegas", "poppr"), 
+                        nperm = 0){
   if (!inherits(x, c("genind", "genlight"))) stop(paste(substitute(x), "must be a genind object."))
   if (is.null(hier)) stop("A population hierarchy must be specified")
-  methods   <- c("ade4", "pegas")
+  methods   <- c("ade4", "pegas", "poppr")
   method    <- match.arg(method, methods)
   setPop(x) <- hier
   is_genind <- is.genind(x)
@@ -366,10 +386,46 @@ poppr.amova <- function(x, hier = NULL, clonecorrect = FALSE, within = TRUE,
     } else {
       if (is_genind) {
         xdist <- dist(tab(x, freq = freq)) 
+      } else if (method == "poppr") {
+        # The squared distances are what the native AMOVA uses, so they are
+        # passed along as they come from C unless the distances are not
+        # euclidean and need to be corrected below.
+        x       <- if (all(ploidy(x) == 2)) fix_uneven_diploid(x) else x
+        xdist   <- bitwise_condensed(x, euclidean = TRUE, scale_missing = TRUE,
+                                     threads = threads)
+        squared <- TRUE
+        rootd   <- structure(sqrt(xdist), Size = nInd(x), Diag = FALSE, 
+                             Upper = FALSE, class = "dist")
+        if (!is.euclid(rootd)) {
+          xdist   <- rootd
+          squared <- FALSE
+        }
       } else {
         xdist <- bitwise.dist(x, euclidean = TRUE, scale_missing = TRUE, threads = threads)
       }
     }
+  } else if (inherits(dist, "dist_file")) {
+    # Distance files are read from disk in C by the native AMOVA, so they are
+    # not clone corrected or corrected for non-euclidean distances.
+    if (method != "poppr") {
+      stop("A dist_file can only be used with method = \"poppr\".")
+    }
+    if (correction != "none") {
+      msg <- paste("The distances in a dist_file are not checked for euclidean",
+                   "properties and no correction is applied.",
+                   if (!squared) "They will be squared as they are.",
+                   "Set correction = \"none\" to use them without this",
+                   "warning.")
+      warning(msg, call. = FALSE)
+    }
+    if (!is.null(dist$samples) || dist$n != nInd(x)) {
+      msg <- paste("\nDistance file does not match the data.\n",
+      "\n\tObservations expected.....................", nInd(x),
+      "\n\tObservations in provided distance file.....", dist$n,
+      ifelse(within == TRUE, "\n\n\tTry setting within = FALSE.", "\n"))
+      stop(msg)
+    }
+    xdist <- dist
   } else {
     datalength <- choose(nInd(x), 2)
     mlgs       <- mlg(x, quiet = TRUE)
@@ -389,10 +445,11 @@ poppr.amova <- function(x, hier = NULL, clonecorrect = FALSE, within = TRUE,
       stop(msg)
     }
     if (squared) {
-      xdist <- sqrt(xdist)
+      xdist   <- sqrt(xdist)
+      squared <- FALSE
     }
   }
-  if (!is.euclid(xdist)) {
+  if (!squared && !inherits(xdist, "dist_file") && !is.euclid(xdist)) {
     CORRECTIONS <- c("cailliez", "quasieuclid", "lingoes")
     try(correct <- match.arg(correction, CORRECTIONS), silent = TRUE)
     if (!exists("correct")){
@@ -414,6 +471,9 @@ poppr.amova <- function(x, hier = NULL, clonecorrect = FALSE, within = TRUE,
     xtab    <- t(mlg.table(x, plot = FALSE, quiet = TRUE, mlgsub = allmlgs))
     xtab    <- as.data.frame(xtab)
     return(ade4::amova(samples = xtab, distances = xdist, structures = xstruct))
+  } else if (method == "poppr") {
+    return(amova_native(xdist, hierdf, all.vars(hier), nperm, threads, 
+                        match.call(), squared = squared))
   } else {
     form <- paste(all.vars(hier), collapse = "/")
     hier <- as.formula(paste("xdist ~", form))
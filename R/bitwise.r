@@ -47,7 +47,9 @@
 #' This function calculates both dissimilarity and Euclidean distances for 
 #' [genlight][genlight-class] or [snpclone][snpclone-class] objects. 
 #' 
-#' @param x a [genlight][genlight-class] or [snpclone][snpclone-class] object.
+#' @param x a [genlight][genlight-class] or [snpclone][snpclone-class] object,
+#'   a genlight object packed with [pack_genlight()], or a [genotype_store()]
+#'   on disk.
 #'   
 #' @param percent `logical`. Should the distance be represented from 0 to 
 #'   1? Default set to `TRUE`. `FALSE` will return the distance 
@@ -86,6 +88,11 @@
 #'   some systems. Other values may be specified, but should be used with 
 #'   caution.
 #'   
+#' @param file an optional path to a [distance file][write_dist_file()]. If 
+#'   this is given, the distances are written to the file in blocks of samples
+#'   instead of being returned, so that the distances between all samples 
+#'   never have to be in memory at once. Defaults to `NULL`.
+#'   
 #'   
 #' @details The default distance calculated here is quite simple and goes by
 #'   many names depending on its application. The most familiar name might be
@@ -95,6 +102,13 @@
 #'   distance and is considerably faster and more memory-efficient than the 
 #'   standard `dist()` function. 
 #'   
+#'   Data that are too large for memory can be written to a 
+#'   [genotype_store()], which is read directly from disk. Data that will be 
+#'   analyzed many times can be packed once with [pack_genlight()]. When 
+#'   there are too many samples for the distances to fit in memory, they can be
+#'   written to a distance file with `file` and used from disk by 
+#'   [mlg.filter()], [poppr.msn()], and [poppr.amova()].
+#'   
 #' @note This function is optimized for [genlight][genlight-class] and
 #'   [snpclone][snpclone-class] objects. This does not mean that it is a
 #'   catch-all optimization for SNP data. Three assumptions must be met for this
@@ -108,7 +122,8 @@
 #'   [genclone][genclone-class] object, [prevosti.dist()] will be used for
 #'   calculation.
 #'   
-#' @return A dist object containing pairwise distances between samples.
+#' @return A dist object containing pairwise distances between samples. If 
+#'   `file` is given, a [dist_file][write_dist_file()] object is returned.
 #'   
 #' @author Zhian N. Kamvar, Jonah C. Brooks
 #' 
@@ -153,20 +168,33 @@
 #==============================================================================#
 bitwise.dist <- function(x, percent = TRUE, mat = FALSE, missing_match = TRUE, 
                          scale_missing = FALSE, euclidean = FALSE,
-                         differences_only = FALSE, threads = 0L){
-  stopifnot(inherits(x, c("genlight", "genclone", "genind", "snpclone")))
-  # Stop if the ploidy of the genlight object is not consistent
-  stopifnot(min(ploidy(x)) == max(ploidy(x))) 
-  # Stop if the ploidy of the genlight object is not haploid or diploid
-  stopifnot(min(ploidy(x)) == 2 || min(ploidy(x)) == 1)
+                         differences_only = FALSE, threads = 0L, file = NULL){
+  stopifnot(inherits(x, c("genlight", "genclone", "genind", "snpclone", 
+                          "genotype_store", "packed_genlight")))
+  if (!is.null(file) && mat){
+    stop("Distances written to a file can not be returned as a matrix.", 
+         call. = FALSE)
+  }
+  packed <- inherits(x, c("genotype_store", "packed_genlight"))
+  if (packed){
+    ploid     <- x$ploidy
+    ind.names <- x$ind.names
+    inds      <- x$n
+    numPairs  <- x$nloc
+  } else {
+    # Stop if the ploidy of the genlight object is not consistent
+    stopifnot(min(ploidy(x)) == max(ploidy(x))) 
+    # Stop if the ploidy of the genlight object is not haploid or diploid
+    stopifnot(min(ploidy(x)) == 2 || min(ploidy(x)) == 1)
 
-  ploid     <- min(ploidy(x))
-  ind.names <- indNames(x)
-  inds      <- nInd(x)
-  numPairs  <- nLoc(x)
+    ploid     <- min(ploidy(x))
+    ind.names <- indNames(x)
+    inds      <- nInd(x)
+    numPairs  <- nLoc(x)
+  }
 
   # Use Prevosti if this is a genclone or genind object
-  if(!is(x, "genlight")){
+  if(!packed && !is(x, "genlight")){
     dist.mat <- prevosti.dist(x)
     if (percent == FALSE){
       dist.mat <- dist.mat*ploid*numPairs
@@ -174,6 +202,9 @@ bitwise.dist <- function(x, percent = TRUE, mat = FALSE, missing_match = TRUE,
     if (mat == TRUE){
       dist.mat <- as.matrix(dist.mat)
     }
+    if (!is.null(file)){
+      return(write_dist_file(dist.mat, file))
+    }
     # Return this matrix and exit function
     return(dist.mat)
   }
@@ -181,7 +212,7 @@ bitwise.dist <- function(x, percent = TRUE, mat = FALSE, missing_match = TRUE,
   # Continue function for genlight objects
 
   # Ensure that every SNPbin object has data for all chromosomes
-  if (ploid == 2){
+  if (!packed && ploid == 2){
     x <- fix_uneven_diploid(x)
   }
   # Threads must be something that can cast to integer
@@ -193,23 +224,23 @@ bitwise.dist <- function(x, percent = TRUE, mat = FALSE, missing_match = TRUE,
   # Cast parameters to proper types before passing them to C
   threads <- as.integer(threads)
 
-  if (ploid == 1)
-  {
-    pairwise_dist <- .Call("bitwise_distance_haploid", x, missing_match, threads)
-  }
-  else
-  {
-    pairwise_dist <- .Call("bitwise_distance_diploid", x, missing_match, euclidean, differences_only, threads)
-  }
-  dist.mat <- pairwise_dist
-  dim(dist.mat) <- c(inds,inds)
-  colnames(dist.mat) <- ind.names
-  rownames(dist.mat) <- ind.names
-  nas <- NA.posi(x)
-  if (scale_missing && sum(lengths(nas)) > 0) {
-    adj      <- missing_correction(nas, nLoc(x))
-    dist.mat <- dist.mat * adj
+  if (!is.null(file)){
+    # The distances are calculated and written one block of samples at a time
+    # and scaled in C in the same way as below.
+    divisor <- if (euclidean || !percent) 1 else numPairs*ifelse(differences_only, 1, ploid)
+    file    <- path.expand(file)
+    .Call("bitwise_distance_file", bitwise_source(x), file, 
+          as.logical(missing_match), as.logical(euclidean), 
+          as.logical(differences_only), as.logical(scale_missing), 
+          as.numeric(divisor), dist_block_size(), threads, PACKAGE = "poppr")
+    write_dist_labels(file, ind.names)
+    return(dist_file(file))
   }
+
+  # The distances and the missing data correction are written directly into
+  # the lower triangle, so no n x n matrices are created.
+  dist.mat <- bitwise_condensed(x, missing_match, euclidean, differences_only,
+                                scale_missing, threads)
   if (euclidean) {
     dist.mat <- sqrt(dist.mat)
   } else if (percent) {
@@ -222,12 +253,76 @@ bitwise.dist <- function(x, percent = TRUE, mat = FALSE, missing_match = TRUE,
       dist.mat <- dist.mat/(numPairs*ploid)
     }
   }
-  if (mat == FALSE) {
-    dist.mat <- as.dist(dist.mat)
+  dist.mat <- make_attributes(dist.mat, inds, ind.names, "bitwise", 
+                              match.call())
+  if (mat == TRUE) {
+    dist.mat <- as.matrix(dist.mat)
   }
   return(dist.mat)
 }
 
+#==============================================================================#
+#' Pack a genlight object for repeated bitwise analyses
+#' 
+#' The bitwise functions read the SNPs and the positions of missing data of
+#' every sample from a genlight object each time they are called. Packing the
+#' genlight object does this once, so that analyses that are repeated on the 
+#' same data, such as [win.ia()] and [samp.ia()], only have to read the SNPs.
+#' 
+#' @param x a [genlight][genlight-class] or [snpclone][snpclone-class] object
+#'   where all samples are either haploid or diploid.
+#'   
+#' @return an object of class "packed_genlight" that can be passed to 
+#'   [bitwise.dist()], [bitwise.ia()], [win.ia()], and [samp.ia()]. It contains
+#'   the number of samples (`n`), the number of loci (`nloc`), the `ploidy`, 
+#'   the sample names (`ind.names`), and the `position` and `chromosome` of the
+#'   loci from `x`.
+#'   
+#' @details The SNPs are not copied. The packed object refers to the data in 
+#'   the genlight object, so it takes little more memory than a bitmap of the
+#'   missing data. Subsetting must be done before packing.
+#'   
+#'   Packed objects can be saved with [saveRDS()]. The data are packed again
+#'   the first time a reloaded object is used.
+#'   
+#' @author Zhian N. Kamvar
+#' @md
+#' @export
+#' @seealso [genotype_store()] for data that are too large for memory.
+#' @examples
+#' set.seed(999)
+#' x <- glSim(n.ind = 10, n.snp.nonstruc = 5e2, n.snp.struc = 5e2, ploidy = 2)
+#' position(x) <- sort(sample(1e4, 1e3))
+#' px <- pack_genlight(x)
+#' px
+#' all.equal(bitwise.dist(px, threads = 1L), bitwise.dist(x, threads = 1L),
+#'           check.attributes = FALSE)
+#' win.ia(px, window = 300L, threads = 1L, quiet = TRUE)
+#' samp.ia(px, threads = 1L, quiet = TRUE)
+#==============================================================================#
+pack_genlight <- function(x){
+  stopifnot(is(x, "genlight"))
+  # Stop if the ploidy of the genlight object is not consistent
+  stopifnot(min(ploidy(x)) == max(ploidy(x))) 
+  # Stop if the ploidy of the genlight object is not haploid or diploid
+  stopifnot(min(ploidy(x)) == 2 || min(ploidy(x)) == 1)
+  # Ensure that every SNPbin object has data for all chromosomes
+  if (min(ploidy(x)) == 2){
+    x <- fix_uneven_diploid(x)
+  }
+  packed            <- new.env(parent = emptyenv())
+  packed$ptr        <- .Call("genotype_view_pack", x, PACKAGE = "poppr")
+  packed$data       <- x
+  packed$n          <- nInd(x)
+  packed$nloc       <- nLoc(x)
+  packed$ploidy     <- min(ploidy(x))
+  packed$ind.names  <- indNames(x)
+  packed$position   <- position(x)
+  packed$chromosome <- chromosome(x)
+  class(packed)     <- "packed_genlight"
+  packed
+}
+
 #==============================================================================#
 #' Determines whether openMP is support on this system.
 #'
@@ -256,12 +351,13 @@ poppr_has_parallel <- function(){
 #' @param nloc the number of loci
 #' @param mat a logical specifying whether or not a matrix should be returned
 #'   (default: TRUE)
+#' @param threads the number of threads to use (default: 1)
 #'
 #' @return an n x n matrix or a choose(n, 2) length vector of values that scale
 #'   from 1 to the number of loci.
 #' @noRd
-missing_correction <- function(nas, nloc, mat = TRUE){
-  res <- .Call("adjust_missing", nas, nloc, PACKAGE = "poppr")
+missing_correction <- function(nas, nloc, mat = TRUE, threads = 1L){
+  res <- .Call("adjust_missing", nas, nloc, as.integer(threads), PACKAGE = "poppr")
   if (mat) {
     return(res)
   } else {
@@ -269,13 +365,80 @@ missing_correction <- function(nas, nloc, mat = TRUE){
   }
 }
 
+#' Condensed bitwise distances for genlight objects
+#'
+#' The distances are calculated in a single pass and written to a vector in the
+#' same order as a dist object. When euclidean is TRUE, the values are the
+#' squared euclidean distances.
+#'
+#' @param x a genlight object where all samples have the same ploidy, a
+#'   packed_genlight, or a genotype_store. Diploids must have passed through
+#'   fix_uneven_diploid.
+#' @param missing_match,euclidean,differences_only see [bitwise.dist()]
+#' @param scale_missing if TRUE, each distance is scaled by nLoc/(nLoc - m)
+#'   where m is the number of loci missing in either sample.
+#' @param threads the number of threads to use.
+#'
+#' @return a numeric vector of length choose(nInd(x), 2)
+#' @noRd
+bitwise_condensed <- function(x, missing_match = TRUE, euclidean = FALSE,
+                              differences_only = FALSE, scale_missing = FALSE,
+                              threads = 0L){
+  .Call("bitwise_distance_condensed", bitwise_source(x), as.logical(missing_match), 
+        as.logical(euclidean), as.logical(differences_only), 
+        as.logical(scale_missing), as.integer(threads), PACKAGE = "poppr")
+}
+
+#' Data passed to the bitwise functions in C
+#'
+#' Packed genlight objects are passed as their external pointer, which is 
+#' created again if the object was loaded from disk. Genotype stores are passed
+#' as the path to the store.
+#'
+#' @param x a genlight, packed_genlight, or genotype_store object
+#'
+#' @return an external pointer, a file path, or x
+#' @noRd
+bitwise_source <- function(x){
+  if (inherits(x, "packed_genlight")){
+    if (.Call("genotype_view_size", x$ptr, PACKAGE = "poppr") < 0){
+      x$ptr <- .Call("genotype_view_pack", x$data, PACKAGE = "poppr")
+    }
+    return(x$ptr)
+  }
+  if (inherits(x, "genotype_store")){
+    return(x$file)
+  }
+  x
+}
+
+#' Index of association over loci of a packed genlight or genotype store
+#'
+#' The loci that were not selected are masked out, so no subset of the data is
+#' created.
+#'
+#' @param x a packed_genlight or genotype_store
+#' @param loci a vector of the (1-based) loci to use
+#' @param missing_match,differences_only,threads see [bitwise.ia()]
+#'
+#' @return the index of association
+#' @noRd
+packed_ia <- function(x, loci, missing_match = TRUE, differences_only = FALSE,
+                      threads = 0L){
+  .Call("association_index_loci", bitwise_source(x), sort(as.integer(loci)) - 1L,
+        as.logical(missing_match), as.logical(differences_only), 
+        as.integer(threads), PACKAGE = "poppr")
+}
+
 #==============================================================================#
 #' Calculate the index of association between samples in a genlight object.
 #' 
 #' This function parses over a genlight object to calculate and return the index
 #' of association for those samples.
 #' 
-#' @param x a [genlight][genlight-class] or [snpclone][snpclone-class] object.
+#' @param x a [genlight][genlight-class] or [snpclone][snpclone-class] object,
+#'   a genlight object packed with [pack_genlight()], or a [genotype_store()]
+#'   on disk.
 #'   
 #' @param missing_match a boolean determining whether missing data should be 
 #'   considered a match. If TRUE (default) missing data at a locus will match 
@@ -308,6 +471,10 @@ missing_correction <- function(nas, nloc, mat = TRUE){
 #' @keywords internal
 #==============================================================================#
 bitwise.ia <- function(x, missing_match=TRUE, differences_only=FALSE, threads=0){
+  if (inherits(x, c("genotype_store", "packed_genlight"))){
+    return(packed_ia(x, seq_len(x$nloc), missing_match, differences_only, 
+                     threads))
+  }
   stopifnot(class(x)[1] %in% c("genlight", "snpclone"))
   # Stop if the ploidy of the genlight object is not consistent
   stopifnot(min(ploidy(x)) == max(ploidy(x))) 
@@ -354,7 +521,10 @@ bitwise.ia <- function(x, missing_match=TRUE, differences_only=FALSE, threads=0)
 #' function will scan windows across the loci positions and calculate the index
 #' of association.
 #' 
-#' @param x a [genlight][genlight-class] or [snpclone][snpclone-class] object.
+#' @param x a [genlight][genlight-class] or [snpclone][snpclone-class] object,
+#'   a genlight object packed with [pack_genlight()], or a [genotype_store()]
+#'   on disk. The positions and chromosomes of a genotype store are those given
+#'   to [genotype_store()].
 #'   
 #' @param window an integer specifying the size of the window.
 #'   
@@ -441,24 +611,26 @@ bitwise.ia <- function(x, missing_match=TRUE, differences_only=FALSE, threads=0)
 #==============================================================================#
 win.ia <- function(x, window = 100L, min.snps = 3L, threads = 1L, quiet = FALSE,
                    name_window = TRUE, chromosome_buffer = TRUE){
-  stopifnot(is(x, "genlight"))
-  if (is.null(position(x))) {
-    position(x) <- seq(nLoc(x))
-  }
+  packed <- inherits(x, c("genotype_store", "packed_genlight"))
+  stopifnot(packed || is(x, "genlight"))
+  # Packed data is an environment that may be reused, so the default positions
+  # are kept local instead of being assigned into it.
+  xpos <- if (packed) x$position else position(x)
+  if (is.null(xpos)) xpos <- seq(if (packed) x$nloc else nLoc(x))
   if (!chromosome_buffer) {
     msg <- paste("The argument `chromosome_buffer` has been deprecated as of",
                  "poppr version 1.8.0. All chromosomes are treated separately",
                  "by default.")
     warning(msg, immediate. = TRUE)
   }
-  chromos <- !is.null(chromosome(x))
-  xpos    <- position(x)
+  xchrom  <- if (packed) x$chromosome else chromosome(x)
+  chromos <- !is.null(xchrom)
   quiet   <- should_poppr_be_quiet(quiet)
   winmat  <- make_windows(maxp = max(xpos), minp = 1L, window = window)
   if (chromos) {
     # Converting to character is necessary to avoid empty chromosomes.
     # See: https://twitter.com/ZKamvar/status/991114778415325184
-    CHROM         <- as.character(chromosome(x))
+    CHROM         <- as.character(xchrom)
     chrom_names   <- unique(CHROM)
     pos_per_chrom <- split(xpos, CHROM)[chrom_names]
     win_per_chrom <- ceiling(vapply(pos_per_chrom, max, integer(1))/window)
@@ -466,7 +638,7 @@ win.ia <- function(x, window = 100L, min.snps = 3L, threads = 1L, quiet = FALSE,
     nwin                 <- sum(win_per_chrom)
     nchrom <- length(win_per_chrom) -> chromosomes_left
   } else {
-    if (any(duplicated(position(x)))) {
+    if (any(duplicated(xpos))) {
       msg <- paste("There are duplicate positions in the data without any",
                    "chromosome structure. All positions must be unique.\n\n",
                    "Please the function chromosome() to add chromosome",
@@ -505,6 +677,8 @@ win.ia <- function(x, window = 100L, min.snps = 3L, threads = 1L, quiet = FALSE,
         # Check to make sure the SNP threshold is met. If not, set to NA
         if (sum(j) < min.snps) {
           res_mat[res_counter] <- NA_real_
+        } else if (packed) {
+          res_mat[res_counter] <- packed_ia(x, which(j), threads = threads)
         } else {
           res_mat[res_counter] <- bitwise.ia(x[, j], threads = threads)
         }
@@ -529,7 +703,9 @@ win.ia <- function(x, window = 100L, min.snps = 3L, threads = 1L, quiet = FALSE,
 #' sense to calculate the index of association over that many loci, this
 #' function will randomly sample sites to calculate the index of association.
 #' 
-#' @param x a [genlight][genlight-class] or [snpclone][snpclone-class] object.
+#' @param x a [genlight][genlight-class] or [snpclone][snpclone-class] object,
+#'   a genlight object packed with \code{\link{pack_genlight}}, or a
+#'   \code{\link{genotype_store}} on disk.
 #'   
 #' @param n.snp the number of snps to be used to calculate standardized index
 #' of association.
@@ -597,8 +773,9 @@ win.ia <- function(x, window = 100L, min.snps = 3L, threads = 1L, quiet = FALSE,
 #' hist(res, breaks = "fd")
 #==============================================================================#
 samp.ia <- function(x, n.snp = 100L, reps = 100L, threads = 1L, quiet = FALSE){
-  stopifnot(is(x, "genlight"))
-  nloc <- nLoc(x)
+  packed <- inherits(x, c("genotype_store", "packed_genlight"))
+  stopifnot(packed || is(x, "genlight"))
+  nloc <- if (packed) x$nloc else nLoc(x)
   quiet <- should_poppr_be_quiet(quiet)
   res_mat <- vector(mode = "numeric", length = reps)
   if (quiet) {
@@ -611,7 +788,8 @@ samp.ia <- function(x, n.snp = 100L, reps = 100L, threads = 1L, quiet = FALSE){
     for (i in seq(reps)){
       if (i %% p$step == 0) p$rog()
       posns <- sample(nloc, n.snp)
-      res_mat[i] <- bitwise.ia(x[, posns], threads = threads)
+      res_mat[i] <- if (packed) packed_ia(x, posns, threads = threads) else
+        bitwise.ia(x[, posns], threads = threads)
     }
   })
   return(res_mat)
@@ -411,7 +411,7 @@ bruvo.boot <- function(pop, replen = 1, add = TRUE, loss = TRUE, sample = 100,
   if ("upgma" %in% treechar){
     treefun <- upgma
   } else if ("nj" %in% treechar){
-    treefun <- nj
+    treefun <- poppr_nj
   } else {
     treefun <- match.fun(tree)    
   }
@@ -483,7 +483,8 @@ bruvo.boot <- function(pop, replen = 1, add = TRUE, loss = TRUE, sample = 100,
 #'   different populations containing the same multilocus genotype.}
 #'   
 #' @details The minimum spanning network generated by this function is generated
-#'   via igraph's \code{\link[igraph:mst]{minimum.spanning.tree}}. The resultant
+#'   with Prim's algorithm in C, as in igraph's
+#'   \code{\link[igraph:mst]{minimum.spanning.tree}}. The resultant
 #'   graph produced can be plotted using igraph functions, or the entire object
 #'   can be plotted using the function \code{\link{plot_poppr_msn}}, which will
 #'   give the user a scale bar and the option to layout your data.
@@ -570,7 +571,7 @@ bruvo.boot <- function(pop, replen = 1, add = TRUE, loss = TRUE, sample = 100,
 #' bruvo.msn(nancycats, replen=rep(2, 9), vertex.label=NA)
 #' }
 #==============================================================================#
-#' @importFrom igraph graph.adjacency plot.igraph V E minimum.spanning.tree V<- E<- print.igraph add.edges
+#' @importFrom igraph plot.igraph V E V<- E<- print.igraph add.edges
 bruvo.msn <- function (gid, replen = 1, add = TRUE, loss = TRUE, 
                        mlg.compute = "original", 
                        palette = topo.colors,
@@ -578,7 +579,7 @@ bruvo.msn <- function (gid, replen = 1, add = TRUE, loss = TRUE,
                        gscale = TRUE, glim = c(0,0.8), gadj = 3, gweight = 1, 
                        wscale = TRUE, showplot = TRUE, 
                        include.ties = FALSE, threshold = NULL, 
-                       clustering.algorithm = NULL, ...){
+                       clustering.algorithm = NULL, threads = 1L, ...){
   if (!inherits(gid, "genind")){
     stop("Bruvo's distance only works for microsatellite markers. gid must be a genind/genclone object.")
   }
@@ -640,7 +641,7 @@ bruvo.msn <- function (gid, replen = 1, add = TRUE, loss = TRUE,
     gid     <- filtered$gid
   } else {
     cgid    <- gid[.clonecorrector(gid), ]
-    distmat <- as.matrix(bruvo.dist(cgid, replen=replen, add = add, loss = loss))
+    distmat <- bruvo.dist(cgid, replen=replen, add = add, loss = loss)
   }
   poppr_msn_list <- msn_constructor(
     gid = gid,
@@ -656,6 +657,7 @@ bruvo.msn <- function (gid, replen = 1, add = TRUE, loss = TRUE,
     glim = glim,
     gadj = gadj,
     showplot = showplot,
+    threads = threads,
     ...)
   return(poppr_msn_list)
 }
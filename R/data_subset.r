@@ -161,26 +161,19 @@ clonecorrect <- function(pop, strata = 1, combine = FALSE, keep = 1){
     stop(hier_incompatible_warning(strata, strata(pop)))
   }
   setPop(pop) <- strataformula
-  # Corrects the individual names of the object. This is fo the fact that the
-  # clone corrector relies on the unique individual names for it to work.
+  # Individuals without names are numbered so that they can still be told
+  # apart after clone correction.
   if (all(indNames(pop) == "")){
     indNames(pop) <- as.character(1:nInd(pop))
   }
 
-  cpop <- nPop(pop)
-
-  # Steps for correction:
-  # Subset by population factor.
-  # Run subset population by the .clonecorrector
-  # Profit!
-  corWrecked <- function(x, pop){
-    subbed <- popsub(pop, x) # population to be...corrected.
-    subbed <- subbed[.clonecorrector(subbed), ] 
-    # Return the indices based off of the individual names.
-    return(which(indNames(pop) %in% indNames(subbed)))
-  }
-  
-  ccpop <- unlist(lapply(1:cpop, corWrecked, pop))
+  # The first individual of each genotype in each population is kept. The
+  # individuals are then grouped by population in the order of the levels,
+  # which drops individuals without a population.
+  pops  <- as.integer(pop(pop))
+  ccpop <- .clonecorrector(pop, pops)
+  ccpop <- ccpop[!is.na(pops[ccpop])]
+  ccpop <- ccpop[order(pops[ccpop])]
   pop   <- pop[ccpop, ]
   
   if (!combine){
@@ -63,12 +63,27 @@
 #' @param mat \code{logical}. Return a matrix object. Default set to 
 #'   \code{FALSE}, returning a dist object. \code{TRUE} returns a matrix object.
 #'   
+#' @param threads The maximum number of parallel threads to be used to
+#'   calculate the distances. Defaults to 1. If 0, all available threads will
+#'   be used.
+#'   
+#' @param file an optional path to a \code{\link[=write_dist_file]{distance 
+#'   file}}. If this is given, the distances are written to the file in blocks
+#'   of individuals instead of being returned, so that the distances between
+#'   all individuals never have to be in memory at once. Defaults to 
+#'   \code{NULL}.
+#'   
 #' @return Pairwise distances between individuals present in the genind object.
+#'   If \code{file} is given, a \code{\link[=write_dist_file]{dist_file}} 
+#'   object is returned.
 #' @author Zhian N. Kamvar
 #'   
 #' @details The distance calculated here is quite simple and goes by many names,
 #'   depending on its application. The most familiar name might be the Hamming
-#'   distance, or the number of differences between two strings.
+#'   distance, or the number of differences between two strings. The 
+#'   differences are counted over all loci at once in C and written directly
+#'   to a dist object. A locus with missing data in either individual does not
+#'   add to the distance.
 #'   
 #' @note When \code{percent = TRUE}, this is exactly the same as
 #'   \code{\link{provesti.dist}}, except that it performs better for large
@@ -90,8 +105,12 @@
 #' @export
 #==============================================================================#
 
-diss.dist <- function(x, percent=FALSE, mat=FALSE){
+diss.dist <- function(x, percent=FALSE, mat=FALSE, threads=1L, file=NULL){
   stopifnot(is(x, "gen"))
+  if (!is.null(file) && mat){
+    stop("Distances written to a file can not be returned as a matrix.", 
+         call. = FALSE)
+  }
   ploid     <- x@ploidy
   if (is(x, "bootgen")){
     ind.names <- x@names
@@ -99,33 +118,28 @@ diss.dist <- function(x, percent=FALSE, mat=FALSE){
     ind.names <- indNames(x)
   }
   inds      <- nrow(x@tab)
-  np        <- choose(inds, 2)
-  dist.mat  <- matrix(data = 0, nrow = inds, ncol = inds)
   numLoci   <- nLoc(x)
   type      <- x@type
   if (type == "PA"){
-    dist_by_locus <- matrix(.Call("pairdiffs", x@tab))
-    ploid <- 1
-  } else if (is(x, "bootgen")){
-    dist_by_locus <- vapply(seq(numLoci), function(i){
-      .Call("pairdiffs", tab(x[, i]))/2
-    }, numeric(np))
-  } else {  
-    x <- seploc(x)
-    dist_by_locus <- vapply(x, function(x) .Call("pairdiffs", x@tab)/2,
-                            numeric(np))
-  }
-  if (is.matrix(dist_by_locus)){
-    dist.mat[lower.tri(dist.mat)] <- rowSums(ceiling(dist_by_locus))    
+    loc_ends <- c(0L, ncol(x@tab))
+    ploid    <- 1
   } else {
-    dist.mat[lower.tri(dist.mat)] <- ceiling(dist_by_locus)
+    loc_ends <- c(0L, cumsum(x@loc.n.all))
   }
-  colnames(dist.mat) <- ind.names
-  rownames(dist.mat) <- ind.names
-  if (percent){
-    dist.mat <- sweep(dist.mat, 1, ploid * numLoci, "/")
+  scale    <- if (percent) rep_len(ploid * numLoci, inds) else 1
+  if (!is.null(file)){
+    file <- path.expand(file)
+    .Call("pairdiffs_all_file", x@tab, as.integer(loc_ends), type != "PA", 
+          as.numeric(scale), file, dist_block_size(), as.integer(threads), 
+          PACKAGE = "poppr")
+    write_dist_labels(file, ind.names)
+    return(dist_file(file))
   }
-  dist.mat <- as.dist(dist.mat)
+  dist.vec <- .Call("pairdiffs_all", x@tab, as.integer(loc_ends), 
+                    type != "PA", as.numeric(scale), as.integer(threads),
+                    PACKAGE = "poppr")
+  dist.mat <- make_attributes(dist.vec, inds, ind.names, "diss.dist", 
+                              match.call())
   if (mat == TRUE){
     dist.mat <- as.matrix(dist.mat)
   }
@@ -145,6 +159,10 @@ diss.dist <- function(x, percent=FALSE, mat=FALSE){
 #'   values are detected and replaced. If \code{FALSE}, these values will be 
 #'   replaced without warning. See Details below.
 #'   
+#' @param threads The maximum number of parallel threads to be used to
+#'   calculate the distances. Defaults to 1. If 0, all available threads will
+#'   be used.
+#'   
 #' @return an object of class dist with the same number of observations as the 
 #'   number of individuals in your data.
 #'   
@@ -155,6 +173,11 @@ diss.dist <- function(x, percent=FALSE, mat=FALSE){
 #'   this happens, infinite values are corrected to be 10 * max(D) where D is
 #'   the distance matrix without infinite values.
 #'   
+#'   All of these distances are calculated in C directly from the allele 
+#'   frequencies in blocks of samples without creating any square matrices. 
+#'   Pairs of samples where either sample has missing data will have a missing
+#'   distance, except for Prevosti's distance, where missing data are ignored.
+#'   
 #' @note Prevosti's distance is identical to \code{\link{diss.dist}}, except 
 #'   that \code{\link{diss.dist}} is optimized for a larger number of 
 #'   individuals (n > 125) at the cost of required memory. Both
@@ -229,7 +252,7 @@ diss.dist <- function(x, percent=FALSE, mat=FALSE){
 #' (pronan <- prevosti.dist(nan9))
 #' 
 #==============================================================================#
-nei.dist <- function(x, warning = TRUE){
+nei.dist <- function(x, warning = TRUE, threads = 1L){
   if (is(x, "gen")){
     MAT    <- get_gen_mat(x)
   } else if (length(dim(x)) == 2){
@@ -237,17 +260,12 @@ nei.dist <- function(x, warning = TRUE){
   } else {
     stop("Object must be a matrix or genind object")
   }
-  IDMAT <- MAT %*% t(MAT)
-  vec   <- sqrt(diag(IDMAT))
-  IDMAT <- IDMAT/vec[col(IDMAT)]
-  IDMAT <- IDMAT/vec[row(IDMAT)]
-  D     <- -log(IDMAT)
+  D     <- genetic_distance_native(MAT, "nei", threads = threads)
   if (any(D %in% Inf)){
     D <- infinite_vals_replacement(D, warning)
   }
-  D     <- as.dist(D)
   labs  <- get_gen_dist_labs(x)
-  D     <- make_attributes(D, length(labs), labs, "Nei", match.call())
+  D     <- make_attributes(D, nrow(MAT), labs, "Nei", match.call())
   return(D)
 }
 
@@ -255,7 +273,7 @@ nei.dist <- function(x, warning = TRUE){
 
 #' @rdname genetic_distance
 #' @export
-edwards.dist <- function(x){
+edwards.dist <- function(x, threads = 1L){
   if (is(x, "gen")){ 
     MAT  <- get_gen_mat(x)
     nloc <- nLoc(x)
@@ -265,49 +283,35 @@ edwards.dist <- function(x){
   } else {
     stop("Object must be a matrix or genind object")
   }
-  MAT     <- sqrt(MAT)
-  D       <- MAT%*%t(MAT)
-  D       <- 1 - D/nloc # Negative number are generated here.
-  diag(D) <- 0
-  D       <- sqrt(D)
-  D       <- as.dist(D)
+  D       <- genetic_distance_native(MAT, "edwards", nloc, threads = threads)
   labs    <- get_gen_dist_labs(x)
-  D       <- make_attributes(D, length(labs), labs, "Edwards", match.call())
+  D       <- make_attributes(D, nrow(MAT), labs, "Edwards", match.call())
   return(D)
 }
 
 
 #' @rdname genetic_distance
 #' @export
-rogers.dist <- function(x){
+rogers.dist <- function(x, threads = 1L){
   if (is(x, "gen")){ 
     if (is.genind(x) && x@type == "PA"){
       MAT     <- x@tab
-      nloc    <- nLoc(x)
       loc.fac <- factor(locNames(x), levels = locNames(x))
       nlig    <- nrow(x@tab)
     } else {
       MAT     <- get_gen_mat(x)
-      nloc    <- nLoc(x)
       loc.fac <- x@loc.fac
       nlig    <- nrow(x@tab)      
     }
   } else if (length(dim(x)) == 2){
     MAT     <- x
-    nloc    <- ncol(x)
     loc.fac <- factor(colnames(x), levels = colnames(x))
     nlig    <- nrow(x)
   } else {
     stop("Object must be a matrix or genind object")
   }
-  # kX is a list of K=nloc matrices
-  kX <- lapply(split(MAT, loc.fac[col(MAT)]), matrix, nrow = nlig)
-  D  <- matrix(0, nlig, nlig)
-  for(i in 1:length(kX)){
-    D <- D + dcano(kX[[i]])
-  }
-  D    <- D/length(kX)
-  D    <- as.dist(D)
+  D    <- genetic_distance_native(MAT, "rogers", loc.fac = loc.fac, 
+                                  threads = threads)
   labs <- get_gen_dist_labs(x)
   D    <- make_attributes(D, nlig, labs, "Rogers", match.call())
   return(D)
@@ -315,7 +319,7 @@ rogers.dist <- function(x){
 
 #' @rdname genetic_distance
 #' @export
-reynolds.dist <- function(x){
+reynolds.dist <- function(x, threads = 1L){
   if (is(x, "gen")){ 
     MAT    <- get_gen_mat(x)
     nloc   <- nLoc(x)
@@ -325,29 +329,21 @@ reynolds.dist <- function(x){
   } else {
     stop("Object must be a matrix or genind object")
   }
-  denomi       <- MAT %*% t(MAT)
-  vec          <- apply(MAT, 1, function(x) sum(x*x))
-  D            <- -2*denomi + vec[col(denomi)] + vec[row(denomi)]
-  diag(D)      <- 0
-  denomi       <- 2*nloc - 2*denomi
-  diag(denomi) <- 1
-  D            <- D/denomi
-  D            <- sqrt(D)
-  D            <- as.dist(D)
+  D            <- genetic_distance_native(MAT, "reynolds", nloc, 
+                                          threads = threads)
   labs         <- get_gen_dist_labs(x)
-  D            <- make_attributes(D, length(labs), labs, "Reynolds", 
+  D            <- make_attributes(D, nrow(MAT), labs, "Reynolds", 
                                   match.call())
   return(D)
 }
 
 #' @rdname genetic_distance
 #' @export
-provesti.dist <- function(x){
+provesti.dist <- function(x, threads = 1L){
   if (is(x, "gen")){
     MAT   <- get_gen_mat(x)
     nlig  <- nrow(tab(x))
     nloc  <- nLoc(x)
-    ploid <- x@ploidy
   } else if (length(dim(x)) == 2){
     MAT  <- x
     nlig <- nrow(x)
@@ -355,20 +351,13 @@ provesti.dist <- function(x){
   } else {
     stop("Object must be a matrix or genind object")
   }
-  w0   <- 1:(nlig-1)
-  loca <- function(k, nlig, MAT, nLoc){
-    w1     <- (k+1):nlig
-    resloc <- vapply(w1, function(y) sum(abs(MAT[k, ] - MAT[y, ]), na.rm = TRUE), numeric(1))
-    if (is(x, "gen") && x@type == "codom"){
-      # This only applies to codominant data because dominant data can only take
-      # on a single state. Dividing by two indicates that the observations can
-      # occupy co-occurring states.
-      resloc <- resloc/2
-    }
-    return(resloc/nloc)
+  if (is(x, "gen") && x@type == "codom"){
+    # This only applies to codominant data because dominant data can only take
+    # on a single state. Dividing by two indicates that the observations can
+    # occupy co-occurring states.
+    nloc <- nloc*2
   }
-
-  d    <- unlist(lapply(w0, loca, nlig, MAT, nloc))
+  d    <- genetic_distance_native(MAT, "prevosti", nloc, threads = threads)
   labs <- get_gen_dist_labs(x)
   d    <- make_attributes(d, nlig, labs, "Provesti", match.call())
   return(d)
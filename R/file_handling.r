@@ -212,20 +212,29 @@ read.genalex <- function(genalex, ploidy = 2, geo = FALSE, region = FALSE,
 
   all.info <- strsplit(readLines(genalex, n = 2), sep)
   cskip    <- ifelse(inherits(genalex, "connection"), 0, 2)
-  gena     <- utils::read.table(
-    genalex, 
-    sep = sep,
-    header = TRUE,
-    skip = cskip,
-    colClasses = "character",
-    stringsAsFactors = FALSE,
-    check.names = FALSE,
-    quote = "\""
-  )
-  for (i in seq_along(gena)) {
-    the_col <- trimws(gena[[i]])
-    the_col[the_col == ""] <- NA_character_
-    gena[[i]] <- the_col
+  if (is_local_genalex(genalex, sep)) {
+    # Uncompressed files are read natively, which is much faster than
+    # read.table for large files. The columns are already trimmed.
+    gena <- .Call("read_genalex_table", path.expand(genalex), sep, 2L, 
+                  PACKAGE = "poppr")
+    gena <- structure(gena, class = "data.frame", 
+                      row.names = c(NA_integer_, -length(gena[[1]])))
+  } else {
+    gena <- utils::read.table(
+      genalex, 
+      sep = sep,
+      header = TRUE,
+      skip = cskip,
+      colClasses = "character",
+      stringsAsFactors = FALSE,
+      check.names = FALSE,
+      quote = "\""
+    )
+    for (i in seq_along(gena)) {
+      the_col <- trimws(gena[[i]])
+      the_col[the_col == ""] <- NA_character_
+      gena[[i]] <- the_col
+    }
   }
   num.info <- as.numeric(all.info[[1]])
   pop.info <- all.info[[2]][-c(1:3)]
@@ -369,38 +378,11 @@ read.genalex <- function(genalex, ploidy = 2, geo = FALSE, region = FALSE,
   # Checking for greater than haploid data.
   if (nloci == clm/ploidy & ploidy > 1){
     # Missing data in genalex is coded as "0" for non-presence/absence data.
-    # We will convert these data later, but this will take care of the 
-    # data that's considered missing here
-    gena[is.na(gena.mat)] <- "0"
-    
-    type  <- 'codom'
-    # The remainder of the position when divided by ploidy is 1, which means
-    # that this is the first column starting the locus
-    loci  <- which(seq(clm) %% ploidy == 1)
-    gena2 <- gena[, loci, drop = FALSE]
-
-    # Collapsing all alleles over all loci into their respective loci.
-    for (pos in loci){
-      # Get the locus position in gena2. Example, in a triploid, the second
-      # locus would be at gena[, 4:6], so the second element in pos would be 4
-      # because position %% ploidy is 4 %% 3 == 1
-      # We get our position out by:
-      #  1. subtracting 1 to account for the modulo
-      #  2. divide by ploidy
-      #  3. add 1 to bring it up to R's 1-index
-      pos_out <- ((pos - 1)/ploidy) + 1
-      pos_in  <- pos:(pos + ploidy - 1) # allele positions in gena
-      # paste columns of locus together
-      donor   <- do.call("paste", c(gena[pos_in], list(sep = "/")))
-      gena2[, pos_out] <- donor
-    }
-
-    # Treating missing data.
-    gena2[gena2 == paste(rep("0", ploidy), collapse = "/")] <- NA_character_
-    
-    # Importing
-    res.gid <- df2genind(gena2, sep="/", ind.names = ind.vec, pop = pop.vec,
-                         ploidy = ploidy, type = type)
+    # The alleles of each locus are counted natively, where a genotype of all
+    # "0" (or NA) is missing and any other missing alleles are kept as "0".
+    # The locus names are in the first column of each locus.
+    loci    <- colnames(gena)[seq(1, clm, by = ploidy)]
+    res.gid <- genalex_genind(gena, loci, ind.vec, pop.vec, ploidy)
   } else if (nloci == clm & all(gena.mat %in% as.integer(-1:1))) {
     # Checking for AFLP data.
     # Missing data in genalex is coded as "-1" for presence/absence data.
@@ -412,13 +394,9 @@ read.genalex <- function(genalex, ploidy = 2, geo = FALSE, region = FALSE,
     res.gid <- df2genind(gena, ind.names = ind.vec, pop = pop.vec,
                          ploidy = ploidy, type = type, ncode = 1)
   } else if (nloci == clm & !all(gena.mat %in% as.integer(-1:1))) {
-    # Checking for haploid microsatellite data or SNP data
-    if (any(gena.mat == "0", na.rm = TRUE)){
-      gena[gena.mat == "0"] <- NA
-    }
-    type    <- 'codom'
-    res.gid <- df2genind(gena, ind.names = ind.vec, pop = pop.vec,
-                         ploidy = 1, type = type)
+    # Checking for haploid microsatellite data or SNP data. Missing data is
+    # coded as "0".
+    res.gid <- genalex_genind(gena, colnames(gena), ind.vec, pop.vec, 1L)
   } else {
     weirdomsg <- paste(
       "Something went wrong. Please ensure that your data is", 
@@ -679,3 +657,306 @@ genind2genalex <- function(gid, filename = "", overwrite = FALSE, quiet = FALSE,
   if(!quiet) cat("Done.\n")
   invisible(return(filename))
 }
+
+#==============================================================================#
+#' Store SNP data on disk for analyses larger than memory
+#' 
+#' A genotype store is a binary file of the packed SNPs of a
+#' [genlight][genlight-class] object that [bitwise.dist()], [bitwise.ia()],
+#' and [win.ia()] can read directly from disk. `write_genotype_store()`
+#' creates (or adds samples to) a store and `genotype_store()` opens one.
+#' 
+#' @param x a [genlight][genlight-class] or [snpclone][snpclone-class] object
+#'   of haploids or diploids.
+#'   
+#' @param file the path to the genotype store.
+#'   
+#' @param append if `TRUE`, the samples in `x` will be added to the end of an
+#'   existing store with the same ploidy and number of loci. Defaults to
+#'   `FALSE`, which creates a new store.
+#'   
+#' @param position an optional vector of positions of the loci used by
+#'   [win.ia()].
+#'   
+#' @param chromosome an optional vector of chromosomes of the loci used by
+#'   [win.ia()].
+#'   
+#' @return an object of class "genotype_store", containing the path to the
+#'   `file`, the number of samples (`n`), the number of loci (`nloc`), the
+#'   `ploidy`, the sample names (`ind.names`), and the `position` and 
+#'   `chromosome` of the loci.
+#'   
+#' @details Each sample is stored as a record of the same size containing its
+#'   chromosomes and a bitmap of its missing data packed eight loci to a byte
+#'   in the same way as a genlight object. The file is memory mapped when it is
+#'   analyzed, so the operating system only needs to keep the parts being read
+#'   in memory. Since the records of all samples are the same size, a store
+#'   that is larger than memory can be written in pieces with `append = TRUE`.
+#'   The sample names are kept in a text file next to the store with the
+#'   extension ".ind".
+#'   
+#'   Stores are read with the byte order of the machine that wrote them.
+#'   
+#' @author Zhian N. Kamvar
+#' @md
+#' @export
+#' @seealso [bitwise.dist()], [bitwise.ia()], [win.ia()]
+#' @examples
+#' set.seed(999)
+#' x <- glSim(n.ind = 10, n.snp.nonstruc = 5e2, n.snp.struc = 5e2, ploidy = 2)
+#' f <- tempfile(fileext = ".snp")
+#' gs <- write_genotype_store(x[1:5], f)
+#' gs <- write_genotype_store(x[6:10], f, append = TRUE)
+#' gs
+#' all.equal(as.vector(bitwise.dist(gs, threads = 1L)), 
+#'           as.vector(bitwise.dist(x, threads = 1L)))
+#' bitwise.ia(gs, threads = 1L)
+#' unlink(c(f, paste0(f, ".ind")))
+#==============================================================================#
+write_genotype_store <- function(x, file, append = FALSE){
+  stopifnot(is(x, "genlight"))
+  # Stop if the ploidy of the genlight object is not consistent
+  stopifnot(min(ploidy(x)) == max(ploidy(x))) 
+  # Stop if the ploidy of the genlight object is not haploid or diploid
+  stopifnot(min(ploidy(x)) == 2 || min(ploidy(x)) == 1)
+  if (nLoc(x) == 0){
+    stop("The genotype store must have at least one locus.", call. = FALSE)
+  }
+  # Ensure that every SNPbin object has data for all chromosomes
+  if (min(ploidy(x)) == 2){
+    x <- fix_uneven_diploid(x)
+  }
+  file  <- path.expand(file)
+  total <- .Call("genotype_store_write", x, file, as.logical(append), 
+                 PACKAGE = "poppr")
+  ind.names <- indNames(x)
+  if (is.null(ind.names)){
+    ind.names <- as.character(seq(total - nInd(x) + 1, total))
+  }
+  cat(ind.names, file = paste0(file, ".ind"), sep = "\n", append = append)
+  invisible(genotype_store(file))
+}
+
+#==============================================================================#
+#' @rdname write_genotype_store
+#' @export
+#==============================================================================#
+genotype_store <- function(file, position = NULL, chromosome = NULL){
+  file <- normalizePath(file, mustWork = TRUE)
+  info <- .Call("genotype_store_info", file, PACKAGE = "poppr")
+  ind_file  <- paste0(file, ".ind")
+  ind.names <- if (file.exists(ind_file)) readLines(ind_file) else NULL
+  if (!is.null(ind.names) && length(ind.names) != info[1]){
+    stop(paste("The number of sample names in", ind_file, "does not match",
+               "the number of samples in the genotype store."), call. = FALSE)
+  }
+  if (!is.null(position) && length(position) != info[2]){
+    stop("position must have one value per locus.", call. = FALSE)
+  }
+  if (!is.null(chromosome) && length(chromosome) != info[2]){
+    stop("chromosome must have one value per locus.", call. = FALSE)
+  }
+  res <- list(file = file, n = as.integer(info[1]), nloc = as.integer(info[2]),
+              ploidy = as.integer(info[3]), ind.names = ind.names, 
+              position = position, chromosome = chromosome)
+  class(res) <- "genotype_store"
+  res
+}
+
+#==============================================================================#
+#' Store distances on disk for data with too many samples for memory
+#' 
+#' A distance file holds the distances between samples on disk in the same 
+#' order as a [dist][stats::dist] object. [bitwise.dist()] and [diss.dist()]
+#' write their distances directly to a distance file when they are given a
+#' `file`, so that the distances between all samples are never in memory at
+#' once. A distance file can be used in place of a dist object by
+#' [mlg.filter()], [poppr.msn()], and [poppr.amova()] (with `method =
+#' "poppr"`), which read the distances from disk.
+#' 
+#' `write_dist_file()` writes a dist object to a distance file, 
+#' `dist_file()` opens a distance file, and `dist_tile()` reads a tile of the
+#' distance matrix from a distance file.
+#' 
+#' @param x a [dist][stats::dist] object for `write_dist_file()` or an object
+#'   of class "dist_file" for `dist_tile()`.
+#'   
+#' @param file the path to the distance file.
+#'   
+#' @param i,j the samples in the rows and columns of the tile as indices or 
+#'   sample names. Defaults to all samples.
+#'   
+#' @return `write_dist_file()` and `dist_file()` return an object of class 
+#'   "dist_file", containing the path to the `file`, the number of samples 
+#'   (`n`), and the sample names (`labels`). `dist_tile()` returns a matrix of
+#'   the distances between the samples in `i` and `j`.
+#'   
+#' @details Distances are calculated and written to the file in blocks of 
+#'   samples that hold about 4 million distances, so the memory used does not
+#'   depend on the number of samples. The file has a 64 byte header followed 
+#'   by the distances as doubles and is memory mapped when it is read, so the 
+#'   operating system only needs to keep the parts being read in memory. The
+#'   sample names are kept in a text file next to the distance file with the 
+#'   extension ".ind".
+#'   
+#'   [mlg.filter()] rejects missing (NA) and negative distances read from a
+#'   file. [poppr.amova()] does not correct the distances in a file if they
+#'   are not Euclidean and warns unless `correction = "none"`. Minimum
+#'   spanning networks can not be built from a distance file with a 
+#'   `threshold`.
+#'   
+#'   Distance files are read with the byte order of the machine that wrote 
+#'   them.
+#'   
+#' @author Zhian N. Kamvar
+#' @md
+#' @export
+#' @seealso [bitwise.dist()], [diss.dist()], [mlg.filter()], [poppr.msn()],
+#'   [poppr.amova()]
+#' @examples
+#' data(Aeut)
+#' f  <- tempfile(fileext = ".dist")
+#' df <- diss.dist(Aeut, file = f)
+#' df
+#' dist_tile(df, 1:5, 1:5)
+#' all.equal(as.vector(mlg.filter(Aeut, threshold = 3, distance = df)),
+#'           as.vector(mlg.filter(Aeut, threshold = 3, distance = diss.dist(Aeut))))
+#' unlink(c(f, paste0(f, ".ind")))
+#==============================================================================#
+write_dist_file <- function(x, file){
+  stopifnot(inherits(x, "dist"))
+  file   <- path.expand(file)
+  labels <- attr(x, "Labels")
+  x      <- as.vector(x)
+  storage.mode(x) <- "double"
+  .Call("dist_file_write", x, file, PACKAGE = "poppr")
+  write_dist_labels(file, labels)
+  invisible(dist_file(file))
+}
+
+#==============================================================================#
+#' @rdname write_dist_file
+#' @export
+#==============================================================================#
+dist_file <- function(file){
+  file     <- normalizePath(file, mustWork = TRUE)
+  n        <- .Call("dist_file_info", file, PACKAGE = "poppr")
+  ind_file <- paste0(file, ".ind")
+  labels   <- if (file.exists(ind_file)) readLines(ind_file) else NULL
+  if (!is.null(labels) && length(labels) != n){
+    stop(paste("The number of sample names in", ind_file, "does not match",
+               "the number of samples in the distance file."), call. = FALSE)
+  }
+  res <- list(file = file, n = n, labels = labels)
+  class(res) <- "dist_file"
+  res
+}
+
+#==============================================================================#
+#' @rdname write_dist_file
+#' @export
+#==============================================================================#
+dist_tile <- function(x, i = NULL, j = i){
+  stopifnot(inherits(x, "dist_file"))
+  samples <- dist_file_samples(x)
+  tile_index <- function(idx){
+    if (is.null(idx)){
+      return(seq_along(samples))
+    }
+    if (is.character(idx)){
+      idx <- match(idx, x$labels)
+    }
+    if (anyNA(idx) || any(idx < 1 | idx > length(samples))){
+      stop("The samples must be in the distance file.", call. = FALSE)
+    }
+    as.integer(idx)
+  }
+  i   <- tile_index(i)
+  j   <- tile_index(j)
+  res <- .Call("dist_file_tile", x$file, samples[i], samples[j], 
+               PACKAGE = "poppr")
+  if (!is.null(x$labels)){
+    dimnames(res) <- list(x$labels[i], x$labels[j])
+  }
+  res
+}
+
+#==============================================================================#
+#' Save genclone objects to binary files that load quickly
+#' 
+#' `write_genclone()` saves a [genclone-class] or [genind-class] object to an 
+#' uncompressed binary file and `read_genclone()` loads it again. This is much
+#' faster than importing the data from a GenAlEx file with [read.genalex()] 
+#' each time it is needed.
+#' 
+#' @param x a [genclone-class] or [genind-class] object.
+#'   
+#' @param file the path to the file.
+#'   
+#' @return `write_genclone()` invisibly returns the path to the file and 
+#'   `read_genclone()` returns the object that was saved.
+#'   
+#' @details The table of allele counts is stored with one byte per count when
+#'   all counts are between 0 and 254, and the rest of the object is stored 
+#'   with [serialize()] in the byte order of the machine that wrote the file. 
+#'   Nothing is compressed, so the file can be read without decoding.
+#'   
+#' @author Zhian N. Kamvar
+#' @md
+#' @export
+#' @seealso [read.genalex()], [saveRDS()]
+#' @examples
+#' data(monpop)
+#' f <- tempfile(fileext = ".gcl")
+#' write_genclone(monpop, f)
+#' mp <- read_genclone(f)
+#' identical(tab(mp), tab(monpop))
+#' unlink(f)
+#==============================================================================#
+write_genclone <- function(x, file){
+  stopifnot(is.genind(x))
+  counts <- x@tab
+  mode   <- storage.mode(counts)
+  packed <- mode == "integer" && length(counts) > 0 && 
+    all(counts >= 0L & counts < 255L, na.rm = TRUE)
+  content <- list(dim = dim(counts), dimnames = dimnames(counts), mode = mode,
+                  packed = packed)
+  if (packed){
+    # NA is stored as 255
+    counts[is.na(counts)] <- 255L
+    counts <- as.raw(counts)
+  }
+  content$counts <- counts
+  x@tab <- matrix(integer(0), nrow = 0, ncol = 0)
+  content$object <- x
+  con <- file(path.expand(file), "wb")
+  on.exit(close(con))
+  writeBin(charToRaw(genclone_magic()), con)
+  serialize(content, con, xdr = FALSE)
+  invisible(file)
+}
+
+#==============================================================================#
+#' @rdname write_genclone
+#' @export
+#==============================================================================#
+read_genclone <- function(file){
+  con <- file(path.expand(file), "rb")
+  on.exit(close(con))
+  magic <- readBin(con, "raw", n = nchar(genclone_magic()))
+  if (!identical(magic, charToRaw(genclone_magic()))){
+    stop(paste(file, "was not written by write_genclone()."), call. = FALSE)
+  }
+  content <- unserialize(con)
+  counts  <- content$counts
+  if (content$packed){
+    counts <- as.integer(counts)
+    counts[counts == 255L] <- NA_integer_
+  }
+  storage.mode(counts) <- content$mode
+  dim(counts)      <- content$dim
+  dimnames(counts) <- content$dimnames
+  x     <- content$object
+  x@tab <- counts
+  x
+}
@@ -98,9 +98,11 @@ process_file <- function(input, quiet=TRUE, missing="ignore", cutoff=0.05,
 }
 
 #==============================================================================#
-# .clonecorrector will simply give a list of individuals (rows) that are
+# .clonecorrector will simply give a list of individuals (rows) that are not
 # duplicated within a genind object. This can be used for clone correcting a
-# single genind object.
+# single genind object. If strata is given as a vector or matrix of integer
+# codes, the individuals are only compared within each combination of strata.
+# The first individual of each genotype is kept in a single pass in C.
 #
 # Public functions utilizing this function:
 # # clonecorrect, bruvo.msn
@@ -109,18 +111,16 @@ process_file <- function(input, quiet=TRUE, missing="ignore", cutoff=0.05,
 # # none
 #==============================================================================#
 
-.clonecorrector <- function(x){
+.clonecorrector <- function(x, strata = NULL){
   if (is.genclone(x) | is(x, "snpclone")){
-    is_duplicated <- duplicated(x@mlg[])
+    genotypes <- x@mlg[]
+    if (!is.integer(genotypes)){
+      genotypes <- match(genotypes, unique(genotypes))
+    }
   } else {
-    is_duplicated <- duplicated(x@tab[, 1:ncol(x@tab)])
-  }
-  res <- -which(is_duplicated)
-  # conditional for the case that all individuals are unique.
-  if(is.na(res[1])){
-    res <- which(!is_duplicated)
+    genotypes <- x@tab
   }
-  return(res)
+  .Call("clone_correct", genotypes, strata, PACKAGE = "poppr")
 }
 
 #==============================================================================#
@@ -269,6 +269,226 @@ mlg.matrix <- function(x){
   colnames(mlg.mat) <- paste("MLG", colnames(mlg.mat), sep=".")
   return(unclass(mlg.mat))
 }
+
+#==============================================================================#
+# Internal function to create a sparse mlg.table. This counts the samples in
+# each population and MLG in C and keeps only the observed pairs in compressed
+# sparse row form:
+#
+#  - p: the (0-based) row pointers. The counts of row i are in
+#       (p[i] + 1):p[i + 1].
+#  - j: the columns of the counts.
+#  - x: the counts.
+#
+# The rows and columns are the same as those of mlg.matrix, including the
+# columns of unused custom MLG levels.
+#
+# Public functions utilizing this function:
+# # mlg.table mlg.crosspop poppr psex
+#
+# Internal functions utilizing this function:
+# # none
+#==============================================================================#
+mlg.sparse <- function(x){
+  visible <- "original"
+  if (is.genclone(x) | is(x, "snpclone")){
+    mlgvec <- x@mlg[]
+    if (is(x@mlg, "MLG")){
+      visible <- visible(x@mlg)
+    }
+  } else {
+    mlgvec <- mlg.vector(x)
+  }
+  # Unused levels of custom MLGs are kept, as they are by table in mlg.matrix.
+  mlgvec <- if (is.factor(mlgvec)) mlgvec else factor(mlgvec)
+  if (!is.null(pop(x))){
+    pops     <- as.integer(pop(x))
+    popnames <- popNames(x)
+  } else {
+    pops     <- rep(1L, length(mlgvec))
+    popnames <- "Total"
+  }
+  mlgnames <- levels(mlgvec)
+  if (visible != "custom"){
+    mlgnames <- paste("MLG", mlgnames, sep = ".")
+  }
+  make_mlg_sparse(pops, as.integer(mlgvec), NULL, list(popnames, mlgnames))
+}
+
+#==============================================================================#
+# Build a sparse mlg.table from the row, column, and count of each entry.
+# Duplicate entries are summed and entries with a missing row or column are
+# dropped.
+#
+# Public functions utilizing this function:
+# # none
+#
+# Internal functions utilizing this function:
+# # mlg.sparse [.mlg_sparse mlg_add_total
+#==============================================================================#
+make_mlg_sparse <- function(rows, cols, counts, dimnames){
+  dims <- c(length(dimnames[[1]]), length(dimnames[[2]]))
+  if (!is.null(counts)){
+    counts <- as.integer(counts)
+  }
+  res <- .Call("mlg_sparse", as.integer(rows), as.integer(cols), counts, 
+               as.integer(dims), PACKAGE = "poppr")
+  structure(list(p = res[[1]], j = res[[2]], x = res[[3]], 
+                 Dim = dims, Dimnames = dimnames), 
+            class = "mlg_sparse")
+}
+
+#==============================================================================#
+# The row of each count in a sparse mlg.table.
+#
+# Public functions utilizing this function:
+# # mlg.crosspop
+#
+# Internal functions utilizing this function:
+# # [.mlg_sparse as.matrix.mlg_sparse mlg_add_total mlg_sparse_rows
+#==============================================================================#
+mlg_sparse_row_index <- function(z){
+  rep.int(seq_len(z$Dim[1]), diff(z$p))
+}
+
+#==============================================================================#
+# A list with the nonzero counts of each row in a sparse mlg.table.
+#
+# Public functions utilizing this function:
+# # diversity_stats
+#
+# Internal functions utilizing this function:
+# # rarefy_sparse
+#==============================================================================#
+mlg_sparse_rows <- function(z){
+  rows <- factor(mlg_sparse_row_index(z), levels = seq_len(z$Dim[1]))
+  stats::setNames(split(z$x, rows), z$Dimnames[[1]])
+}
+
+#==============================================================================#
+# Row or column sums of a dense or sparse mlg.table.
+#
+# Public functions utilizing this function:
+# # mlg.table poppr
+#
+# Internal functions utilizing this function:
+# # none
+#==============================================================================#
+mlg_margin <- function(z, margin = 1){
+  if (!inherits(z, "mlg_sparse")){
+    return(if (margin == 1) rowSums(z) else colSums(z))
+  }
+  if (margin == 1){
+    # The counts of each row are contiguous.
+    sums <- c(0, cumsum(as.numeric(z$x)))
+    res  <- sums[z$p[-1] + 1] - sums[z$p[-length(z$p)] + 1]
+  } else {
+    res <- numeric(z$Dim[2])
+    if (length(z$j) > 0){
+      sums <- rowsum(as.numeric(z$x), z$j)
+      res[as.integer(rownames(sums))] <- sums[, 1]
+    }
+  }
+  stats::setNames(res, z$Dimnames[[margin]])
+}
+
+#==============================================================================#
+# Append a row named "Total" with the column sums to a dense or sparse
+# mlg.table.
+#
+# Public functions utilizing this function:
+# # mlg.table poppr
+#
+# Internal functions utilizing this function:
+# # none
+#==============================================================================#
+mlg_add_total <- function(z){
+  if (!inherits(z, "mlg_sparse")){
+    z <- rbind(z, colSums(z))
+    rownames(z)[nrow(z)] <- "Total"
+    return(z)
+  }
+  rows  <- mlg_sparse_row_index(z)
+  total <- z$Dim[1] + 1L
+  make_mlg_sparse(c(rows, rep.int(total, length(rows))), c(z$j, z$j), 
+                  c(z$x, z$x), list(c(z$Dimnames[[1]], "Total"), z$Dimnames[[2]]))
+}
+
+#==============================================================================#
+# Rarefaction of each row of a sparse mlg.table with vegan::rarefy. Zero counts
+# are ignored by rarefy, so each row is rarefied from its nonzero counts.
+#
+# Public functions utilizing this function:
+# # poppr
+#
+# Internal functions utilizing this function:
+# # none
+#==============================================================================#
+rarefy_sparse <- function(z, sample){
+  res <- vapply(mlg_sparse_rows(z), function(counts){
+    as.vector(vegan::rarefy(matrix(counts, nrow = 1), sample, se = TRUE))
+  }, numeric(2))
+  dimnames(res) <- list(c("S", "se"), z$Dimnames[[1]])
+  res
+}
+
+#==============================================================================#
+# Methods for sparse mlg.tables. Rows and columns can be selected by index, 
+# name, or logical vector, but not repeated.
+#==============================================================================#
+#' @method [ mlg_sparse
+#' @export
+#' @noRd
+"[.mlg_sparse" <- function(x, i, j, drop = FALSE){
+  sparse_index <- function(idx, names){
+    res <- stats::setNames(seq_along(names), names)[idx]
+    if (anyNA(res)){
+      stop("subscript out of bounds", call. = FALSE)
+    }
+    if (anyDuplicated(res)){
+      stop("rows and columns of a sparse MLG table can not be repeated", 
+           call. = FALSE)
+    }
+    res
+  }
+  rows     <- mlg_sparse_row_index(x)
+  cols     <- x$j
+  dimnames <- x$Dimnames
+  if (!missing(i)){
+    i <- sparse_index(i, dimnames[[1]])
+    rows <- match(rows, i)
+    dimnames[[1]] <- dimnames[[1]][i]
+  }
+  if (!missing(j)){
+    j <- sparse_index(j, dimnames[[2]])
+    cols <- match(cols, j)
+    dimnames[[2]] <- dimnames[[2]][j]
+  }
+  make_mlg_sparse(rows, cols, x$x, dimnames)
+}
+
+#' @method dim mlg_sparse
+#' @export
+#' @noRd
+dim.mlg_sparse <- function(x){
+  x$Dim
+}
+
+#' @method dimnames mlg_sparse
+#' @export
+#' @noRd
+dimnames.mlg_sparse <- function(x){
+  x$Dimnames
+}
+
+#' @method as.matrix mlg_sparse
+#' @export
+#' @noRd
+as.matrix.mlg_sparse <- function(x, ...){
+  res <- matrix(0L, nrow = x$Dim[1], ncol = x$Dim[2], dimnames = x$Dimnames)
+  res[cbind(mlg_sparse_row_index(x), x$j)] <- x$x
+  res
+}
 #==============================================================================#
 # !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! #
 # 
@@ -300,7 +520,7 @@ mlg.matrix <- function(x){
   
 	V <- .PA.pairwise.differences(pop, numLoci, np, missing=missing)
 	# First, set the variance of D	
-	varD <- ((sum(V$D.vector^2)-((sum(V$D.vector))^2)/np))/np
+	varD <- ((V$D2 - (V$D^2)/np))/np
 	# Next is to create a vector containing all of the variances of d (there
 	# will be one for each locus)
 	vard.vector <- ((V$d2.vector-((V$d.vector^2)/np))/np)
@@ -327,7 +547,12 @@ mlg.matrix <- function(x){
 # d2.vector = the same as d.vector, except it's the sum of the squares
 # D.vector = a vector of the the pairwise distances over all loci. The length
 #			 of this vector will be the same as n(n-1)/2, where n is number of
-# 			isolates.
+# 			isolates. Only its sum (D) and the sum of its squares (D2) are returned.
+#
+# When all of the markers are coded as 0, 1, or NA, these are calculated in C
+# by association_index_pa in src/bitwise_distance.c, which packs the markers
+# into bits and never creates the pairwise distances.
+#
 # Public functions utilizing this function:
 # # ia
 #
@@ -337,6 +562,18 @@ mlg.matrix <- function(x){
 #==============================================================================#
 
 .PA.pairwise.differences <- function(pop, numLoci, np, missing){  
+  ploid <- max(ploidy(pop))
+  mat   <- pop@tab
+  if (!identical(missing, "MEAN") && all(mat %in% c(0L, 1L, NA))){
+    # Binary markers are packed into bits in C and the distances between samples
+    # are counted with popcount without creating the matrix of distances.
+    storage.mode(mat) <- "integer"
+    V <- .Call("association_index_pa", mat, 1L, PACKAGE = "poppr")
+    return(list(d.vector  = V[[1]] * ploid, 
+                d2.vector = V[[1]] * ploid^2,
+                D         = V[[2]] * ploid,
+                D2        = V[[3]] * ploid^2))
+  }
   temp.d.vector <- matrix(nrow = np, ncol = numLoci, data = NA_real_)
   if( missing == "MEAN" ){
     # this will round all of the values if the missing indicator is "mean"  
@@ -357,10 +594,10 @@ mlg.matrix <- function(x){
       temp.d.vector[which(is.na(temp.d.vector))] <- 0
     }
   }
-  if (max(ploidy(pop)) > 1){
+  if (ploid > 1){
     # multiplying by two is the proper way to evaluate P/A diploid data because
     # one cannot detect heterozygous loci (eg, a difference of 1).
-    temp.d.vector <- temp.d.vector * max(ploidy(pop))
+    temp.d.vector <- temp.d.vector * ploid
     d.vector  <- as.vector(colSums(temp.d.vector))
     d2.vector <- as.vector(colSums(temp.d.vector^2))
     D.vector  <- as.vector(rowSums(temp.d.vector))
@@ -369,7 +606,8 @@ mlg.matrix <- function(x){
     d2.vector <- d.vector
     D.vector  <- as.vector(rowSums(temp.d.vector))
   }
-  vectors <- list(d.vector = d.vector, d2.vector = d2.vector, D.vector = D.vector)
+  vectors <- list(d.vector = d.vector, d2.vector = d2.vector, 
+                  D = sum(D.vector), D2 = sum(D.vector^2))
   return(vectors)
 }
 
@@ -539,13 +777,37 @@ pair_diffs <- function(pop, numLoci, np)
 pair_matrix <- function(pop, numLoci, np)
 {
   temp.d.vector <- matrix(nrow = np, ncol = numLoci, data = as.numeric(NA))
-  temp.d.vector <- vapply(pop, function(x) .Call("pairdiffs", tab(x), 
-                                                 PACKAGE = "poppr")/2, 
+  temp.d.vector <- vapply(pop, function(x) locus_pairdiffs(tab(x))/2, 
                           FUN.VALUE = temp.d.vector[, 1])
   temp.d.vector <- ceiling(temp.d.vector)
   return(temp.d.vector)
 }
 
+#==============================================================================#
+# The sum of the absolute differences in allele counts between all pairs of
+# samples at a single locus in the order of a dist object. Pairs with missing
+# data are zero. Integer counts are compared in C with pairdiffs, while counts
+# that are not integers (e.g. from missingno(x, "mean")) are compared in R.
+# 
+# Public functions utilizing this function:
+# # none
+#
+# Internal functions utilizing this function:
+# # pair_matrix
+#
+#==============================================================================#
+locus_pairdiffs <- function(mat)
+{
+  if (is.integer(mat)){
+    return(.Call("pairdiffs", mat, PACKAGE = "poppr"))
+  }
+  pairs <- which(lower.tri(diag(nrow(mat))), arr.ind = TRUE)
+  diffs <- rowSums(abs(mat[pairs[, 1], , drop = FALSE] - 
+                       mat[pairs[, 2], , drop = FALSE]))
+  diffs[is.na(diffs)] <- 0
+  diffs
+}
+
 #==============================================================================#
 # This will transform the data to be in the range of [0, 1]
 #
@@ -998,6 +1260,61 @@ make_ade_df <- function(hier, df, expanded = FALSE){
   return(rev(data.frame(factlist)))
 }
 
+#==============================================================================#
+# Calculate AMOVA in C from a dist object (or a dist_file) and a data frame of
+# strata. The strata are converted to 0-based group ids for each level and the
+# permutations are performed on these labels in amova_permutation in 
+# src/permut_shuffler.c. The output mirrors pegas::amova so that it can be
+# printed with its print method.
+#
+# Public functions utilizing this function:
+#
+# # poppr.amova
+#
+# Internal functions utilizing this function:
+# # none
+#==============================================================================#
+amova_native <- function(xdist, df, levs, nperm = 0, threads = 1L, call = NULL,
+                         squared = FALSE){
+  # Each level is combined with the levels above it so that the groups are
+  # nested.
+  strata <- vapply(seq_along(levs), function(i){
+    as.integer(interaction(df[levs[seq_len(i)]], drop = TRUE)) - 1L
+  }, integer(nrow(df)))
+  strata <- matrix(strata, nrow = nrow(df))
+  if (inherits(xdist, "dist_file")){
+    # Distance files are read from disk in C
+    xdist <- xdist$file
+  } else {
+    xdist <- as.vector(xdist)
+    storage.mode(xdist) <- "double"
+  }
+  nperm  <- as.integer(nperm)
+  seed   <- sample.int(.Machine$integer.max, 1L)
+  res    <- .Call("amova_permutation", xdist, strata, squared, nperm, seed,
+                  as.integer(threads), PACKAGE = "poppr")
+  SSD    <- res[[1]]
+  df     <- res[[2]]
+  sigma2 <- stats::setNames(res[[3]], c(levs, "Error"))
+  tab    <- data.frame(SSD = SSD, MSD = SSD/df, df = df, 
+                       row.names = c(levs, "Error", "Total"))
+  varcoef <- res[[4]]
+  dimnames(varcoef) <- list(levs, levs)
+  if (nperm > 0) {
+    perms <- res[[5]]
+    colnames(perms) <- levs
+    P.value <- c(colSums(sweep(perms, 2, sigma2[levs], ">=")) + 1, NA)/(nperm + 1)
+    varcomp <- data.frame(sigma2 = sigma2, P.value = P.value)
+  } else {
+    perms   <- NULL
+    varcomp <- sigma2
+  }
+  out <- list(tab = tab, varcoef = varcoef, varcomp = varcomp, call = call)
+  if (!is.null(perms)) out$permutations <- perms
+  class(out) <- "amova"
+  out
+}
+
 # Function for determining if a genind object has any heterozygous sites.
 # Public functions utilizing this function:
 #
@@ -1173,25 +1490,41 @@ poppr.plot.phylo <- function(tree, type = "nj", root = FALSE){
 
 
 #==============================================================================#
-# Function to do something with Rodger's distance
+# Calculate Nei's, Edwards', Rogers', Reynolds', or Prevosti's distance in C 
+# from a matrix of allele frequencies (see genetic_distance in
+# src/poppr_distance.c). The distances are written to a vector in the order of
+# a dist object without creating any square matrices.
+#
+# Arguments:
+#   MAT     - a matrix of allele frequencies with samples in rows
+#   method  - one of "nei", "edwards", "rogers", "reynolds", or "prevosti"
+#   scale   - the number of loci (or twice the number of loci for Prevosti's
+#             distance on codominant data)
+#   loc.fac - a factor with the locus of each column of MAT. The number of
+#             levels is used as the scale for Rogers' distance.
+#   threads - the number of threads
 #
 # Public functions utilizing this function:
-# rodger.dist
+# nei.dist edwards.dist rogers.dist reynolds.dist provesti.dist
 #
 # Private functions utilizing this function:
 # # none
 #==============================================================================#
-# From adegenet dist.genpop
-dcano <- function(mat) {
-  daux       <- mat%*%t(mat)
-  vec        <- diag(daux)
-  daux       <- -2*daux + vec[col(daux)] + vec[row(daux)]
-  diag(daux) <- 0
-  # if (any(daux == Inf)){
-  #   daux <- infinite_vals_replacement(daux, warning)
-  # }
-  daux       <- sqrt(daux*0.5)
-  return(daux)
+genetic_distance_native <- function(MAT, method, scale = 1, loc.fac = NULL, 
+                                    threads = 1L){
+  method <- match(method, c("nei", "edwards", "rogers", "reynolds", "prevosti"))
+  MAT    <- as.matrix(MAT)
+  if (is.null(loc.fac)){
+    loc_ends <- c(0L, ncol(MAT))
+  } else {
+    # The alleles of each locus must be contiguous
+    MAT      <- MAT[, order(as.integer(loc.fac)), drop = FALSE]
+    loc_ends <- c(0L, cumsum(tabulate(as.integer(loc.fac), nlevels(loc.fac))))
+    scale    <- nlevels(loc.fac)
+  }
+  storage.mode(MAT) <- "double"
+  .Call("genetic_distance", MAT, as.integer(loc_ends), as.numeric(scale), 
+        method, as.integer(threads), PACKAGE = "poppr")
 }
 
 #==============================================================================#
@@ -1223,11 +1556,173 @@ infinite_vals_replacement <- function(D, warning){
   if (warning){
     warning("Infinite values detected.")
   }
-  maxval      <- max(D[!D == Inf])
+  maxval      <- max(0, D[!D == Inf])
   D[D == Inf] <- maxval*10
   return(D)
 }
 
+#==============================================================================#
+# Build UPGMA or neighbor-joining trees in C from condensed distance matrices
+# (see build_trees in src/tree_builder.c). This avoids the square matrices
+# created by hclust and ape::nj and builds several trees in parallel.
+#
+# Arguments:
+#   d       - a dist object or a matrix with one condensed distance matrix per
+#             column
+#   n       - the number of samples
+#   labs    - the tip labels. Defaults to the numbers 1 to n.
+#   method  - "upgma" or "nj"
+#   threads - the number of threads used to build the trees
+#
+# Returns:
+#   a multiPhylo object with one tree per condensed distance matrix
+#
+# Public functions utilizing this function:
+# upgma, aboot, bruvo.boot
+#
+# Private functions utilizing this function:
+# # poppr_nj, boot_locus_trees
+#==============================================================================#
+condensed_trees <- function(d, n, labs = NULL, method = c("upgma", "nj"),
+                            threads = 1L){
+  method <- match.arg(method)
+  if (anyNA(d)){
+    stop("Trees cannot be built from distances with missing values.")
+  }
+  if (is.null(labs)){
+    labs <- as.character(seq_len(n))
+  }
+  trees <- .Call("build_trees", as.double(d), as.integer(n), 
+                 match(method, c("upgma", "nj")), as.integer(threads), 
+                 PACKAGE = "poppr")
+  trees <- lapply(trees, function(tr){
+    tr <- list(edge = tr$edge, edge.length = tr$edge.length, tip.label = labs,
+               Nnode = tr$Nnode)
+    class(tr) <- "phylo"
+    attr(tr, "order") <- "cladewise"
+    tr
+  })
+  class(trees) <- "multiPhylo"
+  trees
+}
+
+#==============================================================================#
+# Neighbor-joining tree from a distance matrix, built in C. This gives the same
+# tree as ape::nj.
+#
+# Public functions utilizing this function:
+# aboot, bruvo.boot
+#
+# Private functions utilizing this function:
+# # tree_generator
+#==============================================================================#
+poppr_nj <- function(d){
+  d <- as.dist(d)
+  condensed_trees(d, attr(d, "Size"), attr(d, "Labels"), method = "nj")[[1]]
+}
+
+#==============================================================================#
+# Find the function to build a tree. The names "upgma" and "nj" use the trees
+# built in C.
+#
+# Public functions utilizing this function:
+# aboot, bruvo.boot
+#
+# Private functions utilizing this function:
+# # tree_generator, boot_locus_trees
+#==============================================================================#
+get_tree_function <- function(tree){
+  if (is.character(tree) && length(tree) == 1 && tree == "nj"){
+    return(poppr_nj)
+  } else if (is.character(tree) && length(tree) == 1 && tree == "upgma"){
+    return(upgma)
+  }
+  match.fun(tree)
+}
+
+#==============================================================================#
+# Distances that can be bootstrapped by weighting the contribution of each
+# locus. The values are the method codes for bootstrap_locus_distance in
+# src/poppr_distance.c.
+#
+# Public functions utilizing this function:
+# aboot
+#
+# Private functions utilizing this function:
+# # boot_locus_trees
+#==============================================================================#
+boot_locus_methods <- function(){
+  c(nei.dist = 1L, edwards.dist = 2L, rogers.dist = 3L, reynolds.dist = 4L,
+    provesti.dist = 5L, prevosti.dist = 5L)
+}
+
+#==============================================================================#
+# Bootstrap a tree by resampling loci without creating a new bootgen object for
+# each replicate. The number of times each locus is sampled is drawn in R and
+# the distances of the replicates are calculated in C from the allele 
+# frequencies, weighting each locus by the number of times it was sampled. The
+# trees are then compared to the original tree as in ape::boot.phylo.
+#
+# Arguments:
+#   phy      - the tree calculated from the full data
+#   xboot    - a bootgen object of codominant data without missing values
+#   tree     - the tree function
+#   distance - the name of the distance function (see boot_locus_methods)
+#   B        - the number of bootstrap replicates
+#   rooted   - passed to ape::prop.clades
+#   threads  - the number of threads used to calculate the distances
+#
+# Returns:
+#   a vector with the number of replicates supporting each node in phy.
+#
+# Public functions utilizing this function:
+# aboot
+#
+# Private functions utilizing this function:
+# # none
+#==============================================================================#
+boot_locus_trees <- function(phy, xboot, tree, distance, B = 100, 
+                             rooted = TRUE, threads = 1L){
+  TREEFUNK <- get_tree_function(tree)
+  method   <- boot_locus_methods()[[distance]]
+  alleles  <- slot(xboot, "alllist")
+  nloc     <- length(alleles)
+  xtab     <- tab(xboot)[, unlist(alleles), drop = FALSE]
+  storage.mode(xtab) <- "double"
+  loc_ends <- c(0L, cumsum(lengths(alleles)))
+  weights  <- vapply(seq_len(B), function(i){
+    tabulate(sample.int(nloc, replace = TRUE), nloc)
+  }, integer(nloc))
+  weights  <- matrix(weights, nrow = nloc)
+  labs     <- get_gen_dist_labs(xboot)
+  # The replicates are calculated in chunks of about 16 million distances so
+  # that the distances of all replicates are never in memory at once. The 
+  # clades are counted for each chunk of trees.
+  chunk    <- max(1L, floor(2^24/choose(length(labs), 2)))
+  counts   <- 0
+  for (start in seq(1L, B, by = chunk)){
+    reps  <- start:min(B, start + chunk - 1L)
+    dists <- .Call("bootstrap_locus_distance", xtab, as.integer(loc_ends), 
+                   method, weights[, reps, drop = FALSE], as.integer(threads), 
+                   PACKAGE = "poppr")
+    for (i in which(colSums(dists == Inf, na.rm = TRUE) > 0)){
+      dists[, i] <- infinite_vals_replacement(dists[, i], warning = FALSE)
+    }
+    if (identical(TREEFUNK, upgma) || identical(TREEFUNK, poppr_nj)){
+      # All of the trees in the chunk are built at once in C
+      tmethod <- if (identical(TREEFUNK, upgma)) "upgma" else "nj"
+      trees   <- condensed_trees(dists, length(labs), labs, tmethod, threads)
+    } else {
+      trees <- lapply(seq_along(reps), function(i){
+        TREEFUNK(make_attributes(dists[, i], length(labs), labs, distance, NULL))
+      })
+      class(trees) <- "multiPhylo"
+    }
+    counts <- counts + ape::prop.clades(phy, trees, rooted = rooted)
+  }
+  counts
+}
+
 #==============================================================================#
 # Given a tree function and a distance function, this will generate an
 # automatic tree generating function. This is useful for functions such as
@@ -1240,7 +1735,7 @@ infinite_vals_replacement <- function(D, warning){
 # # none
 #==============================================================================#
 tree_generator <- function(tree, distance, quiet = TRUE, ...){
-  TREEFUNK <- match.fun(tree)
+  TREEFUNK <- get_tree_function(tree)
   DISTFUNK <- match.fun(distance)
   distargs <- as.list(formals(distance))
   otherargs <- list(...)
@@ -1754,6 +2249,78 @@ generate_bruvo_mat <- function(x, maxploid, sep = "/", mat_type = character(0)){
   return(res)
 }
 #==============================================================================#
+# Can a GenAlEx file be read natively? Connections, URLs, compressed files, and
+# white space separators are left to read.table.
+#
+# Public functions utilizing this function:
+# ## read.genalex
+#
+# Internal functions utilizing this function:
+# ## none
+#==============================================================================#
+is_local_genalex <- function(genalex, sep){
+  is.character(genalex) && length(genalex) == 1L && 
+    length(sep) == 1L && nchar(sep) == 1L && sep != " " &&
+    !grepl("://", genalex, fixed = TRUE) && 
+    !grepl("\\.(gz|bz2|xz|zip)$", genalex) && 
+    file.exists(genalex)
+}
+#==============================================================================#
+# Create a genind object from the genotype columns of a GenAlEx file. The
+# alleles are counted natively in the order they first appear, the same as
+# df2genind.
+#
+# gena    - a data frame of character vectors with one column per allele
+# loci    - the names of the loci
+# ind.vec - the sample names
+# pop.vec - the populations
+# ploidy  - the number of columns per locus
+#
+# Duplicate sample names are replaced by their zero-padded positions and
+# samples without any genotypes are removed as in df2genind.
+#
+# Public functions utilizing this function:
+# ## read.genalex
+#
+# Internal functions utilizing this function:
+# ## none
+#==============================================================================#
+genalex_genind <- function(gena, loci, ind.vec, pop.vec, ploidy){
+  counts <- .Call("genalex_tab", gena, as.integer(ploidy), PACKAGE = "poppr")
+  tab    <- counts[[1]]
+  # The locus of each column is found from the last "." of the column name.
+  alleles       <- gsub(".", "_", counts[[3]], fixed = TRUE)
+  colnames(tab) <- paste(loci[counts[[2]]], alleles, sep = ".")
+  ind.names     <- as.character(ind.vec)
+  if (anyDuplicated(ind.names)){
+    warning("duplicate labels detected for some individuals; using generic labels")
+    # The same labels as adegenet's .genlab("", n)
+    ind.names <- formatC(seq_along(ind.names), width = nchar(length(ind.names)),
+                         flag = "0")
+  }
+  rownames(tab) <- ind.names
+  typed <- rowSums(!is.na(tab)) > 0
+  if (!all(typed)){
+    warning("Individuals with no scored loci have been removed")
+    tab     <- tab[typed, , drop = FALSE]
+    pop.vec <- pop.vec[typed]
+  }
+  new("genind", tab = tab, pop = pop.vec, ploidy = as.integer(ploidy), 
+      type = "codom")
+}
+#==============================================================================#
+# The bytes at the start of a file written by write_genclone.
+#
+# Public functions utilizing this function:
+# ## write_genclone read_genclone
+#
+# Internal functions utilizing this function:
+# ## none
+#==============================================================================#
+genclone_magic <- function(){
+  "POPPRGC1"
+}
+#==============================================================================#
 # Function to subset the custom MLGs by the computationally derived MLGs in the
 # data set. This is necessary due to the fact that minimum spanning networks
 # will clone correct before calculations, but this is performed on the visible
@@ -1843,6 +2410,49 @@ boot_per_pop <- function(x, rg = multinom_boot, n, mle = NULL, H = TRUE,
   return(res)
 }
 
+#==============================================================================#
+# Bootstraps all populations from a mlg.matrix in C. The replicates are drawn
+# and the statistics H, G, lambda, and E.5 are calculated from the genotype
+# counts in parallel. The output is a list of objects of class "boot" with the
+# same elements as those from boot_per_pop so that they can be used with the
+# functions from the boot package.
+# 
+# Public functions utilizing this function:
+# ## diversity_boot
+# 
+# Internal functions utilizing this function:
+# ## none
+#==============================================================================#
+boot_per_pop_native <- function(tab, n, mle = NULL, rarefy = FALSE, H = TRUE,
+                                G = TRUE, lambda = TRUE, E5 = TRUE, 
+                                threads = 1L){
+  counts <- matrix(as.integer(tab), nrow = nrow(tab))
+  if (rarefy || !(is.null(mle) || mle < 2)){
+    size <- rep(as.integer(mle), nrow(counts))
+  } else {
+    size <- as.integer(rowSums(counts))
+  }
+  if (!exists(".Random.seed", envir = .GlobalEnv, inherits = FALSE)){
+    stats::runif(1)
+  }
+  rseed <- get(".Random.seed", envir = .GlobalEnv, inherits = FALSE)
+  seed  <- sample.int(.Machine$integer.max, 1L)
+  boots <- .Call("diversity_bootstrap", counts, size, rarefy, as.integer(n), 
+                 seed, as.integer(threads), PACKAGE = "poppr")
+  stats <- c(H, G, lambda, E5)
+  rg    <- if (rarefy) rare_sim_boot else multinom_boot
+  res   <- lapply(seq_len(nrow(counts)), function(i){
+    xi  <- extract_samples(counts[i, ])
+    out <- list(t0 = boot_stats(xi, H = H, G = G, lambda = lambda, E5 = E5),
+                t = boots[[i]][, stats, drop = FALSE], R = n, data = xi, 
+                seed = rseed, statistic = boot_stats, sim = "parametric", 
+                call = match.call(), ran.gen = rg, mle = mle)
+    structure(out, class = "boot", boot_type = "boot")
+  })
+  names(res) <- rownames(tab)
+  return(res)
+}
+
 #==============================================================================#
 # multinomial sampler for bootstrapping
 # 
@@ -2178,20 +2788,163 @@ make_windows <- function(maxp, minp = 1L, window = 100L){
   return(winmat)
 }
 #==============================================================================#
-# add tied edges to minimum spanning tree
+# Converts a dist object or a square distance matrix to a vector in the order
+# of a dist object. Distance files are passed to C as the path to the file.
+#
+# Public functions utilizing this function:
+# ## bruvo.msn poppr.msn
+#
+# Internal functions utilizing this function:
+# ## msn_graph add_tied_edges
+#==============================================================================#
+condensed_distance <- function(distmat){
+  if (inherits(distmat, "dist_file")){
+    return(distmat$file)
+  }
+  if (!inherits(distmat, "dist")){
+    distmat <- distmat[lower.tri(distmat)]
+  }
+  distmat <- as.vector(distmat)
+  storage.mode(distmat) <- "double"
+  return(distmat)
+}
+#==============================================================================#
+# The samples of a dist_file that are used. A dist_file can be subset without
+# copying the distances by keeping the (1-based) samples of the file in 
+# x$samples.
+#
+# Public functions utilizing this function:
+# ## dist_tile poppr.msn
+#
+# Internal functions utilizing this function:
+# ## msn_graph dist_file_positions subset_dist_file
+#==============================================================================#
+dist_file_samples <- function(x){
+  if (is.null(x$samples)) seq_len(x$n) else x$samples
+}
+#==============================================================================#
+# The 0-based positions of the samples of a subset dist_file that are passed to
+# C. This is NULL when all of the samples are used or for any other distances.
+#
+# Public functions utilizing this function:
+# ## bruvo.msn poppr.msn
+#
+# Internal functions utilizing this function:
+# ## msn_graph add_tied_edges
+#==============================================================================#
+dist_file_positions <- function(x){
+  if (!inherits(x, "dist_file") || is.null(x$samples)){
+    return(NULL)
+  }
+  as.integer(x$samples) - 1L
+}
+#==============================================================================#
+# Subset the samples of a dist_file in the same way as the rows and columns of
+# a distance matrix. The distances stay on disk.
+#
+# Public functions utilizing this function:
+# ## poppr.msn
+#
+# Internal functions utilizing this function:
+# ## none
+#==============================================================================#
+subset_dist_file <- function(x, i){
+  x$samples <- dist_file_samples(x)[i]
+  if (!is.null(x$labels)){
+    x$labels <- x$labels[i]
+  }
+  x
+}
+#==============================================================================#
+# Writes the labels of a distance file next to it with the extension ".ind".
+# Labels left from an earlier file are removed when there are none.
+#
+# Public functions utilizing this function:
+# ## bitwise.dist diss.dist write_dist_file
+#
+# Internal functions utilizing this function:
+# ## none
+#==============================================================================#
+write_dist_labels <- function(file, labels){
+  ind_file <- paste0(file, ".ind")
+  if (is.null(labels)){
+    unlink(ind_file)
+  } else {
+    writeLines(as.character(labels), ind_file)
+  }
+  invisible(ind_file)
+}
+#==============================================================================#
+# The number of distances that are calculated and written at once when
+# distances are written to a distance file (2^22 doubles, or 32 MiB).
+#
+# Public functions utilizing this function:
+# ## bitwise.dist diss.dist
+#
+# Internal functions utilizing this function:
+# ## none
+#==============================================================================#
+dist_block_size <- function(){
+  2^22
+}
+#==============================================================================#
+# Build a minimum spanning network in C from a dist object, a square distance
+# matrix, or a dist_file, which is read from disk. Samples with a distance of
+# zero are not connected, the same as in graph.adjacency. If include.ties =
+# TRUE, the edges that are tied with the shortest edge out of each sample are
+# added (see add_tied_edges).
 #
 # Public functions utilizing this function:
 # ## bruvo.msn poppr.msn
 #
 # Internal functions utilizing this function:
-# ## singlepop_msn
+# ## msn_constructor
+#==============================================================================#
+msn_graph <- function(distmat, include.ties = FALSE, 
+                      tolerance = .Machine$double.eps ^ 0.5, threads = 1L){
+  if (inherits(distmat, "dist_file")){
+    n    <- length(dist_file_samples(distmat))
+    labs <- distmat$labels
+  } else if (inherits(distmat, "dist")){
+    n    <- attr(distmat, "Size")
+    labs <- attr(distmat, "Labels")
+  } else {
+    n    <- nrow(distmat)
+    labs <- rownames(distmat)
+  }
+  edges <- .Call("msn_edges", condensed_distance(distmat), as.integer(n), 
+                 include.ties, tolerance, as.integer(threads), 
+                 dist_file_positions(distmat), PACKAGE = "poppr")
+  mst <- igraph::make_empty_graph(n, directed = FALSE)
+  if (!is.null(labs)){
+    V(mst)$name <- labs
+  }
+  if (length(edges[[2]]) > 0){
+    mst <- add.edges(mst, t(edges[[1]]), weight = edges[[2]])
+  }
+  return(mst)
+}
 #==============================================================================#
-add_tied_edges <- function(mst, distmat, tolerance = .Machine$double.eps ^ 0.5){
-  tied_edges <- .Call("msn_tied_edges", as.matrix(mst[]), as.matrix(distmat), tolerance)
-  if (length(tied_edges) > 0){
-    the_edges   <- tied_edges[c(TRUE, TRUE, FALSE)]
-    the_weights <- tied_edges[c(FALSE, FALSE, TRUE)]
-    mst <- add.edges(mst, dimnames(mst[])[[1]][the_edges], weight = the_weights)
+# add tied edges to minimum spanning tree. The distances can be a dist object,
+# a square matrix, or a dist_file in the same order as the vertices of the tree.
+#
+# Public functions utilizing this function:
+# ## none
+#
+# Internal functions utilizing this function:
+# ## none
+#==============================================================================#
+add_tied_edges <- function(mst, distmat, tolerance = .Machine$double.eps ^ 0.5,
+                           threads = 1L){
+  edges <- igraph::as_edgelist(mst, names = FALSE)
+  storage.mode(edges) <- "integer"
+  weights <- as.numeric(E(mst)$weight)
+  tied_edges <- .Call("msn_tied_edges", edges, weights, 
+                      condensed_distance(distmat), igraph::vcount(mst), 
+                      tolerance, as.integer(threads), 
+                      dist_file_positions(distmat), PACKAGE = "poppr")
+  if (length(tied_edges[[2]]) > 0){
+    mst <- add.edges(mst, t(tied_edges[[1]]), weight = tied_edges[[2]])
   }
   return(mst)
 }
@@ -2404,6 +3157,219 @@ rrccbp <- function(i, loclist, mlgs, pnames){
   return(res)
 }
 
+#' Calculate log Pgen for each sample
+#'
+#' This does the work of validating the allele frequencies for pgen and psex
+#' before handing off to C.
+#'
+#' @param gid a genind, genclone, genlight, or snpclone object
+#' @param pop a formula or vector specifying the population factor
+#' @param by_pop logical, should the calculation be done by population?
+#' @param freq NULL, a matrix, or a vector of allele frequencies
+#' @param by_sample logical, if \code{TRUE}, the log pgen values are summed over
+#'   all non-missing loci for each sample, returning a vector. If \code{FALSE},
+#'   a matrix of log pgen per sample and locus (or window of loci for genlight
+#'   objects) is returned.
+#' @param window an integer specifying the number of loci to sum over for
+#'   genlight objects. Defaults to \code{NULL}, indicating all loci.
+#' @param threads the number of threads to use. Defaults to 1. If 0, all
+#'   available threads will be used.
+#' @param ... arguments passed on to \code{\link{rraf}}
+#'
+#' @note 
+#' Public functions: pgen, psex
+#' Private functions: none
+#'
+#' @return a matrix or vector of log pgen values
+#' @noRd
+pgen_internal <- function(gid, pop = NULL, by_pop = TRUE, freq = NULL, 
+                          by_sample = FALSE, window = NULL, threads = 1L, ...){
+  stopifnot(is.genind(gid) || inherits(gid, "genlight"))
+  # Stop if the ploidy of the object is not diploid
+  # stopifnot(all(ploidy(gid) %in% 1:2)) 
+  if (!all(ploidy(gid) < 3)){
+    stop("This function can only work on haploid or diploid data.", call. = FALSE)
+  }
+  if (!is.null(pop)){
+    gid    <- set_pop_from_strata_or_vector(gid, pop)
+    by_pop <- TRUE
+  }
+  # Set single population if none exists OR if user explicitly said by_pop =
+  # FALSE This is done so that rraf is forced to return a matrix.
+  if (is.null(pop(gid)) || !by_pop){
+    pop(gid) <- rep(1, nInd(gid))
+  }   
+  pops <- pop(gid)
+  if (inherits(gid, "genlight")){
+    return(pgen_genlight(gid, pops, freq, by_sample, window, threads))
+  }
+  if (is.null(freq)){
+    # The above lines guarantee that a matrix will return here.
+    freqs <- rraf(gid, by_pop = TRUE, ...)
+  } else if (is.matrix(freq)){
+    if (nrow(freq) != nlevels(pops) || ncol(freq) != ncol(tab(gid))){
+      stop("frequency matrix must have the same dimensions as the data.")
+    }
+    freqs <- freq
+  } else if (is.numeric(freq) && length(freq) == ncol(tab(gid))){
+    freqs <- freq
+    pops <- factor(rep(1, nInd(gid)))
+  } else {
+    stop("frequencies must be the same length as the number of alleles.")
+  }
+  storage.mode(freqs) <- "double"
+  .Call("get_pgen_matrix_genind", gid, freqs, pops, nlevels(pops), by_sample,
+        as.integer(threads), PACKAGE = "poppr")
+}
+
+#' Calculate log Pgen over windows of SNPs
+#'
+#' The allele frequencies are calculated from the packed data in C for each
+#' population. Since there is no round-robin clone-correction for genlight
+#' objects, user-supplied frequencies are not accepted.
+#'
+#' @param gid a genlight or snpclone object with the population set
+#' @param pops a factor of populations
+#' @param freq must be NULL
+#' @param by_sample logical, should the result be summed over all loci?
+#' @param window an integer specifying the number of loci in each window or
+#'   NULL to use all loci.
+#' @param threads the number of threads to use.
+#'
+#' @note 
+#' Public functions: pgen
+#' Private functions: pgen_internal
+#'
+#' @return a matrix with one row per sample and one column per window, or a
+#'   vector of the sums of these rows
+#' @noRd
+pgen_genlight <- function(gid, pops, freq = NULL, by_sample = FALSE, window = NULL,
+                          threads = 1L){
+  if (!is.null(freq)){
+    stop("allele frequencies cannot be supplied for genlight objects.", 
+         call. = FALSE)
+  }
+  ploid <- ploidy(gid)
+  if (length(unique(ploid)) > 1){
+    stop("all samples must have the same ploidy.", call. = FALSE)
+  }
+  # Ensure that every SNPbin object has data for all chromosomes
+  if (ploid[1] == 2){
+    gid <- fix_uneven_diploid(gid)
+  }
+  nloc   <- nLoc(gid)
+  window <- if (is.null(window) || by_sample) nloc else as.integer(window)
+  if (length(window) != 1 || is.na(window) || window < 1){
+    stop("window must be a single positive integer.", call. = FALSE)
+  }
+  window <- min(window, nloc)
+  res <- .Call("get_pgen_matrix_genlight", gid, pops, nlevels(pops), window, 
+               as.integer(threads), PACKAGE = "poppr")
+  if (by_sample){
+    return(setNames(res[, 1], indNames(gid)))
+  }
+  starts <- seq(1L, nloc, by = window)
+  ends   <- pmin(starts + window - 1L, nloc)
+  dimnames(res) <- list(indNames(gid), paste(starts, ends, sep = "-"))
+  res
+}
+
+#' Create an empty MLG index
+#'
+#' The index is an environment so that it can be updated in place. The hash
+#' table lives in C behind an external pointer, but the encoded genotypes are
+#' also stored in \code{chunks} so that the table can be rebuilt after the
+#' index has been serialized.
+#'
+#' @note 
+#' Public functions: mlg.index
+#' Private functions: none
+#'
+#' @return an object of class \code{mlgindex}
+#' @noRd
+new_mlg_index <- function(){
+  index         <- new.env(parent = emptyenv())
+  index$ptr     <- .Call("mlg_index_new", PACKAGE = "poppr")
+  index$loci    <- NULL
+  index$alleles <- character(0)
+  index$n       <- 0
+  index$chunks  <- list()
+  class(index)  <- "mlgindex"
+  index
+}
+
+#' Rebuild the hash table of an MLG index
+#'
+#' External pointers are not preserved when an object is saved, so this will
+#' reinsert the stored genotypes if the index was loaded from disk.
+#'
+#' @param index an mlgindex object
+#'
+#' @note 
+#' Public functions: none
+#' Private functions: mlg_index_add
+#'
+#' @return NULL, invisibly. The index is updated in place.
+#' @noRd
+restore_mlg_index <- function(index){
+  if (.Call("mlg_index_size", index$ptr, PACKAGE = "poppr") >= 0){
+    return(invisible(NULL))
+  }
+  index$ptr <- .Call("mlg_index_new", PACKAGE = "poppr")
+  for (chunk in index$chunks){
+    .Call("mlg_index_insert", index$ptr, chunk$keys, chunk$lengths, chunk$mlgs,
+          PACKAGE = "poppr")
+  }
+  invisible(NULL)
+}
+
+#' Add samples to an MLG index
+#'
+#' The columns of the incoming data are aligned to the alleles in the index
+#' (adding any new alleles) and sorted by locus and allele so that each 
+#' genotype has a single encoding regardless of the column order in gid.
+#'
+#' @param index an mlgindex object
+#' @param gid a genind object
+#' @param ids NULL or a vector of MLG ids to use for genotypes not in the index
+#'
+#' @note 
+#' Public functions: mlg.index, mlg.add
+#' Private functions: none
+#'
+#' @return a named integer vector of MLGs for each sample
+#' @noRd
+mlg_index_add <- function(index, gid, ids = NULL){
+  restore_mlg_index(index)
+  if (is.null(index$loci)){
+    index$loci <- locNames(gid)
+  }
+  the_loci <- match(locNames(gid), index$loci)
+  if (anyNA(the_loci) || length(the_loci) != length(index$loci)){
+    stop("the loci in the data must match the loci in the index", call. = FALSE)
+  }
+  alleles       <- colnames(tab(gid))
+  index$alleles <- c(index$alleles, setdiff(alleles, index$alleles))
+  col_id        <- match(alleles, index$alleles)
+  col_locus     <- the_loci[as.integer(locFac(gid))] - 1L
+  ord           <- order(col_locus, col_id)
+  xtab          <- tab(gid)[, ord, drop = FALSE]
+  storage.mode(xtab) <- "integer"
+  if (!is.null(ids)){
+    ids <- as.integer(ids)
+  }
+  keys <- .Call("mlg_index_encode", xtab, col_id[ord], col_locus[ord], 
+                PACKAGE = "poppr")
+  res  <- .Call("mlg_index_insert", index$ptr, keys[[1]], keys[[2]], ids, 
+                PACKAGE = "poppr")
+  if (length(res[[3]]) > 0){
+    chunk <- list(keys = res[[2]], lengths = res[[3]], mlgs = res[[4]])
+    index$chunks[[length(index$chunks) + 1L]] <- chunk
+  }
+  index$n <- index$n + nInd(gid)
+  setNames(res[[1]], indNames(gid))
+}
+
 #' Treat the optional "G" argument for psex
 #'
 #' @param G either NULL or an integer vector that can be named or not
@@ -2620,25 +3586,6 @@ set_pop_from_strata_or_vector <- function(gid, pop) {
 myTheme <- theme(axis.text.x = element_text(angle = 90, hjust = 1, vjust = 0.5))
 
 
-#' Calculate Psex for a given genotype
-#'
-#' @param n_encounters integer the number of observations of an MLG
-#' @param p_genotype numeric the probability of the given MLG
-#' @param sample_ids list the names of the given MLG
-#' @param n_samples integer the number of samples observed
-#'
-#' @return a vector of probabilities
-#' @noRd
-#'
-#' @examples
-#' make_psex(10, 0.005, n_samples = 100)
-make_psex <- function(n_encounters, p_genotype, sample_ids = NULL, n_samples){
-  encounters <- seq(n_encounters) - 1
-  out        <- dbinom(encounters, n_samples, p_genotype)
-  names(out) <- sample_ids
-  return(out)
-}
-
 cromulent_replen <- function(gid, replen){
   the_loci <- locNames(gid)
   if (length(replen) != nLoc(gid) && is.null(names(replen))){
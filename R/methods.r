@@ -1389,7 +1389,8 @@ setMethod(
 #'   to pop. Defaults to \code{\link{diss.dist}} for genclone objects and
 #'   \code{\link{bitwise.dist}} for snpclone objects. A matrix or table
 #'   containing distances between individuals (such as the output of 
-#'   \code{\link{rogers.dist}}) is also accepted for this parameter.
+#'   \code{\link{rogers.dist}}) is also accepted for this parameter, as is a
+#'   \code{\link[=write_dist_file]{dist_file}}, which is read from disk.
 #' @param threads (unused) Previously, this was the maximum number of parallel 
 #'  threads to be used within this function. Default is 1 indicating that this
 #'  function will run serially. Any other number will result in a warning.
@@ -240,14 +240,23 @@ mlg <- function(gid, quiet=FALSE){
 #' @param background an option to display the the total number of MLGs across
 #'   populations per facet in the background of the plot.
 #'
+#' @param sparse logical. If \code{TRUE}, mlg.table returns a sparse table 
+#'   of class "mlg_sparse" that only stores the counts of the MLGs observed in
+#'   each population. This can be used in place of the matrix by
+#'   \code{\link{diversity_stats}} and is useful for data with many
+#'   populations and MLGs. Use \code{plot = FALSE} to avoid creating the 
+#'   matrix for the plot. Defaults to \code{FALSE}.
+#'
 #' @note The resulting matrix of \code{mlg.table} can be used for analysis with 
-#' the \code{\link{vegan}} package.
+#' the \code{\link{vegan}} package. A sparse table can be converted to a
+#' matrix with \code{as.matrix()}.
 #' 
 #' @export
 #==============================================================================#
 mlg.table <- function(gid, strata = NULL, sublist = "ALL", exclude = NULL, blacklist = NULL, 
                       mlgsub = NULL, bar = TRUE, plot = TRUE, total = FALSE, 
-                      color = FALSE, background = FALSE, quiet = FALSE){  
+                      color = FALSE, background = FALSE, quiet = FALSE,
+                      sparse = FALSE){  
   if (!is.genind(gid) & !is(gid, "snpclone")){
     stop("This function requires a genind object.")
   }
@@ -273,13 +282,13 @@ mlg.table <- function(gid, strata = NULL, sublist = "ALL", exclude = NULL, black
   if (!is.null(strata)){
     setPop(gid) <- strata
   }
-  mlgtab <- mlg.matrix(gid)
+  mlgtab <- if (sparse) mlg.sparse(gid) else mlg.matrix(gid)
   if (!is.null(mlgsub)){
     if (is.numeric(mlgsub)){
       mlgsub <- paste("MLG", mlgsub, sep = ".")
     }
     mlgtab <- mlgtab[, mlgsub, drop = FALSE]
-    mlgtab <- mlgtab[which(rowSums(mlgtab) > 0L), , drop = FALSE]
+    mlgtab <- mlgtab[which(mlg_margin(mlgtab) > 0L), , drop = FALSE]
     gid <- popsub(gid, sublist = rownames(mlgtab))
   }
   if (sublist[1] != "ALL" | !is.null(exclude)){
@@ -288,12 +297,12 @@ mlg.table <- function(gid, strata = NULL, sublist = "ALL", exclude = NULL, black
     rows <- rownames(mlgtab)
   }
   if (total == TRUE && nrow(mlgtab) > 1){
-    mlgtab <- rbind(mlgtab, colSums(mlgtab))
-    rownames(mlgtab)[nrow(mlgtab)] <- "Total"
+    mlgtab <- mlg_add_total(mlgtab)
   }
 
   # Dealing with the visualizations.
   if (plot){
+    mlgmat <- if (sparse) as.matrix(mlgtab) else mlgtab
     # If there is a population structure
     if(!is.null(popNames(gid))){
       popnames <- popNames(gid)
@@ -301,18 +310,18 @@ mlg.table <- function(gid, strata = NULL, sublist = "ALL", exclude = NULL, black
         popnames[length(popnames) + 1] <- "Total"
       }
     }
-    if (total && nrow(mlgtab) > 1 && (color | background)){
-      ggmlg <- mlg_barplot(mlgtab[-nrow(mlgtab), , drop = FALSE], 
+    if (total && nrow(mlgmat) > 1 && (color | background)){
+      ggmlg <- mlg_barplot(mlgmat[-nrow(mlgmat), , drop = FALSE], 
                            color = color, background = background)
     } else {
-      ggmlg <- mlg_barplot(mlgtab, color = color, background = background)
+      ggmlg <- mlg_barplot(mlgmat, color = color, background = background)
     }
     print(ggmlg + 
           myTheme + 
           labs(title = paste("Data:", the_data, "\nN =",
-                             sum(mlgtab), "MLG =", ncol(mlgtab))))
+                             sum(mlgmat), "MLG =", ncol(mlgmat))))
   }
-  mlgtab <- mlgtab[, which(colSums(mlgtab) > 0), drop = FALSE]
+  mlgtab <- mlgtab[, which(mlg_margin(mlgtab, 2) > 0), drop = FALSE]
   return(mlgtab)
 }
 
@@ -450,7 +459,7 @@ mlg.crosspop <- function(gid, strata = NULL, sublist = "ALL", exclude = NULL, bl
   }
   subind <- sub_index(gid, sublist, exclude)
   vec    <- vec[subind]
-  mlgtab <- mlg.matrix(gid)
+  mlgtab <- mlg.sparse(gid)
 
   if (!is.null(mlgsub)){
     if (visible == "custom"){
@@ -475,7 +484,9 @@ mlg.crosspop <- function(gid, strata = NULL, sublist = "ALL", exclude = NULL, bl
       mlgtab <- mlgtab[popNames(gid), , drop = FALSE]
     }
 
-    mlgs <- colSums(ifelse(mlgtab == 0L, 0L, 1L)) > 1
+    # The number of populations with each MLG.
+    mlgs <- stats::setNames(tabulate(mlgtab$j, ncol(mlgtab)) > 1, 
+                            colnames(mlgtab))
     if (sum(mlgs) == 0){
       message("No multilocus genotypes were detected across populations\n")
       return(NULL)
@@ -491,17 +502,21 @@ mlg.crosspop <- function(gid, strata = NULL, sublist = "ALL", exclude = NULL, bl
     return(mlgout)
   }
   popop <- function(x, quiet=TRUE){
-    popnames <- mlgtab[mlgtab[, x] > 0L, x]
-    if (length(popnames) == 1){
-      names(popnames) <- rownames(mlgtab[mlgtab[, x] > 0L, x, drop=FALSE])
-    }
+    popnames <- stats::setNames(mlgtab$x[entries[[x]]], 
+                                rownames(mlgtab)[rows[entries[[x]]]])
     if (!quiet)
       cat(paste(x, ":", sep=""),paste("(",sum(popnames)," inds)", sep=""),
           names(popnames), fill=80)
     return(popnames)
   }
   # Removing any populations that are not represented by the MLGs.
-  mlgtab <- mlgtab[rowSums(mlgtab[, mlgs, drop=FALSE]) > 0L, mlgs, drop=FALSE]
+  mlgtab <- mlgtab[, mlgs, drop = FALSE]
+  mlgtab <- mlgtab[diff(mlgtab$p) > 0L, , drop = FALSE]
+  # The counts of each MLG in order of population.
+  rows    <- mlg_sparse_row_index(mlgtab)
+  entries <- split(seq_along(mlgtab$j), 
+                   factor(mlgtab$j, levels = seq_len(ncol(mlgtab)), 
+                          labels = colnames(mlgtab)))
   # Compiling the list.
   mlg.dup <- lapply(colnames(mlgtab), popop, quiet=quiet)
   names(mlg.dup) <- colnames(mlgtab)
@@ -528,3 +543,83 @@ mlg.id <- function (gid){
   }
   return(split(indNames(gid), mlg.vector(gid)))
 }
+
+#==============================================================================#
+#' Incrementally assign multilocus genotypes to new samples
+#' 
+#' For collections that grow over time, recalculating the multilocus genotypes 
+#' for all samples each time new samples are added with \code{\link{mlg.vector}}
+#' or \code{\link{as.genclone}} becomes slow. An MLG index remembers every 
+#' genotype it has seen in a hash table so that new samples can be assigned 
+#' to existing or new multilocus genotypes in time proportional to the number
+#' of new samples.
+#' 
+#' @param gid a \code{\linkS4class{genind}} or \code{\linkS4class{genclone}}
+#'   object. For \code{mlg.add}, this must have the same loci as the data used
+#'   to create the index, but it can contain new alleles.
+#' @param index an object of class \code{mlgindex} created by \code{mlg.index}.
+#'   
+#' @return \subsection{mlg.index}{an object of class \code{mlgindex}.}
+#'   \subsection{mlg.add}{a named integer vector with the multilocus genotype
+#'   of each sample in \code{gid}. The index is updated in place.}
+#'   
+#' @details Genotypes are considered identical under the same rules as 
+#'   \code{\link{mlg.vector}}: two samples have the same multilocus genotype if
+#'   they have the same allele counts at every locus, with missing data being
+#'   treated as its own state.
+#'   
+#'   When the index is created from a genclone object, the original multilocus
+#'   genotypes are used for the index. For genind objects, they are calculated
+#'   with \code{\link{mlg.vector}}. New multilocus genotypes are numbered
+#'   starting after the largest one in the index.
+#'   
+#'   The index is modified in place by \code{mlg.add}, so copies of the index 
+#'   will also be updated. It can be saved with \code{\link{saveRDS}} and
+#'   reloaded in a new R session. The hash table is rebuilt from the stored
+#'   genotypes the first time the reloaded index is used.
+#'   
+#' @export
+#' @author Zhian N. Kamvar
+#' @seealso \code{\link{mlg.vector}} \code{\link{mll}}
+#' @examples
+#' data(partial_clone)
+#' # Create an index from the first 40 samples
+#' idx <- mlg.index(partial_clone[1:40])
+#' idx
+#' 
+#' # Assign MLGs to the rest of the samples as they come in
+#' mlg.add(idx, partial_clone[41:50])
+#' mlg.add(idx, partial_clone[51:60])
+#' idx
+#' 
+#' \dontrun{
+#' # The index can be saved and reloaded
+#' f <- tempfile(fileext = ".rds")
+#' saveRDS(idx, f)
+#' idx2 <- readRDS(f)
+#' mlg.add(idx2, partial_clone[61:70])
+#' }
+#==============================================================================#
+mlg.index <- function(gid){
+  if (!is.genind(gid)){
+    stop(paste(substitute(gid), "is not a genind or genclone object"))
+  }
+  index <- new_mlg_index()
+  ids   <- if (is.genclone(gid)) mll(gid, "original") else mlg.vector(gid)
+  mlg_index_add(index, gid, ids)
+  index
+}
+
+#==============================================================================#
+#' @rdname mlg.index
+#' @export
+#==============================================================================#
+mlg.add <- function(index, gid){
+  if (!inherits(index, "mlgindex")){
+    stop("index must be an mlgindex object created with mlg.index()")
+  }
+  if (!is.genind(gid)){
+    stop(paste(substitute(gid), "is not a genind or genclone object"))
+  }
+  mlg_index_add(index, gid)
+}
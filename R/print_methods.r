@@ -80,6 +80,61 @@ print.amova <- function(x, full = FALSE, ...)
   PRINT(x)
 }
 
+#' @method print mlgindex
+#' @export
+print.mlgindex <- function(x, ...){
+  restore_mlg_index(x)
+  nmlg <- .Call("mlg_index_size", x$ptr, PACKAGE = "poppr")
+  cat("\nThis is an MLG index\n")
+  cat("--------------------\n")
+  cat("", nmlg, "multilocus genotypes\n",
+      x$n, "individuals\n",
+      length(x$loci), "loci with", length(x$alleles), "alleles\n")
+  invisible(x)
+}
+
+#' @method print genotype_store
+#' @export
+print.genotype_store <- function(x, ...){
+  cat("\nThis is a genotype store\n")
+  cat("------------------------\n")
+  cat("", x$n, ifelse(x$ploidy == 2, "diploid", "haploid"), "samples\n",
+      x$nloc, "SNPs\n",
+      "file:", x$file, "\n")
+  invisible(x)
+}
+
+#' @method print dist_file
+#' @export
+print.dist_file <- function(x, ...){
+  cat("\nThis is a distance file\n")
+  cat("-----------------------\n")
+  cat("", length(dist_file_samples(x)), "samples\n",
+      "file:", x$file, "\n")
+  invisible(x)
+}
+
+#' @method print mlg_sparse
+#' @export
+print.mlg_sparse <- function(x, ...){
+  cat("\nThis is a sparse table of multilocus genotypes\n")
+  cat("----------------------------------------------\n")
+  cat("", x$Dim[1], "populations\n",
+      x$Dim[2], "MLGs\n",
+      length(x$x), "nonzero counts\n")
+  invisible(x)
+}
+
+#' @method print packed_genlight
+#' @export
+print.packed_genlight <- function(x, ...){
+  cat("\nThis is a packed genlight object\n")
+  cat("--------------------------------\n")
+  cat("", x$n, ifelse(x$ploidy == 2, "diploid", "haploid"), "samples\n",
+      x$nloc, "SNPs\n")
+  invisible(x)
+}
+
 #' @method print popprtable
 #' @export
 print.popprtable <- function(x, ...){
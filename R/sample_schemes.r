@@ -139,15 +139,19 @@ shufflepop <- function(pop, method=1){
 # .single.sampler function, which is described below. It will then calculate the
 # Index of Association for the resampled population for the number of times
 # indicated in "iterations".
+#
+# Codominant data are permuted and scored in C by .native.sampling. 
 #==============================================================================#
 .sampling <- function(pop, iterations, quiet=FALSE, missing="ignore", type=type, 
-                      method=1){ 
+                      method=1, threads=1L){ 
   METHODS = c("permute alleles", "parametric bootstrap",
               "non-parametric bootstrap", "multilocus")
   if(!is.list(pop)){
     if(type=="PA"){
       .Ia.Rd <- .PA.Ia.Rd
     }
+  } else {
+    return(.native.sampling(pop, iterations, method = method, threads = threads))
   }
 	sample.data <- data.frame(list(Ia = vector(mode = "numeric", 
                                              length = iterations),
@@ -166,6 +170,36 @@ shufflepop <- function(pop, method=1){
 	return(sample.data)
 }
 
+#==============================================================================#
+# pop = a list of genind objects with one locus each.
+#
+# The data are passed to C once and each iteration is shuffled and scored in 
+# place (see ia_permutation in src/permut_shuffler.c). The iterations are run
+# in chunks to update the progress bar. Each chunk gets a seed from R's random
+# number generator so that the results are reproducible with set.seed() 
+# regardless of the number of threads.
+#==============================================================================#
+.native.sampling <- function(pop, iterations, method=1, threads=1L){
+  mat   <- do.call("cbind", lapply(pop, tab))
+  storage.mode(mat) <- "integer"
+  n.all <- vapply(pop, function(x) ncol(tab(x)), integer(1))
+  ploid <- as.integer(ploidy(pop[[1]]))
+  res   <- matrix(numeric(iterations*2), ncol = 2)
+  p     <- make_progress(iterations, 50)
+  chunk <- if (p$step >= 1) p$step else iterations
+  done  <- 0L
+  while (done < iterations){
+    reps <- as.integer(min(chunk, iterations - done))
+    seed <- sample.int(.Machine$integer.max, 1L)
+    res[done + seq_len(reps), ] <- .Call("ia_permutation", mat, n.all, ploid, 
+                                         as.integer(method), reps, seed, 
+                                         as.integer(threads), PACKAGE = "poppr")
+    done <- done + reps
+    p$rog()
+  }
+  return(data.frame(Ia = res[, 1], rbarD = res[, 2]))
+}
+
 #==============================================================================#
 # pop = a list of genind objects with one locus each.
 # 
@@ -190,6 +190,8 @@ poppr.plot <- function(sample, pval = c(Ia = 0.05, rbarD = 0.05),
 #'   \code{\link{genlight}}, or \code{\link{snpclone}} object
 #'   
 #' @param distmat a distance matrix that has been derived from your data set.
+#'   This can also be a \code{\link[=write_dist_file]{dist_file}}, which is 
+#'   read from disk without loading all of the distances.
 #'   
 #' @param mlg.compute if the multilocus genotypes are set to "custom" (see 
 #'   \code{\link{mll.custom}} for details) in your genclone object, this will 
@@ -256,6 +258,10 @@ poppr.plot <- function(sample, pval = c(Ia = 0.05, rbarD = 0.05),
 #'   you have a data set that contains contracted MLGs, this argument will
 #'   override the algorithm in the data set. See Details.
 #'
+#' @param threads integer. The maximum number of parallel threads used to
+#'   search for tied edges when \code{include.ties = TRUE}. Defaults to 1. A
+#'   value of 0 will use as many threads as there are available cores/CPUs.
+#'
 #' @param ... any other arguments that could go into plot.igraph
 #'   
 #' @return \item{graph}{a minimum spanning network with nodes corresponding to 
@@ -267,7 +273,8 @@ poppr.plot <- function(sample, pval = c(Ia = 0.05, rbarD = 0.05),
 #'   
 #'   
 #' @details The minimum spanning network generated by this function is generated
-#'   via igraph's \code{\link[igraph:mst]{minimum.spanning.tree}}. The resultant
+#'   with Prim's algorithm in C, as in igraph's
+#'   \code{\link[igraph:mst]{minimum.spanning.tree}}. The resultant
 #'   graph produced can be plotted using igraph functions, or the entire object
 #'   can be plotted using the function \code{\link{plot_poppr_msn}}, which will
 #'   give the user a scale bar and the option to layout your data.
@@ -360,7 +367,7 @@ poppr.msn <- function (gid, distmat, palette = topo.colors, mlg.compute = "origi
                        gscale=TRUE, glim = c(0,0.8), gadj = 3, gweight = 1, 
                        wscale=TRUE, showplot = TRUE, 
                        include.ties = FALSE, threshold = NULL, 
-                       clustering.algorithm = NULL, ...){
+                       clustering.algorithm = NULL, threads = 1L, ...){
   
   # testing gid -------------------------------------------------------------
   if (!inherits(gid, c("genclone", "snpclone"))){
@@ -409,23 +416,33 @@ poppr.msn <- function (gid, distmat, palette = topo.colors, mlg.compute = "origi
   # testing dist ------------------------------------------------------------
   is_dist <- inherits(distmat, "dist")
   is_mat  <- inherits(distmat, "matrix")
-  if (is_dist | is_mat){
+  is_file <- inherits(distmat, "dist_file")
+  if (is_dist | is_mat | is_file){
     n       <- nInd(gid)
-    eq_size <- if (is_dist) n == attr(distmat, "Size") else n == nrow(distmat)
+    eq_size <- if (is_dist) n == attr(distmat, "Size") else 
+               if (is_file) n == length(dist_file_samples(distmat)) else 
+               n == nrow(distmat)
     if (!eq_size){
       stop("The size of the distance matrix does not match the size of the data.\n")
     }
   } else {
-    stop("The distance matrix is neither a dist object nor a matrix.\n")
+    stop("The distance matrix is neither a dist object, a matrix, nor a dist_file.\n")
+  }
+  if (is_file && !is.null(threshold)){
+    stop("A minimum spanning network can not be built from a dist_file with a threshold.\n")
+  }
+  # Distance files stay on disk and are subset by their samples
+  if (!is_file){
+    distmat <- as.matrix(distmat)
   }
-  distmat <- as.matrix(distmat)
   gadj   <- ifelse(gweight == 1, gadj, -gadj)
   
   # Subsetting the population -----------------------------------------------
   # This will subset both the population and the matrix. 
   if (toupper(sublist[1]) != "ALL" | !is.null(exclude)){
     sublist_exclude <- sub_index(gid, sublist, exclude)
-    distmat <- distmat[sublist_exclude, sublist_exclude, drop = FALSE]
+    distmat <- if (is_file) subset_dist_file(distmat, sublist_exclude) else 
+               distmat[sublist_exclude, sublist_exclude, drop = FALSE]
     gid    <- popsub(gid, sublist, exclude)
   }
 
@@ -442,9 +459,14 @@ poppr.msn <- function (gid, distmat, palette = topo.colors, mlg.compute = "origi
   } else {  
     cgid    <- gid[.clonecorrector(gid), ]
     singles <- !duplicated(mll(gid))
-    distmat <- distmat[singles, singles, drop = FALSE]
+    distmat <- if (is_file) subset_dist_file(distmat, singles) else 
+               distmat[singles, singles, drop = FALSE]
+  }
+  if (is_file){
+    distmat$labels <- indNames(cgid)
+  } else {
+    rownames(distmat) <- indNames(cgid) -> colnames(distmat)
   }
-  rownames(distmat) <- indNames(cgid) -> colnames(distmat)
   poppr_msn_list <- msn_constructor(
     gid = gid,
     cgid = cgid,
@@ -459,6 +481,7 @@ poppr.msn <- function (gid, distmat, palette = topo.colors, mlg.compute = "origi
     glim = glim,
     gadj = gadj,
     showplot = showplot,
+    threads = threads,
     ...)
   return(poppr_msn_list)
 }
@@ -1,7 +1,13 @@
+#include <stdint.h>
 #include <Rinternals.h>
 #include <Rdefines.h>
 #include <R.h>
 
+// Include openMP if the compiler supports it
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 /*
 #' Calculate correction for genetic distances
 #'
@@ -32,33 +38,35 @@
  
 */
 
+int count_unique_positions(int *arr1, int len1, int *arr2, int len2);
 int count_unique(SEXP arr1, SEXP arr2);
-SEXP adjust_missing(SEXP nas, SEXP nloc);
+SEXP adjust_missing(SEXP nas, SEXP nloc, SEXP requested_threads);
+int popcount64(uint64_t x); // from bitwise_distance.c
 /*
- * Count all unique elements for the union of two arrays
+ * Count all unique elements for the union of two sorted arrays
  * 
  * Parameters:
- *  arr1 an integer array of any length
- *  arr2 an integer array of any length
+ *  arr1 a sorted integer array of any length
+ *  len1 the length of arr1
+ *  arr2 a sorted integer array of any length
+ *  len2 the length of arr2
  *
  * Return:
  *  an integer that is between the length of the smallest array and the length
  *  of the largest array. 
  */
-int count_unique(SEXP arr1, SEXP arr2)
+int count_unique_positions(int *arr1, int len1, int *arr2, int len2)
 {
   int i = 0;
   int j = 0;
   int duplicates = 0;
-  int len1 = length(arr1);
-  int len2 = length(arr2);
   while (i < len1 && j < len2)
   {
-    if (INTEGER(arr1)[i] < INTEGER(arr2)[j])
+    if (arr1[i] < arr2[j])
     {
       i++;
     }
-    else if (INTEGER(arr1)[i] > INTEGER(arr2)[j])
+    else if (arr1[i] > arr2[j])
     {
       j++;
     }
@@ -71,49 +79,139 @@ int count_unique(SEXP arr1, SEXP arr2)
   }
   return len1 + len2 - duplicates;
 }
+/*
+ * Count all unique elements for the union of two R integer vectors
+ * 
+ * Parameters:
+ *  arr1 an integer array of any length
+ *  arr2 an integer array of any length
+ *
+ * Return:
+ *  an integer that is between the length of the smallest array and the length
+ *  of the largest array. 
+ */
+int count_unique(SEXP arr1, SEXP arr2)
+{
+  return count_unique_positions(INTEGER(arr1), length(arr1), 
+                                INTEGER(arr2), length(arr2));
+}
 /*
  * Calculate adjustment for missing data in pairwise comparisons. This will
  * return a square matrix that is used to multiply the raw differences of a
  * distance matrix in order to scale the differences by the number of observed
  * loci. 
+ *
+ * The missing positions of each sample are stored as a bitset of nloc bits so
+ * that the number of loci missing in either sample is the number of bits set
+ * in the union of the two bitsets. Only samples with missing data get a bitset
+ * and the pairs are computed in parallel over the columns.
  * 
  * Parameters:
  *  nas a list where each element represents a sample containing an integer 
  *      vector representing positions of missing data for that individual
  *  nloc an integer specifying the number of loci observed in the entire set
+ *  requested_threads the number of threads to use. 0 uses all available.
  * 
  * Return:
  *  a square matrix
  */
-SEXP adjust_missing(SEXP nas, SEXP nloc)
+SEXP adjust_missing(SEXP nas, SEXP nloc, SEXP requested_threads)
 {
   int i;
-  int j;
+  int k;
   int NLOC = asInteger(nloc);
-  SEXP nai;
-  SEXP naj;
-  double u;
   int n    = length(nas);
+  int num_words = (NLOC + 63)/64;
+  int num_threads;
+  int *num_missing;
+  uint64_t **bits;
+  int *nai;
   SEXP out = PROTECT(allocMatrix(REALSXP, n, n));
-  for (i = 0; i < n - 1; i++)
+  double *res = REAL(out);
+
+  num_missing = R_Calloc(n, int);
+  bits        = R_Calloc(n, uint64_t*);
+  for (i = 0; i < n; i++)
   {
+    num_missing[i] = length(VECTOR_ELT(nas, i));
+    bits[i]        = NULL;
+    if (num_missing[i] > 0)
+    {
+      nai     = INTEGER(VECTOR_ELT(nas, i));
+      bits[i] = R_Calloc(num_words, uint64_t);
+      for (k = 0; k < num_missing[i]; k++)
+      {
+        bits[i][(nai[k] - 1)/64] |= (uint64_t)1 << ((nai[k] - 1)%64);
+      }
+      // Positions are counted from the bitset in case they are repeated
+      num_missing[i] = 0;
+      for (k = 0; k < num_words; k++)
+      {
+        num_missing[i] += popcount64(bits[i][k]);
+      }
+    }
+  }
+
+  #ifdef _OPENMP
+  {
+    if (asInteger(requested_threads) == 0)
+    {
+      num_threads = omp_get_max_threads();
+    }
+    else
+    {
+      num_threads = asInteger(requested_threads);
+    }
+  }
+  #else
+  {
+    num_threads = 1;
+  }
+  #endif
+  num_threads = (num_threads < 1) ? 1 : num_threads;
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) private(i) num_threads(num_threads)
+  #endif
+  for (i = 0; i < n; i++)
+  {
+    int j;
+    int w;
+    int missing;
+    double u;
     // set diag to one
-    REAL(out)[i + i*n] = 1.0;
-    // GET NA list for i
-    nai = VECTOR_ELT(nas, i);
+    res[i + i*n] = 1.0;
     for (j = i + 1; j < n; j++)
     {
-      // Get NA list for j
-      naj = VECTOR_ELT(nas, j);
+      if (bits[i] != NULL && bits[j] != NULL)
+      {
+        missing = 0;
+        for (w = 0; w < num_words; w++)
+        {
+          missing += popcount64(bits[i][w] | bits[j][w]);
+        }
+      }
+      else
+      {
+        // At most one of these is not zero
+        missing = num_missing[i] + num_missing[j];
+      }
       // Scale by N/(N - M)
-      u   = (double)NLOC/(double)(NLOC - count_unique(nai, naj));
-      
-      REAL(out)[i + j*n] = u;
-      REAL(out)[i*n + j] = u;
+      u = (double)NLOC/(double)(NLOC - missing);
+      res[i + j*n] = u;
+      res[i*n + j] = u;
+    }
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    if (bits[i] != NULL)
+    {
+      R_Free(bits[i]);
     }
   }
-  // fencepost for identity
-  REAL(out)[(n*n) - 1] = 1.0;
+  R_Free(bits);
+  R_Free(num_missing);
   UNPROTECT(1);
   return(out);
 }
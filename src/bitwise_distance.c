@@ -36,6 +36,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <limits.h>
 #include <Rinternals.h>
 #include <R_ext/Utils.h>
 #include <Rdefines.h>
@@ -95,18 +96,123 @@ struct locus
   double n;  // Number of genotypes that contributed data to this struct
 };
 
+/*
+
+Genotype view struct
+====================
+
+A struct holding pointers to the packed SNP data and missing positions of every
+sample in a genlight object. This is filled once by fill_genotype_view so that
+the data can be read from multiple threads without touching the R API.
+
+The view can also be filled from a genotype store on disk by 
+fill_genotype_view_store. In that case, the pointers point into the memory
+mapped file and the missing data are a bitmap instead of positions.
+
+A view of a genlight object can be kept between calls from R as an external
+pointer made by genotype_view_pack. The missing positions of these views are
+decoded into a bitmap once when the pointer is made, and the genlight object is
+protected by the pointer so that the packed data stay valid.
+
+*/
+
+struct genotype_view
+{
+  int num_gens;     // Number of samples
+  int num_loci;     // Number of SNPs in each sample
+  int num_chunks;   // Number of 8 locus chunks in each sample
+  int ploidy;       // 1 for haploids, 2 for diploids
+  Rbyte** chr1;     // First set of chromosomes for each sample (@snp[[1]])
+  Rbyte** chr2;     // Second set of chromosomes for each sample (@snp[[2]])
+                    // These are NULL for haploids.
+  int** nap;        // Missing positions (1-based) for each sample (@NA.posi)
+  int* nap_length;  // Number of missing positions for each sample
+  Rbyte** na_mask;  // Missing positions for each sample as 8 locus chunks.
+                    // These are only used for genotype stores and packed views
+                    // (otherwise NULL).
+  Rbyte* na_bits;   // The bitmap na_mask points into for packed views
+  void* store;      // The memory mapped genotype store (NULL for genlights)
+  size_t store_size; // The number of bytes mapped
+};
+
+/*
+
+Genotype store header
+=====================
+
+The first 64 bytes of a genotype store. The header is followed by one record
+of (ploidy + 1)*num_chunks bytes per sample containing the first set of
+chromosomes, the second set of chromosomes (diploids only), and a bitmap of the
+missing data, each packed in 8 locus chunks in the same way as SNPbin objects.
+Since every record has the same size, the records can be read directly from a
+memory mapped file.
+
+*/
+
+#define STORE_MAGIC "POPPRSNP"
+#define STORE_VERSION 1
+#define STORE_HEADER_SIZE 64
+
+struct store_header
+{
+  char magic[8];         // "POPPRSNP"
+  uint32_t version;      // STORE_VERSION
+  uint32_t byte_order;   // 1 when read on a machine with the same byte order
+  uint32_t ploidy;       // 1 for haploids, 2 for diploids
+  uint32_t reserved_1;
+  uint64_t num_gens;     // Number of samples
+  uint64_t num_loci;     // Number of SNPs in each sample
+  uint64_t num_chunks;   // Number of 8 locus chunks in each sample
+  uint64_t record_size;  // Number of bytes per sample
+  uint64_t reserved_2;
+};
+
 
 SEXP bitwise_distance_haploid(SEXP genlight, SEXP missing, SEXP requested_threads);
 SEXP bitwise_distance_diploid(SEXP genlight, SEXP missing, SEXP euclid, SEXP differences_only, SEXP requested_threads);
+SEXP bitwise_distance_condensed(SEXP genlight, SEXP missing, SEXP euclid, SEXP differences_only, SEXP scale_missing, SEXP requested_threads);
+SEXP bitwise_distance_file(SEXP genlight, SEXP path, SEXP missing, SEXP euclid, SEXP differences_only, SEXP scale_missing, SEXP divisor, SEXP block_size, SEXP requested_threads);
 SEXP association_index_haploid(SEXP genlight, SEXP missing, SEXP requested_threads);
 SEXP association_index_diploid(SEXP genlight, SEXP missing, SEXP differences_only, SEXP requested_threads);
-SEXP get_pgen_matrix_genind(SEXP genind, SEXP freqs, SEXP pops, SEXP npop);
-// SEXP get_pgen_matrix_genlight(SEXP genlight, SEXP window);
-// void fill_Pgen(double *pgen, struct locus *loci, int interval, SEXP genlight);
-// void fill_loci(struct locus *loc, SEXP genlight);
+SEXP association_index_pa(SEXP tab, SEXP requested_threads);
+SEXP get_pgen_matrix_genind(SEXP genind, SEXP freqs, SEXP pops, SEXP npop, SEXP by_sample, SEXP requested_threads);
+SEXP get_pgen_matrix_genlight(SEXP genlight, SEXP pops, SEXP npop, SEXP window, SEXP requested_threads);
+void fill_Pgen(double *pgen, double *log_freqs, int interval, struct genotype_view *view, int *pops);
+void fill_loci(struct locus *loc, struct genotype_view *view, int *pops);
+void fill_log_genotype_freqs(double *log_freqs, struct locus *loci, int num_loci, int ploidy);
+void fill_genotype_view(struct genotype_view *view, SEXP genlight);
+void fill_genotype_view_store(struct genotype_view *view, SEXP path);
+void free_genotype_view(struct genotype_view *view);
+SEXP genotype_store_write(SEXP genlight, SEXP path, SEXP append);
+SEXP genotype_store_info(SEXP path);
+SEXP association_index_loci(SEXP x, SEXP loci, SEXP missing, SEXP differences_only, SEXP requested_threads);
+SEXP genotype_view_pack(SEXP genlight);
+SEXP genotype_view_size(SEXP R_ptr);
+int get_first_missing(int *nap, int nap_length, int locus);
+char get_missing_mask(int *nap, int nap_length, int *index, int chunk);
 void fill_zygosity(struct zygosity *ind);
 char get_similarity_set(struct zygosity *ind1, struct zygosity *ind2);
 int get_zeros(char sim_set);
+int popcount64(uint64_t x);
+static void fill_condensed_distances(struct genotype_view *view, int missing_match, int is_euclid, int only_differences, int scale, int first, int last, int num_threads, double *out);
+static double view_association_index(struct genotype_view *view, int *loci, int num_loci, int missing_match, int only_differences, int num_threads);
+static char get_view_missing_mask(struct genotype_view *view, int sample, int *index, int chunk);
+static int get_view_first_missing(struct genotype_view *view, int sample, int locus);
+static int bitwise_threads(SEXP requested_threads);
+static struct genotype_view* open_genotype_view(SEXP x, struct genotype_view *local);
+static void close_genotype_view(struct genotype_view *view, struct genotype_view *local);
+static void finalize_genotype_view(SEXP R_ptr);
+static void set_missing_bits(Rbyte *mask, int *nap, int nap_length);
+static SEXP packed_distance_matrix(SEXP R_ptr, SEXP missing, int euclid, int only_differences, SEXP requested_threads);
+static SEXP packed_association_index(SEXP R_ptr, SEXP missing, int only_differences, SEXP requested_threads);
+static int valid_store_header(struct store_header *header);
+static int64_t seek_file_end(FILE *file);
+// Defined in dist_file.c
+void* map_file(const char *filename, size_t *size);
+void unmap_file(void *data, size_t size);
+size_t dist_row_offset(int i, int n);
+int dist_block_end(int first, int n, size_t capacity);
+FILE* create_dist_file(const char *filename, int n);
 // int get_difference(struct zygosity *z1, struct zygosity *z2);
 // int get_distance(struct zygosity *z1, struct zygosity *z2);
 int get_distance_custom(char sim_set, struct zygosity *z1, struct zygosity *z2, int euclid);
@@ -115,7 +221,8 @@ int get_distance_custom(char sim_set, struct zygosity *z1, struct zygosity *z2,
 Calculates the pairwise differences between samples in a genlight object. The
 distances represent the number of sites between individuals which differ.
 
-Input: A genlight object containing samples of haploids.
+Input: A genlight object containing samples of haploids or a packed view of one
+          made by genotype_view_pack.
        A boolean representing whether missing data should match (TRUE) or not.
        An integer representing the number of threads that should be used.
 Output: A distance matrix representing the number of differences between each sample.
@@ -141,6 +248,12 @@ SEXP bitwise_distance_haploid(SEXP genlight, SEXP missing, SEXP requested_thread
     // Fill the final R return object and return it.
 
 
+  // Views packed by genotype_view_pack have already been read from R
+  if(TYPEOF(genlight) == EXTPTRSXP)
+  {
+    return packed_distance_matrix(genlight, missing, 0, 1, requested_threads);
+  }
+
   SEXP R_out;               // output matrix (n x n)
   SEXP R_gen_symbol;        // gen slot
   SEXP R_chr_symbol;        // snp slot
@@ -441,7 +554,8 @@ zygosity (if differences_only is TRUE) or the number of differing alleles (0 for
 matching zygosity, 1 for the distance between a heterozygote and a homozygote,
 and 2 for the distance between differing homozygotes).
 
-Input: A genlight object containing samples of diploids.
+Input: A genlight object containing samples of diploids or a packed view of one
+          made by genotype_view_pack.
        A boolean representing whether missing data should match (TRUE) or not.
        A boolean indicating if euclidian distance should be calculated (TRUE) or not.
        A boolean representing whether distance (FALSE) or differences (TRUE)
@@ -470,6 +584,13 @@ SEXP bitwise_distance_diploid(SEXP genlight, SEXP missing, SEXP euclid, SEXP dif
           // Update the output matrix with the distances found in this chunk.
     // Fill the final R return object and return it.
 
+  // Views packed by genotype_view_pack have already been read from R
+  if(TYPEOF(genlight) == EXTPTRSXP)
+  {
+    return packed_distance_matrix(genlight, missing, asLogical(euclid), 
+                                  asLogical(differences_only), requested_threads);
+  }
+
   SEXP R_out;
   SEXP R_gen_symbol;
   SEXP R_chr_symbol;
@@ -752,10 +873,236 @@ SEXP bitwise_distance_diploid(SEXP genlight, SEXP missing, SEXP euclid, SEXP dif
   return R_out;
 }
 
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Calculates the pairwise distances between samples in a genlight object of
+haploids or diploids and writes them directly into the lower triangle of a
+distance matrix in the order used by R's dist objects.
+
+This gives the same values as bitwise_distance_haploid and
+bitwise_distance_diploid, but the distances can be scaled for missing data by
+m/(m - x), where m is the number of loci and x is the number of loci missing in
+either sample, as missing_correction() does in R. The number of loci missing in
+either sample is counted from the same missing masks that are used to force
+matches, so scaling costs nothing extra. For the euclidean distance, these are
+the squared distances. No n x n matrices are created.
+
+Input: A genlight object containing samples of haploids or diploids, a packed
+          view of one made by genotype_view_pack, or the path to a genotype
+          store written by genotype_store_write.
+       A boolean representing whether missing data should match (TRUE) or not.
+       A boolean representing whether the squared euclidean distance should
+          be calculated (diploids only).
+       A boolean representing whether distances or differences should be counted.
+       A boolean representing whether the distances should be scaled by the
+          number of loci missing in either sample.
+       An integer representing the number of threads that should be used.
+Output: A vector of length n(n - 1)/2 of the distances between each sample.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP bitwise_distance_condensed(SEXP genlight, SEXP missing, SEXP euclid,
+                                SEXP differences_only, SEXP scale_missing,
+                                SEXP requested_threads)
+{
+  SEXP R_out;
+  struct genotype_view local;
+  struct genotype_view *view;
+
+  view = open_genotype_view(genlight, &local);
+  R_out = PROTECT(allocVector(REALSXP, (R_xlen_t)view->num_gens*(view->num_gens - 1)/2));
+  fill_condensed_distances(view, asLogical(missing), asLogical(euclid),
+                           asLogical(differences_only), asLogical(scale_missing),
+                           0, view->num_gens, bitwise_threads(requested_threads), 
+                           REAL(R_out));
+  close_genotype_view(view, &local);
+  UNPROTECT(1);
+  return R_out;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Calculates the same distances as bitwise_distance_condensed, but writes them to
+a distance file (see dist_file.c) one block of samples at a time, so that only
+block_size distances are in memory at once. The distances can be scaled before
+they are written so that the file holds the same values as bitwise.dist.
+
+Input: A genlight object containing samples of haploids or diploids, a packed
+          view of one made by genotype_view_pack, or the path to a genotype
+          store written by genotype_store_write.
+       The path to the distance file.
+       Booleans for missing, euclid, differences_only, and scale_missing (see
+          bitwise_distance_condensed). When euclid is TRUE, the square root of
+          each distance is written.
+       A number that each distance is divided by.
+       The maximum number of distances to calculate at once.
+       An integer representing the number of threads that should be used.
+Output: The number of samples.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP bitwise_distance_file(SEXP genlight, SEXP path, SEXP missing, SEXP euclid,
+                           SEXP differences_only, SEXP scale_missing, 
+                           SEXP divisor, SEXP block_size, SEXP requested_threads)
+{
+  struct genotype_view local;
+  struct genotype_view *view;
+  const char *filename;
+  FILE *file;
+  double *block;
+  double denominator;
+  size_t capacity;
+  size_t count;
+  size_t k;
+  int num_gens;
+  int num_threads;
+  int is_euclid;
+  int first;
+  int last;
+  int failed;
+
+  filename = CHAR(STRING_ELT(path, 0));
+  is_euclid = asLogical(euclid);
+  denominator = asReal(divisor);
+  num_threads = bitwise_threads(requested_threads);
+  view = open_genotype_view(genlight, &local);
+  num_gens = view->num_gens;
+  file = create_dist_file(filename, num_gens);
+  if(file == NULL)
+  {
+    close_genotype_view(view, &local);
+    error("Could not open %s.", filename);
+  }
+  // Every block holds at least one sample
+  capacity = (size_t)asReal(block_size);
+  capacity = (capacity < (size_t)num_gens) ? (size_t)num_gens : capacity;
+  block = R_Calloc(capacity, double);
+  failed = 0;
+  for(first = 0; first < num_gens - 1 && !failed; first = last)
+  {
+    last = dist_block_end(first, num_gens, capacity);
+    count = dist_row_offset(last, num_gens) - dist_row_offset(first, num_gens);
+    fill_condensed_distances(view, asLogical(missing), is_euclid,
+                             asLogical(differences_only), 
+                             asLogical(scale_missing), first, last, 
+                             num_threads, block);
+    for(k = 0; k < count; k++)
+    {
+      block[k] = ((is_euclid) ? sqrt(block[k]) : block[k])/denominator;
+    }
+    failed = fwrite(block, sizeof(double), count, file) != count;
+  }
+  failed = (fclose(file) != 0) || failed;
+  R_Free(block);
+  close_genotype_view(view, &local);
+  if(failed)
+  {
+    error("Could not write to %s.", filename);
+  }
+  return ScalarInteger(num_gens);
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Fills a vector with the pairwise distances between the samples in a genotype
+view for bitwise_distance_condensed. Only the distances of the samples from 
+first up to last (to the samples after them) are calculated, so that large 
+data can be written to a distance file in blocks.
+
+Input: A filled genotype view.
+       Booleans for missing_match, euclid, differences_only, and scale_missing
+          (see bitwise_distance_condensed).
+       The first sample and the sample after the last sample (0-based). These
+          are 0 and n for all distances.
+       The number of threads to use.
+       A vector to hold the distances of the samples from first to last in the
+          order of a dist object. This has a length of n(n - 1)/2 for all 
+          distances.
+Output: None. The distances are written to out.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static void fill_condensed_distances(struct genotype_view *view, int missing_match,
+                                     int is_euclid, int only_differences, 
+                                     int scale, int first, int last,
+                                     int num_threads, double *out)
+{
+  int num_gens = view->num_gens;
+  size_t start = dist_row_offset(first, num_gens);
+  int i;
+
+  // Each sample i fills the column of the lower triangle below it, so threads
+  // never write to the same position.
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) private(i) num_threads(num_threads)
+  #endif
+  for(i = first; i < last; i++)
+  {
+    int j;
+    int k;
+    int index_i;
+    int index_j;
+    int cur_distance;
+    int num_missing;
+    char mask_i;
+    char mask_j;
+    char sim_set;
+    struct zygosity set_1;
+    struct zygosity set_2;
+    double* column = out + (dist_row_offset(i, num_gens) - start);
+
+    for(j = i + 1; j < num_gens; j++)
+    {
+      cur_distance = 0;
+      num_missing = 0;
+      index_i = 0;
+      index_j = 0;
+      for(k = 0; k < view->num_chunks; k++)
+      {
+        mask_i = get_view_missing_mask(view, i, &index_i, k);
+        mask_j = get_view_missing_mask(view, j, &index_j, k);
+        if(mask_i | mask_j)
+        {
+          num_missing += 8 - get_zeros(mask_i | mask_j);
+        }
+        set_1.c1 = (char)view->chr1[i][k];
+        set_2.c1 = (char)view->chr1[j][k];
+        if(view->ploidy == 2)
+        {
+          set_1.c2 = (char)view->chr2[i][k];
+          set_2.c2 = (char)view->chr2[j][k];
+          fill_zygosity(&set_1);
+          fill_zygosity(&set_2);
+          sim_set = get_similarity_set(&set_1, &set_2);
+        }
+        else
+        {
+          // 1's where the haploid samples match
+          sim_set = ~(set_1.c1 ^ set_2.c1);
+        }
+        // Force missing data to match (or not match)
+        if(missing_match)
+        {
+          sim_set |= (mask_i | mask_j);
+        }
+        else
+        {
+          sim_set &= ~(mask_i | mask_j);
+        }
+        if(only_differences || view->ploidy == 1)
+        {
+          cur_distance += get_zeros(sim_set);
+        }
+        else
+        {
+          cur_distance += get_distance_custom(sim_set, &set_1, &set_2, is_euclid);
+        }
+      }
+      column[j - i - 1] = (double)cur_distance;
+      if(scale && num_missing > 0)
+      {
+        column[j - i - 1] *= (double)view->num_loci/(double)(view->num_loci - num_missing);
+      }
+    }
+  }
+}
+
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 Calculates the index of association of a genlight object of haploids.
 
-Input: A genlight object containing samples of diploids.
+Input: A genlight object containing samples of haploids or a packed view of one
+          made by genotype_view_pack.
        A boolean representing whether or not missing values should match.
        An integer representing the number of threads to be used.
 Output: The index of association for this genlight object
@@ -794,6 +1141,12 @@ SEXP association_index_haploid(SEXP genlight, SEXP missing, SEXP requested_threa
       // denom = 2*sumij(sqrt(vars[i]*vars[j])), such that all combinations of i and j are covered once
     // Store and return the final value for the index of association, (Ve - Vo)/denom
 
+  // Views packed by genotype_view_pack have already been read from R
+  if(TYPEOF(genlight) == EXTPTRSXP)
+  {
+    return packed_association_index(genlight, missing, 1, requested_threads);
+  }
+
   SEXP R_out;
   SEXP R_gen_symbol;
   SEXP R_chr_symbol;
@@ -1125,7 +1478,8 @@ SEXP association_index_haploid(SEXP genlight, SEXP missing, SEXP requested_threa
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 Calculates the index of association of a genlight object of diploids.
 
-Input: A genlight object containing samples of diploids.
+Input: A genlight object containing samples of diploids or a packed view of one
+          made by genotype_view_pack.
        A boolean representing whether or not missing values should match.
        A boolean representing whether distances or differences should be counted.
        An integer representing the number of threads to be used.
@@ -1166,6 +1520,13 @@ SEXP association_index_diploid(SEXP genlight, SEXP missing, SEXP differences_onl
       // denom = 2*sumij(sqrt(vars[i]*vars[j])), such that all combinations of i and j are covered once
     // Store and return the final value for the index of association, (Ve - Vo)/denom
 
+  // Views packed by genotype_view_pack have already been read from R
+  if(TYPEOF(genlight) == EXTPTRSXP)
+  {
+    return packed_association_index(genlight, missing, asLogical(differences_only),
+                                    requested_threads);
+  }
+
   SEXP R_out;
   SEXP R_gen_symbol;
   SEXP R_chr_symbol;
@@ -1530,6 +1891,373 @@ SEXP association_index_diploid(SEXP genlight, SEXP missing, SEXP differences_onl
 
 
 
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Calculates the index of association over a set of loci without subsetting the
+data. This gives the same value as association_index_haploid or 
+association_index_diploid on a genlight object containing only those loci.
+
+Input: A genlight object containing samples of haploids or diploids, a packed
+          view of one made by genotype_view_pack, or the path to a genotype
+          store written by genotype_store_write.
+       A sorted integer vector of the (0-based) loci to use.
+       A boolean representing whether or not missing values should match.
+       A boolean representing whether distances or differences should be counted.
+       An integer representing the number of threads to be used.
+Output: The index of association for these loci.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP association_index_loci(SEXP x, SEXP loci, SEXP missing, 
+                            SEXP differences_only, SEXP requested_threads)
+{
+  SEXP R_out;
+  struct genotype_view local;
+  struct genotype_view *view;
+  int i;
+
+  view = open_genotype_view(x, &local);
+  for(i = 0; i < XLENGTH(loci); i++)
+  {
+    if(INTEGER(loci)[i] < 0 || INTEGER(loci)[i] >= view->num_loci ||
+       (i > 0 && INTEGER(loci)[i] <= INTEGER(loci)[i - 1]))
+    {
+      close_genotype_view(view, &local);
+      error("The loci must be sorted, unique, and within the data.");
+    }
+  }
+  R_out = PROTECT(allocVector(REALSXP, 1));
+  REAL(R_out)[0] = view_association_index(view, INTEGER(loci), XLENGTH(loci),
+                                          asLogical(missing), 
+                                          asLogical(differences_only),
+                                          bitwise_threads(requested_threads));
+  close_genotype_view(view, &local);
+  UNPROTECT(1);
+  return R_out;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Calculates the index of association over a set of loci in a genotype view.
+
+Unlike association_index_haploid and association_index_diploid, the samples are
+not copied. Each pair of samples is visited once, in order, so the records of a
+memory mapped store are read sequentially. The distance between the pair is 
+counted in the same way as fill_condensed_distances and the distance at each 
+locus in the same way as association_index_diploid, with the loci that were not
+selected masked out of both. Each thread sums the distances at each locus 
+separately and these are added together at the end.
+
+Input: A filled genotype view.
+       A sorted array of the (0-based) loci to use and its length.
+       A boolean representing whether or not missing values should match.
+       A boolean representing whether distances or differences should be counted.
+       The number of threads to use.
+Output: The index of association for these loci.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static double view_association_index(struct genotype_view *view, int *loci,
+                                     int num_loci, int missing_match,
+                                     int only_differences, int num_threads)
+{
+  int num_gens = view->num_gens;
+  int first_chunk;
+  int num_chunks;
+  int num_sites;
+  int i;
+  int t;
+  unsigned char* selected; // 1's at the loci to use in each chunk
+  double* M;   // Sum of distances at each locus (for each thread)
+  double* M2;  // Sum of squared distances at each locus (for each thread)
+  int64_t D;   // Sum of distances between each sample
+  int64_t D2;  // Sum of squared distances between each sample
+  double Vo;   // Observed variance
+  double Ve;   // Expected variance
+  double Nc2;  // num_gens choose 2
+  double sd;   // Sum of the standard deviations at each locus
+  double var;
+
+  if(num_loci < 1 || num_gens < 2)
+  {
+    return NA_REAL;
+  }
+  first_chunk = loci[0]/8;
+  num_chunks = loci[num_loci - 1]/8 - first_chunk + 1;
+  num_sites = num_chunks*8;
+  selected = R_Calloc(num_chunks, unsigned char);
+  for(i = 0; i < num_loci; i++)
+  {
+    selected[loci[i]/8 - first_chunk] |= 1 << (loci[i]%8);
+  }
+  M = R_Calloc((size_t)num_threads*num_sites, double);
+  M2 = R_Calloc((size_t)num_threads*num_sites, double);
+  D = 0;
+  D2 = 0;
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) reduction(+ : D,D2) private(i) num_threads(num_threads)
+  #endif
+  for(i = 0; i < num_gens - 1; i++)
+  {
+    int j;
+    int c;
+    int k;
+    int x;
+    int start_i;
+    int index_i;
+    int index_j;
+    int cur_distance;
+    unsigned char mask_i;
+    unsigned char mask_j;
+    unsigned char missing;
+    unsigned char Sn;  // Sites that differ
+    unsigned char Hs;  // Sites that differ between homozygotes
+    unsigned char val;
+    char sim_set;
+    struct zygosity set_1;
+    struct zygosity set_2;
+    int thread = 0;
+    #ifdef _OPENMP
+    thread = omp_get_thread_num();
+    #endif
+    double* Mt = M + (size_t)thread*num_sites;
+    double* M2t = M2 + (size_t)thread*num_sites;
+
+    start_i = get_view_first_missing(view, i, first_chunk*8);
+    for(j = i + 1; j < num_gens; j++)
+    {
+      cur_distance = 0;
+      index_i = start_i;
+      index_j = get_view_first_missing(view, j, first_chunk*8);
+      for(c = 0; c < num_chunks; c++)
+      {
+        k = first_chunk + c;
+        mask_i = get_view_missing_mask(view, i, &index_i, k);
+        mask_j = get_view_missing_mask(view, j, &index_j, k);
+        missing = mask_i | mask_j;
+        if(selected[c] == 0)
+        {
+          continue;
+        }
+        set_1.c1 = (char)view->chr1[i][k];
+        set_2.c1 = (char)view->chr1[j][k];
+        if(view->ploidy == 2)
+        {
+          set_1.c2 = (char)view->chr2[i][k];
+          set_2.c2 = (char)view->chr2[j][k];
+          fill_zygosity(&set_1);
+          fill_zygosity(&set_2);
+          sim_set = get_similarity_set(&set_1, &set_2);
+          Sn = ~sim_set;
+          Hs = Sn & ~(set_1.ch | set_2.ch);
+        }
+        else
+        {
+          sim_set = ~(set_1.c1 ^ set_2.c1);
+          Sn = set_1.c1 ^ set_2.c1;
+          Hs = 0;
+        }
+
+        // The distance between the samples
+        sim_set = (missing_match) ? (sim_set | missing) : (sim_set & ~missing);
+        sim_set |= ~selected[c];
+        if(only_differences || view->ploidy == 1)
+        {
+          cur_distance += get_zeros(sim_set);
+        }
+        else
+        {
+          cur_distance += get_distance_custom(sim_set, &set_1, &set_2, 0);
+        }
+
+        // The distance at each locus
+        if(missing_match)
+        {
+          Sn &= ~missing;
+          Hs &= ~missing;
+        }
+        else
+        {
+          Sn |= missing;
+          if(view->ploidy == 2)
+          {
+            Hs |= (~set_2.ch & mask_i);
+            Hs |= (~set_1.ch & mask_j);
+          }
+        }
+        Sn &= selected[c];
+        Hs &= selected[c];
+        for(x = 0; x < 8; x++)
+        {
+          val = (Sn >> x) & 1;
+          if(!only_differences)
+          {
+            val += (Hs >> x) & 1;
+          }
+          Mt[x + c*8] += (double)val;
+          M2t[x + c*8] += (double)val*(double)val;
+        }
+      }
+      D += cur_distance;
+      D2 += (int64_t)cur_distance*cur_distance;
+    }
+  }
+
+  for(t = 1; t < num_threads; t++)
+  {
+    for(i = 0; i < num_sites; i++)
+    {
+      M[i] += M[i + (size_t)t*num_sites];
+      M2[i] += M2[i + (size_t)t*num_sites];
+    }
+  }
+
+  Nc2 = ((double)num_gens*num_gens - num_gens)/2.0;
+  Vo = ((double)D2 - ((double)D*(double)D)/Nc2) / Nc2;
+  // The denominator, 2*sum(sqrt(var[i]*var[j])) over all pairs of loci, is 
+  // the square of the summed standard deviations without the variances.
+  Ve = 0;
+  sd = 0;
+  for(i = 0; i < num_loci; i++)
+  {
+    t = loci[i] - first_chunk*8;
+    var = (M2[t] - (M[t]*M[t])/Nc2) / Nc2;
+    Ve += var;
+    sd += sqrt(var);
+  }
+
+  R_Free(selected);
+  R_Free(M);
+  R_Free(M2);
+  return (Vo - Ve) / (sd*sd - Ve);
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Calculates the sums needed for the index of association of presence/absence
+data in a genind object.
+
+Each column of the table is a binary marker, so the markers of every sample are
+packed into 64 bit words along with a second set of words marking the markers
+that are not missing. The distance between two samples is then the number of
+set bits in the XOR of their markers where both are observed. Missing data do
+not contribute to the distance, as in .PA.pairwise.differences().
+
+Input: An integer matrix of samples by markers containing 0, 1, or NA.
+       An integer representing the number of threads to be used.
+Output: A list containing
+          - the number of pairs of samples that differ at each marker
+          - the sum of the distances between all pairs of samples
+          - the sum of the squared distances between all pairs of samples
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP association_index_pa(SEXP tab, SEXP requested_threads)
+{
+  SEXP R_out;
+  SEXP R_d;
+  SEXP R_dim;
+  int num_gens;
+  int num_loci;
+  int num_words;
+  int num_threads;
+  int i;
+  int j;
+  int w;
+  int x;
+  int val;
+  int dist;
+  int* tab_ptr;
+  double present;
+  double dominant;
+  double D;         // Sum of distances between each sample
+  double D2;        // Sum of squared distances between each sample
+  uint64_t* chunks; // Packed markers for each sample
+  uint64_t* typed;  // Packed non-missing positions for each sample
+  uint64_t* chunk_i;
+  uint64_t* typed_i;
+  uint64_t* chunk_j;
+  uint64_t* typed_j;
+
+  R_dim = getAttrib(tab, R_DimSymbol);
+  num_gens = INTEGER(R_dim)[0];
+  num_loci = INTEGER(R_dim)[1];
+  num_words = (num_loci + 63)/64;
+  tab_ptr = INTEGER(tab);
+
+  R_out = PROTECT(allocVector(VECSXP, 3));
+  R_d = PROTECT(allocVector(REALSXP, num_loci));
+
+  chunks = R_Calloc((size_t)num_gens*num_words, uint64_t);
+  typed = R_Calloc((size_t)num_gens*num_words, uint64_t);
+
+  // Pack the markers and count the pairs that differ at each marker. Only
+  // pairs where both samples are typed can differ.
+  for(x = 0; x < num_loci; x++)
+  {
+    present = 0;
+    dominant = 0;
+    for(i = 0; i < num_gens; i++)
+    {
+      val = tab_ptr[i + (size_t)x*num_gens];
+      if (val == NA_INTEGER)
+      {
+        continue;
+      }
+      present += 1;
+      typed[(size_t)i*num_words + x/64] |= (uint64_t)1 << (x%64);
+      if (val > 0)
+      {
+        dominant += 1;
+        chunks[(size_t)i*num_words + x/64] |= (uint64_t)1 << (x%64);
+      }
+    }
+    REAL(R_d)[x] = dominant*(present - dominant);
+  }
+
+  #ifdef _OPENMP
+  {
+    if(INTEGER(requested_threads)[0] == 0)
+    {
+      num_threads = omp_get_max_threads();
+    }
+    else
+    {
+      num_threads = INTEGER(requested_threads)[0];
+    }
+  }
+  #else
+  {
+    num_threads = 1;
+  }
+  #endif
+  num_threads = (num_threads < 1) ? 1 : num_threads;
+
+  D = 0;
+  D2 = 0;
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) reduction(+ : D,D2) \
+    private(i,j,w,dist,chunk_i,typed_i,chunk_j,typed_j) num_threads(num_threads)
+  #endif
+  for(i = 0; i < num_gens; i++)
+  {
+    chunk_i = chunks + (size_t)i*num_words;
+    typed_i = typed + (size_t)i*num_words;
+    for(j = i + 1; j < num_gens; j++)
+    {
+      chunk_j = chunks + (size_t)j*num_words;
+      typed_j = typed + (size_t)j*num_words;
+      dist = 0;
+      for(w = 0; w < num_words; w++)
+      {
+        dist += popcount64((chunk_i[w] ^ chunk_j[w]) & typed_i[w] & typed_j[w]);
+      }
+      D += (double)dist;
+      D2 += (double)dist*(double)dist;
+    }
+  }
+
+  SET_VECTOR_ELT(R_out, 0, R_d);
+  SET_VECTOR_ELT(R_out, 1, ScalarReal(D));
+  SET_VECTOR_ELT(R_out, 2, ScalarReal(D2));
+  R_Free(chunks);
+  R_Free(typed);
+  UNPROTECT(2);
+  return R_out;
+}
+
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 Calculates and returns a matrix of Pgen values for each genotype and loci in
 the genind or genclone  object.
@@ -1538,9 +2266,15 @@ Input: A genind or genclone object containing samples of diploids.
        A frequency matrix constructed in R with makefreq(genind2genpop(genind)).
        A vector of population indices for all samples.
        An integer specifying the number of populations.
-Output: A matrix containing the Pgen value of each genotype at each locus.
+       A boolean indicating whether the per-sample sum over all loci (TRUE)
+          should be returned instead of the full matrix (FALSE).
+       An integer representing the number of threads that should be used.
+Output: A matrix containing the log Pgen value of each genotype at each locus or
+        a vector of the summed log Pgen values for each genotype, ignoring
+        missing loci.
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-SEXP get_pgen_matrix_genind(SEXP genind, SEXP freqs, SEXP pops, SEXP npop)
+SEXP get_pgen_matrix_genind(SEXP genind, SEXP freqs, SEXP pops, SEXP npop, 
+                            SEXP by_sample, SEXP requested_threads)
 {
   SEXP R_out;           // The output R object. it's pointer is *pgens
   SEXP R_tab_symbol;    // Symbol for tab slot
@@ -1558,22 +2292,25 @@ SEXP get_pgen_matrix_genind(SEXP genind, SEXP freqs, SEXP pops, SEXP npop)
   // Data in and data out ------------------------------
   int* ploidy;            // Ploidy per sample
   int* alleles_per_locus; // self explanitory
+  int* locus_start;       // column index of the first allele of each locus
   int* gt;                // genotype matrix
+  int* pop_index;         // population index per sample
   double* afreq;          // allele frequency matrix
+  double* log_afreq;      // log allele frequency matrix (num_pops x num_alleles)
   double* pgens;          // output
 
   // Benchmarks ------------------------------
-  int num_gens; // number of genotypes (for *pgen and *gt)
-  int num_loci; // number of loci (for *pgen)
-  int num_pops; // number of pops (for *afreq)
+  int num_gens;    // number of genotypes (for *pgen and *gt)
+  int num_loci;    // number of loci (for *pgen)
+  int num_pops;    // number of pops (for *afreq)
+  int num_alleles; // number of columns in *gt
+  int num_threads;
+  int sum_loci;    // should the rows be summed?
 
   // Iterators ------------------------------
-  int index;        // iterator to store the number of remaining alleles
-  int pop;          // index for the population for each sample
-  int i;            // sample index
-  int j;            // locus index
-  int k;            // allele index
-  int alleles_seen; // number of non-zero alleles seen at a locus
+  int i; // sample index
+  int j; // locus index
+  int k; // allele index
 
   // Misc ------------------------------
   double h; // heterozygosity multiplier. 0 if haploid, log 2 if diploid.
@@ -1583,72 +2320,137 @@ SEXP get_pgen_matrix_genind(SEXP genind, SEXP freqs, SEXP pops, SEXP npop)
   R_tab = getAttrib(genind, R_tab_symbol);
   gt = INTEGER(R_tab);
   afreq = REAL(freqs);
+  pop_index = INTEGER(pops);
   num_gens = INTEGER(getAttrib(R_tab, R_DimSymbol))[0];
+  num_alleles = INTEGER(getAttrib(R_tab, R_DimSymbol))[1];
   num_loci = XLENGTH(R_nall);
   alleles_per_locus = INTEGER(R_nall);
   num_pops = INTEGER(npop)[0];
-  R_out = PROTECT(allocMatrix(REALSXP, num_gens, num_loci));
+  sum_loci = asLogical(by_sample);
+  if (sum_loci)
+  {
+    R_out = PROTECT(allocVector(REALSXP, num_gens));
+  }
+  else
+  {
+    R_out = PROTECT(allocMatrix(REALSXP, num_gens, num_loci));
+  }
   pgens = REAL(R_out);
+  h = log(2);
 
-  // Tue Sep  1 11:19:55 2015 ------------------------------
-  // I have sped up this function by removing the uncessecary step of looping
-  // through the entire matrix in order to find the indices of the alleles.
-
-  // Loop through all samples
-  for (i = 0; i < num_gens; i++)
+  #ifdef _OPENMP
   {
-    R_CheckUserInterrupt();
+    // Set the number of threads to be used in each omp parallel region
+    if(INTEGER(requested_threads)[0] == 0)
+    {
+      num_threads = omp_get_max_threads();
+    }
+    else
+    {
+      num_threads = INTEGER(requested_threads)[0];
+    }
+    omp_set_num_threads(num_threads);
+  }
+  #else
+  {
+    num_threads = 1;
+  }
+  #endif
+
+  // Sun Oct 18 09:42:17 2026 ------------------------------
+  // The logarithm of each allele frequency only needs to be taken once per
+  // population. Previously, this was taken for every allele of every sample.
+  log_afreq = R_Calloc(num_pops*num_alleles, double);
+  for (k = 0; k < num_pops*num_alleles; k++)
+  {
+    log_afreq[k] = log(afreq[k]);
+  }
+  locus_start = R_Calloc(num_loci, int);
+  for (j = 0, k = 0; j < num_loci; j++)
+  {
+    locus_start[j] = k;
+    k += alleles_per_locus[j];
+  }
+
+  // Tue Sep  1 11:19:55 2015 ------------------------------
+  // I have sped up this function by removing the uncessecary step of looping
+  // through the entire matrix in order to find the indices of the alleles.
+  //
+  // Each sample only writes to its own row of the output, so samples can be
+  // processed independently in parallel.
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(static) private(i, j, k)
+  #endif
+  for (i = 0; i < num_gens; i++)
+  {
+    int pop;          // index for the population for each sample
+    int allele;       // column of the current allele
+    int alleles_seen; // number of non-zero alleles seen at a locus
+    double het;       // heterozygosity multiplier for this sample
+    double res;       // log pgen at the current locus
+    double total;     // log pgen summed over all non-missing loci
+    const double* sample_freq;
+
     // Get the index for the allele frequencies
-    pop = INTEGER(pops)[i] - 1;
+    pop = pop_index[i] - 1;
+    sample_freq = log_afreq + pop;
     // h depends on ploidy.
     // It doesn't make sense to have a muliplier for haploids.
-    h = (ploidy[i] == 1) ? 0 : log(2);
-    alleles_seen = 0;
-    k = 0;
-    double res; // variable to make things readable
+    het = (ploidy[i] == 1) ? 0 : h;
+    total = 0;
     for (j = 0; j < num_loci; j++)
     {
       // looping over each locus in a sample. Since we don't know where the
-      // alleles are, we set up a while loop to run through the number of
-      // alleles we find at the locus.
-      index = alleles_per_locus[j];
-      pgens[i + j*num_gens] = 0; // set the value to zero so we can add to it.
-      while(index > 0)
+      // alleles are, we run through the alleles at the locus until we have
+      // seen enough of them to account for the ploidy.
+      res = 0; // set the value to zero so we can add to it.
+      alleles_seen = 0;
+      for (k = 0; k < alleles_per_locus[j]; k++)
       {
-        if (gt[i + k*num_gens] == NA_INTEGER) // missing data
+        allele = locus_start[j] + k;
+        if (gt[i + allele*num_gens] == NA_INTEGER) // missing data
         {
-          pgens[i + j*num_gens] = NA_REAL;
-          goto reset;
+          res = NA_REAL;
+          break;
         }
-        else if (gt[i + k*num_gens] == 2) // homozygote
+        else if (gt[i + allele*num_gens] == 2) // homozygote
         {
-          res = afreq[pop + k*num_pops];
-          pgens[i + j*num_gens] = log(res) + log(res); // p^2
-          goto reset;
+          res = sample_freq[allele*num_pops] + sample_freq[allele*num_pops]; // p^2
+          break;
         }
-        else if (gt[i + k*num_gens] == 1) // heterozygote/haploid
+        else if (gt[i + allele*num_gens] == 1) // heterozygote/haploid
         {
           alleles_seen++;
-          res = afreq[pop + k*num_pops];
           // incremental adding is independent of ploidy
-          pgens[i + j*num_gens] += log(res);
+          res += sample_freq[allele*num_pops];
           if (alleles_seen == ploidy[i]) // Escape is dependent on ploidy
           {
-            alleles_seen = 0;
-            pgens[i + j*num_gens] += h; // 2pq
-            goto reset;
+            res += het; // 2pq
+            break;
           }
         }
         // if none of the conditions were met, we go to the next allele.
-        k++;
-        index--;
       }
-      // When all of the alleles have been filled, we move onto the next locus
-      // by incrementing k with the number of alleles left in the locus.
-      reset:
-        k += index;
+      if (sum_loci)
+      {
+        // Equivalent to rowSums(pgen, na.rm = TRUE)
+        if (!ISNA(res))
+        {
+          total += res;
+        }
+      }
+      else
+      {
+        pgens[i + j*num_gens] = res;
+      }
+    }
+    if (sum_loci)
+    {
+      pgens[i] = total;
     }
   }
+  R_Free(log_afreq);
+  R_Free(locus_start);
   UNPROTECT(4);
   return R_out;
 }
@@ -1656,350 +2458,941 @@ SEXP get_pgen_matrix_genind(SEXP genind, SEXP freqs, SEXP pops, SEXP npop)
 // Mon Aug 31 18:16:46 2015 ------------------------------
 // pgen for genlight objects is taken away since it doesn't particularly make
 // sense as the value would crash to zero due to the vast number of loci.
+//
+// Sun Oct 18 11:03:52 2026 ------------------------------
+// pgen for genlight objects is back. Since the values are kept on the log
+// scale and summed over windows of loci, they no longer crash to zero. The
+// packed data for all samples is gathered once in a genotype_view so that the
+// loops below can be run in parallel without touching the R API.
 
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-Calculates and returns a matrix of Pgen values for the given genlight object.
+Calculates and returns a matrix of log Pgen values for the given genlight object
+summed over windows of loci.
 
-Input: A genlight object containing samples of diploids.
-Output: A matrix containing the Pgen value of each locus in each genotype in the
-        genlight object.
-~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~/
-SEXP get_pgen_matrix_genlight(SEXP genlight, SEXP window)
+Input: A genlight object containing samples of haploids or diploids.
+       A vector of population indices for all samples.
+       An integer specifying the number of populations.
+       An integer specifying the number of loci in each window.
+       An integer representing the number of threads that should be used.
+Output: A matrix containing the log Pgen value of each genotype (rows) for each
+        window of loci (columns), ignoring missing data.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP get_pgen_matrix_genlight(SEXP genlight, SEXP pops, SEXP npop, SEXP window, SEXP requested_threads)
 {
-
-  // TODO: Accept an interval, then use either 8 or num_loci as default when calling from R, never 0
-
   SEXP R_out;
-  SEXP R_gen_symbol;
-  SEXP R_loc_symbol;
-  SEXP R_pop_symbol;
-  R_gen_symbol = PROTECT(install("gen")); // Used for accessing the named elements of the genlight object
-  R_loc_symbol = PROTECT(install("n.loc"));
-  R_pop_symbol = PROTECT(install("pop"));
+  struct genotype_view view;
   struct locus* loci;
-  double *pgens;
-  int num_gens;
-  int num_loci;
+  double* log_freqs;
   int num_sets;
   int num_pops;
+  int num_threads;
   int interval;
-  int size;
-  // Set the interval to calculate Pgen over every 8 loci
-  interval = INTEGER(window)[0];
 
-  num_gens = XLENGTH(getAttrib(genlight, R_gen_symbol));
-  num_loci = INTEGER(getAttrib(genlight, R_loc_symbol))[0];
-  num_sets = ceil((double)num_loci/(double)interval); // Number of sets of loci for which pgen values should be computed
-  size = num_gens*num_sets;
-  pgens = R_Calloc(size, double);
-  R_out = PROTECT(allocVector(REALSXP,size));
-
-  // Find the number of populations by taking the max over all genotypes
-  num_pops = 0;
-  for(int i = 0; i < num_gens; i++)
+  fill_genotype_view(&view, genlight);
+  num_pops = INTEGER(npop)[0];
+  // Set the interval to calculate Pgen over. A window of zero or one that is
+  // larger than the data calculates Pgen over all loci.
+  interval = asInteger(window);
+  if (interval <= 0 || interval > view.num_loci)
   {
-    num_pops = (INTEGER(getAttrib(genlight, R_pop_symbol))[i] > num_pops) ? INTEGER(getAttrib(genlight, R_pop_symbol))[i] : num_pops;
+    interval = view.num_loci;
   }
+  // Number of sets of loci for which pgen values should be computed
+  num_sets = (view.num_loci + interval - 1)/interval;
+  R_out = PROTECT(allocMatrix(REALSXP, view.num_gens, num_sets));
 
-  // Allocate memory for the array of locus struct
-  loci = R_Calloc(num_loci*num_pops,struct locus);
-  // Call fill_loci to get allelic frequency information
-  fill_loci(loci, genlight);
-
-  fill_Pgen(pgens,loci,interval,genlight);
-
-  for(int i = 0; i < num_gens; i++)
+  #ifdef _OPENMP
   {
-    for(int j = 0; j < num_sets; j++)
+    // Set the number of threads to be used in each omp parallel region
+    if(INTEGER(requested_threads)[0] == 0)
+    {
+      num_threads = omp_get_max_threads();
+    }
+    else
     {
-      // Transpose the matrix into column-major ordering before returning to R
-      REAL(R_out)[i + j*num_gens] = (pgens[i*num_sets + j]);
+      num_threads = INTEGER(requested_threads)[0];
     }
+    omp_set_num_threads(num_threads);
   }
+  #else
+  {
+    num_threads = 1;
+  }
+  #endif
+
+  // Allocate memory for the array of locus struct
+  loci = R_Calloc(view.num_loci*num_pops, struct locus);
+  log_freqs = R_Calloc(view.num_loci*num_pops*3, double);
+  // Call fill_loci to get allelic frequency information
+  fill_loci(loci, &view, INTEGER(pops));
+  fill_log_genotype_freqs(log_freqs, loci, view.num_loci*num_pops, view.ploidy);
+  fill_Pgen(REAL(R_out), log_freqs, interval, &view, INTEGER(pops));
 
   R_Free(loci);
-  R_Free(pgens);
-  UNPROTECT(4);
+  R_Free(log_freqs);
+  free_genotype_view(&view);
+  UNPROTECT(1);
   return R_out;
 }
 
 
-/~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-Fills an array of doubles with the Pgen value associated with each individual
-found in the genlight object. These values represent the probability of each
-individual having been produced via random mating of the population, as estimated
-by the samples present in the genlight object
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Fills a matrix of doubles with the log Pgen value associated with each
+individual found in the genlight object. These values represent the probability
+of each individual having been produced via random mating of the population, as
+estimated by the samples present in the genlight object
 
-Input: A pointer to an array of doubles to be filled.
+Input: A pointer to an array of doubles to be filled in column-major order.
         NOTE: This array MUST have a length equal to the number of genotypes found
         in the genlight object times the number of loci divided by specified interval
         ie, num_gens*ceil((double)num_loci/(double)interval)
-       A pointer to an array of allelic frequencies filled with fill_loci
-       THe number of loci which should be considered in each Pgen value
-       A genlight object from which the individual genotypes can be obtained.
+       A pointer to an array of log genotype frequencies filled with
+        fill_log_genotype_freqs
+       The number of loci which should be considered in each Pgen value
+       A genotype_view of the genlight object
+       A vector of 1-based population indices for each sample
 Output: None. Fills in the array of doubles with the log of the Pgen value of each
         individual genotype in the genlight object.
-~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~/
-void fill_Pgen(double *pgen, struct locus *loci, int interval, SEXP genlight)
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void fill_Pgen(double *pgen, double *log_freqs, int interval, struct genotype_view *view, int *pops)
 {
-
-  double log_product;
-  int num_loci;
+  int i;
   int num_gens;
-  int chr_length;
-  int group;
-  int num_groups;
-  int pop;
-  struct locus* loc;
-  struct zygosity zyg;
-  SEXP R_gen;
-  SEXP R_gen_symbol;
-  SEXP R_chr_symbol;
-  SEXP R_loc_symbol;
-  SEXP R_nap_symbol;
-  SEXP R_pop_symbol;
-  SEXP R_chr1;
-  SEXP R_chr2;
-  SEXP R_nap;
-  int nap_length;
-  int next_missing_index;
-  int next_missing;
+  int num_loci;
 
-  R_gen_symbol = PROTECT(install("gen")); // Used for accessing the named elements of the genlight object
-  R_loc_symbol = PROTECT(install("n.loc"));
-  R_chr_symbol = PROTECT(install("snp"));
-  R_nap_symbol = PROTECT(install("NA.posi"));
-  R_pop_symbol = PROTECT(install("pop"));
+  num_gens = view->num_gens;
+  num_loci = view->num_loci;
 
-  R_gen = getAttrib(genlight, R_gen_symbol);
-  num_gens = XLENGTH(R_gen);
-  num_loci = INTEGER(getAttrib(genlight, R_loc_symbol))[0];
-  num_groups = ceil((double)num_loci/(double)interval);
-  nap_length = 0;
-  next_missing_index = 0;
-  next_missing = -1;
-
-  // for each genotype
-  for(int i = 0; i < num_gens; i++)
-  {
-    R_chr1 = VECTOR_ELT(getAttrib(VECTOR_ELT(R_gen,i),R_chr_symbol),0);
-    R_chr2 = VECTOR_ELT(getAttrib(VECTOR_ELT(R_gen,i),R_chr_symbol),1);
-    chr_length = XLENGTH(R_chr1);
-    R_nap = getAttrib(VECTOR_ELT(R_gen,i),R_nap_symbol); // Vector of the indices of missing values
-    nap_length = XLENGTH(R_nap);
-    if(nap_length > 0)
-    {
-      next_missing_index = 0;
-      next_missing = (int)INTEGER(R_nap)[next_missing_index] - 1; //Compensate for Rs 1 based indexing
-    }
-    else
-    {
-      next_missing_index = -1;
-      next_missing = -1;
-    }
-    // Get the population of this genotype
-    pop = INTEGER(getAttrib(genlight, R_pop_symbol))[i] - 1;
+  // Each sample only writes to its own row of pgen, so they are independent.
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(guided) private(i)
+  #endif
+  for(i = 0; i < num_gens; i++)
+  {
+    double log_product;
+    double* freqs;
+    struct zygosity zyg;
+    char missing_mask;
+    int next_missing_index;
+    int group;
+    int locus;
+
+    // Get the log genotype frequencies for the population of this genotype
+    freqs = log_freqs + (pops[i] - 1)*num_loci*3;
+    next_missing_index = 0;
     // restart the log_product and group numbers
     log_product = 0;
     group = 0;
     // for each locus group
-
-    for(int j = 0; j < chr_length; j++)
+    for(int j = 0; j < view->num_chunks; j++)
     {
       // Find zygosity for each site in this locus
-      zyg.c1 = (char)RAW(R_chr1)[j];
-      zyg.c2 = (char)RAW(R_chr2)[j];
+      zyg.c1 = (char)view->chr1[i][j];
+      zyg.c2 = (view->ploidy == 2) ? (char)view->chr2[i][j] : zyg.c1;
       fill_zygosity(&zyg);
-
-      // pseudo code for the next loop
-      // for each bit in locus
-        // if genotype is heterozygous at this site
-          // add one to heterzygotes
-          // product *= dominants * recessives / 4n^2 + (-1*dominants*recessives/4n^2 * (1 - h*4n / (2*dominants*recessives)))
-          // product *= h/2n
-        // else the genotype is homozygous dominant
-          // product *= dominants*dominants / 4n^2 + ((dominants/2n) * (1 - dominants/2n) * (1 - h*4n / (2*dominants*recessives)))
-          // product *= (rd + dh - 2nh)/(2rn)
-        // else the genotype is homozygous recessive
-          // product *= recessives*recessives / 4n^2 + ((recessives/2n) * (1 - recessives/2n) * (1 -  h*4n / (2*dominants*recessives)))
-          // product *= (rd + rh - 2nh)/(2dn)
-      // end for
+      missing_mask = get_missing_mask(view->nap[i], view->nap_length[i], &next_missing_index, j);
 
       for(int k = 0; k < 8 && j*8+k < num_loci; k++)
       {
+        locus = j*8 + k;
         // Skip any missing data
-        if(next_missing_index < nap_length && next_missing != j*8+k)
+        if(((missing_mask >> k) & 1) == 0)
         {
-          loc = &loci[pop*num_loci + j*8 + k]; // loc[pop][bit]
           if(((zyg.ch >> k) & 1) == 1)
           {
             // handle each heterozygous site in this locus
-            // log_product += log(loc->h) - log(loc->n); // - log(2) + log(2)  // Pgen(f)
-            log_product += log(loc->d) + log(loc->r) - (log(2*(loc->n))+log(2*(loc->n))) + log(2);  // Pgen
+            log_product += freqs[locus*3];
           }
           else if(((zyg.cd >> k) & 1) == 1)
           {
             // handle each homozygous dominant site in this locus
-            // log_product += log( (loc->r)*(loc->d) + (loc->d)*(loc->h) - (2*(loc->n))*(loc->h) ) - log( 2*(loc->r)*(loc->n) ); // Pgen(f)
-            log_product += log(loc->d) + log(loc->d) - (log(2*(loc->n))+log(2*(loc->n))); // Pgen
-          }
-          else if(((zyg.cr >> k) & 1) == 1)
-          {
-            // handle each homozygous recessive site in this locus
-            // log_product += log( (loc->r)*(loc->d) + (loc->r)*(loc->h) - (2*(loc->n))*(loc->h) ) - log( 2*(loc->d)*(loc->n) ); // Pgen(f)
-            log_product += log(loc->r) + log(loc->r) - (log(2*(loc->n))+log(2*(loc->n))); // Pgen
+            log_product += freqs[locus*3 + 1];
           }
           else
           {
-            // Error
+            // handle each homozygous recessive site in this locus
+            log_product += freqs[locus*3 + 2];
           }
         }
-        else if(next_missing == j*8+k)
-        {
-          // Update the missing data variables in order to skip the next portion of missing data
-          next_missing_index++;
-          next_missing = (int)INTEGER(R_nap)[next_missing_index] - 1;
-        }
-        if((group+1)*interval == j*8+k+1 || j*8+k+1 == num_loci)
+        if((group+1)*interval == locus+1 || locus+1 == num_loci)
         {
-          pgen[i*num_groups + group] = log_product;
+          pgen[i + group*num_gens] = log_product;
           group++;
           log_product = 0;
         }
       }
     }
   }
-
-  UNPROTECT(5);
-
 }
 
 
-/~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 Fills an array of struct locus objects based on allelic frequencies found in
 the provided genlight object.
 
 Input: A pointer to an array of locus objects to be filled.
         NOTE: This array MUST have a length equal to the number of loci found
-        in each genotype in the genlight object.
-       A genlight object from which the alleles and loci can be gathered.
+        in each genotype in the genlight object times the number of populations.
+       A genotype_view of the genlight object.
+       A vector of 1-based population indices for each sample
 Output: None. Fills in the allelic frequencies and other information found in
         each locus struct.
-~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~/
-void fill_loci(struct locus *loc, SEXP genlight)
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void fill_loci(struct locus *loc, struct genotype_view *view, int *pops)
 {
   // ~Pseudo code~
-  // for each genotype in genlight
-    // for each locus group in genotype
-      // zyg.c1 = locus[0]
-      // zyg.c2 = locus[1]
-      // fill_zygosity(&zyg) // Find zygosity at each site in locus
-      // for each bit in locus group
-        // if not missing
-          // // Exactly one of the next three lines will add 1 (or 2) to its respective counter
-            // Add 1 to h if this is a heterozygous site
-          // loc[locus*8+bit].h += (zyg.ch & (1<<bit)) >> bit // Or is that 1 << 7-bit ?
-            // Add 1 to dominant if this is heterozygous or 2 if this is homozygous dominant
-          // loc[locus*8+bit].d += ((zyg.ch & (1<<bit)) >> bit) + 2 * (zyg.cd & (1<<bit))
-            // Add 1 to recessive if this is heterozygous or 2 if this is homozygous recessive
-          // loc[locus*8+bit].r += ((zyg.ch & (1<<bit)) >> bit) + 2 * (zyg.cr & (1<<bit))
-            // Add 1 to the number of contributing genotypes regardless of what else was added
-          // loc[locus*8+bit].n += 1
-
-  struct zygosity zyg;
+  // for each block of locus groups
+    // for each genotype in genlight
+      // for each locus group in block
+        // zyg.c1 = locus[0]
+        // zyg.c2 = locus[1]
+        // fill_zygosity(&zyg) // Find zygosity at each site in locus
+        // for each bit in locus group
+          // if not missing
+            // // Exactly one of the next three lines will add 1 (or 2) to its respective counter
+              // Add 1 to h if this is a heterozygous site
+            // loc[locus*8+bit].h += (zyg.ch & (1<<bit)) >> bit
+              // Add 1 to dominant if this is heterozygous or 2 if this is homozygous dominant
+            // loc[locus*8+bit].d += ((zyg.ch & (1<<bit)) >> bit) + 2 * (zyg.cd & (1<<bit))
+              // Add 1 to recessive if this is heterozygous or 2 if this is homozygous recessive
+            // loc[locus*8+bit].r += ((zyg.ch & (1<<bit)) >> bit) + 2 * (zyg.cr & (1<<bit))
+              // Add 1 to the number of contributing genotypes regardless of what else was added
+            // loc[locus*8+bit].n += 1
+  //
+  // Each block of locus groups is handled by a single thread. Since no two
+  // blocks share a locus, the threads never write to the same locus struct.
+
+  int block;
+  int num_blocks;
+  int block_size;
+  int num_gens;
+  int num_loci;
+  int num_chunks;
+
+  num_gens = view->num_gens;
+  num_loci = view->num_loci;
+  num_chunks = view->num_chunks;
+  block_size = 64; // 512 loci per block
+  num_blocks = (num_chunks + block_size - 1)/block_size;
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) private(block)
+  #endif
+  for(block = 0; block < num_blocks; block++)
+  {
+    struct zygosity zyg;
+    struct locus* l;
+    char missing_mask;
+    int first;
+    int last;
+    int next_missing_index;
+    int pop;
+
+    first = block*block_size;
+    last = (first + block_size < num_chunks) ? first + block_size : num_chunks;
+    // Loop through every genotype
+    for(int i = 0; i < num_gens; i++)
+    {
+      // Get the population of this genotype
+      pop = pops[i] - 1;
+      // Skip past any missing data before this block
+      next_missing_index = get_first_missing(view->nap[i], view->nap_length[i], first*8);
+      // Loop through all the chunks of SNPs in this block
+      for(int byte = first; byte < last; byte++)
+      {
+        zyg.c1 = (char)view->chr1[i][byte];
+        zyg.c2 = (view->ploidy == 2) ? (char)view->chr2[i][byte] : zyg.c1;
+        fill_zygosity(&zyg);
+        missing_mask = get_missing_mask(view->nap[i], view->nap_length[i], &next_missing_index, byte);
+        for(int bit = 0; bit < 8 && byte*8+bit < num_loci; bit++)
+        {
+          // if not missing
+          if(((missing_mask >> bit) & 1) == 0)
+          {
+            l = &loc[pop*num_loci + byte*8+bit];
+            if(view->ploidy == 2)
+            {
+              // The following lines will add 1 (or 2) to whichever value(s) need to be increased, and 0 to the others
+              l->h += (zyg.ch >> bit) & 1;
+              l->d += ((zyg.ch >> bit) & 1) + 2 * ((zyg.cd >> bit) & 1);
+              l->r += ((zyg.ch >> bit) & 1) + 2 * ((zyg.cr >> bit) & 1);
+            }
+            else
+            {
+              // Haploids only contribute a single allele
+              l->d += (zyg.cd >> bit) & 1;
+              l->r += (zyg.cr >> bit) & 1;
+            }
+            l->n += 1;
+          }
+        }
+      }
+    }
+  }
+}
+
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Converts the allele counts in an array of locus structs into log genotype
+frequencies so that the logarithms are only taken once per locus.
+
+Input: A pointer to an array of doubles with length 3 times the number of
+        locus structs.
+       A pointer to an array of locus structs filled with fill_loci.
+       The number of locus structs.
+       The ploidy of the samples (1 or 2).
+Output: None. Fills the array with the log frequency of heterozygotes,
+        homozygous dominant, and homozygous recessive genotypes, in that order,
+        for each locus.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void fill_log_genotype_freqs(double *log_freqs, struct locus *loci, int num_loci, int ploidy)
+{
+  int i;
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(static) private(i)
+  #endif
+  for(i = 0; i < num_loci; i++)
+  {
+    struct locus* loc = &loci[i];
+    double log_n;
+    if(loc->n == 0)
+    {
+      // No data in this population. These will never be used.
+      log_freqs[i*3] = NA_REAL;
+      log_freqs[i*3 + 1] = NA_REAL;
+      log_freqs[i*3 + 2] = NA_REAL;
+    }
+    else if(ploidy == 2)
+    {
+      log_n = log(2*(loc->n));
+      log_freqs[i*3] = log(loc->d) + log(loc->r) - (log_n + log_n) + log(2); // 2pq
+      log_freqs[i*3 + 1] = log(loc->d) + log(loc->d) - (log_n + log_n);      // p^2
+      log_freqs[i*3 + 2] = log(loc->r) + log(loc->r) - (log_n + log_n);      // q^2
+    }
+    else
+    {
+      log_n = log(loc->n);
+      log_freqs[i*3] = NA_REAL; // Haploids cannot be heterozygous
+      log_freqs[i*3 + 1] = log(loc->d) - log_n; // p
+      log_freqs[i*3 + 2] = log(loc->r) - log_n; // q
+    }
+  }
+}
+
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Gathers pointers to the packed SNP data and missing positions for each sample
+in a genlight object. The resulting struct can be read from multiple threads.
+
+Input: A pointer to a genotype_view struct to be filled.
+       A genlight object with samples of uniform ploidy (1 or 2).
+Output: None. Fills the genotype_view. The memory must be freed with
+        free_genotype_view.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void fill_genotype_view(struct genotype_view *view, SEXP genlight)
+{
   SEXP R_gen_symbol;
-  SEXP R_loc_symbol;
   SEXP R_chr_symbol;
   SEXP R_nap_symbol;
-  SEXP R_pop_symbol;
+  SEXP R_loc_symbol;
   SEXP R_gen;
-  int num_gens;
-  int num_loci;
-  SEXP R_chr1_1;
-  SEXP R_chr1_2;
-  SEXP R_nap1;
-  int nap1_length;
-  int chr_length;
-  int next_missing_index_i;
-  int next_missing_i;
+  SEXP R_snp;
+  SEXP R_nap;
   int i;
-  int bit;
-  int byte;
-  int pop;
 
-  R_gen_symbol = PROTECT(install("gen")); // Used for accessing the named elements of the genlight object
-  R_loc_symbol = PROTECT(install("n.loc"));
+  R_gen_symbol = PROTECT(install("gen"));
   R_chr_symbol = PROTECT(install("snp"));
   R_nap_symbol = PROTECT(install("NA.posi"));
-  R_pop_symbol = PROTECT(install("pop"));
+  R_loc_symbol = PROTECT(install("n.loc"));
 
-  // This will be a LIST of type LIST:RAW
   R_gen = getAttrib(genlight, R_gen_symbol);
-  num_gens = XLENGTH(R_gen);
-  num_loci = INTEGER(getAttrib(genlight, R_loc_symbol))[0];
+  view->num_gens = XLENGTH(R_gen);
+  view->num_loci = INTEGER(getAttrib(genlight, R_loc_symbol))[0];
+  view->num_chunks = 0;
+  view->ploidy = 1;
+  view->chr1 = R_Calloc(view->num_gens, Rbyte*);
+  view->chr2 = R_Calloc(view->num_gens, Rbyte*);
+  view->nap = R_Calloc(view->num_gens, int*);
+  view->nap_length = R_Calloc(view->num_gens, int);
+  view->na_mask = NULL;
+  view->na_bits = NULL;
+  view->store = NULL;
+  view->store_size = 0;
+  for(i = 0; i < view->num_gens; i++)
+  {
+    R_snp = getAttrib(VECTOR_ELT(R_gen, i), R_chr_symbol);
+    R_nap = getAttrib(VECTOR_ELT(R_gen, i), R_nap_symbol);
+    view->chr1[i] = RAW(VECTOR_ELT(R_snp, 0));
+    view->chr2[i] = (XLENGTH(R_snp) > 1) ? RAW(VECTOR_ELT(R_snp, 1)) : NULL;
+    view->nap[i] = INTEGER(R_nap);
+    view->nap_length[i] = XLENGTH(R_nap);
+    if(XLENGTH(R_snp) > 1)
+    {
+      view->ploidy = 2;
+    }
+    if(i == 0)
+    {
+      view->num_chunks = XLENGTH(VECTOR_ELT(R_snp, 0));
+    }
+  }
+  UNPROTECT(4);
+}
 
-  next_missing_index_i = 0;
-  next_missing_i = -1;
-  nap1_length = 0;
-  chr_length = 0;
+// Frees the memory allocated by fill_genotype_view or fill_genotype_view_store
+void free_genotype_view(struct genotype_view *view)
+{
+  R_Free(view->chr1);
+  R_Free(view->chr2);
+  R_Free(view->nap);
+  R_Free(view->nap_length);
+  R_Free(view->na_mask);
+  R_Free(view->na_bits);
+  if(view->store != NULL)
+  {
+    unmap_file(view->store, view->store_size);
+    view->store = NULL;
+  }
+}
 
-  // Loop through every genotype
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Packs a genlight object into a genotype view that can be passed back to the
+bitwise functions from R, so that repeated analyses of the same data do not
+read the SNPbin objects and decode their missing positions every time.
+
+The packed SNPs are not copied; the view points to the raw vectors of the 
+genlight object, which is protected by the external pointer. The missing
+positions are decoded into a bitmap of 8 locus chunks so that the masks can be
+read directly, as they are for genotype stores. The view is freed when the
+external pointer is garbage collected.
+
+Input: A genlight object of haploids or diploids. Diploids must have passed
+          through fix_uneven_diploid.
+Output: An external pointer to the genotype view.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP genotype_view_pack(SEXP genlight)
+{
+  SEXP R_ptr;
+  struct genotype_view *view;
+  int i;
+
+  view = R_Calloc(1, struct genotype_view);
+  fill_genotype_view(view, genlight);
+  view->na_bits = R_Calloc((size_t)view->num_gens*view->num_chunks, Rbyte);
+  view->na_mask = R_Calloc(view->num_gens, Rbyte*);
+  for(i = 0; i < view->num_gens; i++)
+  {
+    view->na_mask[i] = view->na_bits + (size_t)i*view->num_chunks;
+    set_missing_bits(view->na_mask[i], view->nap[i], view->nap_length[i]);
+  }
+  R_ptr = PROTECT(R_MakeExternalPtr(view, install("genotype_view"), genlight));
+  R_RegisterCFinalizerEx(R_ptr, finalize_genotype_view, TRUE);
+  UNPROTECT(1);
+  return R_ptr;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Reports the number of samples in a packed view.
+
+Input: An external pointer created with genotype_view_pack.
+Output: The number of samples in the view or -1 if the pointer is no longer 
+        valid (e.g. after the object was saved and reloaded).
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP genotype_view_size(SEXP R_ptr)
+{
+  struct genotype_view *view;
+  if(TYPEOF(R_ptr) != EXTPTRSXP || R_ExternalPtrTag(R_ptr) != install("genotype_view"))
+  {
+    return ScalarReal(-1);
+  }
+  view = (struct genotype_view*)R_ExternalPtrAddr(R_ptr);
+  return ScalarReal((view == NULL) ? -1 : (double)view->num_gens);
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Returns the genotype view of the data passed to a bitwise function from R.
+Packed views are returned as they are. Otherwise, the local view is filled from
+the genotype store at the given path or from the genlight object. Either way,
+the view must be released with close_genotype_view.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static struct genotype_view* open_genotype_view(SEXP x, struct genotype_view *local)
+{
+  struct genotype_view *view;
+  if(TYPEOF(x) == EXTPTRSXP)
+  {
+    view = (struct genotype_view*)R_ExternalPtrAddr(x);
+    if(R_ExternalPtrTag(x) != install("genotype_view") || view == NULL)
+    {
+      error("The packed genlight is no longer valid. Please pack the genlight object again.");
+    }
+    return view;
+  }
+  if(TYPEOF(x) == STRSXP)
+  {
+    fill_genotype_view_store(local, x);
+  }
+  else
+  {
+    fill_genotype_view(local, x);
+  }
+  return local;
+}
+
+// Frees the view from open_genotype_view unless it belongs to a packed view
+static void close_genotype_view(struct genotype_view *view, struct genotype_view *local)
+{
+  if(view == local)
+  {
+    free_genotype_view(local);
+  }
+}
+
+// Frees a packed view when its external pointer is garbage collected
+static void finalize_genotype_view(SEXP R_ptr)
+{
+  struct genotype_view *view = (struct genotype_view*)R_ExternalPtrAddr(R_ptr);
+  if(view != NULL)
+  {
+    free_genotype_view(view);
+    R_Free(view);
+    R_ClearExternalPtr(R_ptr);
+  }
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Calculates the distance matrix returned by bitwise_distance_haploid and
+bitwise_distance_diploid for a packed view using fill_condensed_distances.
+
+Input: An external pointer made by genotype_view_pack.
+       A boolean representing whether missing data should match (TRUE) or not.
+       Booleans for euclid and differences_only.
+       An integer representing the number of threads that should be used.
+Output: A vector of length n*n containing the distance matrix.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static SEXP packed_distance_matrix(SEXP R_ptr, SEXP missing, int euclid, 
+                                   int only_differences, SEXP requested_threads)
+{
+  SEXP R_out;
+  struct genotype_view *view;
+  double *condensed;
+  int *distances;
+  int num_gens;
+  int i;
+  int j;
+  size_t k;
+
+  view = open_genotype_view(R_ptr, NULL);
+  num_gens = view->num_gens;
+  condensed = R_Calloc((size_t)num_gens*(num_gens - 1)/2 + 1, double);
+  fill_condensed_distances(view, asLogical(missing), euclid, only_differences,
+                           0, 0, num_gens, bitwise_threads(requested_threads), 
+                           condensed);
+  R_out = PROTECT(allocVector(INTSXP, (R_xlen_t)num_gens*num_gens));
+  distances = INTEGER(R_out);
+  k = 0;
   for(i = 0; i < num_gens; i++)
   {
-    R_chr1_1 = VECTOR_ELT(getAttrib(VECTOR_ELT(R_gen,i),R_chr_symbol),0); // Chromosome 1
-    R_chr1_2 = VECTOR_ELT(getAttrib(VECTOR_ELT(R_gen,i),R_chr_symbol),1); // Chromosome 2
-    chr_length = XLENGTH(R_chr1_1);
-    R_nap1 = getAttrib(VECTOR_ELT(R_gen,i),R_nap_symbol); // Vector of the indices of missing values
-    nap1_length = XLENGTH(R_nap1);
-    if(nap1_length > 0)
+    distances[i + (size_t)i*num_gens] = 0;
+    for(j = i + 1; j < num_gens; j++)
     {
-      next_missing_index_i = 0;
-      next_missing_i = (int)INTEGER(R_nap1)[next_missing_index_i] - 1; //Compensate for Rs 1 based indexing
+      distances[j + (size_t)i*num_gens] = (int)condensed[k];
+      distances[i + (size_t)j*num_gens] = (int)condensed[k];
+      k++;
     }
-    else
+  }
+  R_Free(condensed);
+  UNPROTECT(1);
+  return R_out;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Calculates the index of association returned by association_index_haploid and
+association_index_diploid for a packed view over all of its loci. The samples
+are not copied into a chunk matrix.
+
+Input: An external pointer made by genotype_view_pack.
+       A boolean representing whether or not missing values should match.
+       A boolean representing whether distances or differences should be counted.
+       An integer representing the number of threads to be used.
+Output: The index of association.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static SEXP packed_association_index(SEXP R_ptr, SEXP missing, 
+                                     int only_differences, SEXP requested_threads)
+{
+  struct genotype_view *view;
+  int *loci;
+  int i;
+  double index;
+
+  view = open_genotype_view(R_ptr, NULL);
+  loci = R_Calloc(view->num_loci + 1, int);
+  for(i = 0; i < view->num_loci; i++)
+  {
+    loci[i] = i;
+  }
+  index = view_association_index(view, loci, view->num_loci, asLogical(missing),
+                                 only_differences, 
+                                 bitwise_threads(requested_threads));
+  R_Free(loci);
+  return ScalarReal(index);
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Fills a genotype view with the samples in a genotype store on disk. The file is
+memory mapped and the pointers of the view point directly into the records of
+each sample, so nothing is copied. free_genotype_view unmaps the file.
+
+Input: A pointer to the genotype view to fill.
+       The path to a genotype store written by genotype_store_write.
+Output: None. The view is filled. An error is raised if the file is not a
+        valid genotype store.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void fill_genotype_view_store(struct genotype_view *view, SEXP path)
+{
+  struct store_header header;
+  const char *filename;
+  Rbyte* data;
+  Rbyte* record;
+  size_t size;
+  int i;
+
+  filename = CHAR(STRING_ELT(path, 0));
+  data = (Rbyte*)map_file(filename, &size);
+  if(size >= STORE_HEADER_SIZE)
+  {
+    memcpy(&header, data, sizeof(header));
+  }
+  if(size < STORE_HEADER_SIZE || !valid_store_header(&header) ||
+     (size - STORE_HEADER_SIZE)/header.record_size < header.num_gens)
+  {
+    unmap_file(data, size);
+    error("%s is not a valid genotype store.", filename);
+  }
+
+  view->num_gens = (int)header.num_gens;
+  view->num_loci = (int)header.num_loci;
+  view->num_chunks = (int)header.num_chunks;
+  view->ploidy = (int)header.ploidy;
+  view->chr1 = R_Calloc(view->num_gens, Rbyte*);
+  view->chr2 = R_Calloc(view->num_gens, Rbyte*);
+  view->na_mask = R_Calloc(view->num_gens, Rbyte*);
+  view->na_bits = NULL;
+  view->nap = NULL;
+  view->nap_length = NULL;
+  view->store = data;
+  view->store_size = size;
+  for(i = 0; i < view->num_gens; i++)
+  {
+    record = data + STORE_HEADER_SIZE + (size_t)i*header.record_size;
+    view->chr1[i] = record;
+    view->chr2[i] = (view->ploidy == 2) ? record + view->num_chunks : NULL;
+    view->na_mask[i] = record + (size_t)view->ploidy*view->num_chunks;
+  }
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Writes the samples of a genlight object to a genotype store on disk (see the
+description of the store_header struct for the layout). The samples can be 
+added to an existing store with the same ploidy and number of loci so that 
+stores larger than memory can be written in pieces.
+
+Input: A genlight object of haploids or diploids. Diploids must have passed
+          through fix_uneven_diploid.
+       The path to the genotype store.
+       A boolean representing whether the samples should be added to the end of
+          an existing store (TRUE) or the store should be created (FALSE).
+Output: The number of samples in the store.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP genotype_store_write(SEXP genlight, SEXP path, SEXP append)
+{
+  struct genotype_view view;
+  struct store_header header;
+  const char *filename;
+  FILE *file;
+  Rbyte* record;
+  Rbyte* na_mask;
+  Rbyte last_chunk;
+  size_t record_size;
+  int64_t file_size;
+  int failed;
+  int i;
+
+  filename = CHAR(STRING_ELT(path, 0));
+  fill_genotype_view(&view, genlight);
+  record_size = (size_t)(view.ploidy + 1)*view.num_chunks;
+  if(view.num_chunks == 0)
+  {
+    free_genotype_view(&view);
+    error("The genotype store must have at least one locus.");
+  }
+  if(asLogical(append))
+  {
+    file = fopen(filename, "r+b");
+    if(file == NULL)
     {
-      next_missing_index_i = -1;
-      next_missing_i = -1;
+      free_genotype_view(&view);
+      error("Could not open %s.", filename);
     }
-    // Get the population of this genotype
-    pop = INTEGER(getAttrib(genlight, R_pop_symbol))[i] - 1;
-    // Loop through all the chunks of SNPs in this genotype
-    for(byte = 0; byte < chr_length; byte++)
+    if(fread(&header, sizeof(header), 1, file) != 1 || !valid_store_header(&header))
     {
-      zyg.c1 = (char)RAW(R_chr1_1)[byte];
-      zyg.c2 = (char)RAW(R_chr1_2)[byte];
-      fill_zygosity(&zyg);
+      fclose(file);
+      free_genotype_view(&view);
+      error("%s is not a valid genotype store.", filename);
+    }
+    if(header.ploidy != (uint32_t)view.ploidy || header.num_loci != (uint64_t)view.num_loci)
+    {
+      fclose(file);
+      free_genotype_view(&view);
+      error("The samples must have the same ploidy and number of loci as the genotype store.");
+    }
+    // New records are written at the end of the file, which must hold exactly
+    // the records given in the header
+    file_size = seek_file_end(file);
+    if(file_size < 0)
+    {
+      fclose(file);
+      free_genotype_view(&view);
+      error("Could not seek to the end of %s.", filename);
+    }
+    if((uint64_t)file_size != STORE_HEADER_SIZE + header.num_gens*header.record_size)
+    {
+      fclose(file);
+      free_genotype_view(&view);
+      error("%s is not a valid genotype store.", filename);
+    }
+  }
+  else
+  {
+    file = fopen(filename, "wb");
+    if(file == NULL)
+    {
+      free_genotype_view(&view);
+      error("Could not open %s.", filename);
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STORE_MAGIC, 8);
+    header.version = STORE_VERSION;
+    header.byte_order = 1;
+    header.ploidy = view.ploidy;
+    header.num_loci = view.num_loci;
+    header.num_chunks = view.num_chunks;
+    header.record_size = record_size;
+    if(fwrite(&header, sizeof(header), 1, file) != 1)
+    {
+      fclose(file);
+      free_genotype_view(&view);
+      error("Could not write to %s.", filename);
+    }
+  }
 
-      // TODO: Find a way to parallelize either here or the locus loop.
-      //       Unfortunately, next_missing_i complicates this.
-      for(bit = 0; bit < 8 && byte*8+bit < num_loci; bit++)
-      {
-        // if not missing
-        if(next_missing_i != byte*8+bit)
-        {
-          // The following lines will add 1 (or 2) to whichever value(s) need to be increased, and 0 to the others
-          loc[pop*num_loci + byte*8+bit].h += (zyg.ch >> bit) & 1;
-          loc[pop*num_loci + byte*8+bit].d += ((zyg.ch >> bit) & 1) + 2 * ((zyg.cd >> bit) & 1);
-          loc[pop*num_loci + byte*8+bit].r += ((zyg.ch >> bit) & 1) + 2 * ((zyg.cr >> bit) & 1);
-          loc[pop*num_loci + byte*8+bit].n += 1;
-        }
-        else
-        {
-          if(next_missing_index_i < nap1_length-1)
-          {
-            next_missing_index_i++;
-            next_missing_i = (int)INTEGER(R_nap1)[next_missing_index_i] - 1;
-          }
-        }
-      }
+  // Bits past the last locus are cleared so that they always match
+  last_chunk = (view.num_loci % 8 == 0) ? 0xFF : (Rbyte)((1 << (view.num_loci % 8)) - 1);
+  record = R_Calloc(record_size, Rbyte);
+  na_mask = record + (size_t)view.ploidy*view.num_chunks;
+  failed = 0;
+  for(i = 0; i < view.num_gens && !failed; i++)
+  {
+    memcpy(record, view.chr1[i], view.num_chunks);
+    record[view.num_chunks - 1] &= last_chunk;
+    if(view.ploidy == 2)
+    {
+      memcpy(record + view.num_chunks, view.chr2[i], view.num_chunks);
+      record[2*view.num_chunks - 1] &= last_chunk;
+    }
+    memset(na_mask, 0, view.num_chunks);
+    set_missing_bits(na_mask, view.nap[i], view.nap_length[i]);
+    failed = fwrite(record, 1, record_size, file) != record_size;
+  }
+  if(!failed)
+  {
+    header.num_gens += view.num_gens;
+    failed = fseek(file, 0, SEEK_SET) != 0 || 
+             fwrite(&header, sizeof(header), 1, file) != 1;
+  }
+  failed = (fclose(file) != 0) || failed;
+  R_Free(record);
+  free_genotype_view(&view);
+  if(failed)
+  {
+    error("Could not write to %s.", filename);
+  }
+  return ScalarReal((double)header.num_gens);
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Reads the header of a genotype store.
+
+Input: The path to a genotype store written by genotype_store_write.
+Output: A numeric vector with the number of samples, the number of loci, and
+        the ploidy of the store.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP genotype_store_info(SEXP path)
+{
+  SEXP R_out;
+  struct genotype_view view;
+
+  // Mapping the file checks that it is complete
+  fill_genotype_view_store(&view, path);
+  R_out = PROTECT(allocVector(REALSXP, 3));
+  REAL(R_out)[0] = (double)view.num_gens;
+  REAL(R_out)[1] = (double)view.num_loci;
+  REAL(R_out)[2] = (double)view.ploidy;
+  free_genotype_view(&view);
+  UNPROTECT(1);
+  return R_out;
+}
+
+// Moves to the end of a file and returns its size or -1 on failure. The 64-bit
+// functions are used because long is 32 bits on Windows.
+static int64_t seek_file_end(FILE *file)
+{
+#ifdef _WIN32
+  if(_fseeki64(file, 0, SEEK_END) != 0)
+  {
+    return -1;
+  }
+  return (int64_t)_ftelli64(file);
+#else
+  if(fseeko(file, 0, SEEK_END) != 0)
+  {
+    return -1;
+  }
+  return (int64_t)ftello(file);
+#endif
+}
+
+// Checks that a genotype store header was written by genotype_store_write
+static int valid_store_header(struct store_header *header)
+{
+  return memcmp(header->magic, STORE_MAGIC, 8) == 0 &&
+         header->version == STORE_VERSION &&
+         header->byte_order == 1 &&
+         (header->ploidy == 1 || header->ploidy == 2) &&
+         header->num_chunks == (header->num_loci + 7)/8 &&
+         header->num_chunks > 0 &&
+         header->record_size == (header->ploidy + 1)*header->num_chunks &&
+         header->num_gens <= INT_MAX && header->num_loci <= INT_MAX;
+}
+
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Finds the index of the first missing position at or after a given locus using
+a binary search over the sorted NA.posi vector of a sample.
+
+Input: A pointer to the 1-based missing positions of a sample.
+       The number of missing positions.
+       The 0-based locus to search for.
+Output: The index of the first missing position that is not before the locus.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+int get_first_missing(int *nap, int nap_length, int locus)
+{
+  int lo = 0;
+  int hi = nap_length;
+  int mid;
+  while(lo < hi)
+  {
+    mid = lo + (hi - lo)/2;
+    if(nap[mid] - 1 < locus)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Creates a mask of the missing positions within a chunk of 8 loci and advances
+the index into the sample's NA.posi vector past that chunk.
+
+Input: A pointer to the 1-based missing positions of a sample.
+       The number of missing positions.
+       A pointer to the index of the next missing position to consider. This
+        must not point past any missing data in the current chunk.
+       The index of the current chunk.
+Output: A char with 1's wherever data is missing in this chunk.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+char get_missing_mask(int *nap, int nap_length, int *index, int chunk)
+{
+  char mask = 0;
+  while(*index < nap_length && nap[*index] - 1 < (chunk+1)*8)
+  {
+    if(nap[*index] - 1 >= chunk*8)
+    {
+      mask |= 1 << ((nap[*index] - 1)%8);
     }
+    (*index)++;
+  }
+  return mask;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Creates a mask of the missing positions within a chunk of 8 loci of a sample in
+a genotype view. Views of genotype stores read the mask directly. Otherwise, 
+this is get_missing_mask, and the index must start at get_view_first_missing
+for the first chunk read.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static char get_view_missing_mask(struct genotype_view *view, int sample, 
+                                  int *index, int chunk)
+{
+  if(view->na_mask != NULL)
+  {
+    return (char)view->na_mask[sample][chunk];
   }
+  return get_missing_mask(view->nap[sample], view->nap_length[sample], index, chunk);
+}
 
-  UNPROTECT(5);
+// The index for get_view_missing_mask when starting from a given locus
+static int get_view_first_missing(struct genotype_view *view, int sample, int locus)
+{
+  if(view->na_mask != NULL)
+  {
+    return 0;
+  }
+  return get_first_missing(view->nap[sample], view->nap_length[sample], locus);
 }
 
+// Sets the bits of the 1-based missing positions in a bitmap of 8 locus chunks
+static void set_missing_bits(Rbyte *mask, int *nap, int nap_length)
+{
+  int m;
+  int position;
+  for(m = 0; m < nap_length; m++)
+  {
+    position = nap[m] - 1;
+    mask[position/8] |= 1 << (position%8);
+  }
+}
 
-/~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// The number of threads to use. 0 uses all available threads.
+static int bitwise_threads(SEXP requested_threads)
+{
+  int num_threads;
+  #ifdef _OPENMP
+  {
+    if(asInteger(requested_threads) == 0)
+    {
+      num_threads = omp_get_max_threads();
+    }
+    else
+    {
+      num_threads = asInteger(requested_threads);
+    }
+  }
+  #else
+  {
+    num_threads = 1;
+  }
+  #endif
+  return (num_threads < 1) ? 1 : num_threads;
+}
+
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 Calculates the zygosity at each location of a given section. The zygosity struct
 must have c1 and c2 filled before calling this function.
 
@@ -2073,6 +3466,25 @@ int get_zeros(char sim_set)
   return zeros;
 }
 
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Calculates the number of ones in a 64 bit word. Used by association_index_pa to
+find the number of differences between two samples in 64 markers at once.
+
+Input: A 64 bit word.
+Output: The number of bits set in the word.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+int popcount64(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcountll(x);
+#else
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 Counts the number of differences between two partially filled zygosity structs.
 c1 and c2 must be filled in both structs prior to calling this function.
@@ -0,0 +1,394 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#
+# This software was authored by Zhian N. Kamvar and Javier F. Tabima, graduate
+# students at Oregon State University; Jonah C. Brooks, undergraduate student at
+# Oregon State University; and Dr. Nik Grünwald, an employee of USDA-ARS.
+#
+# Permission to use, copy, modify, and distribute this software and its
+# documentation for educational, research and non-profit purposes, without fee,
+# and without a written agreement is hereby granted, provided that the statement
+# above is incorporated into the material, giving appropriate attribution to the
+# authors.
+#
+# Permission to incorporate this software into commercial products may be
+# obtained by contacting USDA ARS and OREGON STATE UNIVERSITY Office for
+# Commercialization and Corporate Development.
+#
+# The software program and documentation are supplied "as is", without any
+# accompanying services from the USDA or the University. USDA ARS or the
+# University do not warrant that the operation of the program will be
+# uninterrupted or error-free. The end-user understands that the program was
+# developed for research purposes and is advised not to rely exclusively on the
+# program for any reason.
+#
+# IN NO EVENT SHALL USDA ARS OR OREGON STATE UNIVERSITY BE LIABLE TO ANY PARTY
+# FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+# LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+# EVEN IF THE OREGON STATE UNIVERSITY HAS BEEN ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE. USDA ARS OR OREGON STATE UNIVERSITY SPECIFICALLY DISCLAIMS ANY
+# WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE AND ANY STATUTORY
+# WARRANTY OF NON-INFRINGEMENT. THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS"
+# BASIS, AND USDA ARS AND OREGON STATE UNIVERSITY HAVE NO OBLIGATIONS TO PROVIDE
+# MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+#
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+// The system headers for memory mapping must come before R's headers
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOGDI
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <Rinternals.h>
+#include <R_ext/Utils.h>
+#include <R.h>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+
+/*
+
+Distance file header
+====================
+
+The first 64 bytes of a distance file. The header is followed by the 
+n(n - 1)/2 distances between the samples as doubles in the same order as a 
+dist object (the lower triangle by column), so the distances of each sample
+to the samples after it are contiguous and can be written one block of 
+samples at a time. The file is memory mapped when it is read, so only the 
+parts being used need to be in memory.
+
+*/
+
+#define DIST_MAGIC "POPPRDST"
+#define DIST_VERSION 1
+#define DIST_HEADER_SIZE 64
+
+struct dist_header
+{
+  char magic[8];         // "POPPRDST"
+  uint32_t version;      // DIST_VERSION
+  uint32_t byte_order;   // 1 when read on a machine with the same byte order
+  uint64_t num_samples;  // Number of samples
+  uint64_t reserved[5];
+};
+
+void* map_file(const char *filename, size_t *size);
+void unmap_file(void *data, size_t size);
+size_t dist_row_offset(int i, int n);
+int dist_block_end(int first, int n, size_t capacity);
+FILE* create_dist_file(const char *filename, int n);
+const double* open_distances(SEXP dist, int *n, size_t *mapped);
+void close_distances(const double *dist, size_t mapped);
+SEXP dist_file_write(SEXP dist, SEXP path);
+SEXP dist_file_info(SEXP path);
+SEXP dist_file_tile(SEXP path, SEXP rows, SEXP cols);
+
+// Maps a file into memory for reading
+void* map_file(const char *filename, size_t *size)
+{
+  void* data;
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+  LARGE_INTEGER file_size;
+
+  file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, 
+                     OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if(file == INVALID_HANDLE_VALUE)
+  {
+    error("Could not open %s.", filename);
+  }
+  if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+  {
+    CloseHandle(file);
+    error("%s is empty.", filename);
+  }
+  mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  data = (mapping == NULL) ? NULL : MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if(mapping != NULL)
+  {
+    CloseHandle(mapping);
+  }
+  if(data == NULL)
+  {
+    error("Could not map %s into memory.", filename);
+  }
+  *size = (size_t)file_size.QuadPart;
+#else
+  int file;
+  struct stat info;
+
+  file = open(filename, O_RDONLY);
+  if(file < 0)
+  {
+    error("Could not open %s.", filename);
+  }
+  if(fstat(file, &info) != 0 || info.st_size == 0)
+  {
+    close(file);
+    error("%s is empty.", filename);
+  }
+  data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, file, 0);
+  close(file);
+  if(data == MAP_FAILED)
+  {
+    error("Could not map %s into memory.", filename);
+  }
+  *size = (size_t)info.st_size;
+#endif
+  return data;
+}
+
+// Unmaps a file mapped by map_file
+void unmap_file(void *data, size_t size)
+{
+#ifdef _WIN32
+  UnmapViewOfFile(data);
+#else
+  munmap(data, size);
+#endif
+}
+
+// Position of the first distance of sample i (to sample i + 1) in a dist
+// object of n samples. This is also the number of distances of the samples 
+// before i.
+size_t dist_row_offset(int i, int n)
+{
+  return (size_t)i*n - (size_t)i*(i + 1)/2;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Finds the block of samples whose distances are written together. The samples 
+from first up to (but not including) the returned sample have at most capacity
+distances between them and the samples after them. A block always contains at
+least one sample, so capacity should be at least n - 1.
+
+Input: The first sample of the block (0-based).
+       The number of samples.
+       The maximum number of distances in a block.
+Output: The sample after the last sample in the block.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+int dist_block_end(int first, int n, size_t capacity)
+{
+  int last = first + 1;
+  size_t count = (size_t)(n - 1 - first);
+
+  while(last < n - 1 && count + (size_t)(n - 1 - last) <= capacity)
+  {
+    count += (size_t)(n - 1 - last);
+    last++;
+  }
+  return last;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Creates a distance file and writes its header. The distances are written after
+it in the order of a dist object with fwrite.
+
+Input: The path to the distance file.
+       The number of samples.
+Output: The open file or NULL if it could not be created. 
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+FILE* create_dist_file(const char *filename, int n)
+{
+  struct dist_header header;
+  FILE *file;
+
+  file = fopen(filename, "wb");
+  if(file == NULL)
+  {
+    return NULL;
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, DIST_MAGIC, 8);
+  header.version = DIST_VERSION;
+  header.byte_order = 1;
+  header.num_samples = (uint64_t)n;
+  if(fwrite(&header, sizeof(header), 1, file) != 1)
+  {
+    fclose(file);
+    return NULL;
+  }
+  return file;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Gives the distances of a dist vector or of a distance file in the order of a
+dist object. Distance files are memory mapped and must be closed with 
+close_distances.
+
+Input: A numeric vector in the order of a dist object or the path to a 
+          distance file.
+       A pointer to hold the number of samples.
+       A pointer to hold the number of bytes mapped (0 for vectors).
+Output: A pointer to the first distance. An error is raised if the file is not
+        a valid distance file.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+const double* open_distances(SEXP dist, int *n, size_t *mapped)
+{
+  struct dist_header header;
+  const char *filename;
+  char *data;
+  size_t size;
+  size_t count;
+
+  if(TYPEOF(dist) != STRSXP)
+  {
+    count = (size_t)XLENGTH(dist);
+    *n = (int)((1 + sqrt(1 + 8*(double)count))/2);
+    *mapped = 0;
+    return REAL(dist);
+  }
+  filename = CHAR(STRING_ELT(dist, 0));
+  data = (char*)map_file(filename, &size);
+  if(size >= DIST_HEADER_SIZE)
+  {
+    memcpy(&header, data, sizeof(header));
+  }
+  if(size < DIST_HEADER_SIZE || memcmp(header.magic, DIST_MAGIC, 8) != 0 ||
+     header.version != DIST_VERSION || header.byte_order != 1 || 
+     header.num_samples > INT_MAX ||
+     (size - DIST_HEADER_SIZE)/sizeof(double) < 
+       dist_row_offset((int)header.num_samples, (int)header.num_samples))
+  {
+    unmap_file(data, size);
+    error("%s is not a valid distance file.", filename);
+  }
+  *n = (int)header.num_samples;
+  *mapped = size;
+  return (const double*)(data + DIST_HEADER_SIZE);
+}
+
+// Unmaps a distance file opened by open_distances
+void close_distances(const double *dist, size_t mapped)
+{
+  if(mapped > 0)
+  {
+    unmap_file((char*)dist - DIST_HEADER_SIZE, mapped);
+  }
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Writes a dist object to a distance file.
+
+Input: A numeric vector in the order of a dist object.
+       The path to the distance file.
+Output: The number of samples.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP dist_file_write(SEXP dist, SEXP path)
+{
+  const double *values;
+  const char *filename;
+  FILE *file;
+  size_t mapped;
+  size_t count;
+  int n;
+  int failed;
+
+  filename = CHAR(STRING_ELT(path, 0));
+  values = open_distances(dist, &n, &mapped);
+  count = dist_row_offset(n, n);
+  file = create_dist_file(filename, n);
+  if(file == NULL)
+  {
+    error("Could not open %s.", filename);
+  }
+  failed = fwrite(values, sizeof(double), count, file) != count;
+  failed = (fclose(file) != 0) || failed;
+  if(failed)
+  {
+    error("Could not write to %s.", filename);
+  }
+  return ScalarInteger(n);
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Reads the header of a distance file.
+
+Input: The path to a distance file.
+Output: The number of samples.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP dist_file_info(SEXP path)
+{
+  const double *dist;
+  size_t mapped;
+  int n;
+
+  // Mapping the file checks that it is complete
+  dist = open_distances(path, &n, &mapped);
+  close_distances(dist, mapped);
+  return ScalarInteger(n);
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Reads a tile of the square distance matrix from a distance file. Only the 
+pages of the file holding the requested distances are read.
+
+Input: The path to a distance file.
+       An integer vector of the (1-based) samples in the rows of the tile.
+       An integer vector of the (1-based) samples in the columns of the tile.
+Output: A matrix of the distances between the samples in rows and cols.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP dist_file_tile(SEXP path, SEXP rows, SEXP cols)
+{
+  SEXP R_out;
+  const double *dist;
+  double *out;
+  size_t mapped;
+  int num_rows = length(rows);
+  int num_cols = length(cols);
+  int n;
+  int r;
+  int c;
+  int i;
+  int j;
+
+  // The output is allocated before the file is mapped so that an allocation
+  // error does not leave the file mapped
+  R_out = PROTECT(allocMatrix(REALSXP, num_rows, num_cols));
+  out = REAL(R_out);
+  dist = open_distances(path, &n, &mapped);
+  for(r = 0; r < num_rows + num_cols; r++)
+  {
+    i = (r < num_rows) ? INTEGER(rows)[r] : INTEGER(cols)[r - num_rows];
+    if(i == NA_INTEGER || i < 1 || i > n)
+    {
+      close_distances(dist, mapped);
+      error("The samples must be between 1 and %d.", n);
+    }
+  }
+  for(c = 0; c < num_cols; c++)
+  {
+    j = INTEGER(cols)[c] - 1;
+    for(r = 0; r < num_rows; r++)
+    {
+      i = INTEGER(rows)[r] - 1;
+      if(i == j)
+      {
+        out[r + (size_t)c*num_rows] = 0.0;
+      }
+      else if(i < j)
+      {
+        out[r + (size_t)c*num_rows] = dist[dist_row_offset(i, n) + (j - i - 1)];
+      }
+      else
+      {
+        out[r + (size_t)c*num_rows] = dist[dist_row_offset(j, n) + (i - j - 1)];
+      }
+    }
+  }
+  close_distances(dist, mapped);
+  UNPROTECT(1);
+  return R_out;
+}
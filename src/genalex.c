@@ -0,0 +1,518 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#
+# This software was authored by Zhian N. Kamvar and Javier F. Tabima, graduate
+# students at Oregon State University; Jonah C. Brooks, undergraduate student at
+# Oregon State University; and Dr. Nik Grünwald, an employee of USDA-ARS.
+#
+# Permission to use, copy, modify, and distribute this software and its
+# documentation for educational, research and non-profit purposes, without fee,
+# and without a written agreement is hereby granted, provided that the statement
+# above is incorporated into the material, giving appropriate attribution to the
+# authors.
+#
+# Permission to incorporate this software into commercial products may be
+# obtained by contacting USDA ARS and OREGON STATE UNIVERSITY Office for
+# Commercialization and Corporate Development.
+#
+# The software program and documentation are supplied "as is", without any
+# accompanying services from the USDA or the University. USDA ARS or the
+# University do not warrant that the operation of the program will be
+# uninterrupted or error-free. The end-user understands that the program was
+# developed for research purposes and is advised not to rely exclusively on the
+# program for any reason.
+#
+# IN NO EVENT SHALL USDA ARS OR OREGON STATE UNIVERSITY BE LIABLE TO ANY PARTY
+# FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+# LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+# EVEN IF THE OREGON STATE UNIVERSITY HAS BEEN ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE. USDA ARS OR OREGON STATE UNIVERSITY SPECIFICALLY DISCLAIMS ANY
+# WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE AND ANY STATUTORY
+# WARRANTY OF NON-INFRINGEMENT. THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS"
+# BASIS, AND USDA ARS AND OREGON STATE UNIVERSITY HAVE NO OBLIGATIONS TO PROVIDE
+# MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+#
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+
+#include <Rinternals.h>
+#include <R_ext/Utils.h>
+#include <R.h>
+#include <string.h>
+#include <stdlib.h>
+
+/*
+
+Reading GenAlEx files
+=====================
+
+read.genalex() reads the first two lines of a GenAlEx file in R to find the 
+layout of the file. The rest of the file is a table with a header line that is
+read here from a memory mapped copy of the file in the same way as 
+read.table(colClasses = "character", quote = "\"") followed by trimming the 
+white space of the data:
+
+ - blank lines and everything after a '#' outside of quotes are skipped
+ - fields in double quotes may contain the separator and "" for a quote
+ - the data fields "NA" and "" (after trimming) are missing
+
+The genotypes are then converted into a table of allele counts directly 
+instead of pasting the alleles of each locus together and splitting them again
+in df2genind().
+
+*/
+
+// A hash table of the alleles of a single locus. The slots hold the index of
+// the allele in alleles, or -1 if the slot is empty. The memory is allocated
+// with R_alloc so that it is released if the user interrupts.
+struct allele_table
+{
+  SEXP *alleles; // CHARSXPs of the alleles in the order they were found
+  int *slots;
+  int num_alleles;
+  int num_slots;  // Always a power of two
+  int capacity;   // Space for alleles
+};
+
+SEXP read_genalex_table(SEXP path, SEXP sep, SEXP skip);
+SEXP genalex_tab(SEXP genotypes, SEXP ploidy);
+static const char* next_line(const char *start, const char *end);
+static int split_fields(const char *line, const char *end, char sep, 
+                        char *buffer, int *starts, int *lengths, int max_fields);
+static SEXP field_string(const char *field, int length);
+static int is_blank_line(const char *line, const char *end);
+static void allele_table_init(struct allele_table *table);
+static void allele_table_clear(struct allele_table *table);
+static int allele_index(struct allele_table *table, SEXP allele);
+static int is_missing_allele(SEXP allele);
+// Defined in dist_file.c
+void* map_file(const char *filename, size_t *size);
+void unmap_file(void *data, size_t size);
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Reads the table of a GenAlEx file. The file is read twice: once to count the 
+rows and columns, and once to fill in the columns.
+
+Input: The path to the file.
+       The separator of the columns (a single character).
+       The number of lines to skip before the header.
+Output: A list of character vectors, one for each column, named by the header.
+        Short rows are filled in with missing data.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP read_genalex_table(SEXP path, SEXP sep, SEXP skip)
+{
+  SEXP R_out;
+  SEXP R_names;
+  const char *filename;
+  const char *data;
+  const char *end;
+  const char *line;
+  const char *line_end;
+  const char *header;
+  const char *header_end;
+  char separator;
+  char *buffer;
+  int *starts;
+  int *lengths;
+  size_t size;
+  size_t max_length;
+  size_t line_length;
+  int num_skip;
+  int num_rows;
+  int num_cols;
+  int num_fields;
+  int row;
+  int i;
+
+  filename  = CHAR(STRING_ELT(path, 0));
+  separator = *CHAR(STRING_ELT(sep, 0));
+  num_skip  = asInteger(skip);
+  data = (const char*)map_file(filename, &size);
+  end  = data + size;
+
+  // Skip to the header, which is the first line after skip that is not blank
+  line = data;
+  for(i = 0; i < num_skip && line < end; i++)
+  {
+    line = next_line(line, end);
+  }
+  while(line < end && is_blank_line(line, next_line(line, end)))
+  {
+    line = next_line(line, end);
+  }
+  if(line >= end)
+  {
+    unmap_file((void*)data, size);
+    error("%s has no header.", filename);
+  }
+  header     = line;
+  header_end = next_line(header, end);
+
+  // Count the rows and the number of fields in the longest line. A line has at
+  // most one more field than it has characters.
+  num_rows   = 0;
+  max_length = header_end - header;
+  for(line = header_end; line < end; line = line_end)
+  {
+    line_end = next_line(line, end);
+    if(!is_blank_line(line, line_end))
+    {
+      num_rows++;
+      line_length = (size_t)(line_end - line);
+      max_length = (line_length > max_length) ? line_length : max_length;
+    }
+  }
+  buffer  = R_Calloc(max_length + 1, char);
+  starts  = R_Calloc(max_length + 1, int);
+  lengths = R_Calloc(max_length + 1, int);
+  num_cols = split_fields(header, header_end, separator, buffer, starts, 
+                          lengths, max_length + 1);
+  for(line = header_end; line < end; line = line_end)
+  {
+    line_end = next_line(line, end);
+    if(!is_blank_line(line, line_end))
+    {
+      num_fields = split_fields(line, line_end, separator, buffer, starts, 
+                                lengths, max_length + 1);
+      num_cols = (num_fields > num_cols) ? num_fields : num_cols;
+    }
+  }
+
+  PROTECT(R_out   = allocVector(VECSXP, num_cols));
+  PROTECT(R_names = allocVector(STRSXP, num_cols));
+  for(i = 0; i < num_cols; i++)
+  {
+    SET_VECTOR_ELT(R_out, i, allocVector(STRSXP, num_rows));
+    SET_STRING_ELT(R_names, i, mkChar(""));
+  }
+  // The column names are not trimmed, just like read.table(header = TRUE)
+  num_fields = split_fields(header, header_end, separator, buffer, starts, 
+                            lengths, max_length + 1);
+  for(i = 0; i < num_fields; i++)
+  {
+    SET_STRING_ELT(R_names, i, 
+                   mkCharLenCE(buffer + starts[i], lengths[i], CE_NATIVE));
+  }
+  // There are no checks for interrupts while the file is mapped, since the
+  // mapping would not be released.
+  row = 0;
+  for(line = header_end; line < end; line = line_end)
+  {
+    line_end = next_line(line, end);
+    if(is_blank_line(line, line_end))
+    {
+      continue;
+    }
+    num_fields = split_fields(line, line_end, separator, buffer, starts, 
+                              lengths, max_length + 1);
+    for(i = 0; i < num_cols; i++)
+    {
+      SET_STRING_ELT(VECTOR_ELT(R_out, i), row, (i < num_fields) ? 
+                     field_string(buffer + starts[i], lengths[i]) : NA_STRING);
+    }
+    row++;
+  }
+  setAttrib(R_out, R_NamesSymbol, R_names);
+  R_Free(buffer);
+  R_Free(starts);
+  R_Free(lengths);
+  unmap_file((void*)data, size);
+  UNPROTECT(2);
+  return R_out;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Counts the alleles of the genotypes of a GenAlEx file. The alleles of each 
+locus are numbered in the order they are first seen going down the samples, 
+which is the same order that df2genind() gives them.
+
+Input: A list of character vectors, one for each allele of each locus. The 
+       columns of a locus must be next to each other.
+       The number of columns of each locus (the ploidy).
+Output: A list of three elements:
+         1. an integer matrix of allele counts with samples in rows. All of 
+            the counts of a locus are NA if every allele of the locus is 
+            missing (NA or "0"). Otherwise, missing alleles are counted as the
+            allele "0", the same as polyploids in read.genalex().
+         2. the (1-based) locus of each column
+         3. the allele of each column
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP genalex_tab(SEXP genotypes, SEXP ploidy)
+{
+  SEXP R_out;
+  SEXP R_tab;
+  SEXP R_loci;
+  SEXP R_alleles;
+  SEXP R_zero;
+  SEXP allele;
+  struct allele_table table;
+  int *tab;
+  int *locus_start;
+  int num_samples;
+  int num_loci;
+  int num_columns;
+  int ploid;
+  int missing;
+  int locus;
+  int sample;
+  int a;
+  int k;
+
+  ploid       = asInteger(ploidy);
+  num_loci    = length(genotypes)/ploid;
+  num_samples = (num_loci > 0) ? length(VECTOR_ELT(genotypes, 0)) : 0;
+  PROTECT(R_zero = mkChar("0"));
+
+  // Find the alleles of each locus. locus_start[l] is the first column of 
+  // locus l in the table.
+  allele_table_init(&table);
+  locus_start = (int*)R_alloc(num_loci + 1, sizeof(int));
+  locus_start[0] = 0;
+  for(locus = 0; locus < num_loci; locus++)
+  {
+    R_CheckUserInterrupt();
+    allele_table_clear(&table);
+    for(sample = 0; sample < num_samples; sample++)
+    {
+      missing = 1;
+      for(a = 0; a < ploid && missing; a++)
+      {
+        missing = is_missing_allele(STRING_ELT(VECTOR_ELT(genotypes, locus*ploid + a), sample));
+      }
+      for(a = 0; a < ploid && !missing; a++)
+      {
+        allele = STRING_ELT(VECTOR_ELT(genotypes, locus*ploid + a), sample);
+        allele_index(&table, (allele == NA_STRING) ? R_zero : allele);
+      }
+    }
+    locus_start[locus + 1] = locus_start[locus] + table.num_alleles;
+  }
+  num_columns = locus_start[num_loci];
+
+  PROTECT(R_out     = allocVector(VECSXP, 3));
+  PROTECT(R_tab     = allocMatrix(INTSXP, num_samples, num_columns));
+  PROTECT(R_loci    = allocVector(INTSXP, num_columns));
+  PROTECT(R_alleles = allocVector(STRSXP, num_columns));
+  tab = INTEGER(R_tab);
+  memset(tab, 0, sizeof(int)*num_samples*(size_t)num_columns);
+
+  // Count the alleles. The alleles are found again in the same order, so 
+  // their indices match the first pass.
+  for(locus = 0; locus < num_loci; locus++)
+  {
+    R_CheckUserInterrupt();
+    allele_table_clear(&table);
+    for(sample = 0; sample < num_samples; sample++)
+    {
+      missing = 1;
+      for(a = 0; a < ploid && missing; a++)
+      {
+        missing = is_missing_allele(STRING_ELT(VECTOR_ELT(genotypes, locus*ploid + a), sample));
+      }
+      for(k = locus_start[locus]; k < locus_start[locus + 1] && missing; k++)
+      {
+        tab[sample + (size_t)k*num_samples] = NA_INTEGER;
+      }
+      for(a = 0; a < ploid && !missing; a++)
+      {
+        allele = STRING_ELT(VECTOR_ELT(genotypes, locus*ploid + a), sample);
+        k = locus_start[locus] + 
+            allele_index(&table, (allele == NA_STRING) ? R_zero : allele);
+        tab[sample + (size_t)k*num_samples]++;
+      }
+    }
+    for(a = 0; a < table.num_alleles; a++)
+    {
+      INTEGER(R_loci)[locus_start[locus] + a] = locus + 1;
+      SET_STRING_ELT(R_alleles, locus_start[locus] + a, table.alleles[a]);
+    }
+  }
+  SET_VECTOR_ELT(R_out, 0, R_tab);
+  SET_VECTOR_ELT(R_out, 1, R_loci);
+  SET_VECTOR_ELT(R_out, 2, R_alleles);
+  UNPROTECT(5);
+  return R_out;
+}
+
+// The start of the line after the one starting at start
+static const char* next_line(const char *start, const char *end)
+{
+  const char *newline = memchr(start, '\n', end - start);
+  return (newline == NULL) ? end : newline + 1;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Splits a line into fields. The text of the fields (without quotes) is copied 
+into buffer, and the fields start at buffer + starts[i] with lengths[i] 
+characters. Reading stops at a '#' outside of quotes or at the end of the line.
+
+Returns the number of fields.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static int split_fields(const char *line, const char *end, char sep, 
+                        char *buffer, int *starts, int *lengths, int max_fields)
+{
+  const char *p = line;
+  int num_fields = 0;
+  int length = 0;
+  int quoted;
+
+  // Drop the line ending
+  while(end > line && (end[-1] == '\n' || end[-1] == '\r'))
+  {
+    end--;
+  }
+  while(num_fields < max_fields)
+  {
+    starts[num_fields] = length;
+    quoted = 0;
+    while(p < end && (quoted || (*p != sep && *p != '#')))
+    {
+      if(*p == '"')
+      {
+        if(quoted && p + 1 < end && p[1] == '"')
+        {
+          buffer[length++] = '"';
+          p++;
+        }
+        else
+        {
+          quoted = !quoted;
+        }
+      }
+      else
+      {
+        buffer[length++] = *p;
+      }
+      p++;
+    }
+    lengths[num_fields] = length - starts[num_fields];
+    num_fields++;
+    if(p >= end || *p != sep)
+    {
+      break;
+    }
+    p++;
+  }
+  return num_fields;
+}
+
+// A line is blank if it has nothing but an optional comment
+static int is_blank_line(const char *line, const char *end)
+{
+  while(line < end && (*line == '\n' || *line == '\r'))
+  {
+    line++;
+  }
+  return line == end || *line == '#';
+}
+
+// Converts a field to a string. "NA" and fields that are empty after trimming
+// white space are missing.
+static SEXP field_string(const char *field, int length)
+{
+  if(length == 2 && field[0] == 'N' && field[1] == 'A')
+  {
+    return NA_STRING;
+  }
+  while(length > 0 && (*field == ' ' || *field == '\t' || 
+        *field == '\r' || *field == '\n' || *field == '\v' || *field == '\f'))
+  {
+    field++;
+    length--;
+  }
+  while(length > 0 && (field[length - 1] == ' ' || 
+        field[length - 1] == '\t' || field[length - 1] == '\r' || 
+        field[length - 1] == '\n' || field[length - 1] == '\v' || 
+        field[length - 1] == '\f'))
+  {
+    length--;
+  }
+  return (length == 0) ? NA_STRING : mkCharLenCE(field, length, CE_NATIVE);
+}
+
+// Missing alleles are NA in GenAlEx files read by R and "0" in the file
+static int is_missing_allele(SEXP allele)
+{
+  return allele == NA_STRING || strcmp(CHAR(allele), "0") == 0;
+}
+
+static void allele_table_init(struct allele_table *table)
+{
+  table->capacity    = 16;
+  table->num_slots   = 32;
+  table->num_alleles = 0;
+  table->alleles     = (SEXP*)R_alloc(table->capacity, sizeof(SEXP));
+  table->slots       = (int*)R_alloc(table->num_slots, sizeof(int));
+  memset(table->slots, -1, sizeof(int)*table->num_slots);
+}
+
+static void allele_table_clear(struct allele_table *table)
+{
+  table->num_alleles = 0;
+  memset(table->slots, -1, sizeof(int)*table->num_slots);
+}
+
+// FNV-1a hash of a string
+static unsigned int hash_string(const char *s)
+{
+  unsigned int hash = 2166136261u;
+  while(*s)
+  {
+    hash = (hash ^ (unsigned char)*s++) * 16777619u;
+  }
+  return hash;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Finds the index of an allele in the table. If the allele is new, it is added
+to the end of the table. The table is kept at most half full so that the 
+alleles can be found with linear probing.
+
+Returns the index of the allele.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static int allele_index(struct allele_table *table, SEXP allele)
+{
+  const char *name = CHAR(allele);
+  unsigned int mask = table->num_slots - 1;
+  unsigned int slot = hash_string(name) & mask;
+  SEXP *alleles;
+  int index;
+  int i;
+
+  while(table->slots[slot] >= 0)
+  {
+    if(strcmp(CHAR(table->alleles[table->slots[slot]]), name) == 0)
+    {
+      return table->slots[slot];
+    }
+    slot = (slot + 1) & mask;
+  }
+  if(table->num_alleles == table->capacity)
+  {
+    alleles = (SEXP*)R_alloc(2*table->capacity, sizeof(SEXP));
+    memcpy(alleles, table->alleles, sizeof(SEXP)*table->capacity);
+    table->alleles  = alleles;
+    table->capacity *= 2;
+  }
+  index = table->num_alleles++;
+  table->alleles[index] = allele;
+  table->slots[slot] = index;
+  if(2*table->num_alleles > table->num_slots)
+  {
+    // Grow the slots and put the alleles back in
+    table->num_slots *= 2;
+    table->slots = (int*)R_alloc(table->num_slots, sizeof(int));
+    memset(table->slots, -1, sizeof(int)*table->num_slots);
+    mask = table->num_slots - 1;
+    for(i = 0; i < table->num_alleles; i++)
+    {
+      slot = hash_string(CHAR(table->alleles[i])) & mask;
+      while(table->slots[slot] >= 0)
+      {
+        slot = (slot + 1) & mask;
+      }
+      table->slots[slot] = i;
+    }
+  }
+  return index;
+}
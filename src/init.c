@@ -8,44 +8,108 @@
 */
 
 /* .Call calls */
-extern SEXP adjust_missing(SEXP, SEXP);
+extern SEXP adjust_missing(SEXP, SEXP, SEXP);
+extern SEXP amova_permutation(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
 extern SEXP association_index_diploid(SEXP, SEXP, SEXP, SEXP);
 extern SEXP association_index_haploid(SEXP, SEXP, SEXP);
+extern SEXP association_index_loci(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP association_index_pa(SEXP, SEXP);
+extern SEXP bitwise_distance_condensed(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
 extern SEXP bitwise_distance_diploid(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP bitwise_distance_file(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
 extern SEXP bitwise_distance_haploid(SEXP, SEXP, SEXP);
+extern SEXP bootstrap_locus_distance(SEXP, SEXP, SEXP, SEXP, SEXP);
 extern SEXP bruvo_distance(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
 extern SEXP bruvo_between(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP build_trees(SEXP, SEXP, SEXP, SEXP);
+extern SEXP clone_correct(SEXP, SEXP);
+extern SEXP dist_file_info(SEXP);
+extern SEXP dist_file_tile(SEXP, SEXP, SEXP);
+extern SEXP dist_file_write(SEXP, SEXP);
+extern SEXP diversity_bootstrap(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
 extern SEXP expand_indices(SEXP, SEXP);
+extern SEXP genalex_tab(SEXP, SEXP);
+extern SEXP genetic_distance(SEXP, SEXP, SEXP, SEXP, SEXP);
 extern SEXP genotype_curve_internal(SEXP, SEXP, SEXP, SEXP);
-extern SEXP get_pgen_matrix_genind(SEXP, SEXP, SEXP, SEXP);
+extern SEXP genotype_store_info(SEXP);
+extern SEXP genotype_store_write(SEXP, SEXP, SEXP);
+extern SEXP genotype_view_pack(SEXP);
+extern SEXP genotype_view_size(SEXP);
+extern SEXP get_pgen_matrix_genind(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP get_pgen_matrix_genlight(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP ia_permutation(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP mlg_index_encode(SEXP, SEXP, SEXP);
+extern SEXP mlg_index_insert(SEXP, SEXP, SEXP, SEXP);
+extern SEXP mlg_index_new(void);
+extern SEXP mlg_index_size(SEXP);
 extern SEXP mlg_round_robin(SEXP);
-extern SEXP msn_tied_edges(SEXP, SEXP, SEXP);
+extern SEXP mlg_sparse(SEXP, SEXP, SEXP, SEXP);
+extern SEXP msn_edges(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP msn_tied_edges(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
 extern SEXP neighbor_clustering(SEXP, SEXP, SEXP, SEXP, SEXP);
 extern SEXP omp_test();
+extern SEXP pair_ia_sums(SEXP, SEXP, SEXP, SEXP, SEXP);
 extern SEXP pairdiffs(SEXP);
+extern SEXP pairdiffs_all(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP pairdiffs_all_file(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
 extern SEXP pairwise_covar(SEXP);
 extern SEXP permute_shuff(SEXP, SEXP, SEXP);
 extern SEXP permuto(SEXP);
+extern SEXP psex_multiple(SEXP, SEXP, SEXP, SEXP);
+extern SEXP read_genalex_table(SEXP, SEXP, SEXP);
+extern SEXP resample_ia(SEXP, SEXP, SEXP, SEXP, SEXP);
 
 static const R_CallMethodDef CallEntries[] = {
-    {"adjust_missing",            (DL_FUNC) &adjust_missing,            2},
-    {"association_index_diploid", (DL_FUNC) &association_index_diploid, 4},
-    {"association_index_haploid", (DL_FUNC) &association_index_haploid, 3},
-    {"bitwise_distance_diploid",  (DL_FUNC) &bitwise_distance_diploid,  5},
-    {"bitwise_distance_haploid",  (DL_FUNC) &bitwise_distance_haploid,  3},
-    {"bruvo_distance",            (DL_FUNC) &bruvo_distance,            6},
-    {"bruvo_between",             (DL_FUNC) &bruvo_between,             7},
-    {"expand_indices",            (DL_FUNC) &expand_indices,            2},
-    {"genotype_curve_internal",   (DL_FUNC) &genotype_curve_internal,   4},
-    {"get_pgen_matrix_genind",    (DL_FUNC) &get_pgen_matrix_genind,    4},
-    {"mlg_round_robin",           (DL_FUNC) &mlg_round_robin,           1},
-    {"msn_tied_edges",            (DL_FUNC) &msn_tied_edges,            3},
-    {"neighbor_clustering",       (DL_FUNC) &neighbor_clustering,       5},
-    {"omp_test",                  (DL_FUNC) &omp_test,                  0},
-    {"pairdiffs",                 (DL_FUNC) &pairdiffs,                 1},
-    {"pairwise_covar",            (DL_FUNC) &pairwise_covar,            1},
-    {"permute_shuff",             (DL_FUNC) &permute_shuff,             3},
-    {"permuto",                   (DL_FUNC) &permuto,                   1},
+    {"adjust_missing",             (DL_FUNC) &adjust_missing,              3},
+    {"amova_permutation",          (DL_FUNC) &amova_permutation,           6},
+    {"association_index_diploid",  (DL_FUNC) &association_index_diploid,   4},
+    {"association_index_haploid",  (DL_FUNC) &association_index_haploid,   3},
+    {"association_index_loci",     (DL_FUNC) &association_index_loci,      5},
+    {"association_index_pa",       (DL_FUNC) &association_index_pa,        2},
+    {"bitwise_distance_condensed", (DL_FUNC) &bitwise_distance_condensed,  6},
+    {"bitwise_distance_diploid",   (DL_FUNC) &bitwise_distance_diploid,    5},
+    {"bitwise_distance_file",      (DL_FUNC) &bitwise_distance_file,       9},
+    {"bitwise_distance_haploid",   (DL_FUNC) &bitwise_distance_haploid,    3},
+    {"bootstrap_locus_distance",   (DL_FUNC) &bootstrap_locus_distance,    5},
+    {"bruvo_distance",             (DL_FUNC) &bruvo_distance,              6},
+    {"bruvo_between",              (DL_FUNC) &bruvo_between,               7},
+    {"build_trees",                (DL_FUNC) &build_trees,                 4},
+    {"clone_correct",              (DL_FUNC) &clone_correct,               2},
+    {"dist_file_info",             (DL_FUNC) &dist_file_info,              1},
+    {"dist_file_tile",             (DL_FUNC) &dist_file_tile,              3},
+    {"dist_file_write",            (DL_FUNC) &dist_file_write,             2},
+    {"diversity_bootstrap",        (DL_FUNC) &diversity_bootstrap,         6},
+    {"expand_indices",             (DL_FUNC) &expand_indices,              2},
+    {"genalex_tab",                (DL_FUNC) &genalex_tab,                 2},
+    {"genetic_distance",           (DL_FUNC) &genetic_distance,            5},
+    {"genotype_curve_internal",    (DL_FUNC) &genotype_curve_internal,     4},
+    {"genotype_store_info",        (DL_FUNC) &genotype_store_info,         1},
+    {"genotype_store_write",       (DL_FUNC) &genotype_store_write,        3},
+    {"genotype_view_pack",         (DL_FUNC) &genotype_view_pack,          1},
+    {"genotype_view_size",         (DL_FUNC) &genotype_view_size,          1},
+    {"get_pgen_matrix_genind",     (DL_FUNC) &get_pgen_matrix_genind,      6},
+    {"get_pgen_matrix_genlight",   (DL_FUNC) &get_pgen_matrix_genlight,    5},
+    {"ia_permutation",             (DL_FUNC) &ia_permutation,              7},
+    {"mlg_index_encode",           (DL_FUNC) &mlg_index_encode,            3},
+    {"mlg_index_insert",           (DL_FUNC) &mlg_index_insert,            4},
+    {"mlg_index_new",              (DL_FUNC) &mlg_index_new,               0},
+    {"mlg_index_size",             (DL_FUNC) &mlg_index_size,              1},
+    {"mlg_round_robin",            (DL_FUNC) &mlg_round_robin,             1},
+    {"mlg_sparse",                 (DL_FUNC) &mlg_sparse,                  4},
+    {"msn_edges",                  (DL_FUNC) &msn_edges,                   6},
+    {"msn_tied_edges",             (DL_FUNC) &msn_tied_edges,              7},
+    {"neighbor_clustering",        (DL_FUNC) &neighbor_clustering,         5},
+    {"omp_test",                   (DL_FUNC) &omp_test,                    0},
+    {"pair_ia_sums",               (DL_FUNC) &pair_ia_sums,                5},
+    {"pairdiffs",                  (DL_FUNC) &pairdiffs,                   1},
+    {"pairdiffs_all",              (DL_FUNC) &pairdiffs_all,               5},
+    {"pairdiffs_all_file",         (DL_FUNC) &pairdiffs_all_file,          7},
+    {"pairwise_covar",             (DL_FUNC) &pairwise_covar,              1},
+    {"permute_shuff",              (DL_FUNC) &permute_shuff,               3},
+    {"permuto",                    (DL_FUNC) &permuto,                     1},
+    {"psex_multiple",              (DL_FUNC) &psex_multiple,               4},
+    {"read_genalex_table",         (DL_FUNC) &read_genalex_table,          3},
+    {"resample_ia",                (DL_FUNC) &resample_ia,                 5},
     {NULL, NULL, 0}
 };
 
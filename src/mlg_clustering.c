@@ -40,6 +40,7 @@
 #include <Rdefines.h>
 #include <R.h>
 #include <math.h>
+#include <float.h>
 #include <time.h>
 #include <string.h>
 #include <stdlib.h>
@@ -55,14 +56,20 @@
 
 
 SEXP neighbor_clustering(SEXP dist, SEXP mlg, SEXP threshold, SEXP algorithm, SEXP requested_threads);
-void fill_distance_matrix(double** cluster_distance_martix, double*** private_distance_matrix, int* out_vector, int* cluster_size, SEXP dist, char algo, int num_individuals, int num_mlgs, int num_threads);
+void fill_distance_matrix(double** cluster_distance_martix, double*** private_distance_matrix, int* out_vector, int* cluster_size, const double* dist, int condensed, char algo, int num_individuals, int num_mlgs, int num_threads);
+int check_distances(const double* dist, int condensed, int* mlg, int num_individuals);
+// Defined in dist_file.c
+size_t dist_row_offset(int i, int n);
+const double* open_distances(SEXP dist, int *n, size_t *mapped);
+void close_distances(const double *dist, size_t mapped);
 
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 Reassigns genotypes from mlg into new clusters based on a minimum genetic distance
 between clusters using one of three clustering algorithms. 
 The result will be a new list of mll assignments based on those rules.
 
-Input: A square matrix of numeric distances between each pair of samples.
+Input: A square matrix of numeric distances between each pair of samples or
+        the path to a distance file (see dist_file.c).
        A vector of initial mlg assignments for each sample.
        A real used to govern the minimum distance between clusters/mlls.
        A string determining the algorithm to use. Must start with a lowercase
@@ -89,7 +96,8 @@ SEXP neighbor_clustering(SEXP dist, SEXP mlg, SEXP threshold, SEXP algorithm, SE
   //  Take care if calling this function directly.
 
   // Assumptions:
-  //  dist is an n by n matrix containing distances between individuals
+  //  dist is an n by n matrix containing distances between individuals or
+  //   the path to a distance file of n individuals
   //  mlg is a vector of length n containing mlg assignments
   //  length(unique(mlg)) is at most n and at least 1
   //  threshold is a real
@@ -111,6 +119,10 @@ SEXP neighbor_clustering(SEXP dist, SEXP mlg, SEXP threshold, SEXP algorithm, SE
   int* out_vector; // A copy of Rout for internal use
   int num_threads;
   char algo;  // Used for storing the first letter of algorithm
+  const double* distances; // The distances in dist
+  int condensed; // Are the distances in the order of a dist object?
+  size_t mapped; // Bytes mapped for a distance file
+  int invalid; // Do the distances contain missing or negative values?
 
   SEXP Rout;
   SEXP Rout_vects;
@@ -122,8 +134,33 @@ SEXP neighbor_clustering(SEXP dist, SEXP mlg, SEXP threshold, SEXP algorithm, SE
   // Convert the R object arguments into C data types
   algo = *CHAR(STRING_ELT(algorithm,0));
   thresh = REAL(threshold)[0];
-  Rdim = getAttrib(dist, R_DimSymbol);
-  num_individuals = INTEGER(Rdim)[0]; // dist is a square matrix
+  if(TYPEOF(dist) == STRSXP)
+  {
+    // The distance file is memory mapped and read in the order of a dist object
+    distances = open_distances(dist, &num_individuals, &mapped);
+    condensed = 1;
+  }
+  else
+  {
+    Rdim = getAttrib(dist, R_DimSymbol);
+    num_individuals = INTEGER(Rdim)[0]; // dist is a square matrix
+    distances = REAL(dist);
+    condensed = 0;
+    mapped = 0;
+  }
+
+  // The distances are checked before any memory is allocated so that a
+  // distance file can be closed before the error
+  invalid = check_distances(distances, condensed, INTEGER(mlg), num_individuals);
+  if(invalid)
+  {
+    close_distances(distances, mapped);
+    if(invalid == 1)
+    {
+      error("Data set contains missing or invalid distances. Please check your data.\n");
+    }
+    error("Distance matrix must not contain negative distances.\n");
+  }
 
   // Find the MLG with the highest index value
   // and use it as the number of MLGs in the data set 
@@ -252,7 +289,7 @@ SEXP neighbor_clustering(SEXP dist, SEXP mlg, SEXP threshold, SEXP algorithm, SE
     closest_pair[0] = -1;
     closest_pair[1] = -1;
     // Fill the distance matrix with the new distances between each cluster
-    fill_distance_matrix(cluster_distance_matrix,private_distance_matrix,out_vector,cluster_size,dist,algo,num_individuals,num_mlgs,num_threads);
+    fill_distance_matrix(cluster_distance_matrix,private_distance_matrix,out_vector,cluster_size,distances,condensed,algo,num_individuals,num_mlgs,num_threads);
     // Loop through each pairing of MLGs to find the pair whose clusters are separated by the smallest distance
     for(int i = 0; i < num_mlgs; i++)
     {
@@ -339,7 +376,7 @@ SEXP neighbor_clustering(SEXP dist, SEXP mlg, SEXP threshold, SEXP algorithm, SE
     INTEGER(Rout_vects)[i] = out_vector[i]+1;
   }
   // Fill return distance matrix with updated cluster_distance_matrix
-  fill_distance_matrix(cluster_distance_matrix,private_distance_matrix,out_vector,cluster_size,dist,algo,num_individuals,num_mlgs,num_threads);
+  fill_distance_matrix(cluster_distance_matrix,private_distance_matrix,out_vector,cluster_size,distances,condensed,algo,num_individuals,num_mlgs,num_threads);
   for(int i = 0; i < num_mlgs; i++)
   {
     // Fill return sizes
@@ -381,6 +418,7 @@ SEXP neighbor_clustering(SEXP dist, SEXP mlg, SEXP threshold, SEXP algorithm, SE
   R_Free(cluster_distance_matrix);
   R_Free(cluster_size);
   R_Free(out_vector);
+  close_distances(distances, mapped);
   
   SET_VECTOR_ELT(Rout, 0, Rout_vects);
   SET_VECTOR_ELT(Rout, 1, Rout_stats);
@@ -393,10 +431,11 @@ SEXP neighbor_clustering(SEXP dist, SEXP mlg, SEXP threshold, SEXP algorithm, SE
 }
 
 // Fill the distance matrix given the current cluster assignments
-void fill_distance_matrix(double** cluster_distance_matrix, double*** private_distance_matrix, int* out_vector, int* cluster_size, SEXP dist, char algo, int num_individuals, int num_mlgs, int num_threads)
+void fill_distance_matrix(double** cluster_distance_matrix, double*** private_distance_matrix, int* out_vector, int* cluster_size, const double* dist, int condensed, char algo, int num_individuals, int num_mlgs, int num_threads)
 {
   double* dist_ij; // Variables to store distances inside loops
   double* dist_ji;
+  double dist_value;
   int thread_id;
 
   // Thu Apr 13 08:37:40 2017 ------------------------------
@@ -456,19 +495,18 @@ void fill_distance_matrix(double** cluster_distance_matrix, double*** private_di
             //  samples i and j.
             dist_ij = &(private_distance_matrix[thread_id][out_vector[i]][out_vector[j]]);
             dist_ji = &(private_distance_matrix[thread_id][out_vector[j]][out_vector[i]]);
-            if(ISNA(REAL(dist)[(i) + (j)*num_individuals]) || ISNAN(REAL(dist)[(i) + (j)*num_individuals]) 
-              || !R_FINITE(REAL(dist)[(i) + (j)*num_individuals]))
-            {
-              error("Data set contains missing or invalid distances. Please check your data.\n");
-            }
-            else if(algo=='n' && ((REAL(dist)[(i) + (j)*num_individuals] < *dist_ij) || *dist_ij < -0.5))
+            // The distance between samples i and j
+            dist_value = (condensed) ? dist[dist_row_offset(i, num_individuals) + (j - i - 1)]
+                                     : dist[(i) + (size_t)(j)*num_individuals];
+            // Missing and negative distances were rejected by check_distances
+            if(algo=='n' && ((dist_value < *dist_ij) || *dist_ij < -0.5))
             { // Nearest Neighbor clustering
               // These will update and store the smallest distance between an individual in one cluster
               //  and an individual in another. Note that the pointer nature of dist_ij means this is
               //  actually updating the private distance matrix itself in order to keep track of the
               //  distances between every pairing of clusters.
-              *dist_ij = REAL(dist)[(i) + (j)*num_individuals];
-              *dist_ji = REAL(dist)[(i) + (j)*num_individuals];
+              *dist_ij = dist_value;
+              *dist_ji = dist_value;
             }
             else if(algo=='a')
             { // Average Neighbor clustering, otherwise known as UPGMA
@@ -477,7 +515,7 @@ void fill_distance_matrix(double** cluster_distance_matrix, double*** private_di
               // Which lets us add the elements in one at a time divided by the product of cluster sizes
               if(*dist_ij < -0.5)
               { // This is the first pair to be considered between these two clusters
-                double portion = REAL(dist)[i + j*num_individuals] / (double)(cluster_size[out_vector[i]]*cluster_size[out_vector[j]]); 
+                double portion = dist_value / (double)(cluster_size[out_vector[i]]*cluster_size[out_vector[j]]); 
                 *dist_ij = portion;
                 *dist_ji = portion;
               }
@@ -485,17 +523,17 @@ void fill_distance_matrix(double** cluster_distance_matrix, double*** private_di
               { 
                 // This is adding to the existing value in order to find the mean distance between all
                 // individuals in cluster a with all individuals in cluster b, for all combinations of a and b.
-                double portion = REAL(dist)[i + j*num_individuals] / (double)(cluster_size[out_vector[i]]*cluster_size[out_vector[j]]); 
+                double portion = dist_value / (double)(cluster_size[out_vector[i]]*cluster_size[out_vector[j]]); 
                 *dist_ij += portion;
                 *dist_ji += portion;
               }
             }
-            else if(algo=='f' && REAL(dist)[(i) + (j)*num_individuals] > *dist_ij)
+            else if(algo=='f' && dist_value > *dist_ij)
             { // Farthest Neighbor clustering
               // This functions exactly like Nearest Neighbor, but using the maximum distance between
               // any individual in one cluster to any individual in another.
-              *dist_ij = REAL(dist)[(i) + (j)*num_individuals];
-              *dist_ji = REAL(dist)[(i) + (j)*num_individuals];
+              *dist_ij = dist_value;
+              *dist_ji = dist_value;
             }
           } 
         }
@@ -569,3 +607,32 @@ void fill_distance_matrix(double** cluster_distance_matrix, double*** private_di
 
   } // End parallel
 }
+
+// Checks the distances between all pairs of samples in different MLGs, which
+// are the only ones read by fill_distance_matrix. Returns 1 if a distance is
+// missing or invalid, 2 if a distance is negative, and 0 otherwise.
+int check_distances(const double* dist, int condensed, int* mlg, int num_individuals)
+{
+  double dist_value;
+  for(int i = 0; i < num_individuals; i++)
+  {
+    for(int j = i+1; j < num_individuals; j++)
+    {
+      if(mlg[i] == mlg[j])
+      {
+        continue;
+      }
+      dist_value = (condensed) ? dist[dist_row_offset(i, num_individuals) + (j - i - 1)]
+                               : dist[(i) + (size_t)(j)*num_individuals];
+      if(ISNA(dist_value) || ISNAN(dist_value) || !R_FINITE(dist_value))
+      {
+        return 1;
+      }
+      if(dist_value < -sqrt(DBL_EPSILON))
+      {
+        return 2;
+      }
+    }
+  }
+  return 0;
+}
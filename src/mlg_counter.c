@@ -36,16 +36,19 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
 #include <Rinternals.h>
 #include <R_ext/Utils.h>
+#include <Rmath.h>
 #include <R.h>
 
-int mlg_round_robin_cmpr (const void *a, const void *b);
 void SampleWithoutReplacement(int populationSize, int sampleSize, int* samples);
 SEXP mlg_round_robin(SEXP mat);
 SEXP genotype_curve_internal(SEXP mat, SEXP iter, SEXP maxloci, SEXP report);
-// global variable indicating the size of array to use for comparison in memcmp.
-int NLOCI = 0;
+SEXP psex_multiple(SEXP pgen, SEXP mlgs, SEXP pops, SEXP n_samples);
+SEXP clone_correct(SEXP genotypes, SEXP strata);
+SEXP mlg_sparse(SEXP rows, SEXP cols, SEXP counts, SEXP dims);
 
 
 /*
@@ -53,26 +56,70 @@ int NLOCI = 0;
 * columns, where m represents the number of loci in the data set. The integer i
 * represents the initial position of the sample in the data set for back
 * reference.
-* 
-* Note that there is a potential extra value for the struct: n
-* This vaule would contain the comparison size needed for memcmp. If this code
-* were to be parallelized, make sure this part of the struct is available.
 */
 struct mask {
   int* ind;
   int i;
-  // int n;
 };
 
-int mlg_round_robin_cmpr (const void *a, const void *b){
-  struct mask *ia = (struct mask *)a;
-  struct mask *ib = (struct mask *)b;
-  // Note: this depends on the global variable NLOCI. This potentially means
-  // that it's not possible in its current form to go parallel unless the
-  // variable is moved into the struct.
-  return memcmp( (const int *)(ia->ind), (const int *)(ib->ind), NLOCI );
-}
+/*
+* Sort an array of masks by the first nbytes bytes of their genotypes. This is
+* a least significant digit radix sort over single bytes, which places the
+* samples in the same order as comparing them with memcmp, but without needing
+* a comparison function (and thus global state) and in O(n*nbytes) time.
+*
+* Input:
+*   - masks an array of n mask structs to be sorted.
+*   - buffer an array of n mask structs used as scratch space.
+*   - n the number of samples.
+*   - nbytes the number of bytes of each genotype to compare.
+* Output:
+*   - none. masks will be sorted.
+*/
+static void radix_sort_masks(struct mask* masks, struct mask* buffer, int n, 
+                             int nbytes)
+{
+  int i;
+  int b;
+  int count[257];
+  unsigned char byte;
+  struct mask* from = masks;
+  struct mask* to = buffer;
+  struct mask* tmp;
 
+  for (b = nbytes - 1; b >= 0; b--)
+  {
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++)
+    {
+      byte = ((unsigned char*)from[i].ind)[b];
+      count[byte + 1]++;
+    }
+    // If all samples have the same byte here, this pass would not change the
+    // order, so it can be skipped.
+    for (i = 1; i < 257; i++)
+    {
+      if (count[i] == n) break;
+    }
+    if (i < 257) continue;
+    for (i = 1; i < 257; i++)
+    {
+      count[i] += count[i - 1];
+    }
+    for (i = 0; i < n; i++)
+    {
+      byte = ((unsigned char*)from[i].ind)[b];
+      to[count[byte]++] = from[i];
+    }
+    tmp = from;
+    from = to;
+    to = tmp;
+  }
+  if (from != masks)
+  {
+    memcpy(masks, from, n*sizeof(struct mask));
+  }
+}
 
 // Adapted from http://stackoverflow.com/a/311716/2752888
 // Algorithm 3.4.2S by Donald Knuth
@@ -107,7 +154,7 @@ void SampleWithoutReplacement(int populationSize, int sampleSize, int* samples)
 
 /*
 * This will be a function to calculate round-robin multilocus genotypes using
-* qsort. It currenlty takes in an integer matrix and spits out a vector that
+* a radix sort. It currenlty takes in an integer matrix and spits out a vector that
 * is the same length as the number of columns indicating the number of unique
 * genotypes when masking that column.
 *
@@ -153,18 +200,21 @@ SEXP mlg_round_robin(SEXP mat)
   int new_genotype;
   int mask_position;
   int nmlg;
+  int nbytes;
   int* genotype_matrix;
   struct mask* mask_matrix;
+  struct mask* mask_buffer;
   
   Rdim = getAttrib(mat, R_DimSymbol);
   rows = INTEGER(Rdim)[0];
   cols = INTEGER(Rdim)[1];
   PROTECT(Rout = allocMatrix(INTSXP, rows, cols));
   
-  NLOCI = (cols - 1)*sizeof(int);
+  nbytes = (cols - 1)*sizeof(int);
   genotype_matrix = INTEGER(mat);
   
   mask_matrix = R_Calloc(rows, struct mask);
+  mask_buffer = R_Calloc(rows, struct mask);
   for (i = 0; i < rows; i++)
   {
     mask_matrix[i].ind = R_Calloc(cols, int);
@@ -187,13 +237,13 @@ SEXP mlg_round_robin(SEXP mat)
   for (j = 0; j < cols; j++)
   {
     R_CheckUserInterrupt();
-    qsort(mask_matrix, rows, sizeof(struct mask), mlg_round_robin_cmpr);
+    radix_sort_masks(mask_matrix, mask_buffer, rows, nbytes);
 
     for (i = 0; i < rows; i++)
     {
       if (i != 0)
       {
-        if (memcmp(mask_matrix[i].ind, mask_matrix[i - 1].ind, sizeof(int)*(cols - 1)) != 0)
+        if (memcmp(mask_matrix[i].ind, mask_matrix[i - 1].ind, nbytes) != 0)
         {
           nmlg++;
         }
@@ -223,6 +273,7 @@ SEXP mlg_round_robin(SEXP mat)
     R_Free(mask_matrix[i].ind);
   }
   R_Free(mask_matrix);
+  R_Free(mask_buffer);
   
   UNPROTECT(1);
   return(Rout);
@@ -263,7 +314,9 @@ SEXP genotype_curve_internal(SEXP mat, SEXP iter, SEXP maxloci, SEXP report)
   int* genotype_matrix;
   int* sampled_loci;
   int selected_locus;
+  int nbytes;
   struct mask* mask_matrix;
+  struct mask* mask_buffer;
   
   Rdim = getAttrib(mat, R_DimSymbol);
   rows = INTEGER(Rdim)[0];
@@ -276,6 +329,7 @@ SEXP genotype_curve_internal(SEXP mat, SEXP iter, SEXP maxloci, SEXP report)
   genotype_matrix = INTEGER(mat);
   sampled_loci = R_Calloc(nmax, int);
   mask_matrix = R_Calloc(rows, struct mask);
+  mask_buffer = R_Calloc(rows, struct mask);
   for (i = 0; i < rows; i++)
   {
     mask_matrix[i].ind = R_Calloc(nmax, int);
@@ -285,9 +339,8 @@ SEXP genotype_curve_internal(SEXP mat, SEXP iter, SEXP maxloci, SEXP report)
   while (nloci < nmax + 1)
   {
     R_CheckUserInterrupt();
-    // Initialize the global variable to be the number of loci we want to 
-    // compare. 
-    NLOCI = nloci*sizeof(int);
+    // The number of bytes we want to compare for this number of loci.
+    nbytes = nloci*sizeof(int);
       
     // iterate the number of times defined by the user. 
     while (iteration < INTEGER(iter)[0])
@@ -325,14 +378,14 @@ SEXP genotype_curve_internal(SEXP mat, SEXP iter, SEXP maxloci, SEXP report)
       // Here, we sort the mask_matrix and then iterate through, counting up the
       // number of times we see a change in genotype. We also fill the matrix 
       // with the values for the next iteration.
-      qsort(mask_matrix, rows, sizeof(struct mask), mlg_round_robin_cmpr);
+      radix_sort_masks(mask_matrix, mask_buffer, rows, nbytes);
       for (i = 0; i < rows; i++)
       {
         // Here, we compare the current sample with the previous to determine if
         // the number of MLGs needs to go up. 
         if (i != 0)
         {
-          if (memcmp(mask_matrix[i].ind, mask_matrix[i - 1].ind, NLOCI) != 0)
+          if (memcmp(mask_matrix[i].ind, mask_matrix[i - 1].ind, nbytes) != 0)
           {
             nmlg++;
           }
@@ -382,6 +435,402 @@ SEXP genotype_curve_internal(SEXP mat, SEXP iter, SEXP maxloci, SEXP report)
     R_Free(mask_matrix[i].ind);
   }
   R_Free(mask_matrix);
+  R_Free(mask_buffer);
+  R_Free(sampled_loci);
+  UNPROTECT(1);
+  return(Rout);
+}
+
+/*
+* The encounter struct records the number of times a multilocus genotype has
+* been seen within a population and the value of pgen for the first sample
+* with that genotype. These are stored in an open-addressing hash table keyed 
+* on the combination of population and multilocus genotype.
+*/
+struct encounter {
+  int64_t key;
+  int count;
+  double pgen;
+};
+
+static uint64_t hash_key(int64_t key)
+{
+  // splitmix64 finalizer
+  uint64_t z = (uint64_t)key + 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/*
+* Calculate psex for multiple encounters of multilocus genotypes 
+* (Arnaud-Haond et al. 2007) for all samples at once.
+*
+* For the ith sample of a given multilocus genotype in a population (counting
+* from zero in the order they appear in the data), psex is
+*
+*   dbinom(i, N, pgen)
+*
+* where N is the number of samples for the population and pgen is the value of
+* pgen for the first sample of the genotype in that population. This replaces
+* the per-population and per-MLG loops in R.
+*
+* Input:
+*   - pgen a numeric vector of pgen values (not logged) for each sample.
+*   - mlgs an integer vector of multilocus genotype assignments.
+*   - pops an integer vector of 1-based population indices for each sample.
+*   - n_samples a numeric vector with the value of N for each population.
+* Output:
+*   - A numeric vector of psex for each sample.
+*/
+SEXP psex_multiple(SEXP pgen, SEXP mlgs, SEXP pops, SEXP n_samples)
+{
+  SEXP Rout;
+  int n;
+  int i;
+  int pop;
+  int64_t key;
+  uint64_t capacity;
+  uint64_t slot;
+  double* out;
+  double* pg;
+  double* N;
+  int* mlg;
+  int* population;
+  struct encounter* table;
+  struct encounter* e;
+  
+  n = XLENGTH(pgen);
+  pg = REAL(pgen);
+  mlg = INTEGER(mlgs);
+  population = INTEGER(pops);
+  N = REAL(n_samples);
+  PROTECT(Rout = allocVector(REALSXP, n));
+  out = REAL(Rout);
+  
+  // The table is at most half full so that probing stays short.
+  capacity = 16;
+  while (capacity < 2*(uint64_t)n)
+  {
+    capacity <<= 1;
+  }
+  table = R_Calloc(capacity, struct encounter);
+  for (slot = 0; slot < capacity; slot++)
+  {
+    table[slot].key = -1;
+  }
+  
+  for (i = 0; i < n; i++)
+  {
+    if (i % 65536 == 0)
+    {
+      R_CheckUserInterrupt();
+    }
+    pop = population[i] - 1;
+    key = ((int64_t)pop << 32) | (uint32_t)mlg[i];
+    slot = hash_key(key) & (capacity - 1);
+    while (table[slot].key != -1 && table[slot].key != key)
+    {
+      slot = (slot + 1) & (capacity - 1);
+    }
+    e = &table[slot];
+    if (e->key == -1)
+    {
+      // First encounter of this genotype in this population
+      e->key = key;
+      e->count = 0;
+      e->pgen = pg[i];
+    }
+    // The binomial density is evaluated on the log scale by R's saddle point
+    // algorithm and then exponentiated, which matches dbinom() in R.
+    out[i] = exp(dbinom((double)e->count, N[pop], e->pgen, TRUE));
+    e->count++;
+  }
+  
+  R_Free(table);
   UNPROTECT(1);
   return(Rout);
 }
+
+/*
+* Number the distinct rows of an integer matrix in the order they first appear
+* by placing the first sample of each row in an open-addressing hash table.
+* Missing values are compared like any other value.
+*
+* Input:
+*   - x an integer matrix with n rows and ncol columns (column-major).
+*   - n the number of rows.
+*   - ncol the number of columns.
+*   - ids an array of length n that will hold the (0-based) id of each row.
+* Output:
+*   - The number of distinct rows.
+*/
+static int number_rows(const int* x, int n, int ncol, int* ids)
+{
+  int i;
+  int j;
+  int first;
+  int same;
+  int num_ids;
+  uint64_t capacity;
+  uint64_t slot;
+  uint64_t* hashes;
+  int* table;
+  
+  // The table is at most half full so that probing stays short.
+  capacity = 16;
+  while (capacity < 2*(uint64_t)n)
+  {
+    capacity <<= 1;
+  }
+  table = R_Calloc(capacity, int);
+  hashes = R_Calloc(n, uint64_t);
+  for (slot = 0; slot < capacity; slot++)
+  {
+    table[slot] = -1;
+  }
+  num_ids = 0;
+  for (i = 0; i < n; i++)
+  {
+    if (i % 65536 == 0)
+    {
+      R_CheckUserInterrupt();
+    }
+    hashes[i] = 0;
+    for (j = 0; j < ncol; j++)
+    {
+      hashes[i] = hash_key((int64_t)(hashes[i] ^ (uint32_t)x[i + (size_t)j*n]));
+    }
+    slot = hashes[i] & (capacity - 1);
+    while ((first = table[slot]) != -1)
+    {
+      same = hashes[first] == hashes[i];
+      for (j = 0; j < ncol && same; j++)
+      {
+        same = x[first + (size_t)j*n] == x[i + (size_t)j*n];
+      }
+      if (same)
+      {
+        break;
+      }
+      slot = (slot + 1) & (capacity - 1);
+    }
+    if (first == -1)
+    {
+      // First sample with this row
+      table[slot] = i;
+      ids[i] = num_ids++;
+    }
+    else
+    {
+      ids[i] = ids[first];
+    }
+  }
+  R_Free(table);
+  R_Free(hashes);
+  return num_ids;
+}
+
+/*
+* Find the samples that are kept by clone correction: the first sample of each
+* multilocus genotype within each combination of strata. The genotypes and the
+* strata are each numbered with a hash table, and the first sample of each 
+* pair of numbers is kept. This replaces subsetting the data by population and
+* looking for duplicated genotypes in each subset.
+*
+* Input:
+*   - genotypes an integer vector of multilocus genotypes or an integer matrix
+*     with the genotype of each sample in a row (e.g. the @tab slot).
+*   - strata an integer matrix with the codes of the strata of each sample in
+*     a row, or NULL to clone correct without strata.
+* Output:
+*   - An integer vector of the (1-based) samples that are kept in their
+*     original order.
+*/
+SEXP clone_correct(SEXP genotypes, SEXP strata)
+{
+  SEXP Rout;
+  SEXP Rdim;
+  int n;
+  int i;
+  int ncol;
+  int num_kept;
+  int* pairs;
+  int* ids;
+  
+  Rdim = getAttrib(genotypes, R_DimSymbol);
+  n = isNull(Rdim) ? length(genotypes) : INTEGER(Rdim)[0];
+  ncol = isNull(Rdim) ? 1 : INTEGER(Rdim)[1];
+  PROTECT(genotypes = coerceVector(genotypes, INTSXP));
+  pairs = R_Calloc(2*(size_t)n, int);
+  ids = R_Calloc(n, int);
+  
+  // The first column holds the strata and the second holds the genotypes.
+  number_rows(INTEGER(genotypes), n, ncol, pairs + n);
+  if (isNull(strata))
+  {
+    memset(pairs, 0, n*sizeof(int));
+  }
+  else
+  {
+    PROTECT(strata = coerceVector(strata, INTSXP));
+    Rdim = getAttrib(strata, R_DimSymbol);
+    ncol = isNull(Rdim) ? 1 : INTEGER(Rdim)[1];
+    number_rows(INTEGER(strata), n, ncol, pairs);
+    UNPROTECT(1);
+  }
+  
+  // A sample is the first of its pair if its id is the next one to be found.
+  num_kept = number_rows(pairs, n, 2, ids);
+  PROTECT(Rout = allocVector(INTSXP, num_kept));
+  num_kept = 0;
+  for (i = 0; i < n; i++)
+  {
+    if (ids[i] == num_kept)
+    {
+      INTEGER(Rout)[num_kept++] = i + 1;
+    }
+  }
+  R_Free(pairs);
+  R_Free(ids);
+  UNPROTECT(2);
+  return(Rout);
+}
+
+/*
+* Count the samples in each combination of population and multilocus genotype
+* as a sparse table in compressed sparse row (CSR) form. Only the observed
+* pairs are stored, so the memory used depends on the number of pairs and not
+* on the number of populations times the number of multilocus genotypes.
+*
+* The entries are sorted into rows with a counting sort and the columns of 
+* each row are accumulated in a work array that is marked with the row, so
+* duplicate pairs are summed.
+*
+* Input:
+*   - rows an integer vector with the (1-based) row (population) of each
+*     entry.
+*   - cols an integer vector with the (1-based) column (MLG) of each entry.
+*   - counts an integer vector with the count of each entry, or NULL to count
+*     each entry once. Entries with a missing row or column are skipped.
+*   - dims an integer vector with the number of rows and columns.
+* Output:
+*   - A list with the (0-based) row pointers, the (1-based) columns of the
+*     nonzero counts in each row in increasing order, and the counts.
+*/
+SEXP mlg_sparse(SEXP rows, SEXP cols, SEXP counts, SEXP dims)
+{
+  SEXP Rout;
+  SEXP Rp;
+  SEXP Rj;
+  SEXP Rx;
+  int n;
+  int i;
+  int k;
+  int r;
+  int c;
+  int nrow;
+  int ncol;
+  int nnz;
+  int start;
+  int* row_ptr;
+  int* entries;
+  int* out_j;
+  int* out_x;
+  int* mark;
+  int* sums;
+  int* row_i;
+  int* col_i;
+  int* count_i;
+  
+  n = length(rows);
+  nrow = INTEGER(dims)[0];
+  ncol = INTEGER(dims)[1];
+  row_i = INTEGER(rows);
+  col_i = INTEGER(cols);
+  count_i = isNull(counts) ? NULL : INTEGER(counts);
+  PROTECT(Rp = allocVector(INTSXP, nrow + 1));
+  row_ptr = INTEGER(Rp);
+  memset(row_ptr, 0, (nrow + 1)*sizeof(int));
+  
+  // Count the entries in each row and turn the counts into row offsets.
+  for (i = 0; i < n; i++)
+  {
+    r = row_i[i];
+    c = col_i[i];
+    if (r == NA_INTEGER || c == NA_INTEGER || r < 1 || r > nrow || c < 1 || c > ncol)
+    {
+      continue;
+    }
+    row_ptr[r]++;
+  }
+  for (r = 0; r < nrow; r++)
+  {
+    row_ptr[r + 1] += row_ptr[r];
+  }
+  
+  // Place each entry in its row. The row pointers are used as the insertion
+  // points and are shifted back afterwards.
+  entries = R_Calloc((size_t)row_ptr[nrow] + 1, int);
+  for (i = 0; i < n; i++)
+  {
+    r = row_i[i];
+    c = col_i[i];
+    if (r == NA_INTEGER || c == NA_INTEGER || r < 1 || r > nrow || c < 1 || c > ncol)
+    {
+      continue;
+    }
+    entries[row_ptr[r - 1]++] = i;
+  }
+  for (r = nrow; r > 0; r--)
+  {
+    row_ptr[r] = row_ptr[r - 1];
+  }
+  row_ptr[0] = 0;
+  
+  // Sum the counts of each column within each row.
+  out_j = R_Calloc((size_t)row_ptr[nrow] + 1, int);
+  out_x = R_Calloc((size_t)row_ptr[nrow] + 1, int);
+  mark = R_Calloc((size_t)ncol + 1, int);
+  sums = R_Calloc((size_t)ncol + 1, int);
+  nnz = 0;
+  for (r = 0; r < nrow; r++)
+  {
+    start = nnz;
+    for (k = row_ptr[r]; k < row_ptr[r + 1]; k++)
+    {
+      i = entries[k];
+      c = col_i[i];
+      if (mark[c] != r + 1)
+      {
+        mark[c] = r + 1;
+        sums[c] = 0;
+        out_j[nnz++] = c;
+      }
+      sums[c] += (count_i == NULL) ? 1 : count_i[i];
+    }
+    R_qsort_int(out_j, start + 1, nnz);
+    for (k = start; k < nnz; k++)
+    {
+      out_x[k] = sums[out_j[k]];
+    }
+    row_ptr[r] = start;
+  }
+  row_ptr[nrow] = nnz;
+  
+  PROTECT(Rj = allocVector(INTSXP, nnz));
+  PROTECT(Rx = allocVector(INTSXP, nnz));
+  memcpy(INTEGER(Rj), out_j, nnz*sizeof(int));
+  memcpy(INTEGER(Rx), out_x, nnz*sizeof(int));
+  PROTECT(Rout = allocVector(VECSXP, 3));
+  SET_VECTOR_ELT(Rout, 0, Rp);
+  SET_VECTOR_ELT(Rout, 1, Rj);
+  SET_VECTOR_ELT(Rout, 2, Rx);
+  R_Free(entries);
+  R_Free(out_j);
+  R_Free(out_x);
+  R_Free(mark);
+  R_Free(sums);
+  UNPROTECT(4);
+  return(Rout);
+}
@@ -0,0 +1,449 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#
+# This software was authored by Zhian N. Kamvar and Javier F. Tabima, graduate
+# students at Oregon State University; Jonah C. Brooks, undergraduate student at
+# Oregon State University; and Dr. Nik Grünwald, an employee of USDA-ARS.
+#
+# Permission to use, copy, modify, and distribute this software and its
+# documentation for educational, research and non-profit purposes, without fee,
+# and without a written agreement is hereby granted, provided that the statement
+# above is incorporated into the material, giving appropriate attribution to the
+# authors.
+#
+# Permission to incorporate this software into commercial products may be
+# obtained by contacting USDA ARS and OREGON STATE UNIVERSITY Office for
+# Commercialization and Corporate Development.
+#
+# The software program and documentation are supplied "as is", without any
+# accompanying services from the USDA or the University. USDA ARS or the
+# University do not warrant that the operation of the program will be
+# uninterrupted or error-free. The end-user understands that the program was
+# developed for research purposes and is advised not to rely exclusively on the
+# program for any reason.
+#
+# IN NO EVENT SHALL USDA ARS OR OREGON STATE UNIVERSITY BE LIABLE TO ANY PARTY
+# FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+# LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+# EVEN IF THE OREGON STATE UNIVERSITY HAS BEEN ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE. USDA ARS OR OREGON STATE UNIVERSITY SPECIFICALLY DISCLAIMS ANY
+# WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE AND ANY STATUTORY
+# WARRANTY OF NON-INFRINGEMENT. THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS"
+# BASIS, AND USDA ARS AND OREGON STATE UNIVERSITY HAVE NO OBLIGATIONS TO PROVIDE
+# MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+#
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <Rinternals.h>
+#include <R_ext/Utils.h>
+#include <R.h>
+
+/*
+
+Genotype index struct
+=====================
+
+An open-addressing hash table mapping encoded multilocus genotypes to MLG ids.
+This lives behind an external pointer so that it persists between calls from R.
+The encoded genotypes are also kept in R (see mlg.index()) so that the table
+can be rebuilt after the object has been serialized and reloaded.
+
+Each genotype is encoded as a sequence of integers, made from the allele counts
+of the sample with the columns sorted by locus and then by allele id:
+  - a non-zero allele count contributes the pair (allele id, count)
+  - a missing locus contributes the single value -(locus + 1)
+  - alleles with a count of zero contribute nothing
+Two samples have the same encoding if and only if they have identical rows in
+the @tab slot after aligning the alleles, which is the rule used by mlg.vector.
+
+*/
+struct genotype_index
+{
+  int64_t num_keys;   // Number of unique genotypes
+  int64_t capacity;   // Number of slots in the hash table (power of 2)
+  int64_t* slots;     // Index into the keys for each slot, -1 if empty
+  uint64_t* hashes;   // Hash of each key
+  int64_t* offsets;   // Start of each key in data
+  int* lengths;       // Length of each key
+  int* mlgs;          // MLG id of each key
+  int* data;          // Concatenated keys
+  int64_t data_used;
+  int64_t data_size;
+  int64_t keys_size;
+  int next_mlg;       // The next MLG id to be assigned
+};
+
+SEXP mlg_index_new(void);
+SEXP mlg_index_size(SEXP index);
+SEXP mlg_index_encode(SEXP tab, SEXP col_id, SEXP col_locus);
+SEXP mlg_index_insert(SEXP index, SEXP keys, SEXP lengths, SEXP ids);
+static void genotype_index_free(struct genotype_index *gi);
+static void genotype_index_finalize(SEXP index);
+static struct genotype_index* get_genotype_index(SEXP index);
+static uint64_t hash_genotype(const int *key, int length);
+static void grow_slots(struct genotype_index *gi);
+
+static void genotype_index_free(struct genotype_index *gi)
+{
+  R_Free(gi->slots);
+  R_Free(gi->hashes);
+  R_Free(gi->offsets);
+  R_Free(gi->lengths);
+  R_Free(gi->mlgs);
+  R_Free(gi->data);
+  R_Free(gi);
+}
+
+static void genotype_index_finalize(SEXP index)
+{
+  struct genotype_index *gi = (struct genotype_index*)R_ExternalPtrAddr(index);
+  if (gi != NULL)
+  {
+    genotype_index_free(gi);
+    R_ClearExternalPtr(index);
+  }
+}
+
+static struct genotype_index* get_genotype_index(SEXP index)
+{
+  struct genotype_index *gi;
+  if (TYPEOF(index) != EXTPTRSXP)
+  {
+    error("index must be an external pointer");
+  }
+  gi = (struct genotype_index*)R_ExternalPtrAddr(index);
+  if (gi == NULL)
+  {
+    error("the genotype index has not been initialized");
+  }
+  return gi;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+FNV-1a hash over the integers of an encoded genotype followed by a final mix so
+that the low bits can be used to index the table.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static uint64_t hash_genotype(const int *key, int length)
+{
+  uint64_t h = 14695981039346656037ULL;
+  int i;
+  for (i = 0; i < length; i++)
+  {
+    h ^= (uint32_t)key[i];
+    h *= 1099511628211ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Doubles the number of slots in the hash table and reinserts all of the keys
+using their stored hashes. This keeps the table at most half full.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static void grow_slots(struct genotype_index *gi)
+{
+  int64_t i;
+  int64_t slot;
+  int64_t mask;
+  
+  gi->capacity *= 2;
+  mask = gi->capacity - 1;
+  gi->slots = R_Realloc(gi->slots, gi->capacity, int64_t);
+  for (i = 0; i < gi->capacity; i++)
+  {
+    gi->slots[i] = -1;
+  }
+  for (i = 0; i < gi->num_keys; i++)
+  {
+    slot = gi->hashes[i] & mask;
+    while (gi->slots[slot] != -1)
+    {
+      slot = (slot + 1) & mask;
+    }
+    gi->slots[slot] = i;
+  }
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Creates a new, empty genotype index.
+
+Input: None.
+Output: An external pointer to the index. The memory is released when the
+        pointer is garbage collected.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP mlg_index_new(void)
+{
+  SEXP Rout;
+  int64_t i;
+  struct genotype_index *gi;
+  
+  gi = R_Calloc(1, struct genotype_index);
+  gi->num_keys = 0;
+  gi->capacity = 1024;
+  gi->slots = R_Calloc(gi->capacity, int64_t);
+  for (i = 0; i < gi->capacity; i++)
+  {
+    gi->slots[i] = -1;
+  }
+  gi->keys_size = 512;
+  gi->hashes = R_Calloc(gi->keys_size, uint64_t);
+  gi->offsets = R_Calloc(gi->keys_size, int64_t);
+  gi->lengths = R_Calloc(gi->keys_size, int);
+  gi->mlgs = R_Calloc(gi->keys_size, int);
+  gi->data_size = 8192;
+  gi->data_used = 0;
+  gi->data = R_Calloc(gi->data_size, int);
+  gi->next_mlg = 1;
+  
+  PROTECT(Rout = R_MakeExternalPtr(gi, install("genotype_index"), R_NilValue));
+  R_RegisterCFinalizerEx(Rout, genotype_index_finalize, TRUE);
+  UNPROTECT(1);
+  return Rout;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Reports the number of genotypes in an index.
+
+Input: An external pointer created with mlg_index_new.
+Output: The number of unique genotypes in the index or -1 if the pointer is no
+        longer valid (e.g. after the object was saved and reloaded).
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP mlg_index_size(SEXP index)
+{
+  struct genotype_index *gi;
+  if (TYPEOF(index) != EXTPTRSXP)
+  {
+    return ScalarReal(-1);
+  }
+  gi = (struct genotype_index*)R_ExternalPtrAddr(index);
+  return ScalarReal((gi == NULL) ? -1 : (double)gi->num_keys);
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Encodes the rows of an allele count matrix as integer keys.
+
+Input: An n x m integer matrix of allele counts whose columns have been sorted
+        by locus and then by allele id.
+       An integer vector of length m with the global id of each allele.
+       An integer vector of length m with the 0-based locus of each allele.
+Output: A list with two elements:
+         keys - the concatenated keys of all samples
+         lengths - the length of the key for each sample
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP mlg_index_encode(SEXP tab, SEXP col_id, SEXP col_locus)
+{
+  SEXP Rout;
+  SEXP Rkeys;
+  SEXP Rlengths;
+  int rows;
+  int cols;
+  int i;
+  int j;
+  int len;
+  int locus;
+  int64_t total;
+  int64_t pos;
+  int* gt;
+  int* id;
+  int* loc;
+  int* keys;
+  int* lengths;
+  
+  rows = INTEGER(getAttrib(tab, R_DimSymbol))[0];
+  cols = INTEGER(getAttrib(tab, R_DimSymbol))[1];
+  gt = INTEGER(tab);
+  id = INTEGER(col_id);
+  loc = INTEGER(col_locus);
+  
+  // First pass: find the length of each key so that we can allocate once.
+  PROTECT(Rlengths = allocVector(INTSXP, rows));
+  lengths = INTEGER(Rlengths);
+  total = 0;
+  for (i = 0; i < rows; i++)
+  {
+    len = 0;
+    locus = -1;
+    for (j = 0; j < cols; j++)
+    {
+      if (gt[i + j*rows] == NA_INTEGER)
+      {
+        if (loc[j] != locus)
+        {
+          len++;
+          locus = loc[j];
+        }
+      }
+      else if (gt[i + j*rows] != 0)
+      {
+        len += 2;
+      }
+    }
+    lengths[i] = len;
+    total += len;
+  }
+  
+  // Second pass: fill the keys
+  PROTECT(Rkeys = allocVector(INTSXP, total));
+  keys = INTEGER(Rkeys);
+  pos = 0;
+  for (i = 0; i < rows; i++)
+  {
+    locus = -1;
+    for (j = 0; j < cols; j++)
+    {
+      if (gt[i + j*rows] == NA_INTEGER)
+      {
+        if (loc[j] != locus)
+        {
+          keys[pos++] = -(loc[j] + 1);
+          locus = loc[j];
+        }
+      }
+      else if (gt[i + j*rows] != 0)
+      {
+        keys[pos++] = id[j];
+        keys[pos++] = gt[i + j*rows];
+      }
+    }
+  }
+  
+  PROTECT(Rout = allocVector(VECSXP, 2));
+  SET_VECTOR_ELT(Rout, 0, Rkeys);
+  SET_VECTOR_ELT(Rout, 1, Rlengths);
+  UNPROTECT(3);
+  return Rout;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Looks up encoded genotypes in the index, adding any that have not been seen. The
+cost is proportional to the size of the batch, not the size of the index.
+
+Input: An external pointer created with mlg_index_new.
+       An integer vector of concatenated keys from mlg_index_encode.
+       An integer vector with the length of each key.
+       NULL or an integer vector of MLG ids to assign to new genotypes. This is
+        used when building the index from existing MLG assignments or when
+        restoring a serialized index.
+Output: A list with four elements:
+         mlg - the MLG id of each sample
+         keys - the concatenated keys of the genotypes added to the index
+         lengths - the length of each key added to the index
+         mlgs - the MLG id of each key added to the index
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP mlg_index_insert(SEXP index, SEXP keys, SEXP lengths, SEXP ids)
+{
+  SEXP Rout;
+  SEXP Rmlg;
+  SEXP Rnew_keys;
+  SEXP Rnew_lengths;
+  SEXP Rnew_mlgs;
+  struct genotype_index *gi;
+  int n;
+  int i;
+  int len;
+  int has_ids;
+  int num_new;
+  int64_t first_key;
+  int64_t new_data;
+  int64_t pos;
+  int64_t slot;
+  int64_t k;
+  uint64_t h;
+  int* key;
+  int* mlg;
+  
+  gi = get_genotype_index(index);
+  n = XLENGTH(lengths);
+  has_ids = !isNull(ids);
+  if (has_ids && XLENGTH(ids) != n)
+  {
+    error("there must be one MLG id per genotype");
+  }
+  PROTECT(Rmlg = allocVector(INTSXP, n));
+  mlg = INTEGER(Rmlg);
+  key = INTEGER(keys);
+  first_key = gi->num_keys;
+  pos = 0;
+  for (i = 0; i < n; i++)
+  {
+    if (i % 65536 == 0)
+    {
+      R_CheckUserInterrupt();
+    }
+    len = INTEGER(lengths)[i];
+    h = hash_genotype(key + pos, len);
+    slot = h & (gi->capacity - 1);
+    // Linear probing until we find the genotype or an empty slot
+    while ((k = gi->slots[slot]) != -1)
+    {
+      if (gi->hashes[k] == h && gi->lengths[k] == len &&
+          memcmp(gi->data + gi->offsets[k], key + pos, len*sizeof(int)) == 0)
+      {
+        break;
+      }
+      slot = (slot + 1) & (gi->capacity - 1);
+    }
+    if (k == -1)
+    {
+      // This is a new genotype
+      if (gi->num_keys == gi->keys_size)
+      {
+        gi->keys_size *= 2;
+        gi->hashes = R_Realloc(gi->hashes, gi->keys_size, uint64_t);
+        gi->offsets = R_Realloc(gi->offsets, gi->keys_size, int64_t);
+        gi->lengths = R_Realloc(gi->lengths, gi->keys_size, int);
+        gi->mlgs = R_Realloc(gi->mlgs, gi->keys_size, int);
+      }
+      while (gi->data_used + len > gi->data_size)
+      {
+        gi->data_size *= 2;
+        gi->data = R_Realloc(gi->data, gi->data_size, int);
+      }
+      k = gi->num_keys;
+      memcpy(gi->data + gi->data_used, key + pos, len*sizeof(int));
+      gi->hashes[k] = h;
+      gi->offsets[k] = gi->data_used;
+      gi->lengths[k] = len;
+      gi->mlgs[k] = (has_ids) ? INTEGER(ids)[i] : gi->next_mlg;
+      if (gi->mlgs[k] >= gi->next_mlg)
+      {
+        gi->next_mlg = gi->mlgs[k] + 1;
+      }
+      gi->data_used += len;
+      gi->slots[slot] = k;
+      gi->num_keys++;
+      if (2*gi->num_keys > gi->capacity)
+      {
+        grow_slots(gi);
+      }
+    }
+    mlg[i] = gi->mlgs[k];
+    pos += len;
+  }
+  
+  // Return the genotypes that were added so that they can be stored in R.
+  num_new = gi->num_keys - first_key;
+  new_data = (num_new > 0) ? gi->data_used - gi->offsets[first_key] : 0;
+  PROTECT(Rnew_keys = allocVector(INTSXP, new_data));
+  PROTECT(Rnew_lengths = allocVector(INTSXP, num_new));
+  PROTECT(Rnew_mlgs = allocVector(INTSXP, num_new));
+  if (num_new > 0)
+  {
+    memcpy(INTEGER(Rnew_keys), gi->data + gi->offsets[first_key], new_data*sizeof(int));
+    memcpy(INTEGER(Rnew_lengths), gi->lengths + first_key, num_new*sizeof(int));
+    memcpy(INTEGER(Rnew_mlgs), gi->mlgs + first_key, num_new*sizeof(int));
+  }
+  PROTECT(Rout = allocVector(VECSXP, 4));
+  SET_VECTOR_ELT(Rout, 0, Rmlg);
+  SET_VECTOR_ELT(Rout, 1, Rnew_keys);
+  SET_VECTOR_ELT(Rout, 2, Rnew_lengths);
+  SET_VECTOR_ELT(Rout, 3, Rnew_mlgs);
+  UNPROTECT(5);
+  return Rout;
+}
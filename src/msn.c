@@ -50,19 +50,419 @@
 
 
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-Finds any edges that could have been included in the given MST, then adds them
-to a list of edges to be added in the future.
+Edge buffer for building minimum spanning networks. Vertices are 0-based.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+struct msn_edge_list {
+  int *from;
+  int *to;
+  double *weight;
+  size_t size;
+  size_t capacity;
+  int failed;    // Set if memory could not be allocated in a parallel region
+};
+
+static void msn_edge_list_init(struct msn_edge_list *el, size_t capacity)
+{
+  capacity = (capacity < 16) ? 16 : capacity;
+  el->from = R_Calloc(capacity, int);
+  el->to = R_Calloc(capacity, int);
+  el->weight = R_Calloc(capacity, double);
+  el->size = 0;
+  el->capacity = capacity;
+  el->failed = 0;
+}
+
+static void msn_edge_list_push(struct msn_edge_list *el, int from, int to, 
+                               double weight)
+{
+  if (el->size == el->capacity)
+  {
+    el->capacity *= 2;
+    el->from = R_Realloc(el->from, el->capacity, int);
+    el->to = R_Realloc(el->to, el->capacity, int);
+    el->weight = R_Realloc(el->weight, el->capacity, double);
+  }
+  el->from[el->size] = from;
+  el->to[el->size] = to;
+  el->weight[el->size] = weight;
+  el->size++;
+}
+
+static void msn_edge_list_free(struct msn_edge_list *el)
+{
+  R_Free(el->from);
+  R_Free(el->to);
+  R_Free(el->weight);
+}
+
+/*
+* Edge buffers that are filled inside of a parallel region can not use R's
+* allocators, which call error() on failure. These use the C allocators and set
+* the failed flag instead, which is checked after the parallel region.
+*/
+static void msn_edge_list_init_local(struct msn_edge_list *el)
+{
+  el->capacity = 16;
+  el->size = 0;
+  el->from = malloc(el->capacity*sizeof(int));
+  el->to = malloc(el->capacity*sizeof(int));
+  el->weight = malloc(el->capacity*sizeof(double));
+  el->failed = (el->from == NULL || el->to == NULL || el->weight == NULL);
+}
+
+static void msn_edge_list_push_local(struct msn_edge_list *el, int from, 
+                                     int to, double weight)
+{
+  int *new_from;
+  int *new_to;
+  double *new_weight;
+  if (el->failed)
+  {
+    return;
+  }
+  if (el->size == el->capacity)
+  {
+    new_from = realloc(el->from, 2*el->capacity*sizeof(int));
+    if (new_from != NULL) el->from = new_from;
+    new_to = realloc(el->to, 2*el->capacity*sizeof(int));
+    if (new_to != NULL) el->to = new_to;
+    new_weight = realloc(el->weight, 2*el->capacity*sizeof(double));
+    if (new_weight != NULL) el->weight = new_weight;
+    if (new_from == NULL || new_to == NULL || new_weight == NULL)
+    {
+      el->failed = 1;
+      return;
+    }
+    el->capacity *= 2;
+  }
+  el->from[el->size] = from;
+  el->to[el->size] = to;
+  el->weight[el->size] = weight;
+  el->size++;
+}
+
+static void msn_edge_list_free_local(struct msn_edge_list *el)
+{
+  free(el->from);
+  free(el->to);
+  free(el->weight);
+}
+
+// Defined in dist_file.c
+const double* open_distances(SEXP dist, int *n, size_t *mapped);
+void close_distances(const double *dist, size_t mapped);
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Distances between the samples of a minimum spanning network. These are read 
+from a dist object or a distance file of all samples and the network can be 
+built from a subset of the samples without copying the distances.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+struct msn_dist {
+  const double *values; // Distances between all samples as in a dist object
+  int n;                // Number of samples in values
+  int *samples;         // 0-based samples of the network (NULL for all)
+  size_t mapped;        // Bytes mapped for a distance file (0 otherwise)
+};
+
+// Position of the distance between samples i < j in a dist object of n samples
+static size_t msn_dist_index(int i, int j, int n)
+{
+  return (size_t)i*n - (size_t)i*(i + 1)/2 + (j - i - 1);
+}
+
+// Distance between samples i and j of the network
+static double msn_distance(const struct msn_dist *dist, int i, int j)
+{
+  int a = (dist->samples == NULL) ? i : dist->samples[i];
+  int b = (dist->samples == NULL) ? j : dist->samples[j];
+  if (a == b)
+  {
+    return 0.0;
+  }
+  return (a < b) ? dist->values[msn_dist_index(a, b, dist->n)] : 
+                   dist->values[msn_dist_index(b, a, dist->n)];
+}
 
-Input: A minimum spanning tree (as a matrix of edge weights) and the distance 
-       matrix used to construct it. epsi is used as the epsilon value in determining
-       how similar two branches must be to be considered equal. Note that this value
-       should never be less than an reasonable integer multiple of the machine epsilon,
-Output: A list of edges that lost the tiebreak while constructing the mst.
+// Opens the distances of a dist object or distance file for n samples of the
+// network. samples is an integer vector of 0-based samples or NULL.
+static void msn_dist_open(struct msn_dist *dist, SEXP R_dist, int n, 
+                          SEXP samples)
+{
+  int i;
+  int invalid;
+
+  dist->values = open_distances(R_dist, &dist->n, &dist->mapped);
+  dist->samples = (isNull(samples)) ? NULL : INTEGER(samples);
+  invalid = (dist->samples == NULL) ? n > dist->n : length(samples) != n;
+  for (i = 0; i < n && !invalid && dist->samples != NULL; i++)
+  {
+    invalid = dist->samples[i] < 0 || dist->samples[i] >= dist->n;
+  }
+  if (invalid)
+  {
+    close_distances(dist->values, dist->mapped);
+    error("The samples do not match the distances.");
+  }
+}
+
+// Checks for a user interrupt. It is run with R_ToplevelExec so that the
+// interrupt does not jump past the memory and distance file of the caller.
+static void msn_check_interrupt(void *data)
+{
+  R_CheckUserInterrupt();
+}
+
+static int msn_interrupted(void)
+{
+  return !R_ToplevelExec(msn_check_interrupt, NULL);
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Prim's algorithm on a dist object. Samples with a distance of zero (or NA) are 
+not connected, the same as in igraph's graph.adjacency, so the result is a 
+minimum spanning forest if some samples cannot be reached. Ties are broken in
+favor of the sample with the lowest index. The edges are appended to el.
+Returns 1 if the user interrupted and 0 otherwise.
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
-SEXP msn_tied_edges(SEXP mst, SEXP bclone, SEXP epsi)
+static int msn_prim(const struct msn_dist *dist, int n, struct msn_edge_list *el)
 {
-  // R code
-  /*
+  int step;
+  int u;
+  int v;
+  int interrupted = 0;
+  double d;
+  double best;
+  double *key = R_Calloc(n, double);
+  int *parent = R_Calloc(n, int);
+  int *in_tree = R_Calloc(n, int);
+
+  for (v = 0; v < n; v++)
+  {
+    key[v] = R_PosInf;
+    parent[v] = -1;
+  }
+  for (step = 0; step < n; step++)
+  {
+    if (step % 1024 == 0 && msn_interrupted())
+    {
+      interrupted = 1;
+      break;
+    }
+    // The closest sample to the tree. If none can be reached, this starts a
+    // new tree from the first sample left.
+    u = -1;
+    best = R_PosInf;
+    for (v = 0; v < n; v++)
+    {
+      if (!in_tree[v] && (u < 0 || key[v] < best))
+      {
+        u = v;
+        best = key[v];
+      }
+    }
+    in_tree[u] = 1;
+    if (parent[u] >= 0)
+    {
+      msn_edge_list_push(el, parent[u], u, key[u]);
+    }
+    for (v = 0; v < n; v++)
+    {
+      if (in_tree[v])
+      {
+        continue;
+      }
+      d = msn_distance(dist, u, v);
+      if (d > 0 && d < key[v])
+      {
+        key[v] = d;
+        parent[v] = u;
+      }
+    }
+  }
+  R_Free(key);
+  R_Free(parent);
+  R_Free(in_tree);
+  return interrupted;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Finds the edges that tie with the shortest edge out of each sample in the 
+minimum spanning tree. The first mst_size edges of el are the tree and the tied
+edges are appended to el in order of the samples.
+
+The samples are split over threads. Each thread writes to its own buffer and 
+remembers where the edges of each sample start, so the buffers can be merged
+in order of the samples afterwards and the result does not depend on the 
+number of threads. Returns 1 if the buffers could not be allocated and 0
+otherwise.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static int msn_find_ties(const struct msn_dist *dist, int n, struct msn_edge_list *el,
+                         double epsi, int num_threads)
+{
+  int i;
+  int t;
+  int e;
+  int failed;
+  size_t k;
+  size_t mst_size = el->size;
+  double *mn = R_Calloc(n, double);
+  int *degree = R_Calloc(n + 1, int);
+  int *neighbor = R_Calloc(2*mst_size + 1, int);
+  int *fill = R_Calloc(n, int);
+  int *vthread = R_Calloc(n, int);
+  size_t *vstart = R_Calloc(n, size_t);
+  size_t *vcount = R_Calloc(n, size_t);
+  struct msn_edge_list *ws = R_Calloc(num_threads, struct msn_edge_list);
+
+  // Shortest edge and neighbors of each sample in the tree
+  for (i = 0; i < n; i++)
+  {
+    mn[i] = -1;
+  }
+  for (e = 0; e < (int)mst_size; e++)
+  {
+    int a = el->from[e];
+    int b = el->to[e];
+    double w = el->weight[e];
+    mn[a] = (mn[a] < 0 || w < mn[a]) ? w : mn[a];
+    mn[b] = (mn[b] < 0 || w < mn[b]) ? w : mn[b];
+    degree[a + 1]++;
+    degree[b + 1]++;
+  }
+  for (i = 0; i < n; i++)
+  {
+    degree[i + 1] += degree[i];
+  }
+  for (e = 0; e < (int)mst_size; e++)
+  {
+    int a = el->from[e];
+    int b = el->to[e];
+    neighbor[degree[a] + fill[a]++] = b;
+    neighbor[degree[b] + fill[b]++] = a;
+  }
+  for (t = 0; t < num_threads; t++)
+  {
+    msn_edge_list_init_local(&ws[t]);
+  }
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic, 16) private(i) num_threads(num_threads)
+  #endif
+  for (i = 0; i < n; i++)
+  {
+    int j;
+    int m;
+    int in_mst;
+    int thread = 0;
+    double d;
+    #ifdef _OPENMP
+    thread = omp_get_thread_num();
+    #endif
+    vthread[i] = thread;
+    vstart[i] = ws[thread].size;
+    if (mn[i] >= 0)
+    {
+      for (j = i + 1; j < n; j++)
+      {
+        d = msn_distance(dist, i, j);
+        if (!(fabs(d - mn[i]) < epsi))
+        {
+          continue;
+        }
+        in_mst = 0;
+        for (m = degree[i]; m < degree[i + 1]; m++)
+        {
+          if (neighbor[m] == j)
+          {
+            in_mst = 1;
+            break;
+          }
+        }
+        if (!in_mst)
+        {
+          msn_edge_list_push_local(&ws[thread], i, j, d);
+        }
+      }
+    }
+    vcount[i] = ws[thread].size - vstart[i];
+  }
+
+  failed = 0;
+  for (t = 0; t < num_threads; t++)
+  {
+    failed = failed || ws[t].failed;
+  }
+  for (i = 0; i < n && !failed; i++)
+  {
+    struct msn_edge_list *src = &ws[vthread[i]];
+    for (k = vstart[i]; k < vstart[i] + vcount[i]; k++)
+    {
+      msn_edge_list_push(el, src->from[k], src->to[k], src->weight[k]);
+    }
+  }
+  for (t = 0; t < num_threads; t++)
+  {
+    msn_edge_list_free_local(&ws[t]);
+  }
+  R_Free(ws);
+  R_Free(mn);
+  R_Free(degree);
+  R_Free(neighbor);
+  R_Free(fill);
+  R_Free(vthread);
+  R_Free(vstart);
+  R_Free(vcount);
+  return failed;
+}
+
+// Number of threads to use for the requested number. 0 means all available.
+static int msn_threads(SEXP requested_threads)
+{
+  int num_threads = 1;
+  #ifdef _OPENMP
+  {
+    if (asInteger(requested_threads) == 0)
+    {
+      num_threads = omp_get_max_threads();
+    }
+    else
+    {
+      num_threads = asInteger(requested_threads);
+    }
+    num_threads = (num_threads < 1) ? 1 : num_threads;
+  }
+  #endif
+  return num_threads;
+}
+
+// Edges of an edge list as a list of a two column matrix and the weights
+static SEXP msn_edge_list_to_R(struct msn_edge_list *el, size_t first)
+{
+  size_t e;
+  size_t m = el->size - first;
+  SEXP Rout;
+  SEXP Redges;
+  SEXP Rweight;
+  PROTECT(Rout = allocVector(VECSXP, 2));
+  PROTECT(Redges = allocMatrix(INTSXP, m, 2));
+  PROTECT(Rweight = allocVector(REALSXP, m));
+  for (e = 0; e < m; e++)
+  {
+    INTEGER(Redges)[e] = el->from[first + e] + 1;
+    INTEGER(Redges)[e + m] = el->to[first + e] + 1;
+    REAL(Rweight)[e] = el->weight[first + e];
+  }
+  SET_VECTOR_ELT(Rout, 0, Redges);
+  SET_VECTOR_ELT(Rout, 1, Rweight);
+  UNPROTECT(3);
+  return Rout;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Finds any edges that could have been included in the given MST, then adds them
+to a list of edges to be added in the future.
+
+  # R code
   # Add any relevant edges that were cut from the mst while still being tied for the title of optimal edge
   # Loop through every vertex
   for(v1 in dimnames(mst[])[[1]])
@@ -79,66 +479,99 @@ SEXP msn_tied_edges(SEXP mst, SEXP bclone, SEXP epsi)
       }
     }
   }
-  */
-  // End R code
-
-  SEXP R_out;
-  int edges_size = 24;
-  int num_edges = 0;
-  int num_vertices = 0;
-  double mn;
-  double candidate_edge;
-  double this_edge;
-  double *edges = R_Calloc(edges_size,double);
-  num_vertices = INTEGER(getAttrib(bclone,R_DimSymbol))[1];
-  for(int i = 0; i < num_vertices; i++)
-  {
-    R_CheckUserInterrupt();
-    // Find the shortest path out of this vertex
-    mn = -1;
-    for(int j = 0; j < num_vertices; j++)
-    {
-      this_edge = REAL(mst)[i + j*num_vertices];
-      // Set mn to REAL(mst)[i][j] if it is smaller than mn, or it mn is still -1
-      // ie, this loop finds the shortest path out of node i
-      mn = ((mn < 0 || this_edge < mn) && this_edge > 0) ? this_edge : mn;
-    }
-    // Find all paths out of this vertex that are tied in length with the minimum
-    for(int j = i+1; j < num_vertices; j++)
+  # End R code
+
+Input: A minimum spanning tree as a two column integer matrix of (1-based) 
+       vertices and a vector of edge weights, the dist object or the path to 
+       the distance file used to construct it, the number of samples n in the
+       tree, and the number of threads. epsi is used as the epsilon value in 
+       determining how similar two branches must be to be considered equal. 
+       Note that this value should never be less than an reasonable integer 
+       multiple of the machine epsilon. If the tree was built from a subset of
+       the distances, samples gives the 0-based positions of the n samples in
+       the distances (otherwise NULL).
+Output: A list with a two column integer matrix of the edges that lost the 
+        tiebreak while constructing the mst and a vector of their weights.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP msn_tied_edges(SEXP edges, SEXP weights, SEXP dist, SEXP n_samples, 
+                    SEXP epsi, SEXP requested_threads, SEXP samples)
+{
+  int n = asInteger(n_samples);
+  int m = length(weights);
+  int e;
+  int failed;
+  struct msn_dist distances;
+  struct msn_edge_list el;
+  SEXP Rout;
+
+  msn_dist_open(&distances, dist, n, samples);
+  msn_edge_list_init(&el, (size_t)m);
+  for (e = 0; e < m; e++)
+  {
+    msn_edge_list_push(&el, INTEGER(edges)[e] - 1, INTEGER(edges)[e + m] - 1, 
+                       REAL(weights)[e]);
+  }
+  failed = msn_find_ties(&distances, n, &el, asReal(epsi), 
+                         msn_threads(requested_threads));
+  close_distances(distances.values, distances.mapped);
+  if (failed)
+  {
+    msn_edge_list_free(&el);
+    error("Could not allocate memory for the tied edges.");
+  }
+  PROTECT(Rout = msn_edge_list_to_R(&el, (size_t)m));
+  msn_edge_list_free(&el);
+  UNPROTECT(1);
+  return Rout;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Builds a minimum spanning network directly from a dist object without creating
+a full graph of all pairs of samples.
+
+Input: A dist object or the path to a distance file, the number of samples n 
+       in the network, a logical indicating if tied edges should be included,
+       the epsilon value used to determine ties (see msn_tied_edges), the 
+       number of threads used to find the ties, and the 0-based positions of 
+       the n samples in the distances (NULL if the network has all samples).
+Output: A list with a two column integer matrix of the (1-based) vertices of 
+        each edge and a numeric vector of the edge weights. The edges of the 
+        minimum spanning tree come first, followed by the tied edges.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP msn_edges(SEXP dist, SEXP n_samples, SEXP include_ties, SEXP epsi, 
+               SEXP requested_threads, SEXP samples)
+{
+  int n = asInteger(n_samples);
+  int failed = 0;
+  int interrupted = 0;
+  struct msn_dist distances;
+  struct msn_edge_list el;
+  SEXP Rout;
+
+  msn_dist_open(&distances, dist, n, samples);
+  msn_edge_list_init(&el, (size_t)n);
+  if (n > 1)
+  {
+    interrupted = msn_prim(&distances, n, &el);
+    if (!interrupted && asLogical(include_ties))
     {
-      candidate_edge = REAL(bclone)[i + j*num_vertices];
-      this_edge = REAL(mst)[i + j*num_vertices];
-      // Check for matching edges that do not already exist in this graph
-      // For each path out of node i, check to see if its length is no more than
-      // epsi larger than the minimum
-      if(fabs(candidate_edge - mn) < asReal(epsi) && !(this_edge > 0))
-      {
-        // Resize the edges array if it does not have room for another set of 
-        // three values
-        if(num_edges+2 >= edges_size)
-        {
-          edges = R_Realloc(edges, edges_size*2, double);
-          edges_size *= 2;
-        }
-        // add i, j, and mn to a vector to return
-        // This sets edges[x] and edges[x+1] to be end points of a path of size 
-        // edges[x+2] = mn
-        edges[num_edges] = (double)(i+1);
-        edges[num_edges+1] = (double)(j+1);
-        edges[num_edges+2] = candidate_edge;
-        num_edges += 3;
-      }
+      failed = msn_find_ties(&distances, n, &el, asReal(epsi), 
+                             msn_threads(requested_threads));
     }
-  } 
-  R_out = PROTECT(allocVector(REALSXP,num_edges));
-  for(int i = 0; i < num_edges; i+=3)
-  {
-    REAL(R_out)[i] = edges[i];
-    REAL(R_out)[i+1] = edges[i+1];
-    REAL(R_out)[i+2] = edges[i+2];
-  }   
-  R_Free(edges);
+  }
+  close_distances(distances.values, distances.mapped);
+  if (interrupted)
+  {
+    msn_edge_list_free(&el);
+    error("The minimum spanning network was interrupted.");
+  }
+  if (failed)
+  {
+    msn_edge_list_free(&el);
+    error("Could not allocate memory for the tied edges.");
+  }
+  PROTECT(Rout = msn_edge_list_to_R(&el, 0));
+  msn_edge_list_free(&el);
   UNPROTECT(1);
-  return R_out;
+  return Rout;
 }
-
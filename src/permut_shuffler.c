@@ -36,6 +36,31 @@
 #include <Rinternals.h>
 #include <R_ext/Utils.h>
 #include <R.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Include openMP if the compiler supports it
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+SEXP permute_shuff(SEXP locus, SEXP alleles, SEXP ploidy);
+SEXP expand_indices(SEXP indices, SEXP length);
+SEXP ia_permutation(SEXP tab, SEXP n_alleles, SEXP ploidy, SEXP method, 
+	SEXP iterations, SEXP seed, SEXP requested_threads);
+SEXP pair_ia_sums(SEXP tab, SEXP n_alleles, SEXP ploidy, SEXP codominant, 
+	SEXP requested_threads);
+SEXP resample_ia(SEXP V, SEXP inds, SEXP nsamples, SEXP np, 
+	SEXP requested_threads);
+SEXP amova_permutation(SEXP dist, SEXP strata, SEXP squared, SEXP nperm, 
+	SEXP seed, SEXP requested_threads);
+SEXP diversity_bootstrap(SEXP tab, SEXP size, SEXP rarefy, SEXP nboot, 
+	SEXP seed, SEXP requested_threads);
+// Defined in dist_file.c
+const double* open_distances(SEXP dist, int *n, size_t *mapped);
+void close_distances(const double *dist, size_t mapped);
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 A slightly faster method of permuting alleles at a locus. 
 
@@ -145,3 +170,1743 @@ SEXP expand_indices(SEXP indices, SEXP length) {
 	UNPROTECT(1); // for res
 	return res;
 }
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Permutation tests for the index of association.
+
+R's random number generator cannot be used from multiple threads, so each
+replicate gets its own xoshiro256** generator seeded from a single seed drawn
+in R and the replicate number. This means that the results depend only on the
+seed and not on the number of threads.
+
+The pairwise distance between two samples at a locus only depends on their
+genotypes, so after each permutation, the genotypes at each locus are given an
+id and the distances between all the genotypes at that locus are stored in a 
+table. The sums of distances over loci are then calculated for all pairs of
+samples with one table lookup per locus.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+struct ia_rng {
+	uint64_t s[4];
+};
+
+static uint64_t splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static void ia_rng_seed(struct ia_rng *rng, uint64_t seed, uint64_t replicate)
+{
+	int i;
+	uint64_t x = seed ^ splitmix64(&replicate);
+	for (i = 0; i < 4; i++)
+	{
+		rng->s[i] = splitmix64(&x);
+	}
+}
+
+static uint64_t rotl(const uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static double ia_rng_unif(struct ia_rng *rng)
+{
+	uint64_t *s = rng->s;
+	const uint64_t result = rotl(s[1] * 5, 7) * 9;
+	const uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return (result >> 11) * 0x1.0p-53;
+}
+
+static int ia_rng_index(struct ia_rng *rng, int n)
+{
+	int i = (int)(ia_rng_unif(rng) * n);
+	return (i < n) ? i : n - 1;
+}
+
+static void ia_rng_shuffle(struct ia_rng *rng, int *x, int n)
+{
+	int i;
+	int j;
+	int tmp;
+	for (i = n - 1; i > 0; i--)
+	{
+		j = ia_rng_index(rng, i + 1);
+		tmp = x[i];
+		x[i] = x[j];
+		x[j] = tmp;
+	}
+}
+
+/*
+	The workspace holds everything a single thread needs to permute and score
+	one replicate. 
+
+	geno     - the permuted n x a matrix of allele counts.
+	gid      - an n x l matrix (samples in rows) of genotype ids per locus.
+	ngeno    - the number of distinct genotypes at each locus.
+	gcount   - the number of samples with each genotype id. 
+	dist     - the distance tables for each locus, starting at table_start.
+	slots    - the hash table used to assign the genotype ids.
+	reps     - the first sample with each genotype id at the current locus.
+	pool     - the pool of alleles for the permutation.
+	typed    - the samples that are not missing at the current locus.
+	weights  - the cumulative allele frequencies for the bootstraps.
+	rows     - pointers to the table rows for the current sample.
+*/
+struct ia_workspace {
+	int *geno;
+	int *gid;
+	int *ngeno;
+	int *gcount;
+	unsigned short *dist;
+	size_t *table_start;
+	int *slots;
+	int *reps;
+	int *pool;
+	int *typed;
+	double *weights;
+	unsigned short **rows;
+};
+
+/*
+	The data struct holds the read-only information shared between threads.
+	For presence/absence data, codominant is 0, each column is a locus, and the
+	distance between samples is not halved.
+*/
+struct ia_data {
+	int *tab;
+	int *n_alleles;
+	int *locus_start;
+	int *ploidy;
+	int n;
+	int nloci;
+	int nalleles;
+	int method;
+	int codominant;
+	int nslots;
+	int max_pool;
+	int max_alleles;
+	size_t table_size;
+};
+
+/*
+	Fill the shared data for the index of association. This calculates the
+	first column of each locus and the maximum size of the distance tables,
+	which is bounded by the number of samples and by the number of multisets of
+	alleles up to the maximum ploidy.
+*/
+static void setup_ia_data(struct ia_data *dat, SEXP tab, SEXP n_alleles, 
+	SEXP ploidy, int method, int codominant)
+{
+	int i;
+	int l;
+	int n;
+	int max_ploidy = 0;
+	double bound;
+	double cap;
+	SEXP Rdim = getAttrib(tab, R_DimSymbol);
+
+	n = INTEGER(Rdim)[0];
+	dat->tab = INTEGER(tab);
+	dat->n_alleles = INTEGER(n_alleles);
+	dat->ploidy = INTEGER(ploidy);
+	dat->n = n;
+	dat->nloci = length(n_alleles);
+	dat->nalleles = INTEGER(Rdim)[1];
+	dat->method = method;
+	dat->codominant = codominant;
+	dat->locus_start = R_Calloc(dat->nloci, int);
+	for (dat->nslots = 1; dat->nslots < 2*n; dat->nslots *= 2);
+	for (i = 0; i < n; i++)
+	{
+		max_ploidy = (dat->ploidy[i] > max_ploidy) ? dat->ploidy[i] : max_ploidy;
+	}
+	dat->max_pool = n*max_ploidy;
+	dat->max_alleles = 0;
+	dat->table_size = 0;
+	for (l = 0; l < dat->nloci; l++)
+	{
+		dat->locus_start[l] = (l == 0) ? 0 : 
+		                      dat->locus_start[l - 1] + dat->n_alleles[l - 1];
+		if (dat->n_alleles[l] > dat->max_alleles)
+		{
+			dat->max_alleles = dat->n_alleles[l];
+		}
+		// One more row and column is needed for missing data.
+		bound = 1.0;
+		for (i = 1; i <= max_ploidy && bound < n; i++)
+		{
+			bound += exp(lgamma(dat->n_alleles[l] + i) - lgamma(i + 1) - 
+			             lgamma(dat->n_alleles[l]));
+		}
+		cap = (bound < n) ? ceil(bound + 0.5) + 1 : n + 1;
+		dat->table_size += (size_t)(cap*cap);
+	}
+}
+
+static void alloc_ia_workspace(struct ia_workspace *ws, struct ia_data *dat)
+{
+	int n = dat->n;
+	ws->geno = R_Calloc((size_t)n*dat->nalleles, int);
+	ws->gid = R_Calloc((size_t)n*dat->nloci, int);
+	ws->ngeno = R_Calloc(dat->nloci, int);
+	ws->gcount = R_Calloc(n + 1, int);
+	ws->dist = R_Calloc(dat->table_size, unsigned short);
+	ws->table_start = R_Calloc(dat->nloci, size_t);
+	ws->slots = R_Calloc(dat->nslots, int);
+	ws->reps = R_Calloc(n, int);
+	ws->pool = R_Calloc(dat->max_pool + n, int);
+	ws->typed = R_Calloc(n, int);
+	ws->weights = R_Calloc(dat->max_alleles + dat->nloci, double);
+	ws->rows = R_Calloc(dat->nloci, unsigned short*);
+}
+
+static void free_ia_workspace(struct ia_workspace *ws)
+{
+	R_Free(ws->geno);
+	R_Free(ws->gid);
+	R_Free(ws->ngeno);
+	R_Free(ws->gcount);
+	R_Free(ws->dist);
+	R_Free(ws->table_start);
+	R_Free(ws->slots);
+	R_Free(ws->reps);
+	R_Free(ws->pool);
+	R_Free(ws->typed);
+	R_Free(ws->weights);
+	R_Free(ws->rows);
+}
+
+static void shuffle_locus(struct ia_data *dat, struct ia_workspace *ws, 
+	struct ia_rng *rng, int locus)
+{
+	int i;
+	int a;
+	int c;
+	int m;
+	int p;
+	int count;
+	int ntyped = 0;
+	int size;
+	int n = dat->n;
+	int k = dat->n_alleles[locus];
+	int *geno = ws->geno + (size_t)dat->locus_start[locus]*n;
+	int *tab = dat->tab + (size_t)dat->locus_start[locus]*n;
+	double total = 0.0;
+	double u;
+
+	for (i = 0; i < n; i++)
+	{
+		if (tab[i] != NA_INTEGER)
+		{
+			ws->typed[ntyped++] = i;
+		}
+	}
+	if (dat->method == 1)
+	{
+		// Permute alleles: pool all observed alleles and deal them back out to
+		// the samples, keeping the number of alleles per sample.
+		count = 0;
+		for (m = 0; m < ntyped; m++)
+		{
+			for (a = 0; a < k; a++)
+			{
+				for (c = 0; c < tab[ws->typed[m] + a*n]; c++)
+				{
+					ws->pool[count++] = a;
+				}
+			}
+		}
+		ia_rng_shuffle(rng, ws->pool, count);
+		count = 0;
+		for (m = 0; m < ntyped; m++)
+		{
+			i = ws->typed[m];
+			p = 0;
+			for (a = 0; a < k; a++)
+			{
+				p += tab[i + a*n];
+				geno[i + a*n] = 0;
+			}
+			for (c = 0; c < p; c++)
+			{
+				geno[i + ws->pool[count++]*n] += 1;
+			}
+		}
+	}
+	else if (dat->method == 4)
+	{
+		// Multilocus: shuffle the genotypes among the typed samples.
+		memcpy(ws->pool, ws->typed, ntyped*sizeof(int));
+		ia_rng_shuffle(rng, ws->pool, ntyped);
+		for (m = 0; m < ntyped; m++)
+		{
+			for (a = 0; a < k; a++)
+			{
+				geno[ws->typed[m] + a*n] = tab[ws->pool[m] + a*n];
+			}
+		}
+	}
+	else
+	{
+		// Parametric (2) and non-parametric (3) bootstrap: draw new genotypes
+		// for all samples from a multinomial distribution of the allele 
+		// frequencies or equal frequencies with a single randomly chosen ploidy.
+		for (a = 0; a < k; a++)
+		{
+			ws->weights[a] = 0.0;
+			if (dat->method == 3)
+			{
+				ws->weights[a] = 1.0;
+			}
+			else
+			{
+				for (m = 0; m < ntyped; m++)
+				{
+					ws->weights[a] += tab[ws->typed[m] + a*n];
+				}
+			}
+			total += ws->weights[a];
+			ws->weights[a] = total;
+		}
+		if (total <= 0.0)
+		{
+			return;
+		}
+		size = dat->ploidy[ia_rng_index(rng, n)];
+		for (i = 0; i < n; i++)
+		{
+			for (a = 0; a < k; a++)
+			{
+				geno[i + a*n] = 0;
+			}
+			for (c = 0; c < size; c++)
+			{
+				u = ia_rng_unif(rng) * total;
+				for (a = 0; a < k - 1 && u >= ws->weights[a]; a++);
+				geno[i + a*n] += 1;
+			}
+		}
+	}
+}
+
+static int same_genotype(int *geno, int n, int k, int i, int j)
+{
+	int a;
+	for (a = 0; a < k; a++)
+	{
+		if (geno[i + a*n] != geno[j + a*n]) return 0;
+	}
+	return 1;
+}
+
+/*
+	Assign ids to the genotypes at a locus and fill its distance table. Missing
+	samples get the id ngeno, whose row and column are zero.
+*/
+static void fill_locus_table(struct ia_data *dat, struct ia_workspace *ws, 
+	int locus, size_t start)
+{
+	int i;
+	int j;
+	int a;
+	int g;
+	int h;
+	int d;
+	int ng = 0;
+	int n = dat->n;
+	int k = dat->n_alleles[locus];
+	int *geno = ws->geno + (size_t)dat->locus_start[locus]*n;
+	int nslots = dat->nslots;
+	uint64_t hash;
+	unsigned short *table;
+	
+	for (i = 0; i < nslots; i++)
+	{
+		ws->slots[i] = -1;
+	}
+	for (i = 0; i < n; i++)
+	{
+		if (geno[i] == NA_INTEGER)
+		{
+			ws->gid[(size_t)i*dat->nloci + locus] = -1;
+			continue;
+		}
+		hash = 14695981039346656037ULL;
+		for (a = 0; a < k; a++)
+		{
+			hash = (hash ^ (uint64_t)geno[i + a*n]) * 1099511628211ULL;
+		}
+		j = (int)(hash & (nslots - 1));
+		while (ws->slots[j] >= 0 && 
+		       !same_genotype(geno, n, k, i, ws->reps[ws->slots[j]]))
+		{
+			j = (j + 1) & (nslots - 1);
+		}
+		if (ws->slots[j] < 0)
+		{
+			ws->slots[j] = ng;
+			ws->reps[ng++] = i;
+		}
+		ws->gid[(size_t)i*dat->nloci + locus] = ws->slots[j];
+	}
+	ws->ngeno[locus] = ng;
+	ws->table_start[locus] = start;
+	table = ws->dist + start;
+	for (g = 0; g <= ng; g++)
+	{
+		table[g*(ng + 1) + g] = 0;
+		table[g*(ng + 1) + ng] = 0;
+		table[ng*(ng + 1) + g] = 0;
+	}
+	for (g = 0; g < ng; g++)
+	{
+		for (h = g + 1; h < ng; h++)
+		{
+			d = 0;
+			for (a = 0; a < k; a++)
+			{
+				d += abs(geno[ws->reps[g] + a*n] - geno[ws->reps[h] + a*n]);
+			}
+			// This matches ceiling(pairdiffs/2) in pair_matrix()
+			if (dat->codominant)
+			{
+				d = (d + 1)/2;
+			}
+			table[g*(ng + 1) + h] = (unsigned short)d;
+			table[h*(ng + 1) + g] = (unsigned short)d;
+		}
+	}
+	for (i = 0; i < n; i++)
+	{
+		g = ws->gid[(size_t)i*dat->nloci + locus];
+		if (g < 0)
+		{
+			ws->gid[(size_t)i*dat->nloci + locus] = ng;
+		}
+	}
+}
+
+static void ia_replicate(struct ia_data *dat, struct ia_workspace *ws, 
+	struct ia_rng *rng, double *out)
+{
+	int i;
+	int j;
+	int l;
+	int g;
+	int h;
+	int ng;
+	int n = dat->n;
+	int nloci = dat->nloci;
+	int *gj;
+	size_t start = 0;
+	int D;
+	int64_t rowD2;
+	double np = (double)n*(n - 1)/2.0;
+	double sumD = 0.0;
+	double sumD2 = 0.0;
+	double varD;
+	double sigVarj = 0.0;
+	double covar = 0.0;
+	double d;
+	double d2;
+	double t;
+	double *vard = (double*)ws->weights + dat->max_alleles;
+	unsigned short *table;
+
+	memcpy(ws->geno, dat->tab, (size_t)n*dat->nalleles*sizeof(int));
+	for (l = 0; l < nloci; l++)
+	{
+		if (dat->n_alleles[l] > 1)
+		{
+			shuffle_locus(dat, ws, rng, l);
+		}
+		fill_locus_table(dat, ws, l, start);
+		ng = ws->ngeno[l];
+		start += (size_t)(ng + 1)*(ng + 1);
+
+		// The sums of distances and squared distances at this locus only
+		// depend on the number of samples with each genotype.
+		memset(ws->gcount, 0, (ng + 1)*sizeof(int));
+		for (i = 0; i < n; i++)
+		{
+			ws->gcount[ws->gid[(size_t)i*nloci + l]]++;
+		}
+		table = ws->dist + ws->table_start[l];
+		d = 0.0;
+		d2 = 0.0;
+		for (g = 0; g < ng; g++)
+		{
+			for (h = g + 1; h < ng; h++)
+			{
+				t = table[g*(ng + 1) + h];
+				d += t*ws->gcount[g]*ws->gcount[h];
+				d2 += t*t*ws->gcount[g]*ws->gcount[h];
+			}
+		}
+		sumD += d;
+		vard[l] = (d2 - (d*d)/np)/np;
+		sigVarj += vard[l];
+	}
+	for (i = 0; i < n - 1; i++)
+	{
+		for (l = 0; l < nloci; l++)
+		{
+			ng = ws->ngeno[l];
+			g = ws->gid[(size_t)i*nloci + l];
+			ws->rows[l] = ws->dist + ws->table_start[l] + (size_t)g*(ng + 1);
+		}
+		rowD2 = 0;
+		for (j = i + 1; j < n; j++)
+		{
+			gj = ws->gid + (size_t)j*nloci;
+			D = 0;
+			for (l = 0; l < nloci; l++)
+			{
+				D += ws->rows[l][gj[l]];
+			}
+			rowD2 += (int64_t)D*D;
+		}
+		sumD2 += (double)rowD2;
+	}
+	for (l = 0; l < nloci - 1; l++)
+	{
+		for (i = l + 1; i < nloci; i++)
+		{
+			covar += sqrt(vard[l]*vard[i]);
+		}
+	}
+	varD = (sumD2 - (sumD*sumD)/np)/np;
+	out[0] = (varD/sigVarj) - 1;
+	out[1] = (varD - sigVarj)/(2*covar);
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Calculate the index of association and standardized index of association for
+permuted or simulated data sets. This is equivalent to calling .Ia.Rd() on the
+output of .all.shuffler() for each iteration.
+
+Inputs:
+	tab - an n x a integer matrix of allele counts with NA for missing loci.
+	      The columns must be grouped by locus.
+	n_alleles - an integer vector with the number of alleles at each locus.
+	ploidy - an integer vector with the ploidy of each sample.
+	method - an integer from 1 to 4 indicating the permutation scheme:
+	         1: permute alleles, 2: parametric bootstrap, 3: non-parametric
+	         bootstrap, 4: multilocus
+	iterations - the number of replicates
+	seed - an integer seed for the replicates
+	requested_threads - the number of threads to use. 0 means all available.
+
+Outputs:
+	An iterations x 2 matrix with Ia in the first column and rbarD in the second.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP ia_permutation(SEXP tab, SEXP n_alleles, SEXP ploidy, SEXP method, 
+	SEXP iterations, SEXP seed, SEXP requested_threads)
+{
+	int t;
+	int r;
+	int reps;
+	int num_threads = 1;
+	uint64_t base_seed;
+	struct ia_data dat;
+	struct ia_workspace *ws;
+	SEXP Rout;
+
+	reps = INTEGER(iterations)[0];
+	base_seed = (uint64_t)(unsigned int)INTEGER(seed)[0];
+
+	setup_ia_data(&dat, tab, n_alleles, ploidy, INTEGER(method)[0], 1);
+
+	#ifdef _OPENMP
+	{
+		if (INTEGER(requested_threads)[0] == 0)
+		{
+			num_threads = omp_get_max_threads();
+		}
+		else
+		{
+			num_threads = INTEGER(requested_threads)[0];
+		}
+		num_threads = (num_threads > reps) ? reps : num_threads;
+		num_threads = (num_threads < 1) ? 1 : num_threads;
+	}
+	#endif
+
+	ws = R_Calloc(num_threads, struct ia_workspace);
+	for (t = 0; t < num_threads; t++)
+	{
+		alloc_ia_workspace(&ws[t], &dat);
+	}
+	PROTECT(Rout = allocMatrix(REALSXP, reps, 2));
+	double *out = REAL(Rout);
+
+	#ifdef _OPENMP
+	#pragma omp parallel for private(r) schedule(dynamic) num_threads(num_threads)
+	#endif
+	for (r = 0; r < reps; r++)
+	{
+		int thread = 0;
+		double res[2];
+		struct ia_rng rng;
+		#ifdef _OPENMP
+		thread = omp_get_thread_num();
+		#endif
+		ia_rng_seed(&rng, base_seed, (uint64_t)r);
+		ia_replicate(&dat, &ws[thread], &rng, res);
+		out[r] = res[0];
+		out[r + reps] = res[1];
+	}
+
+	for (t = 0; t < num_threads; t++)
+	{
+		free_ia_workspace(&ws[t]);
+	}
+	R_Free(ws);
+	R_Free(dat.locus_start);
+	UNPROTECT(1);
+	return Rout;
+}
+
+/*
+	Calculate the sum over all pairs of samples of the product of the distances
+	at loci a and b. When there are few genotypes at both loci, this uses the
+	number of samples with each combination of genotypes (C):
+
+	sum(Ta[u, u'] * (C %*% Tb %*% t(C))[u, u'] for u < u')
+
+	Otherwise, it loops over all pairs of samples. 
+*/
+static double locus_cross_product(struct ia_data *dat, struct ia_workspace *ws,
+	int a, int b, int contingency, double *C, double *M)
+{
+	int i;
+	int j;
+	int u;
+	int v;
+	int w;
+	int n = dat->n;
+	int nloci = dat->nloci;
+	int ga = ws->ngeno[a] + 1;
+	int gb = ws->ngeno[b] + 1;
+	unsigned short *Ta = ws->dist + ws->table_start[a];
+	unsigned short *Tb = ws->dist + ws->table_start[b];
+	unsigned short *ra;
+	unsigned short *rb;
+	int64_t row;
+	double res = 0.0;
+	double tmp;
+
+	if (contingency)
+	{
+		memset(C, 0, ga*gb*sizeof(double));
+		for (i = 0; i < n; i++)
+		{
+			C[ws->gid[(size_t)i*nloci + a]*gb + ws->gid[(size_t)i*nloci + b]] += 1.0;
+		}
+		for (u = 0; u < ga; u++)
+		{
+			for (w = 0; w < gb; w++)
+			{
+				tmp = 0.0;
+				for (v = 0; v < gb; v++)
+				{
+					tmp += C[u*gb + v]*Tb[v*gb + w];
+				}
+				M[u*gb + w] = tmp;
+			}
+		}
+		for (u = 0; u < ga - 1; u++)
+		{
+			for (v = u + 1; v < ga; v++)
+			{
+				if (Ta[u*ga + v] == 0) continue;
+				tmp = 0.0;
+				for (w = 0; w < gb; w++)
+				{
+					tmp += M[u*gb + w]*C[v*gb + w];
+				}
+				res += Ta[u*ga + v]*tmp;
+			}
+		}
+		return res;
+	}
+	for (i = 0; i < n - 1; i++)
+	{
+		ra = Ta + (size_t)ws->gid[(size_t)i*nloci + a]*ga;
+		rb = Tb + (size_t)ws->gid[(size_t)i*nloci + b]*gb;
+		row = 0;
+		for (j = i + 1; j < n; j++)
+		{
+			row += (int64_t)ra[ws->gid[(size_t)j*nloci + a]]*
+			                rb[ws->gid[(size_t)j*nloci + b]];
+		}
+		res += (double)row;
+	}
+	return res;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Sufficient statistics for the index of association between all pairs of loci.
+
+If V is the matrix of pairwise distances between samples with one column per 
+locus (as created by pair_matrix()), then this calculates colSums(V) and 
+crossprod(V) without creating V. The index of association for any set of loci
+can be calculated from these. 
+
+Inputs:
+	tab - an n x a integer matrix of allele counts with NA for missing loci.
+	      The columns must be grouped by locus.
+	n_alleles - an integer vector with the number of alleles at each locus.
+	            For presence/absence data, this is a vector of ones.
+	ploidy - an integer vector with the ploidy of each sample.
+	codominant - a logical. If FALSE, the data are presence/absence.
+	requested_threads - the number of threads to use. 0 means all available.
+
+Outputs:
+	A list with a vector of the sums of distances per locus and a matrix of the
+	sums of the products of distances between loci. 
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP pair_ia_sums(SEXP tab, SEXP n_alleles, SEXP ploidy, SEXP codominant, 
+	SEXP requested_threads)
+{
+	int i;
+	int a;
+	int t;
+	int g;
+	int h;
+	int ng;
+	int nloci;
+	int max_small = 1;
+	int num_threads = 1;
+	int *small;
+	size_t start = 0;
+	double np;
+	double tmp;
+	double *d;
+	double *VV;
+	double **C;
+	double **M;
+	unsigned short *table;
+	struct ia_data dat;
+	struct ia_workspace ws;
+	SEXP Rout;
+	SEXP Rd;
+	SEXP RVV;
+
+	setup_ia_data(&dat, tab, n_alleles, ploidy, 0, asLogical(codominant));
+	alloc_ia_workspace(&ws, &dat);
+	memcpy(ws.geno, dat.tab, (size_t)dat.n*dat.nalleles*sizeof(int));
+	nloci = dat.nloci;
+	np = (double)dat.n*(dat.n - 1)/2.0;
+	small = R_Calloc(nloci, int);
+
+	PROTECT(Rout = allocVector(VECSXP, 2));
+	PROTECT(Rd = allocVector(REALSXP, nloci));
+	PROTECT(RVV = allocMatrix(REALSXP, nloci, nloci));
+	d = REAL(Rd);
+	VV = REAL(RVV);
+
+	for (a = 0; a < nloci; a++)
+	{
+		fill_locus_table(&dat, &ws, a, start);
+		ng = ws.ngeno[a];
+		start += (size_t)(ng + 1)*(ng + 1);
+		memset(ws.gcount, 0, (ng + 1)*sizeof(int));
+		for (i = 0; i < dat.n; i++)
+		{
+			ws.gcount[ws.gid[(size_t)i*nloci + a]]++;
+		}
+		table = ws.dist + ws.table_start[a];
+		d[a] = 0.0;
+		VV[a + a*nloci] = 0.0;
+		for (g = 0; g < ng; g++)
+		{
+			for (h = g + 1; h < ng; h++)
+			{
+				tmp = (double)ws.gcount[g]*ws.gcount[h];
+				d[a] += table[g*(ng + 1) + h]*tmp;
+				VV[a + a*nloci] += table[g*(ng + 1) + h]*table[g*(ng + 1) + h]*tmp;
+			}
+		}
+		// Loci with few genotypes will use the contingency table.
+		tmp = (double)(ng + 1);
+		small[a] = 2.0*tmp*tmp*tmp < np;
+		if (small[a] && ng + 1 > max_small)
+		{
+			max_small = ng + 1;
+		}
+	}
+
+	#ifdef _OPENMP
+	{
+		if (INTEGER(requested_threads)[0] == 0)
+		{
+			num_threads = omp_get_max_threads();
+		}
+		else
+		{
+			num_threads = INTEGER(requested_threads)[0];
+		}
+		num_threads = (num_threads < 1) ? 1 : num_threads;
+	}
+	#endif
+
+	C = R_Calloc(num_threads, double*);
+	M = R_Calloc(num_threads, double*);
+	for (t = 0; t < num_threads; t++)
+	{
+		C[t] = R_Calloc(max_small*max_small, double);
+		M[t] = R_Calloc(max_small*max_small, double);
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel for private(a) schedule(dynamic) num_threads(num_threads)
+	#endif
+	for (a = 0; a < nloci - 1; a++)
+	{
+		int b;
+		int thread = 0;
+		#ifdef _OPENMP
+		thread = omp_get_thread_num();
+		#endif
+		for (b = a + 1; b < nloci; b++)
+		{
+			VV[a + b*nloci] = locus_cross_product(&dat, &ws, a, b, 
+			                                      small[a] && small[b], 
+			                                      C[thread], M[thread]);
+			VV[b + a*nloci] = VV[a + b*nloci];
+		}
+	}
+
+	for (t = 0; t < num_threads; t++)
+	{
+		R_Free(C[t]);
+		R_Free(M[t]);
+	}
+	R_Free(C);
+	R_Free(M);
+	R_Free(small);
+	free_ia_workspace(&ws);
+	R_Free(dat.locus_start);
+	SET_VECTOR_ELT(Rout, 0, Rd);
+	SET_VECTOR_ELT(Rout, 1, RVV);
+	UNPROTECT(3);
+	return Rout;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Calculate the index of association on resampled data sets from the pairwise
+distances per locus. This is used by resample.ia() and boot.ia().
+
+Each column of inds contains the samples drawn for one replicate. Instead of 
+subsetting V, the pairs of the sampled indices are enumerated and the 
+distances looked up in V. Pairs of a sample with itself (which can occur 
+when sampling with replacement) have no distance and are skipped.
+
+Inputs:
+	V - a choose(nsamples, 2) x m matrix of the distances between samples for 
+	    each locus, in the order of a dist object.
+	inds - an n x reps integer matrix of sampled indices (1-based).
+	nsamples - the number of samples in V.
+	np - the number of pairs to use for the variances.
+	requested_threads - the number of threads to use. 0 means all available.
+
+Outputs:
+	A reps x 2 matrix with Ia in the first column and rbarD in the second.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP resample_ia(SEXP V, SEXP inds, SEXP nsamples, SEXP np, 
+	SEXP requested_threads)
+{
+	int l;
+	int t;
+	int r;
+	int n;
+	int reps;
+	int nloci;
+	int N = asInteger(nsamples);
+	int num_threads = 1;
+	int *samples = INTEGER(inds);
+	size_t i;
+	size_t nrows;
+	double npairs = asReal(np);
+	double *Vin = REAL(V);
+	double *Vt;
+	double **d;
+	double **d2;
+	SEXP Rout;
+	SEXP Rdim;
+
+	Rdim = getAttrib(V, R_DimSymbol);
+	nrows = (size_t)INTEGER(Rdim)[0];
+	nloci = INTEGER(Rdim)[1];
+	Rdim = getAttrib(inds, R_DimSymbol);
+	n = INTEGER(Rdim)[0];
+	reps = INTEGER(Rdim)[1];
+
+	// Store the distances for each pair of samples together.
+	Vt = R_Calloc(nrows*nloci, double);
+	for (i = 0; i < nrows; i++)
+	{
+		for (l = 0; l < nloci; l++)
+		{
+			Vt[i*nloci + l] = Vin[i + l*nrows];
+		}
+	}
+
+	#ifdef _OPENMP
+	{
+		if (INTEGER(requested_threads)[0] == 0)
+		{
+			num_threads = omp_get_max_threads();
+		}
+		else
+		{
+			num_threads = INTEGER(requested_threads)[0];
+		}
+		num_threads = (num_threads > reps) ? reps : num_threads;
+		num_threads = (num_threads < 1) ? 1 : num_threads;
+	}
+	#endif
+
+	d = R_Calloc(num_threads, double*);
+	d2 = R_Calloc(num_threads, double*);
+	for (t = 0; t < num_threads; t++)
+	{
+		d[t] = R_Calloc(nloci, double);
+		d2[t] = R_Calloc(nloci, double);
+	}
+	PROTECT(Rout = allocMatrix(REALSXP, reps, 2));
+	double *out = REAL(Rout);
+
+	#ifdef _OPENMP
+	#pragma omp parallel for private(r) schedule(dynamic) num_threads(num_threads)
+	#endif
+	for (r = 0; r < reps; r++)
+	{
+		int a;
+		int b;
+		int k;
+		int m;
+		int lo;
+		int hi;
+		int thread = 0;
+		int *s = samples + (size_t)r*n;
+		double *dr;
+		double *d2r;
+		double *v;
+		double D;
+		double sumD = 0.0;
+		double sumD2 = 0.0;
+		double varD;
+		double vard;
+		double sigVarj = 0.0;
+		double covar = 0.0;
+		#ifdef _OPENMP
+		thread = omp_get_thread_num();
+		#endif
+		dr = d[thread];
+		d2r = d2[thread];
+		memset(dr, 0, nloci*sizeof(double));
+		memset(d2r, 0, nloci*sizeof(double));
+		for (a = 0; a < n - 1; a++)
+		{
+			for (b = a + 1; b < n; b++)
+			{
+				if (s[a] == s[b]) continue;
+				lo = (s[a] < s[b]) ? s[a] - 1 : s[b] - 1;
+				hi = (s[a] < s[b]) ? s[b] - 1 : s[a] - 1;
+				v = Vt + ((size_t)lo*N - (size_t)lo*(lo + 1)/2 + hi - lo - 1)*nloci;
+				D = 0.0;
+				for (k = 0; k < nloci; k++)
+				{
+					dr[k] += v[k];
+					d2r[k] += v[k]*v[k];
+					D += v[k];
+				}
+				sumD += D;
+				sumD2 += D*D;
+			}
+		}
+		// The variance of each locus is stored in d2r for the covariance.
+		for (k = 0; k < nloci; k++)
+		{
+			vard = (d2r[k] - (dr[k]*dr[k])/npairs)/npairs;
+			sigVarj += vard;
+			d2r[k] = vard;
+		}
+		for (k = 0; k < nloci - 1; k++)
+		{
+			for (m = k + 1; m < nloci; m++)
+			{
+				covar += sqrt(d2r[k]*d2r[m]);
+			}
+		}
+		varD = (sumD2 - (sumD*sumD)/npairs)/npairs;
+		out[r] = (varD/sigVarj) - 1;
+		out[r + reps] = (varD - sigVarj)/(2*covar);
+	}
+
+	for (t = 0; t < num_threads; t++)
+	{
+		R_Free(d[t]);
+		R_Free(d2[t]);
+	}
+	R_Free(d);
+	R_Free(d2);
+	R_Free(Vt);
+	UNPROTECT(1);
+	return Rout;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Analysis of molecular variance (AMOVA) from a dist object.
+
+The sum of squared deviations within the groups of each level of the hierarchy
+is the sum of the squared distances between all pairs of samples in the group
+divided by the number of samples in the group. Since the levels are nested, a
+pair of samples that is in the same group at one level is in the same group at
+all of the levels above it, so all of the levels are calculated in a single
+pass over the distances.
+
+The variance components are estimated from the expected mean squares for an
+unbalanced nested design (Excoffier et al. 1992). The coefficient of the
+variance component of level j in the mean square of level k is calculated from
+the group sizes as
+
+	S[k, j] = sum(n_g^2/n_parent(g)) for all groups g at level j
+
+where parent(g) is the group containing g at level k.
+
+The permutations follow the scheme used by pegas. The variance component of
+the lowest level is tested by permuting samples among the groups of the lowest
+level within the groups of the level above. The variance component of every
+other level is tested by permuting whole groups of the level below it within
+the groups of the level above it. Only the labels are permuted, so the
+distances are never copied.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*
+	The amova struct holds the read-only data shared between threads.
+
+	dist     - the lower triangle of the distance matrix.
+	strata   - an n x nlev matrix (samples in rows) of 0-based group ids. 
+	           The first column is the highest level of the hierarchy. 
+	ngroups  - the number of groups at each level.
+	offset   - the start of each level in arrays of groups over all levels.
+	squared  - whether or not the distances are already squared.
+*/
+struct amova_data {
+	const double *dist;
+	int *strata;
+	int *ngroups;
+	int *offset;
+	int n;
+	int nlev;
+	int total_groups;
+	int squared;
+};
+
+/*
+	The workspace holds everything a single thread needs to permute the labels
+	and calculate the variance components. Labels are stored by sample so that
+	the labels of a pair can be compared without striding over the matrix.
+
+	labels   - an n x nlev matrix (levels in rows) of group ids.
+	size     - the number of samples in each group for all levels.
+	within   - the sum of squared distances within each group for all levels.
+	parent   - the group at each level containing each group (total x nlev).
+	units    - a representative sample for each unit that is permuted.
+	unit_of  - the unit of each sample.
+	order    - the units sorted by the group they are permuted within.
+	label    - the permuted label of each unit.
+	coef     - the coefficients of the variance components (nlev x nlev).
+	W        - the sums of squared deviations within each level.
+	MSD      - the mean squared deviations.
+	SSD, df, sigma - the results for a permutation.
+*/
+struct amova_workspace {
+	int *labels;
+	int *size;
+	double *within;
+	int *parent;
+	int *units;
+	int *unit_of;
+	int *order;
+	int *block_start;
+	int *label;
+	double *coef;
+	double *W;
+	double *MSD;
+	double *SSD;
+	double *df;
+	double *sigma;
+};
+
+static void alloc_amova_workspace(struct amova_workspace *ws, 
+	struct amova_data *dat)
+{
+	ws->labels = R_Calloc((size_t)dat->n*dat->nlev, int);
+	ws->size = R_Calloc(dat->total_groups, int);
+	ws->within = R_Calloc(dat->total_groups, double);
+	ws->parent = R_Calloc((size_t)dat->total_groups*dat->nlev, int);
+	ws->units = R_Calloc(dat->n, int);
+	ws->unit_of = R_Calloc(dat->n, int);
+	ws->order = R_Calloc(dat->n, int);
+	ws->block_start = R_Calloc(dat->n + 1, int);
+	ws->label = R_Calloc(dat->n, int);
+	ws->coef = R_Calloc(dat->nlev*dat->nlev, double);
+	ws->W = R_Calloc(dat->nlev + 1, double);
+	ws->MSD = R_Calloc(dat->nlev + 1, double);
+	ws->SSD = R_Calloc(dat->nlev + 2, double);
+	ws->df = R_Calloc(dat->nlev + 2, double);
+	ws->sigma = R_Calloc(dat->nlev + 1, double);
+}
+
+static void free_amova_workspace(struct amova_workspace *ws)
+{
+	R_Free(ws->labels);
+	R_Free(ws->size);
+	R_Free(ws->within);
+	R_Free(ws->parent);
+	R_Free(ws->units);
+	R_Free(ws->unit_of);
+	R_Free(ws->order);
+	R_Free(ws->block_start);
+	R_Free(ws->label);
+	R_Free(ws->coef);
+	R_Free(ws->W);
+	R_Free(ws->MSD);
+	R_Free(ws->SSD);
+	R_Free(ws->df);
+	R_Free(ws->sigma);
+}
+
+/*
+	Calculate the sums of squared deviations, degrees of freedom, and variance
+	components for the labels in the workspace.
+
+	SSD and df have nlev + 2 elements in the order of the levels followed by
+	the error (within the lowest level) and total. sigma has nlev + 1 elements.
+*/
+static void amova_sigma(struct amova_data *dat, struct amova_workspace *ws,
+	double *SSD, double *df, double *sigma)
+{
+	int i;
+	int j;
+	int k;
+	int m;
+	int g;
+	int n = dat->n;
+	int nlev = dat->nlev;
+	int *li;
+	int *lj;
+	size_t pair = 0;
+	double d;
+	double total = 0.0;
+	double S;
+	double prev;
+	double *W = ws->W;
+	double *MSD = ws->MSD;
+
+	memset(ws->size, 0, dat->total_groups*sizeof(int));
+	memset(ws->within, 0, dat->total_groups*sizeof(double));
+	for (i = 0; i < n; i++)
+	{
+		li = ws->labels + (size_t)i*nlev;
+		for (k = 0; k < nlev; k++)
+		{
+			g = dat->offset[k] + li[k];
+			ws->size[g]++;
+			for (m = 0; m <= k; m++)
+			{
+				ws->parent[(size_t)g*nlev + m] = li[m];
+			}
+		}
+	}
+
+	// The dist object is stored by column of the lower triangle.
+	for (j = 0; j < n - 1; j++)
+	{
+		lj = ws->labels + (size_t)j*nlev;
+		for (i = j + 1; i < n; i++, pair++)
+		{
+			d = dat->dist[pair];
+			d = (dat->squared) ? d : d*d;
+			total += d;
+			li = ws->labels + (size_t)i*nlev;
+			// Find the lowest level at which the pair share a group.
+			for (m = nlev - 1; m >= 0 && li[m] != lj[m]; m--);
+			for (k = 0; k <= m; k++)
+			{
+				ws->within[dat->offset[k] + li[k]] += d;
+			}
+		}
+	}
+
+	// W[k] is the sum of squared deviations within the groups of level k - 1,
+	// where level -1 is the whole population.
+	W[0] = total/n;
+	for (k = 0; k < nlev; k++)
+	{
+		W[k + 1] = 0.0;
+		for (g = 0; g < dat->ngroups[k]; g++)
+		{
+			i = dat->offset[k] + g;
+			W[k + 1] += ws->within[i]/ws->size[i];
+		}
+	}
+	prev = 1.0;
+	for (k = 0; k < nlev; k++)
+	{
+		SSD[k] = W[k] - W[k + 1];
+		df[k] = dat->ngroups[k] - prev;
+		prev = dat->ngroups[k];
+	}
+	SSD[nlev] = W[nlev];
+	df[nlev] = n - prev;
+	SSD[nlev + 1] = W[0];
+	df[nlev + 1] = n - 1;
+	for (k = 0; k <= nlev; k++)
+	{
+		MSD[k] = SSD[k]/df[k];
+	}
+
+	// coef[k + j*nlev] is the coefficient of the variance component of level j
+	// in the mean square of level k. This is the difference between the sums
+	// over the groups of level j nested within levels k - 1 and k.
+	for (k = 0; k < nlev; k++)
+	{
+		for (j = 0; j < nlev; j++)
+		{
+			ws->coef[k + j*nlev] = 0.0;
+			if (j < k)
+			{
+				continue;
+			}
+			for (g = 0; g < dat->ngroups[j]; g++)
+			{
+				i = dat->offset[j] + g;
+				S = (double)ws->size[i]*ws->size[i];
+				// The sum for level k - 1.
+				prev = (k == 0) ? n : 
+				       ws->size[dat->offset[k - 1] + ws->parent[(size_t)i*nlev + k - 1]];
+				ws->coef[k + j*nlev] -= S/prev;
+				if (j > k)
+				{
+					ws->coef[k + j*nlev] += 
+						S/ws->size[dat->offset[k] + ws->parent[(size_t)i*nlev + k]];
+				}
+			}
+			if (j == k)
+			{
+				ws->coef[k + j*nlev] += n;
+			}
+			ws->coef[k + j*nlev] /= df[k];
+		}
+	}
+
+	// Solve for the variance components from the bottom of the hierarchy up.
+	sigma[nlev] = MSD[nlev];
+	for (k = nlev - 1; k >= 0; k--)
+	{
+		S = MSD[k] - sigma[nlev];
+		for (j = k + 1; j < nlev; j++)
+		{
+			S -= ws->coef[k + j*nlev]*sigma[j];
+		}
+		sigma[k] = S/ws->coef[k + k*nlev];
+	}
+}
+
+/*
+	Permute the labels of level k (0-based) for the test of its variance 
+	component. The units are the samples for the lowest level and the groups of
+	the level below for the other levels. Units are shuffled within the groups
+	of the level above k. Since the units of a group share all of their labels 
+	above level k, only the labels at level k need to be moved.
+*/
+static void amova_permute(struct amova_data *dat, struct amova_workspace *ws,
+	struct ia_rng *rng, int k)
+{
+	int i;
+	int b;
+	int u;
+	int nunits;
+	int nblocks;
+	int n = dat->n;
+	int nlev = dat->nlev;
+	int *unit_of = ws->unit_of;
+	int *new_label = ws->label;
+
+	memcpy(ws->labels, dat->strata, (size_t)n*nlev*sizeof(int));
+	nunits = (k == nlev - 1) ? n : dat->ngroups[k + 1];
+	nblocks = (k == 0) ? 1 : dat->ngroups[k - 1];
+	for (u = 0; u < nunits; u++)
+	{
+		ws->units[u] = -1;
+	}
+	for (i = 0; i < n; i++)
+	{
+		unit_of[i] = (k == nlev - 1) ? i : ws->labels[(size_t)i*nlev + k + 1];
+		if (ws->units[unit_of[i]] < 0)
+		{
+			ws->units[unit_of[i]] = i;
+		}
+	}
+	// Counting sort of the units by block.
+	memset(ws->block_start, 0, (nblocks + 1)*sizeof(int));
+	for (u = 0; u < nunits; u++)
+	{
+		b = (k == 0) ? 0 : ws->labels[(size_t)ws->units[u]*nlev + k - 1];
+		ws->block_start[b + 1]++;
+	}
+	for (b = 0; b < nblocks; b++)
+	{
+		ws->block_start[b + 1] += ws->block_start[b];
+	}
+	for (u = 0; u < nunits; u++)
+	{
+		b = (k == 0) ? 0 : ws->labels[(size_t)ws->units[u]*nlev + k - 1];
+		ws->order[ws->block_start[b]++] = u;
+	}
+	for (b = nblocks; b > 0; b--)
+	{
+		ws->block_start[b] = ws->block_start[b - 1];
+	}
+	ws->block_start[0] = 0;
+	for (b = 0; b < nblocks; b++)
+	{
+		int start = ws->block_start[b];
+		int len = ws->block_start[b + 1] - start;
+		for (i = 0; i < len; i++)
+		{
+			u = ws->order[start + i];
+			new_label[u] = ws->labels[(size_t)ws->units[u]*nlev + k];
+		}
+		// Shuffle the labels among the units of this block.
+		for (i = len - 1; i > 0; i--)
+		{
+			int j = ia_rng_index(rng, i + 1);
+			int tmp = new_label[ws->order[start + i]];
+			new_label[ws->order[start + i]] = new_label[ws->order[start + j]];
+			new_label[ws->order[start + j]] = tmp;
+		}
+	}
+	for (i = 0; i < n; i++)
+	{
+		ws->labels[(size_t)i*nlev + k] = new_label[unit_of[i]];
+	}
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Inputs:
+	dist - a dist object (lower triangle by column) of n samples or the path to
+	       a distance file (see dist_file.c) of n samples.
+	strata - an n x l integer matrix of 0-based group ids for each level of the
+	         hierarchy, from the highest to the lowest level. Group ids must be
+	         unique within each level and the levels must be nested.
+	squared - a logical indicating if the distances are already squared.
+	nperm - the number of permutations for each level.
+	seed - a single integer used to seed the permutations.
+	requested_threads - the number of threads. 0 uses all available threads.
+
+Outputs:
+	A list with:
+	 - SSD: the sums of squared deviations (levels, error, total)
+	 - df: the degrees of freedom (levels, error, total)
+	 - sigma2: the variance components (levels, error)
+	 - varcoef: an l x l matrix of the coefficients of the variance components 
+	   (columns) in the expected mean squares (rows).
+	 - perm: an nperm x l matrix of the permuted variance components for each
+	   level.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP amova_permutation(SEXP dist, SEXP strata, SEXP squared, SEXP nperm, 
+	SEXP seed, SEXP requested_threads)
+{
+	int i;
+	int k;
+	int r;
+	int t;
+	int reps;
+	int nlev;
+	int num_threads = 1;
+	int ndist;
+	size_t mapped;
+	uint64_t base_seed;
+	struct amova_data dat;
+	struct amova_workspace *ws;
+	SEXP Rdim;
+	SEXP Rout;
+	SEXP RSSD;
+	SEXP Rdf;
+	SEXP Rsigma;
+	SEXP Rcoef;
+	SEXP Rperm;
+
+	Rdim = getAttrib(strata, R_DimSymbol);
+	dat.n = INTEGER(Rdim)[0];
+	dat.nlev = nlev = INTEGER(Rdim)[1];
+	dat.dist = open_distances(dist, &ndist, &mapped);
+	if (ndist != dat.n)
+	{
+		close_distances(dat.dist, mapped);
+		error("The distances must be between the %d samples of the strata.", dat.n);
+	}
+	dat.squared = asLogical(squared);
+	reps = asInteger(nperm);
+	base_seed = (uint64_t)(unsigned int)asInteger(seed);
+
+	// Store the labels by sample.
+	dat.strata = R_Calloc((size_t)dat.n*nlev, int);
+	dat.ngroups = R_Calloc(nlev, int);
+	dat.offset = R_Calloc(nlev, int);
+	dat.total_groups = 0;
+	for (k = 0; k < nlev; k++)
+	{
+		dat.ngroups[k] = 0;
+		for (i = 0; i < dat.n; i++)
+		{
+			dat.strata[(size_t)i*nlev + k] = INTEGER(strata)[i + (size_t)k*dat.n];
+			if (INTEGER(strata)[i + (size_t)k*dat.n] >= dat.ngroups[k])
+			{
+				dat.ngroups[k] = INTEGER(strata)[i + (size_t)k*dat.n] + 1;
+			}
+		}
+		dat.offset[k] = dat.total_groups;
+		dat.total_groups += dat.ngroups[k];
+	}
+
+	#ifdef _OPENMP
+	{
+		if (asInteger(requested_threads) == 0)
+		{
+			num_threads = omp_get_max_threads();
+		}
+		else
+		{
+			num_threads = asInteger(requested_threads);
+		}
+		num_threads = (num_threads > reps) ? reps : num_threads;
+		num_threads = (num_threads < 1) ? 1 : num_threads;
+	}
+	#endif
+
+	ws = R_Calloc(num_threads, struct amova_workspace);
+	for (t = 0; t < num_threads; t++)
+	{
+		alloc_amova_workspace(&ws[t], &dat);
+	}
+
+	PROTECT(Rout = allocVector(VECSXP, 5));
+	PROTECT(RSSD = allocVector(REALSXP, nlev + 2));
+	PROTECT(Rdf = allocVector(REALSXP, nlev + 2));
+	PROTECT(Rsigma = allocVector(REALSXP, nlev + 1));
+	PROTECT(Rcoef = allocMatrix(REALSXP, nlev, nlev));
+	PROTECT(Rperm = allocMatrix(REALSXP, reps, nlev));
+
+	memcpy(ws[0].labels, dat.strata, (size_t)dat.n*nlev*sizeof(int));
+	amova_sigma(&dat, &ws[0], REAL(RSSD), REAL(Rdf), REAL(Rsigma));
+	memcpy(REAL(Rcoef), ws[0].coef, nlev*nlev*sizeof(double));
+
+	double *perm = REAL(Rperm);
+	#ifdef _OPENMP
+	#pragma omp parallel for private(r) schedule(dynamic) num_threads(num_threads)
+	#endif
+	for (r = 0; r < reps; r++)
+	{
+		int thread = 0;
+		int lev;
+		struct ia_rng rng;
+		#ifdef _OPENMP
+		thread = omp_get_thread_num();
+		#endif
+		ia_rng_seed(&rng, base_seed, (uint64_t)r);
+		for (lev = 0; lev < nlev; lev++)
+		{
+			amova_permute(&dat, &ws[thread], &rng, lev);
+			amova_sigma(&dat, &ws[thread], ws[thread].SSD, ws[thread].df, 
+			            ws[thread].sigma);
+			perm[r + (size_t)lev*reps] = ws[thread].sigma[lev];
+		}
+	}
+
+	SET_VECTOR_ELT(Rout, 0, RSSD);
+	SET_VECTOR_ELT(Rout, 1, Rdf);
+	SET_VECTOR_ELT(Rout, 2, Rsigma);
+	SET_VECTOR_ELT(Rout, 3, Rcoef);
+	SET_VECTOR_ELT(Rout, 4, Rperm);
+
+	for (t = 0; t < num_threads; t++)
+	{
+		free_amova_workspace(&ws[t]);
+	}
+	R_Free(ws);
+	R_Free(dat.strata);
+	R_Free(dat.ngroups);
+	R_Free(dat.offset);
+	close_distances(dat.dist, mapped);
+	UNPROTECT(6);
+	return Rout;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Bootstrap replicates of the diversity statistics for diversity_boot.
+
+Each replicate is a vector of genotype counts that is either drawn from a 
+multinomial distribution with the observed genotype frequencies or, for 
+rarefaction, drawn without replacement from the observed samples. The 
+statistics only depend on these counts, so the samples themselves are never 
+created. The replicates are seeded the same way as in ia_permutation.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+struct diversity_workspace {
+	int *counts; // genotype counts of the replicate
+	int *pool;   // genotype of each observed sample for rarefaction
+};
+
+/*
+	Shannon (H), Stoddart and Taylor (G), Simpson (lambda), and evenness (E.5)
+	from a vector of counts. These are the same as the ones in diversity_stats.
+*/
+static void diversity_indices(int *counts, int nmlg, int size, double *out, 
+	int nboot, int r)
+{
+	int j;
+	double p;
+	double H = 0.0;
+	double S = 0.0;
+	for (j = 0; j < nmlg; j++)
+	{
+		if (counts[j] > 0)
+		{
+			p = (double)counts[j]/size;
+			H -= p*log(p);
+			S += p*p;
+		}
+	}
+	out[r]           = H;
+	out[r + nboot]   = 1.0/S;
+	out[r + 2*nboot] = 1.0 - S;
+	out[r + 3*nboot] = (1.0/S - 1.0)/(exp(H) - 1.0);
+}
+
+/*
+	Multinomial draw of size samples. cum holds the cumulative counts of the
+	observed genotypes, so a uniform sample index is mapped to its genotype by
+	a binary search.
+*/
+static void diversity_multinomial(struct ia_rng *rng, int *cum, int nmlg, 
+	int size, int *counts)
+{
+	int i;
+	int lo;
+	int hi;
+	int mid;
+	int idx;
+	int total = cum[nmlg - 1];
+	memset(counts, 0, nmlg*sizeof(int));
+	for (i = 0; i < size; i++)
+	{
+		idx = ia_rng_index(rng, total);
+		lo = 0;
+		hi = nmlg - 1;
+		while (lo < hi)
+		{
+			mid = (lo + hi)/2;
+			if (cum[mid] > idx)
+			{
+				hi = mid;
+			}
+			else
+			{
+				lo = mid + 1;
+			}
+		}
+		counts[lo]++;
+	}
+}
+
+/*
+	Draw size samples without replacement with a partial Fisher-Yates shuffle.
+	The pool is refilled for every replicate so that the result does not depend
+	on the replicates that the thread has seen before.
+*/
+static void diversity_rarefy(struct ia_rng *rng, int *obs, int nmlg, int size,
+	int *pool, int *counts)
+{
+	int i;
+	int j;
+	int k;
+	int tmp;
+	int total = 0;
+	for (j = 0; j < nmlg; j++)
+	{
+		for (k = 0; k < obs[j]; k++)
+		{
+			pool[total++] = j;
+		}
+	}
+	size = (size > total) ? total : size;
+	memset(counts, 0, nmlg*sizeof(int));
+	for (i = 0; i < size; i++)
+	{
+		j = i + ia_rng_index(rng, total - i);
+		tmp = pool[i];
+		pool[i] = pool[j];
+		pool[j] = tmp;
+		counts[pool[i]]++;
+	}
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Inputs:
+	tab - an integer matrix of genotype counts with populations in rows and 
+	      MLGs in columns.
+	size - an integer vector with the number of samples to draw for each 
+	       population.
+	rarefy - a logical. If TRUE, samples are drawn without replacement and at
+	         most all of the samples in the population are drawn. If FALSE,
+	         samples are drawn from a multinomial distribution.
+	nboot - the number of bootstrap replicates per population.
+	seed - a single integer used to seed the replicates.
+	requested_threads - the number of threads. 0 uses all available threads.
+
+Outputs:
+	A list with one nboot x 4 matrix per population with the statistics H, G,
+	lambda, and E.5 in columns.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP diversity_bootstrap(SEXP tab, SEXP size, SEXP rarefy, SEXP nboot, 
+	SEXP seed, SEXP requested_threads)
+{
+	int i;
+	int j;
+	int t;
+	int npop;
+	int nmlg;
+	int reps;
+	int rare;
+	int max_total = 1;
+	int num_threads = 1;
+	int *cum;
+	int *obs;
+	double **out;
+	uint64_t base_seed;
+	size_t b;
+	size_t nrep;
+	struct diversity_workspace *ws;
+	SEXP Rdim;
+	SEXP Rout;
+	SEXP Rmat;
+
+	Rdim = getAttrib(tab, R_DimSymbol);
+	npop = INTEGER(Rdim)[0];
+	nmlg = INTEGER(Rdim)[1];
+	rare = asLogical(rarefy);
+	reps = asInteger(nboot);
+	base_seed = (uint64_t)(unsigned int)asInteger(seed);
+	nrep = (size_t)npop*reps;
+
+	// Samples are stored by population
+	obs = R_Calloc((size_t)npop*nmlg, int);
+	cum = R_Calloc((size_t)npop*nmlg, int);
+	for (i = 0; i < npop; i++)
+	{
+		int total = 0;
+		for (j = 0; j < nmlg; j++)
+		{
+			obs[(size_t)i*nmlg + j] = INTEGER(tab)[i + (size_t)j*npop];
+			total += obs[(size_t)i*nmlg + j];
+			cum[(size_t)i*nmlg + j] = total;
+		}
+		max_total = (total > max_total) ? total : max_total;
+	}
+
+	#ifdef _OPENMP
+	{
+		if (asInteger(requested_threads) == 0)
+		{
+			num_threads = omp_get_max_threads();
+		}
+		else
+		{
+			num_threads = asInteger(requested_threads);
+		}
+		num_threads = ((size_t)num_threads > nrep) ? (int)nrep : num_threads;
+		num_threads = (num_threads < 1) ? 1 : num_threads;
+	}
+	#endif
+
+	ws = R_Calloc(num_threads, struct diversity_workspace);
+	for (t = 0; t < num_threads; t++)
+	{
+		ws[t].counts = R_Calloc(nmlg, int);
+		ws[t].pool = (rare) ? R_Calloc(max_total, int) : NULL;
+	}
+
+	PROTECT(Rout = allocVector(VECSXP, npop));
+	out = R_Calloc(npop, double*);
+	for (i = 0; i < npop; i++)
+	{
+		PROTECT(Rmat = allocMatrix(REALSXP, reps, 4));
+		SET_VECTOR_ELT(Rout, i, Rmat);
+		out[i] = REAL(Rmat);
+		UNPROTECT(1);
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel for private(b) schedule(dynamic) num_threads(num_threads)
+	#endif
+	for (b = 0; b < nrep; b++)
+	{
+		int thread = 0;
+		int pop = (int)(b / reps);
+		int r = (int)(b % reps);
+		int total = cum[(size_t)pop*nmlg + nmlg - 1];
+		int draws = INTEGER(size)[pop];
+		struct ia_rng rng;
+		#ifdef _OPENMP
+		thread = omp_get_thread_num();
+		#endif
+		ia_rng_seed(&rng, base_seed, (uint64_t)b);
+		if (rare)
+		{
+			draws = (draws > total) ? total : draws;
+			diversity_rarefy(&rng, obs + (size_t)pop*nmlg, nmlg, draws, 
+			                 ws[thread].pool, ws[thread].counts);
+		}
+		else if (total > 0)
+		{
+			diversity_multinomial(&rng, cum + (size_t)pop*nmlg, nmlg, draws, 
+			                      ws[thread].counts);
+		}
+		else
+		{
+			memset(ws[thread].counts, 0, nmlg*sizeof(int));
+		}
+		diversity_indices(ws[thread].counts, nmlg, draws, out[pop], reps, r);
+	}
+
+	for (t = 0; t < num_threads; t++)
+	{
+		R_Free(ws[t].counts);
+		if (ws[t].pool != NULL)
+		{
+			R_Free(ws[t].pool);
+		}
+	}
+	R_Free(ws);
+	R_Free(out);
+	R_Free(obs);
+	R_Free(cum);
+	UNPROTECT(1);
+	return Rout;
+}
@@ -42,11 +42,27 @@
 #include <time.h>
 #include <string.h>
 #include <stdlib.h>
+
+// Include openMP if the compiler supports it
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 int perm_count;
 
 SEXP pairwise_covar(SEXP pair_vec);
 SEXP pairdiffs(SEXP freq_mat);
+SEXP pairdiffs_all(SEXP geno_mat, SEXP loc_ends, SEXP codominant, SEXP scale, SEXP requested_threads);
+SEXP pairdiffs_all_file(SEXP geno_mat, SEXP loc_ends, SEXP codominant, SEXP scale, SEXP path, SEXP block_size, SEXP requested_threads);
+static int* pairdiffs_samples(SEXP geno_mat, int n, int nall);
+static int pairdiffs_threads(SEXP requested_threads);
+static void fill_pairdiffs(int *samples, int n, int nall, int nloc, int *ends, int codom, double *div, int nscale, int first, int last, int num_threads, double *out);
+// Defined in dist_file.c
+size_t dist_row_offset(int i, int n);
+int dist_block_end(int first, int n, size_t capacity);
+FILE* create_dist_file(const char *filename, int n);
 SEXP permuto(SEXP perm);
+SEXP bootstrap_locus_distance(SEXP freq_mat, SEXP loc_ends, SEXP method, SEXP weights, SEXP requested_threads);
+SEXP genetic_distance(SEXP freq_mat, SEXP loc_ends, SEXP scale, SEXP method, SEXP requested_threads);
 SEXP bruvo_distance(SEXP bruvo_mat, SEXP permutations, SEXP alleles, SEXP m_add, SEXP m_loss, SEXP old_model);
 double bruvo_dist(int *in, int *nall, int *perm, int *woo, int *loss, int *add, int old_model);
 void swap(int *x, int *y);  
@@ -162,6 +178,217 @@ SEXP pairdiffs(SEXP freq_mat)
 	return Rout;
 }
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Calculates the number of allelic differences between all pairs of samples over
+all loci at once. This gives the same result as summing ceiling(pairdiffs/2)
+over each locus, but it reads the genotype matrix once and writes the sums 
+directly into a dist vector without a matrix of pairs by loci.
+
+The genotypes are first copied so that the alleles of each sample are 
+contiguous, and the rows of the dist vector are spread over threads.
+
+Parameters:
+	geno_mat   - an integer matrix of allele counts with samples in rows and 
+	             alleles in columns. The alleles of each locus must be 
+	             contiguous.
+	loc_ends   - an integer vector of length m + 1 where the alleles of locus l
+	             are in columns loc_ends[l] to loc_ends[l + 1] - 1 (0-based).
+	codominant - if TRUE, the differences at each locus are halved and rounded
+	             up as in pair_matrix(). If FALSE (presence/absence data), the
+	             differences are counted as they are.
+	scale      - a numeric vector of length 1 or n. The distance between 
+	             samples i < j is divided by scale[j], the same as sweeping the
+	             rows of the lower triangle of the matrix in diss.dist().
+	requested_threads - the number of threads to use. 0 uses all available.
+
+Returns:
+	A vector of n*(n-1)/2 distances in the order of a dist object. A locus 
+	with missing data in either sample contributes no differences.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP pairdiffs_all(SEXP geno_mat, SEXP loc_ends, SEXP codominant, SEXP scale, SEXP requested_threads)
+{
+	int n;
+	int nall;
+	int *samples;
+	SEXP Rdim;
+	SEXP Rout;
+
+	Rdim   = getAttrib(geno_mat, R_DimSymbol);
+	n      = INTEGER(Rdim)[0];
+	nall   = INTEGER(Rdim)[1];
+	PROTECT(loc_ends = coerceVector(loc_ends, INTSXP));
+	PROTECT(scale    = coerceVector(scale, REALSXP));
+	PROTECT(Rout = allocVector(REALSXP, (size_t)n*(n - 1)/2));
+
+	samples = pairdiffs_samples(geno_mat, n, nall);
+	fill_pairdiffs(samples, n, nall, length(loc_ends) - 1, INTEGER(loc_ends), 
+		asLogical(codominant), REAL(scale), length(scale), 0, n, 
+		pairdiffs_threads(requested_threads), REAL(Rout));
+	R_Free(samples);
+	UNPROTECT(3);
+	return Rout;
+}
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Calculates the same distances as pairdiffs_all, but writes them to a distance
+file (see dist_file.c) one block of samples at a time so that the distances 
+between all samples never have to be in memory at once.
+
+Parameters:
+	geno_mat, loc_ends, codominant, scale - see pairdiffs_all
+	path       - the path to the distance file.
+	block_size - the maximum number of distances to calculate at once.
+	requested_threads - the number of threads to use. 0 uses all available.
+
+Returns:
+	The number of samples.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP pairdiffs_all_file(SEXP geno_mat, SEXP loc_ends, SEXP codominant, SEXP scale, SEXP path, SEXP block_size, SEXP requested_threads)
+{
+	int n;
+	int nall;
+	int first;
+	int last;
+	int failed;
+	int num_threads;
+	int *samples;
+	size_t capacity;
+	size_t count;
+	double *block;
+	const char *filename;
+	FILE *file;
+	SEXP Rdim;
+
+	filename = CHAR(STRING_ELT(path, 0));
+	Rdim   = getAttrib(geno_mat, R_DimSymbol);
+	n      = INTEGER(Rdim)[0];
+	nall   = INTEGER(Rdim)[1];
+	PROTECT(loc_ends = coerceVector(loc_ends, INTSXP));
+	PROTECT(scale    = coerceVector(scale, REALSXP));
+	num_threads = pairdiffs_threads(requested_threads);
+
+	file = create_dist_file(filename, n);
+	if (file == NULL)
+	{
+		error("Could not open %s.", filename);
+	}
+	// Every block holds at least one sample
+	capacity = (size_t)asReal(block_size);
+	capacity = (capacity < (size_t)n) ? (size_t)n : capacity;
+	block    = R_Calloc(capacity, double);
+	samples  = pairdiffs_samples(geno_mat, n, nall);
+	failed   = 0;
+	for (first = 0; first < n - 1 && !failed; first = last)
+	{
+		last  = dist_block_end(first, n, capacity);
+		count = dist_row_offset(last, n) - dist_row_offset(first, n);
+		fill_pairdiffs(samples, n, nall, length(loc_ends) - 1, 
+			INTEGER(loc_ends), asLogical(codominant), REAL(scale), 
+			length(scale), first, last, num_threads, block);
+		failed = fwrite(block, sizeof(double), count, file) != count;
+	}
+	failed = (fclose(file) != 0) || failed;
+	R_Free(samples);
+	R_Free(block);
+	UNPROTECT(2);
+	if (failed)
+	{
+		error("Could not write to %s.", filename);
+	}
+	return ScalarInteger(n);
+}
+
+// Copies the genotypes so that the alleles of each sample are contiguous
+static int* pairdiffs_samples(SEXP geno_mat, int n, int nall)
+{
+	int i;
+	int a;
+	int *geno;
+	int *samples;
+
+	PROTECT(geno_mat = coerceVector(geno_mat, INTSXP));
+	geno = INTEGER(geno_mat);
+	samples = R_Calloc((size_t)n*nall, int);
+	for (i = 0; i < n; i++)
+	{
+		for (a = 0; a < nall; a++)
+		{
+			samples[(size_t)i*nall + a] = geno[i + (size_t)a*n];
+		}
+	}
+	UNPROTECT(1);
+	return samples;
+}
+
+// Number of threads to use for the requested number. 0 means all available.
+static int pairdiffs_threads(SEXP requested_threads)
+{
+	int num_threads;
+	#ifdef _OPENMP
+	{
+		if (asInteger(requested_threads) == 0)
+		{
+			num_threads = omp_get_max_threads();
+		}
+		else
+		{
+			num_threads = asInteger(requested_threads);
+		}
+	}
+	#else
+	{
+		num_threads = 1;
+	}
+	#endif
+	return (num_threads < 1) ? 1 : num_threads;
+}
+
+/*
+	Fills out with the distances of the samples from first up to last (to the
+	samples after them) in the order of a dist object. The rows are spread 
+	over threads. See pairdiffs_all for the parameters.
+*/
+static void fill_pairdiffs(int *samples, int n, int nall, int nloc, int *ends, 
+	int codom, double *div, int nscale, int first, int last, int num_threads, 
+	double *out)
+{
+	int i;
+	size_t start = dist_row_offset(first, n);
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic) private(i) num_threads(num_threads)
+	#endif
+	for (i = first; i < last; i++)
+	{
+		int j;
+		int l;
+		int k;
+		int d;
+		int total;
+		int *x = samples + (size_t)i*nall;
+		int *y;
+		size_t row = dist_row_offset(i, n) - start;
+		for (j = i + 1; j < n; j++)
+		{
+			y = samples + (size_t)j*nall;
+			total = 0;
+			for (l = 0; l < nloc; l++)
+			{
+				d = 0;
+				for (k = ends[l]; k < ends[l + 1]; k++)
+				{
+					if (x[k] == NA_INTEGER || y[k] == NA_INTEGER)
+					{
+						d = 0;
+						break;
+					}
+					d += abs(x[k] - y[k]);
+				}
+				total += (codom) ? (d + 1)/2 : d;
+			}
+			out[row + (j - i - 1)] = total/div[(nscale > 1) ? j : 0];
+		}
+	}
+}
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 permuto will return a vector of all permutations needed for bruvo's distance.
 ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
 SEXP permuto(SEXP perm)
@@ -191,6 +418,426 @@ SEXP permuto(SEXP perm)
 	return Rval;
 }
 /*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+The contribution of locus l to the distance between samples i and j for 
+bootstrap_locus_distance. The alleles of the locus are in columns start to 
+end - 1 of freqs, which has n rows.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static double locus_component(const double *freqs, int n, int i, int j, 
+	int start, int end, int method)
+{
+	int a;
+	double p;
+	double q;
+	double res = 0.0;
+	for (a = start; a < end; a++)
+	{
+		p = freqs[i + (size_t)a*n];
+		q = freqs[j + (size_t)a*n];
+		switch (method)
+		{
+			case 2:
+				res += sqrt(p*q);
+				break;
+			case 3:
+				res += (p - q)*(p - q);
+				break;
+			case 5:
+				res += fabs(p - q);
+				break;
+			default:
+				res += p*q;
+		}
+	}
+	if (method == 3)
+	{
+		res = sqrt(res*0.5);
+	}
+	else if (method == 5)
+	{
+		res = res/2;
+	}
+	return res;
+}
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Calculates bootstrap replicates of a genetic distance by reweighting the loci.
+
+Each of these distances is a function of sums over loci, so a bootstrap 
+replicate that samples loci with replacement is the sum of the contributions of
+the loci weighted by the number of times each locus was sampled. The 
+contributions are calculated from the allele frequencies for each replicate and
+loci that were not sampled are skipped, so no memory is needed beyond the 
+output. The methods are coded as:
+
+	1 - Nei's distance:      -log(sum(pq)/sqrt(sum(p^2)*sum(q^2)))
+	2 - Edwards' distance:   sqrt(1 - sum(sqrt(pq))/m)
+	3 - Rogers' distance:    sum(sqrt(sum((p - q)^2)/2))/m
+	4 - Reynolds' distance:  sqrt(sum((p - q)^2)/(2m - 2*sum(pq)))
+	5 - Prevosti's distance: sum(sum(abs(p - q))/2)/m
+
+where p and q are the allele frequencies of two samples and m is the number of
+loci. These give the same values as nei.dist, edwards.dist, rogers.dist,
+reynolds.dist, and provesti.dist for codominant data without missing values.
+
+Parameters:
+	freq_mat - a matrix of allele frequencies with samples in rows and alleles
+	           in columns. The alleles of each locus must be contiguous.
+	loc_ends - an integer vector of length m + 1 where the alleles of locus l
+	           are in columns loc_ends[l] to loc_ends[l + 1] - 1 (0-based).
+	method   - an integer from 1 to 5 (see above).
+	weights  - an m x B integer matrix of the number of times each locus was
+	           sampled in each of B replicates.
+	requested_threads - the number of threads to use. 0 uses all available.
+
+Returns:
+	A matrix of n*(n-1)/2 rows and B columns where each column contains the
+	distances of one replicate in the order of a dist object.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP bootstrap_locus_distance(SEXP freq_mat, SEXP loc_ends, SEXP method, SEXP weights, SEXP requested_threads)
+{
+	int n;
+	int nloc;
+	int reps;
+	int dist_method;
+	int num_threads;
+	int i;
+	int l;
+	int a;
+	int r;
+	int *ends;
+	int *w;
+	int *wr;
+	size_t npairs;
+	double total;
+	double *freqs;
+	double *samp_sums;
+	double *out;
+	double *res;
+	SEXP Rdim;
+	SEXP Rout;
+
+	Rdim        = getAttrib(freq_mat, R_DimSymbol);
+	n           = INTEGER(Rdim)[0];
+	nloc        = length(loc_ends) - 1;
+	reps        = INTEGER(getAttrib(weights, R_DimSymbol))[1];
+	dist_method = asInteger(method);
+	freqs       = REAL(freq_mat);
+	ends        = INTEGER(loc_ends);
+	w           = INTEGER(weights);
+	npairs      = (size_t)n*(n - 1)/2;
+
+	#ifdef _OPENMP
+	{
+		if (asInteger(requested_threads) == 0)
+		{
+			num_threads = omp_get_max_threads();
+		}
+		else
+		{
+			num_threads = asInteger(requested_threads);
+		}
+	}
+	#else
+	{
+		num_threads = 1;
+	}
+	#endif
+	num_threads = (num_threads < 1) ? 1 : num_threads;
+
+	PROTECT(Rout = allocMatrix(REALSXP, npairs, reps));
+	out       = REAL(Rout);
+	samp_sums = NULL;
+	if (dist_method == 1 || dist_method == 4)
+	{
+		// Nei and Reynolds also need the sum of squared frequencies per sample
+		samp_sums = R_Calloc(n, double);
+	}
+
+	for (r = 0; r < reps; r++)
+	{
+		wr    = w + (size_t)r*nloc;
+		res   = out + (size_t)r*npairs;
+		total = 0.0;
+		for (l = 0; l < nloc; l++)
+		{
+			total += wr[l];
+		}
+		if (samp_sums != NULL)
+		{
+			for (i = 0; i < n; i++)
+			{
+				samp_sums[i] = 0.0;
+				for (l = 0; l < nloc; l++)
+				{
+					for (a = ends[l]; a < ends[l + 1] && wr[l] > 0; a++)
+					{
+						samp_sums[i] += wr[l]*freqs[i + (size_t)a*n]*freqs[i + (size_t)a*n];
+					}
+				}
+			}
+		}
+		#ifdef _OPENMP
+		#pragma omp parallel for schedule(dynamic) private(i) num_threads(num_threads)
+		#endif
+		for (i = 0; i < n - 1; i++)
+		{
+			int j;
+			int k;
+			double sum;
+			double *row = res + (size_t)i*n - (size_t)i*(i + 1)/2;
+			for (j = i + 1; j < n; j++)
+			{
+				sum = 0.0;
+				for (k = 0; k < nloc; k++)
+				{
+					if (wr[k] > 0)
+					{
+						sum += wr[k]*locus_component(freqs, n, i, j, ends[k], 
+							ends[k + 1], dist_method);
+					}
+				}
+				switch (dist_method)
+				{
+					case 1:
+						row[j - i - 1] = -log(sum/sqrt(samp_sums[i]*samp_sums[j]));
+						break;
+					case 2:
+						row[j - i - 1] = sqrt(1 - sum/total);
+						break;
+					case 4:
+						row[j - i - 1] = sqrt((samp_sums[i] + samp_sums[j] - 2*sum)/(2*total - 2*sum));
+						break;
+					default:
+						row[j - i - 1] = sum/total;
+				}
+			}
+		}
+	}
+
+	if (samp_sums != NULL)
+	{
+		R_Free(samp_sums);
+	}
+	UNPROTECT(1);
+	return Rout;
+}
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Distance between two samples for genetic_distance. x and y are the allele 
+frequencies of the samples and sx and sy are their sums of squared 
+frequencies. The method codes are the same as in bootstrap_locus_distance.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static double pair_genetic_distance(const double *x, const double *y, 
+	double sx, double sy, const int *ends, int nloc, double scale, int method)
+{
+	int a;
+	int l;
+	int nall = ends[nloc];
+	double diff;
+	double res = 0.0;
+	double sum = 0.0;
+	switch (method)
+	{
+		case 1:
+			for (a = 0; a < nall; a++)
+			{
+				sum += x[a]*y[a];
+			}
+			return -log(sum/(sqrt(sx)*sqrt(sy)));
+		case 2:
+			for (a = 0; a < nall; a++)
+			{
+				sum += sqrt(x[a]*y[a]);
+			}
+			return sqrt(1 - sum/scale);
+		case 3:
+			for (l = 0; l < nloc; l++)
+			{
+				sum = 0.0;
+				for (a = ends[l]; a < ends[l + 1]; a++)
+				{
+					diff = x[a] - y[a];
+					sum += diff*diff;
+				}
+				res += sqrt(sum*0.5);
+			}
+			return res/scale;
+		case 4:
+			for (a = 0; a < nall; a++)
+			{
+				diff = x[a] - y[a];
+				res += diff*diff;
+				sum += x[a]*y[a];
+			}
+			return sqrt(res/(2*scale - 2*sum));
+		default:
+			// Missing data is skipped for Prevosti's distance
+			for (a = 0; a < nall; a++)
+			{
+				diff = fabs(x[a] - y[a]);
+				if (!ISNAN(diff))
+				{
+					sum += diff;
+				}
+			}
+			return sum/scale;
+	}
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Calculates Nei's, Edwards', Rogers', Reynolds', or Prevosti's distance between
+all samples of an allele frequency matrix without creating any square matrices.
+
+The frequencies are first copied so that the alleles of each sample are 
+contiguous. The pairs are then processed in square blocks of samples so that
+the frequencies of both blocks stay in the cache while the block is 
+calculated, and the blocks are spread over threads.
+
+The distances are the same as those in bootstrap_locus_distance. For all but
+Prevosti's distance, any missing value in either sample gives a missing 
+distance, the same as the matrix products in R. Prevosti's distance ignores 
+missing values.
+
+Parameters:
+	freq_mat - a matrix of allele frequencies with samples in rows and alleles
+	           in columns. The alleles of each locus must be contiguous.
+	loc_ends - an integer vector of length m + 1 where the alleles of locus l
+	           are in columns loc_ends[l] to loc_ends[l + 1] - 1 (0-based).
+	           Only Rogers' distance uses the loci.
+	scale    - the number that the sums are divided by (the number of loci for
+	           Edwards', Rogers', and Reynolds' distance). This is not used for
+	           Nei's distance.
+	method   - an integer from 1 to 5 (see bootstrap_locus_distance).
+	requested_threads - the number of threads to use. 0 uses all available.
+
+Returns:
+	A vector of n*(n-1)/2 distances in the order of a dist object.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP genetic_distance(SEXP freq_mat, SEXP loc_ends, SEXP scale, SEXP method, SEXP requested_threads)
+{
+	const int block = 64;
+	int n;
+	int nall;
+	int nloc;
+	int nblocks;
+	int dist_method;
+	int num_threads;
+	int i;
+	int a;
+	int t;
+	int ntiles;
+	int *ends;
+	int *has_na;
+	int *tile_i;
+	int *tile_j;
+	double div;
+	double *freqs;
+	double *samples;
+	double *sumsq;
+	double *out;
+	SEXP Rdim;
+	SEXP Rout;
+
+	Rdim        = getAttrib(freq_mat, R_DimSymbol);
+	n           = INTEGER(Rdim)[0];
+	nall        = INTEGER(Rdim)[1];
+	nloc        = length(loc_ends) - 1;
+	ends        = INTEGER(loc_ends);
+	div         = asReal(scale);
+	dist_method = asInteger(method);
+	freqs       = REAL(freq_mat);
+
+	#ifdef _OPENMP
+	{
+		if (asInteger(requested_threads) == 0)
+		{
+			num_threads = omp_get_max_threads();
+		}
+		else
+		{
+			num_threads = asInteger(requested_threads);
+		}
+	}
+	#else
+	{
+		num_threads = 1;
+	}
+	#endif
+	num_threads = (num_threads < 1) ? 1 : num_threads;
+
+	PROTECT(Rout = allocVector(REALSXP, (size_t)n*(n - 1)/2));
+	out = REAL(Rout);
+
+	// Frequencies by sample, their sums of squares, and missing data
+	samples = R_Calloc((size_t)n*nall, double);
+	sumsq   = R_Calloc(n, double);
+	has_na  = R_Calloc(n, int);
+	for (i = 0; i < n; i++)
+	{
+		for (a = 0; a < nall; a++)
+		{
+			double p = freqs[i + (size_t)a*n];
+			samples[(size_t)i*nall + a] = p;
+			sumsq[i] += p*p;
+			has_na[i] = has_na[i] || ISNAN(p);
+		}
+	}
+
+	// Blocks on and above the diagonal
+	nblocks = (n + block - 1)/block;
+	ntiles  = nblocks*(nblocks + 1)/2;
+	tile_i  = R_Calloc(ntiles, int);
+	tile_j  = R_Calloc(ntiles, int);
+	t = 0;
+	for (i = 0; i < nblocks; i++)
+	{
+		for (a = i; a < nblocks; a++)
+		{
+			tile_i[t] = i;
+			tile_j[t] = a;
+			t++;
+		}
+	}
+
+	#ifdef _OPENMP
+	#pragma omp parallel for schedule(dynamic) private(t) num_threads(num_threads)
+	#endif
+	for (t = 0; t < ntiles; t++)
+	{
+		int j;
+		int k;
+		int i_end = (tile_i[t] + 1)*block;
+		int j_end = (tile_j[t] + 1)*block;
+		i_end = (i_end > n) ? n : i_end;
+		j_end = (j_end > n) ? n : j_end;
+		for (j = tile_i[t]*block; j < i_end; j++)
+		{
+			size_t row = (size_t)j*n - (size_t)j*(j + 1)/2;
+			k = tile_j[t]*block;
+			k = (k > j + 1) ? k : j + 1;
+			for (; k < j_end; k++)
+			{
+				if (dist_method != 5 && (has_na[j] || has_na[k]))
+				{
+					out[row + (k - j - 1)] = NA_REAL;
+				}
+				else
+				{
+					out[row + (k - j - 1)] = pair_genetic_distance(
+						samples + (size_t)j*nall, samples + (size_t)k*nall,
+						sumsq[j], sumsq[k], ends, nloc, div, dist_method);
+				}
+			}
+		}
+	}
+
+	R_Free(samples);
+	R_Free(sumsq);
+	R_Free(has_na);
+	R_Free(tile_i);
+	R_Free(tile_j);
+	UNPROTECT(1);
+	return Rout;
+}
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 Calculates Bruvo's distance over a matrix of individuals by loci. This is
 calcluated regardless of ploidy. For more information, see Bruvo et al. 2006
 
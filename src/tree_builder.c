@@ -0,0 +1,666 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#
+# This software was authored by Zhian N. Kamvar and Javier F. Tabima, graduate
+# students at Oregon State University; Jonah C. Brooks, undergraduate student at
+# Oregon State University; and Dr. Nik Grünwald, an employee of USDA-ARS.
+#
+# Permission to use, copy, modify, and distribute this software and its
+# documentation for educational, research and non-profit purposes, without fee,
+# and without a written agreement is hereby granted, provided that the statement
+# above is incorporated into the material, giving appropriate attribution to the
+# authors.
+#
+# Permission to incorporate this software into commercial products may be
+# obtained by contacting USDA ARS and OREGON STATE UNIVERSITY Office for
+# Commercialization and Corporate Development.
+#
+# The software program and documentation are supplied "as is", without any
+# accompanying services from the USDA or the University. USDA ARS or the
+# University do not warrant that the operation of the program will be
+# uninterrupted or error-free. The end-user understands that the program was
+# developed for research purposes and is advised not to rely exclusively on the
+# program for any reason.
+#
+# IN NO EVENT SHALL USDA ARS OR OREGON STATE UNIVERSITY BE LIABLE TO ANY PARTY
+# FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES, INCLUDING
+# LOST PROFITS, ARISING OUT OF THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION,
+# EVEN IF THE OREGON STATE UNIVERSITY HAS BEEN ADVISED OF THE POSSIBILITY OF
+# SUCH DAMAGE. USDA ARS OR OREGON STATE UNIVERSITY SPECIFICALLY DISCLAIMS ANY
+# WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE AND ANY STATUTORY
+# WARRANTY OF NON-INFRINGEMENT. THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS"
+# BASIS, AND USDA ARS AND OREGON STATE UNIVERSITY HAVE NO OBLIGATIONS TO PROVIDE
+# MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+#
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <Rinternals.h>
+#include <R_ext/Utils.h>
+#include <R.h>
+
+// Include openMP if the compiler supports it
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+
+Tree workspace struct
+=====================
+
+Everything needed to build one tree from a condensed distance matrix of n
+samples. These are allocated once per thread so that trees can be built in
+parallel without allocating memory inside of the parallel region.
+
+Nodes 0 to n - 1 are the tips. Internal nodes are numbered from n in the order
+they are created and the last node created is the root. The trees are recorded
+as the parent and the length of the branch to the parent for each node and are
+converted to the phylo format by tree_to_phylo.
+
+*/
+
+struct tree_workspace
+{
+  int n;              // Number of tips
+  double *dist;       // Working copy of the condensed distance matrix
+  int *alive;         // Whether or not each slot holds an active cluster
+  int *node;          // The node represented by each slot
+  int *size;          // Number of tips under each slot (UPGMA)
+  int *chain;         // Nearest neighbor chain (UPGMA)
+  double *height;     // Height of each node (UPGMA)
+  double *rowsum;     // Sum of distances from each slot (NJ)
+  int *birth;         // Step at which each slot was last replaced (NJ)
+  int **order;        // Slots sorted by distance for each slot (NJ)
+  int *order_length;  // Length of each sorted list (NJ)
+  int *order_pool;    // Memory for the sorted lists (NJ)
+  size_t pool_used;   // Amount of order_pool in use (NJ)
+  struct dist_index *sorter; // Scratch space for sorting (NJ)
+};
+
+struct dist_index
+{
+  double d;
+  int j;
+};
+
+SEXP build_trees(SEXP dists, SEXP n_samples, SEXP method, SEXP requested_threads);
+void alloc_tree_workspace(struct tree_workspace *ws, int n, int nj);
+void free_tree_workspace(struct tree_workspace *ws);
+void upgma_condensed(struct tree_workspace *ws, double *dist, int *parent, double *blen);
+void nj_condensed(struct tree_workspace *ws, double *dist, int *parent, double *blen);
+void sort_slot(struct tree_workspace *ws, int i, int from_zero);
+int compare_dist_index(const void *a, const void *b);
+SEXP tree_to_phylo(int n, int nnode, int *parent, double *blen);
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Returns the position of the distance between samples i and j in a condensed
+distance matrix of n samples (the order of a dist object).
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+static inline size_t dist_index(int i, int j, int n)
+{
+  if (i > j)
+  {
+    int tmp = i;
+    i = j;
+    j = tmp;
+  }
+  return (size_t)i*n - (size_t)i*(i + 1)/2 + (j - i - 1);
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Builds UPGMA or neighbor-joining trees from condensed distance matrices.
+
+UPGMA is calculated with the nearest neighbor chain algorithm, which gives the
+same tree as the classical algorithm in O(n^2) time. Neighbor-joining uses the
+bound from RapidNJ (Simonsen et al. 2008): the distances from each cluster are
+kept sorted, so the search for the pair with the smallest Q value can stop
+early for each row. Only the condensed distances are copied; no n x n matrix of
+doubles is created.
+
+Input: A matrix of n(n - 1)/2 rows with one condensed distance matrix per column.
+       An integer specifying the number of samples, n.
+       An integer specifying the method: 1 for UPGMA and 2 for neighbor-joining.
+       An integer representing the number of threads that should be used.
+Output: A list with one element per column of dists, each a list with the
+        elements edge, edge.length, and Nnode of a phylo object.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP build_trees(SEXP dists, SEXP n_samples, SEXP method, SEXP requested_threads)
+{
+  int n = asInteger(n_samples);
+  int nj = asInteger(method) == 2;
+  int num_threads;
+  int reps;
+  int nnode;
+  int nodes;
+  int r;
+  size_t npairs = (size_t)n*(n - 1)/2;
+  int *parents;
+  double *lengths;
+  double *dist = REAL(dists);
+  struct tree_workspace *ws;
+  SEXP Rout;
+
+  if (n < (nj ? 3 : 2))
+  {
+    error("At least %d observations are needed to build a tree.", nj ? 3 : 2);
+  }
+  if ((size_t)XLENGTH(dists) % npairs != 0)
+  {
+    error("The distances do not match the number of samples.");
+  }
+  reps  = (int)((size_t)XLENGTH(dists)/npairs);
+  nnode = nj ? n - 2 : n - 1;
+  nodes = n + nnode;
+
+  #ifdef _OPENMP
+  {
+    if (asInteger(requested_threads) == 0)
+    {
+      num_threads = omp_get_max_threads();
+    }
+    else
+    {
+      num_threads = asInteger(requested_threads);
+    }
+  }
+  #else
+  {
+    num_threads = 1;
+  }
+  #endif
+  num_threads = (num_threads < 1) ? 1 : num_threads;
+  num_threads = (num_threads > reps) ? reps : num_threads;
+  num_threads = (num_threads < 1) ? 1 : num_threads;
+
+  ws = R_Calloc(num_threads, struct tree_workspace);
+  for (r = 0; r < num_threads; r++)
+  {
+    alloc_tree_workspace(&ws[r], n, nj);
+  }
+  parents = R_Calloc((size_t)reps*nodes, int);
+  lengths = R_Calloc((size_t)reps*nodes, double);
+
+  #ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) private(r) num_threads(num_threads)
+  #endif
+  for (r = 0; r < reps; r++)
+  {
+    int thread = 0;
+    #ifdef _OPENMP
+    thread = omp_get_thread_num();
+    #endif
+    if (nj)
+    {
+      nj_condensed(&ws[thread], dist + (size_t)r*npairs, 
+                   parents + (size_t)r*nodes, lengths + (size_t)r*nodes);
+    }
+    else
+    {
+      upgma_condensed(&ws[thread], dist + (size_t)r*npairs, 
+                      parents + (size_t)r*nodes, lengths + (size_t)r*nodes);
+    }
+  }
+
+  for (r = 0; r < num_threads; r++)
+  {
+    free_tree_workspace(&ws[r]);
+  }
+  R_Free(ws);
+
+  PROTECT(Rout = allocVector(VECSXP, reps));
+  for (r = 0; r < reps; r++)
+  {
+    SET_VECTOR_ELT(Rout, r, tree_to_phylo(n, nnode, parents + (size_t)r*nodes, 
+                                          lengths + (size_t)r*nodes));
+  }
+  R_Free(parents);
+  R_Free(lengths);
+  UNPROTECT(1);
+  return Rout;
+}
+
+void alloc_tree_workspace(struct tree_workspace *ws, int n, int nj)
+{
+  ws->n      = n;
+  ws->dist   = R_Calloc((size_t)n*(n - 1)/2, double);
+  ws->alive  = R_Calloc(n, int);
+  ws->node   = R_Calloc(n, int);
+  ws->size   = NULL;
+  ws->chain  = NULL;
+  ws->height = NULL;
+  ws->rowsum = NULL;
+  ws->birth  = NULL;
+  ws->order  = NULL;
+  ws->order_length = NULL;
+  ws->order_pool   = NULL;
+  ws->sorter       = NULL;
+  if (nj)
+  {
+    ws->rowsum       = R_Calloc(n, double);
+    ws->birth        = R_Calloc(n, int);
+    ws->order        = R_Calloc(n, int*);
+    ws->order_length = R_Calloc(n, int);
+    // The initial lists take n(n - 1)/2 and each of the n - 3 joins adds a
+    // list no longer than n - 1.
+    ws->order_pool   = R_Calloc((size_t)n*n, int);
+    ws->sorter       = R_Calloc(n, struct dist_index);
+  }
+  else
+  {
+    ws->size   = R_Calloc(n, int);
+    ws->chain  = R_Calloc(n, int);
+    ws->height = R_Calloc(2*n, double);
+  }
+}
+
+void free_tree_workspace(struct tree_workspace *ws)
+{
+  R_Free(ws->dist);
+  R_Free(ws->alive);
+  R_Free(ws->node);
+  if (ws->rowsum != NULL)
+  {
+    R_Free(ws->rowsum);
+    R_Free(ws->birth);
+    R_Free(ws->order);
+    R_Free(ws->order_length);
+    R_Free(ws->order_pool);
+    R_Free(ws->sorter);
+  }
+  else
+  {
+    R_Free(ws->size);
+    R_Free(ws->chain);
+    R_Free(ws->height);
+  }
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+UPGMA by nearest neighbor chains. Starting from any cluster, the chain follows
+nearest neighbors until two clusters are each other's nearest neighbors. These
+are merged and the search continues from the remaining chain. Average linkage
+is reducible, so the merges are the same as those of the classical algorithm.
+
+The height of a node is half of the distance between the merged clusters, as in
+as.phylo.hclust. The merged cluster takes the slot of the first cluster.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void upgma_condensed(struct tree_workspace *ws, double *dist, int *parent, double *blen)
+{
+  int n = ws->n;
+  int i;
+  int k;
+  int a;
+  int b;
+  int best;
+  int chain_length = 0;
+  int next_node = n;
+  int remaining = n;
+  double best_dist;
+  double d;
+  double *D = ws->dist;
+
+  memcpy(D, dist, sizeof(double)*((size_t)n*(n - 1)/2));
+  for (i = 0; i < n; i++)
+  {
+    ws->alive[i]  = 1;
+    ws->node[i]   = i;
+    ws->size[i]   = 1;
+    ws->height[i] = 0.0;
+  }
+
+  while (remaining > 1)
+  {
+    if (chain_length == 0)
+    {
+      for (i = 0; !ws->alive[i]; i++);
+      ws->chain[chain_length++] = i;
+    }
+    a = ws->chain[chain_length - 1];
+    // Prefer the previous cluster in the chain when there are ties so that
+    // the chain always ends.
+    best      = (chain_length > 1) ? ws->chain[chain_length - 2] : -1;
+    best_dist = (best >= 0) ? D[dist_index(a, best, n)] : INFINITY;
+    for (k = 0; k < n; k++)
+    {
+      if (k == a || !ws->alive[k])
+      {
+        continue;
+      }
+      d = D[dist_index(a, k, n)];
+      if (d < best_dist || best < 0)
+      {
+        best      = k;
+        best_dist = d;
+      }
+    }
+    if (chain_length > 1 && best == ws->chain[chain_length - 2])
+    {
+      // a and best are reciprocal nearest neighbors
+      chain_length -= 2;
+      b = best;
+      if (b < a)
+      {
+        b = a;
+        a = best;
+      }
+      ws->height[next_node] = best_dist/2;
+      parent[ws->node[a]] = next_node;
+      parent[ws->node[b]] = next_node;
+      blen[ws->node[a]]   = best_dist/2 - ws->height[ws->node[a]];
+      blen[ws->node[b]]   = best_dist/2 - ws->height[ws->node[b]];
+      for (k = 0; k < n; k++)
+      {
+        if (k == a || k == b || !ws->alive[k])
+        {
+          continue;
+        }
+        D[dist_index(a, k, n)] = (ws->size[a]*D[dist_index(a, k, n)] + 
+                                  ws->size[b]*D[dist_index(b, k, n)])/
+                                 (ws->size[a] + ws->size[b]);
+      }
+      ws->size[a] += ws->size[b];
+      ws->node[a]  = next_node++;
+      ws->alive[b] = 0;
+      remaining--;
+    }
+    else
+    {
+      ws->chain[chain_length++] = best;
+    }
+  }
+  parent[next_node - 1] = -1;
+  blen[next_node - 1]   = 0.0;
+}
+
+int compare_dist_index(const void *a, const void *b)
+{
+  double da = ((const struct dist_index*)a)->d;
+  double db = ((const struct dist_index*)b)->d;
+  return (da > db) - (da < db);
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Sorts the active slots by their distance from slot i and stores them in a new
+list for slot i. If from_zero is false, only slots after i are included. This is
+used for the initial lists, where every pair is in the list of its first slot.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void sort_slot(struct tree_workspace *ws, int i, int from_zero)
+{
+  int k;
+  int count = 0;
+  int n = ws->n;
+  for (k = from_zero ? 0 : i + 1; k < n; k++)
+  {
+    if (k == i || !ws->alive[k])
+    {
+      continue;
+    }
+    ws->sorter[count].d = ws->dist[dist_index(i, k, n)];
+    ws->sorter[count].j = k;
+    count++;
+  }
+  qsort(ws->sorter, count, sizeof(struct dist_index), compare_dist_index);
+  ws->order[i] = ws->order_pool + ws->pool_used;
+  ws->order_length[i] = count;
+  ws->pool_used += count;
+  for (k = 0; k < count; k++)
+  {
+    ws->order[i][k] = ws->sorter[k].j;
+  }
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Neighbor-joining with the RapidNJ search. With r active clusters and
+u_i = sum_k(d_ik)/(r - 2), the pair with the smallest Q = d_ij - u_i - u_j is
+joined. Because the list of each slot is sorted by distance, the search of a
+list can stop once d_ij - u_i - max(u) is no smaller than the best Q so far.
+
+A joined cluster takes the slot of the first cluster and gets a new sorted
+list. Entries in older lists that point to a slot that has since been replaced
+are skipped; that pair is in the list of the newer slot. The last three
+clusters are joined to the root, giving an unrooted tree as in ape::nj.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+void nj_condensed(struct tree_workspace *ws, double *dist, int *parent, double *blen)
+{
+  int n = ws->n;
+  int i;
+  int j;
+  int k;
+  int idx;
+  int step = 0;
+  int remaining = n;
+  int next_node = n;
+  int best_i;
+  int best_j;
+  int last[3];
+  double *D = ws->dist;
+  double *u = ws->rowsum;
+  double umax;
+  double q;
+  double best_q;
+  double dij;
+  double dik;
+  double djk;
+  double dnew;
+  double vi;
+
+  memcpy(D, dist, sizeof(double)*((size_t)n*(n - 1)/2));
+  for (i = 0; i < n; i++)
+  {
+    ws->alive[i] = 1;
+    ws->node[i]  = i;
+    ws->birth[i] = 0;
+    u[i]         = 0.0;
+  }
+  for (i = 0; i < n - 1; i++)
+  {
+    for (j = i + 1; j < n; j++)
+    {
+      dij = D[dist_index(i, j, n)];
+      u[i] += dij;
+      u[j] += dij;
+    }
+  }
+  ws->pool_used = 0;
+  for (i = 0; i < n; i++)
+  {
+    sort_slot(ws, i, 0);
+  }
+
+  while (remaining > 3)
+  {
+    // u holds the row sums; the Q criterion uses them divided by r - 2.
+    umax = -INFINITY;
+    for (i = 0; i < n; i++)
+    {
+      if (ws->alive[i] && u[i] > umax)
+      {
+        umax = u[i];
+      }
+    }
+    umax   = umax/(remaining - 2);
+    best_q = INFINITY;
+    best_i = -1;
+    best_j = -1;
+    for (i = 0; i < n; i++)
+    {
+      double ui;
+      if (!ws->alive[i])
+      {
+        continue;
+      }
+      ui = u[i]/(remaining - 2);
+      for (idx = 0; idx < ws->order_length[i]; idx++)
+      {
+        j = ws->order[i][idx];
+        if (!ws->alive[j] || ws->birth[j] > ws->birth[i])
+        {
+          continue;
+        }
+        dij = D[dist_index(i, j, n)];
+        if (dij - ui - umax >= best_q && best_i >= 0)
+        {
+          break;
+        }
+        q = dij - ui - u[j]/(remaining - 2);
+        if (q < best_q || best_i < 0)
+        {
+          best_q = q;
+          best_i = i;
+          best_j = j;
+        }
+      }
+    }
+    i = (best_i < best_j) ? best_i : best_j;
+    j = (best_i < best_j) ? best_j : best_i;
+    dij = D[dist_index(i, j, n)];
+    vi  = dij/2 + (u[i] - u[j])/(2*(remaining - 2));
+    parent[ws->node[i]] = next_node;
+    parent[ws->node[j]] = next_node;
+    blen[ws->node[i]]   = vi;
+    blen[ws->node[j]]   = dij - vi;
+    u[i] = 0.0;
+    for (k = 0; k < n; k++)
+    {
+      if (k == i || k == j || !ws->alive[k])
+      {
+        continue;
+      }
+      dik  = D[dist_index(i, k, n)];
+      djk  = D[dist_index(j, k, n)];
+      dnew = (dik + djk - dij)/2;
+      u[k] += dnew - dik - djk;
+      u[i] += dnew;
+      D[dist_index(i, k, n)] = dnew;
+    }
+    ws->alive[j] = 0;
+    ws->node[i]  = next_node++;
+    ws->birth[i] = ++step;
+    remaining--;
+    sort_slot(ws, i, 1);
+  }
+
+  k = 0;
+  for (i = 0; i < n; i++)
+  {
+    if (ws->alive[i])
+    {
+      last[k++] = i;
+    }
+  }
+  for (k = 0; k < 3; k++)
+  {
+    int a = last[k];
+    int b = last[(k + 1) % 3];
+    int c = last[(k + 2) % 3];
+    parent[ws->node[a]] = next_node;
+    blen[ws->node[a]]   = (D[dist_index(a, b, n)] + D[dist_index(a, c, n)] - 
+                           D[dist_index(b, c, n)])/2;
+  }
+  parent[next_node] = -1;
+  blen[next_node]   = 0.0;
+}
+
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+Converts a tree stored as parents and branch lengths into the elements of an
+ape phylo object. Tips are numbered 1 to n and the internal nodes are numbered
+from n + 1 in preorder so that the root is n + 1. The edges are in cladewise
+order.
+
+Input: The number of tips and internal nodes, and the parent and branch length
+       of each node, where the root is the last node and has no parent.
+Output: A list with the elements edge, edge.length, and Nnode.
+~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+SEXP tree_to_phylo(int n, int nnode, int *parent, double *blen)
+{
+  int nodes = n + nnode;
+  int nedges = nodes - 1;
+  int root = nodes - 1;
+  int i;
+  int top = 0;
+  int edge = 0;
+  int next_id = n + 1;
+  int cur;
+  int *first_child = R_Calloc(nodes, int);
+  int *next_sibling = R_Calloc(nodes, int);
+  int *id = R_Calloc(nodes, int);
+  int *stack = R_Calloc(nodes, int);
+  int *edges;
+  double *lengths;
+  SEXP Rout;
+  SEXP Redge;
+  SEXP Rlength;
+  SEXP Rnames;
+
+  for (i = 0; i < nodes; i++)
+  {
+    first_child[i] = -1;
+  }
+  // Children are added in reverse so that they are visited in order
+  for (i = nodes - 2; i >= 0; i--)
+  {
+    next_sibling[i] = first_child[parent[i]];
+    first_child[parent[i]] = i;
+  }
+
+  PROTECT(Rout    = allocVector(VECSXP, 3));
+  PROTECT(Rnames  = allocVector(STRSXP, 3));
+  PROTECT(Redge   = allocMatrix(INTSXP, nedges, 2));
+  PROTECT(Rlength = allocVector(REALSXP, nedges));
+  edges   = INTEGER(Redge);
+  lengths = REAL(Rlength);
+
+  stack[top++] = root;
+  while (top > 0)
+  {
+    int child;
+    int count = 0;
+    cur = stack[--top];
+    if (cur < n)
+    {
+      id[cur] = cur + 1;
+    }
+    else
+    {
+      id[cur] = next_id++;
+    }
+    if (cur != root)
+    {
+      edges[edge]          = id[parent[cur]];
+      edges[edge + nedges] = id[cur];
+      lengths[edge]        = blen[cur];
+      edge++;
+    }
+    // Push the children so that the first child is on top of the stack
+    for (child = first_child[cur]; child >= 0; child = next_sibling[child])
+    {
+      count++;
+    }
+    top += count;
+    i = top - 1;
+    for (child = first_child[cur]; child >= 0; child = next_sibling[child])
+    {
+      stack[i--] = child;
+    }
+  }
+
+  SET_VECTOR_ELT(Rout, 0, Redge);
+  SET_VECTOR_ELT(Rout, 1, Rlength);
+  SET_VECTOR_ELT(Rout, 2, ScalarInteger(nnode));
+  SET_STRING_ELT(Rnames, 0, mkChar("edge"));
+  SET_STRING_ELT(Rnames, 1, mkChar("edge.length"));
+  SET_STRING_ELT(Rnames, 2, mkChar("Nnode"));
+  setAttrib(Rout, R_NamesSymbol, Rnames);
+
+  R_Free(first_child);
+  R_Free(next_sibling);
+  R_Free(id);
+  R_Free(stack);
+  UNPROTECT(4);
+  return Rout;
+}